@@ -2,10 +2,13 @@
 #define FILECHANGEMODEL_H
 
 #include <QAbstractItemModel>
+#include <QHash>
 #include <QVariantMap>
 #include <QString>
+#include <QTimer>
 #include <QVector>
 #include <QDBusInterface>
+#include <QDBusMessage>
 
 /**
  * @brief ファイル変更情報を保持するアイテムクラス
@@ -25,8 +28,15 @@ private:
     ChangeType m_changeType;                // 変更タイプ
     QVector<FileChangeItem*> m_children;    // 子要素のリスト
     FileChangeItem *m_parent;               // 親要素へのポインタ
+    int m_row = 0;                          // 親要素内での行番号
     bool m_checked = false;                 // チェック状態
     bool m_explicitlyUnchecked = false;     // 明示的にチェックを外されたフラグ
+    bool m_hasChildren = false;             // サービスから取得していない子要素がある場合true
+    bool m_fetched = false;                 // 子要素を取得済みの場合true
+    bool m_fetching = false;                // 子要素の取得中の場合true
+    int m_createdCount = 0;                 // サブツリー内の作成されたエントリ数
+    int m_modifiedCount = 0;                // サブツリー内の変更されたエントリ数
+    int m_deletedCount = 0;                 // サブツリー内の削除されたエントリ数
 
 public:
     explicit FileChangeItem(const QString &path, ChangeType type, FileChangeItem *parent = nullptr);
@@ -46,6 +56,15 @@ public:
     void setChecked(bool checked) { m_checked = checked; }
     bool isExplicitlyUnchecked() const { return m_explicitlyUnchecked; }
     void setExplicitlyUnchecked(bool explicitlyUnchecked) { m_explicitlyUnchecked = explicitlyUnchecked; }
+    void setHasChildren(bool hasChildren) { m_hasChildren = hasChildren; }
+    bool canFetchMore() const { return m_hasChildren && !m_fetched && !m_fetching; }
+    bool hasUnfetchedChildren() const { return m_hasChildren && !m_fetched; }
+    void setFetched(bool fetched) { m_fetched = fetched; }
+    void setFetching(bool fetching) { m_fetching = fetching; }
+    int createdCount() const { return m_createdCount; }
+    int modifiedCount() const { return m_modifiedCount; }
+    int deletedCount() const { return m_deletedCount; }
+    void setCounts(int created, int modified, int deleted);
 };
 
 /**
@@ -56,46 +75,114 @@ class FileChangeModel : public QAbstractItemModel
     Q_OBJECT
     Q_PROPERTY(QString configName READ configName WRITE setConfigName NOTIFY configNameChanged)
     Q_PROPERTY(int snapshotNumber READ snapshotNumber WRITE setSnapshotNumber NOTIFY snapshotNumberChanged)
+    Q_PROPERTY(int compareToNumber READ compareToNumber WRITE setCompareToNumber NOTIFY compareToNumberChanged)
+    Q_PROPERTY(QStringList pathPrefixes READ pathPrefixes WRITE setPathPrefixes NOTIFY filterChanged)
+    Q_PROPERTY(QStringList includeGlobs READ includeGlobs WRITE setIncludeGlobs NOTIFY filterChanged)
+    Q_PROPERTY(QStringList excludeGlobs READ excludeGlobs WRITE setExcludeGlobs NOTIFY filterChanged)
+    Q_PROPERTY(int statusFilter READ statusFilter WRITE setStatusFilter NOTIFY filterChanged)
     Q_PROPERTY(bool hasChanges READ hasChanges NOTIFY hasChangesChanged)
+    Q_PROPERTY(bool loading READ isLoading NOTIFY loadingChanged)
+    Q_PROPERTY(int loadedCount READ loadedCount NOTIFY loadProgressChanged)
+    Q_PROPERTY(int totalCount READ totalCount NOTIFY loadProgressChanged)
 
 private:
+    static constexpr int FirstPageSize = 500;   // 最初に取得するページの件数
+    static constexpr int PageSize = 10000;      // 2ページ目以降の件数
+    static constexpr int DiffContextLines = 3;          // 差分の前後に表示する行数
+    static constexpr int DiffMaxLines = 5000;           // 表示する差分の最大行数
+    static constexpr int DiffMaxBytes = 1024 * 1024;    // 表示する差分の最大バイト数
+
     QString m_configName;                   // Snapper設定名
     int m_snapshotNumber;                   // スナップショット番号
+    int m_compareToNumber;                  // 比較先のスナップショット番号 (0は現在のシステム)
+    QStringList m_pathPrefixes;             // 表示するパスの接頭辞 (空の場合は全て)
+    QStringList m_includeGlobs;             // 表示するファイルのglob (空の場合は全て)
+    QStringList m_excludeGlobs;             // 表示しないファイルのglob
+    int m_statusFilter;                     // 表示するステータスのビット (StatusFlagの組み合わせ、0は全て)
     FileChangeItem *m_rootItem;             // ツリーのルートアイテム
     QDBusInterface *m_dbusInterface;        // D-Busインターフェース
     bool m_hasChanges;                      // ファイル変更があるかどうか
 
-    // バッチ復元用の変数
-    QList<QStringList> m_restoreBatches;    // 復元ファイルのバッチリスト
-    int m_currentBatchIndex;                // 現在処理中のバッチインデックス
-    int m_totalFilesCount;                  // 復元対象の総ファイル数
-    int m_processedFilesCount;              // 処理済みファイル数
-    bool m_restoreHasError;                 // 復元エラーフラグ
+    // ページ単位の読み込み用の変数
+    QHash<QString, FileChangeItem*> m_itemMap;  // 正規化パス (末尾スラッシュなし) → アイテム
+    bool m_loading;                         // 読み込み中フラグ
+    int m_loadedCount;                      // 読み込み済みの変更数
+    int m_totalCount;                       // 変更の総数
+    quint64 m_loadSerial;                   // 読み込み要求の通し番号 (古い応答の破棄用)
+
+    // 比較セッション用の変数
+    uint m_comparisonHandle;                // 比較セッションのハンドル (0は未取得)
+    QString m_comparisonConfig;             // 比較セッションを開いた設定名
+    int m_comparisonSnapshot;               // 比較セッションを開いたスナップショット番号
+    int m_comparisonCompareTo;              // 比較セッションを開いた比較先のスナップショット番号
+
+    // 復元ジョブ用の変数
+    static constexpr int MaxReportedFailures = 5;   // エラーメッセージに表示する失敗ファイル数
+    uint m_restoreJobId;                    // 実行中の復元ジョブのID (0は未開始)
+    bool m_restoreStarting;                 // StartRestoreの応答待ちの場合true
     bool m_cancelRequested;                 // キャンセル要求フラグ
+    QHash<uint, QDBusMessage> m_finishedJobs;   // ジョブIDの受信前に届いた完了シグナル
+
+    // 進捗通知の間引き (QMLへの通知は1フレームに1回まで)
+    static constexpr int ProgressFrameMs = 16;      // QMLに進捗を通知する最小間隔 (約60fps)
+    QTimer m_progressTimer;                 // 保留中の進捗を通知するタイマー
+    bool m_progressPending;                 // 通知していない進捗がある場合true
+    int m_pendingCurrent;                   // 保留中の完了ステップ数
+    int m_pendingTotal;                     // 保留中のステップの総数
+    QString m_pendingFilePath;              // 保留中のファイルパス
 
 public:
 
 private:
-    void setupModelData(const QStringList &changes);
+    void appendChanges(const QStringList &changes);
+    void requestChangesPage(int offset, int limit);
+    void requestRemainingChanges();
+    void requestChildren(FileChangeItem *parentItem);
+    void appendChildren(FileChangeItem *parentItem, const QDBusArgument &children);
+    void openComparison();
+    void sendCloseComparison(uint handle);
+    void setLoading(bool loading);
+    QModelIndex indexForItem(FileChangeItem *item) const;
     void clearModel();
     FileChangeItem *getItem(const QModelIndex &index) const;
     FileChangeItem::ChangeType parseChangeType(const QChar &statusChar);
     QString executeCommand(const QString &command, const QStringList &arguments);
     QDBusInterface* getDBusInterface();
-    QModelIndex findItemIndex(FileChangeItem *parent, const QString &path) const;
     void collectCheckedItems(FileChangeItem *parent, QStringList &paths) const;
     void collectAllFilesRecursive(FileChangeItem *parent, QStringList &paths) const;
     void setItemCheckedRecursive(FileChangeItem *item, const QModelIndex &index, bool checked);
-    void processNextBatch();
+    void setRestoreSignalsConnected(bool connected);
+    void sendCancelRestore(uint jobId);
+    void finishRestore(const QDBusMessage &finished);
+    void flushRestoreProgress();
     void dumpTree(FileChangeItem *item, int depth, int maxDepth);
 
 public:
+    /**
+     * @brief ステータスによる絞り込みのビット (サービスのChangeFilter::Statusと同じ値)
+     */
+    enum StatusFlag {
+        StatusCreated     = 0x001,  // 作成
+        StatusDeleted     = 0x002,  // 削除
+        StatusType        = 0x004,  // 種類の変更
+        StatusContent     = 0x008,  // 内容の変更
+        StatusPermissions = 0x010,  // パーミッションの変更
+        StatusOwner       = 0x020,  // 所有者の変更
+        StatusGroup       = 0x040,  // グループの変更
+        StatusXattrs      = 0x080,  // 拡張属性の変更
+        StatusAcl         = 0x100   // ACLの変更
+    };
+    Q_ENUM(StatusFlag)
+
     enum Roles {
         PathRole = Qt::UserRole + 1,
         NameRole,
         ChangeTypeRole,
         IsDirectoryRole,
-        IsCheckedRole
+        IsCheckedRole,
+        CreatedCountRole,
+        ModifiedCountRole,
+        DeletedCountRole
     };
 
     explicit FileChangeModel(QObject *parent = nullptr);
@@ -108,6 +195,9 @@ public:
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
     QHash<int, QByteArray> roleNames() const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
 
     // プロパティ
     QString configName() const { return m_configName; }
@@ -116,11 +206,31 @@ public:
     int snapshotNumber() const { return m_snapshotNumber; }
     void setSnapshotNumber(int number);
 
+    int compareToNumber() const { return m_compareToNumber; }
+    void setCompareToNumber(int number);
+
+    QStringList pathPrefixes() const { return m_pathPrefixes; }
+    void setPathPrefixes(const QStringList &prefixes);
+
+    QStringList includeGlobs() const { return m_includeGlobs; }
+    void setIncludeGlobs(const QStringList &globs);
+
+    QStringList excludeGlobs() const { return m_excludeGlobs; }
+    void setExcludeGlobs(const QStringList &globs);
+
+    int statusFilter() const { return m_statusFilter; }
+    void setStatusFilter(int mask);
+
     bool hasChanges() const { return m_hasChanges; }
+    bool isLoading() const { return m_loading; }
+    int loadedCount() const { return m_loadedCount; }
+    int totalCount() const { return m_totalCount; }
 
     // 公開メソッド
     Q_INVOKABLE void loadChanges();
+    Q_INVOKABLE void closeComparison();
     Q_INVOKABLE QString getFileDiff(const QString &filePath);
+    Q_INVOKABLE QVariantMap getFileDiffHunks(const QString &filePath);
     Q_INVOKABLE void setItemChecked(const QString &filePath, bool checked);
     Q_INVOKABLE QStringList getCheckedItems() const;
     Q_INVOKABLE bool restoreCheckedItems();
@@ -129,13 +239,18 @@ public:
 signals:
     void configNameChanged();
     void snapshotNumberChanged();
+    void compareToNumberChanged();
+    void filterChanged();
     void hasChangesChanged();
+    void loadingChanged();
+    void loadProgressChanged();
     void errorOccurred(const QString &message);
     void restoreProgress(int current, int total, const QString &filePath);
     void restoreCompleted(bool success);
 
 private slots:
-    void onRestoreProgress(int current, int total, const QString &filePath);
+    void onRestoreJobProgress(uint jobId, int current, int total, const QString &filePath);
+    void onRestoreJobFinished(const QDBusMessage &message);
 };
 
 #endif // FILECHANGEMODEL_H
@@ -0,0 +1,42 @@
+#ifndef MAPPEDBUFFER_H
+#define MAPPEDBUFFER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QDBusUnixFileDescriptor>
+
+/**
+ * @brief D-Busで受け取ったファイルディスクリプタの内容を読み込むクラス
+ *
+ * サービスが封印済みmemfdで返した大きな応答をマップし、コピーせずに参照します。
+ * zstdで圧縮されている場合は展開したデータを保持します。
+ * data()が返すデータはこのオブジェクトが破棄されるまで有効です。
+ */
+class MappedBuffer
+{
+private:
+    void *m_map;            // マップしたアドレス
+    size_t m_mapSize;       // マップしたサイズ
+    QByteArray m_data;      // 内容 (非圧縮の場合はマップ領域を直接参照)
+    QString m_error;        // エラーメッセージ
+
+    bool decompress(const char *data, size_t size);
+
+public:
+    MappedBuffer(const QDBusUnixFileDescriptor &fd, bool compressed);
+    ~MappedBuffer();
+
+    MappedBuffer(const MappedBuffer &) = delete;
+    MappedBuffer &operator=(const MappedBuffer &) = delete;
+
+    static bool isCompressionAvailable();
+
+    bool isValid() const { return m_error.isEmpty(); }
+    QString errorString() const { return m_error; }
+    const QByteArray &data() const { return m_data; }
+
+    QStringList lines(qsizetype &position, qsizetype maxLines) const;
+};
+
+#endif // MAPPEDBUFFER_H
@@ -2,10 +2,14 @@
 #define SNAPPERSERVICE_H
 
 #include <QObject>
+#include <QHash>
 #include <QList>
+#include <QPair>
 #include <QString>
 #include <QLoggingCategory>
 #include <QDBusInterface>
+#include <QDBusArgument>
+#include <QDBusMessage>
 #include "fssnapshot.h"
 
 Q_DECLARE_LOGGING_CATEGORY(snapperLog)
@@ -14,6 +18,7 @@ class SnapperService : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(bool configured READ isConfigured NOTIFY configuredChanged)
+    Q_PROPERTY(QString configName READ configName WRITE setConfigName NOTIFY configNameChanged)
 
 public:
     explicit SnapperService(QObject *parent = nullptr);
@@ -22,6 +27,9 @@ public:
     static SnapperService* instance();
 
     bool isConfigured();
+
+    QString configName() const { return m_configName; }
+    void setConfigName(const QString &configName);
     Q_INVOKABLE void configureSnapper();
 
     Q_INVOKABLE bool createSnapshotAllowed(const QString &snapshotType) const;
@@ -40,21 +48,34 @@ public:
                                        bool important = false);
 
     Q_INVOKABLE QList<FsSnapshot*> all();
+    QList<FsSnapshot*> snapshots(const QList<int> &numbers);
+    bool snapshotsSince(quint64 generation, QList<int> &added, QList<int> &removed,
+                        QList<int> &modified, quint64 &newGeneration);
+    void requestSnapshotSizes(const QList<int> &numbers = QList<int>());
     Q_INVOKABLE FsSnapshot* find(int number);
     Q_INVOKABLE bool rollback(int number);
     Q_INVOKABLE bool deleteSnapshot(int number);
+    void deleteSnapshots(const QList<int> &numbers);
+    Q_INVOKABLE void planCleanup(const QString &algorithm);
+    Q_INVOKABLE void runCleanup(uint planId);
 
     void setConfigureOnInstall(bool value) { m_configureOnInstall = value; }
     bool configureOnInstall() const { return m_configureOnInstall; }
 
 signals:
     void configuredChanged(bool configured);
+    void configNameChanged();
     void snapshotCreated(FsSnapshot *snapshot);
     void snapshotCreationFailed(const QString &error);
     void rollbackCompleted();
     void rollbackFailed(const QString &error);
     void snapshotDeleted(int number);
     void snapshotDeletionFailed(int number, const QString &error);
+    void snapshotsDeletionCompleted(int successCount, int failureCount);
+    void cleanupPlanned(uint planId, const QList<int> &numbers, qint64 estimatedBytes);
+    void cleanupPlanFailed(const QString &error);
+    void snapshotSizesReceived(const QString &configName, const QList<int> &numbers,
+                               const QHash<int, QPair<qint64, qint64>> &sizes);
 
 private:
     FsSnapshot* create(FsSnapshot::SnapshotType snapshotType,
@@ -71,16 +92,22 @@ private:
     void updateEtcSysconfigYast2();
     void setupSnapperQuota();
 
-    QList<FsSnapshot*> parseSnapshotList(const QString &csvOutput);
+    QList<FsSnapshot*> parseSnapshotRecords(const QDBusArgument &argument);
+    void handleDeletionReply(const QDBusMessage &reply, const QList<int> &numbers);
+    static QStringList compressNumberRanges(QList<int> numbers);
     QString executeCommand(const QString &program, const QStringList &arguments, bool &success);
     QDBusInterface* getDBusInterface();
 
+    static constexpr int DeleteTimeoutMs = 10 * 60 * 1000;  // 一括削除の応答を待つ時間
+
     static SnapperService *s_instance;       // シングルトンインスタンス
 
     bool m_configured;                       // Snapperが設定済みかどうか
     bool m_configuredChecked;                // 設定チェック済みフラグ
     bool m_configureOnInstall;               // インストール時に設定を行うかどうか
     QDBusInterface *m_dbusInterface;         // DBus通信インターフェース
+    QString m_configName;                    // 操作対象のSnapper設定名
+    QHash<uint, QList<int>> m_cleanupPlans;  // 計画ID → 削除されるスナップショット番号
 };
 
 #endif // SNAPPERSERVICE_H
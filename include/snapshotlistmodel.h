@@ -2,7 +2,9 @@
 #define SNAPSHOTLISTMODEL_H
 
 #include <QAbstractListModel>
+#include <QHash>
 #include <QList>
+#include <QPair>
 #include "fssnapshot.h"
 
 class SnapperService;
@@ -23,7 +25,9 @@ public:
         DescriptionRole,
         SnapshotTypeStringRole,
         CleanupAlgoStringRole,
-        UserdataRole
+        UserdataRole,
+        ReferencedSizeRole,
+        ExclusiveSizeRole
     };
 
     explicit SnapshotListModel(QObject *parent = nullptr);
@@ -52,6 +56,7 @@ signals:
     void snapshotDeleted(int number);
     void snapshotDeletionFailed(int number, const QString &error);
     void snapshotsDeletionCompleted(int successCount, int failureCount);
+    void spaceReclaimProgress(int pendingSubvolumes, qint64 bytesFreed);
 
 private slots:
     void onSnapshotCreated(FsSnapshot *snapshot);
@@ -60,10 +65,25 @@ private slots:
     void onRollbackFailed(const QString &error);
     void onSnapshotDeleted(int number);
     void onSnapshotDeletionFailed(int number, const QString &error);
+    void onSnapshotsDeletionCompleted(int successCount, int failureCount);
+    void onSnapshotsChanged(const QString &configName, const QList<int> &added, const QList<int> &removed);
+    void onSpaceReclaimProgress(const QString &configName, int pendingSubvolumes, qlonglong bytesFreed);
+    void onConfigNameChanged();
+    void onSnapshotSizesReceived(const QString &configName, const QList<int> &numbers,
+                                 const QHash<int, QPair<qint64, qint64>> &sizes);
 
 private:
+    void reload();
+    bool applySnapshotDelta();
+    void updateSizes(const QList<int> &numbers = QList<int>());
+    int indexOfNumber(int number) const;
+    int insertionRow(int number) const;
+
     QList<FsSnapshot*> m_snapshots;      // スナップショットオブジェクトのリスト
     SnapperService *m_snapperService;    // SnapperServiceシングルトンインスタンスへのポインタ
+    quint64 m_generation;                // 反映済みのスナップショット一覧の世代番号 (0は未取得)
+    int m_invalidDeletionCount;          // 一括削除で指定された無効な番号の数
+    QHash<int, QPair<qint64, qint64>> m_sizes;  // スナップショット番号 → (参照量, 排他量)
 };
 
 #endif // SNAPSHOTLISTMODEL_H
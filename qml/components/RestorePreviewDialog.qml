@@ -11,6 +11,7 @@ Dialog {
 
     property string configName: "root"               // Snapper設定名
     property int snapshotNumber: 0                   // 対象スナップショット番号
+    property int compareToNumber: 0                  // 比較先スナップショット番号 (0は現在のシステム)
 
     signal restoreConfirmed()                        // 復元確認シグナル
 
@@ -26,15 +27,63 @@ Dialog {
     title: qsTr("Snapshot Overview")
     anchors.centerIn: Overlay.overlay
 
+    // 絞り込み欄の入力をパスの接頭辞とglobに分けて読み込み直す
+    // "/"で始まりワイルドカードを含まない項目はディレクトリ、それ以外はglobとして扱う
+    function applyPathFilter(text) {
+        var prefixes = []
+        var globs = []
+        var items = text.split(/[\s,]+/)
+        for (var i = 0; i < items.length; i++) {
+            var item = items[i]
+            if (item === "") continue
+            if (item.charAt(0) === "/" && !/[*?\[]/.test(item)) {
+                prefixes.push(item)
+            } else {
+                globs.push(item)
+            }
+        }
+        fileChangeModel.pathPrefixes = prefixes
+        fileChangeModel.includeGlobs = globs
+        fileChangeModel.loadChanges()
+    }
+
+    // ハンクの範囲をunified diffの見出しの表記に整形
+    function formatDiffRange(start, count) {
+        return count === 1 ? String(start) : start + "," + count
+    }
+
+    // ハンクの配列をunified diff形式のテキストに整形
+    function formatDiffHunks(hunks) {
+        var text = ""
+        for (var i = 0; i < hunks.length; i++) {
+            var hunk = hunks[i]
+            text += "@@ -" + formatDiffRange(hunk.oldStart, hunk.oldCount)
+                  + " +" + formatDiffRange(hunk.newStart, hunk.newCount) + " @@\n"
+            if (hunk.lines.length > 0) {
+                text += hunk.lines.join("\n") + "\n"
+            }
+        }
+        return text
+    }
+
     // ダイアログ表示時の初期化処理
     onOpened: {
         console.log("RestorePreviewDialog opened with configName:", configName, "snapshotNumber:", snapshotNumber)
         errorLabel.visible = false
+        pathFilterField.text = ""
+        fileChangeModel.pathPrefixes = []
+        fileChangeModel.includeGlobs = []
         fileChangeModel.configName = configName
         fileChangeModel.snapshotNumber = snapshotNumber
+        fileChangeModel.compareToNumber = compareToNumber
         fileChangeModel.loadChanges()
     }
 
+    // ダイアログを閉じた時に比較セッションを閉じる (スナップショットのアンマウント)
+    onClosed: {
+        fileChangeModel.closeComparison()
+    }
+
     // ファイル変更モデル
     // スナップショットとの差分を階層的に管理
     FileChangeModel {
@@ -99,6 +148,15 @@ Dialog {
                     anchors.margins: 5
                     spacing: 5
 
+                    // パスの絞り込み (サービス側で絞り込み、一致する変更だけを受信)
+                    TextField {
+                        id: pathFilterField
+                        Layout.fillWidth: true
+                        placeholderText: qsTr("Filter paths (e.g. /etc, *.conf)")
+                        selectByMouse: true
+                        onAccepted: root.applyPathFilter(text)
+                    }
+
                     // 変更がある場合: ファイル変更ツリー表示
                     ScrollView {
                         Layout.fillWidth: true
@@ -132,6 +190,9 @@ Dialog {
                                     required property string fileName          // ファイル/ディレクトリ名
                                     required property string filePath          // フルパス
                                     required property bool isChecked           // 復元選択状態
+                                    required property int createdCount         // 配下の作成されたエントリ数
+                                    required property int modifiedCount        // 配下の変更されたエントリ数
+                                    required property int deletedCount         // 配下の削除されたエントリ数
 
                                     contentItem: RowLayout {
                                         spacing: 5
@@ -197,17 +258,43 @@ Dialog {
                                             font.italic: fileName === ""
                                             Layout.fillWidth: true
                                         }
+
+                                        // 配下の変更件数 (ディレクトリのみ)
+                                        Label {
+                                            visible: isDirectory && (createdCount + modifiedCount + deletedCount) > 0
+                                            text: "+%1 M%2 -%3".arg(createdCount).arg(modifiedCount).arg(deletedCount)
+                                            color: palette.placeholderText
+                                            font.pixelSize: 11
+                                        }
                                     }
 
                                     // クリック時: 右ペインにdiffを表示
                                     onClicked: {
+                                        diffNoticeLabel.text = ""
                                         if (!isDirectory) {
                                             diffTextArea.text = qsTr("Loading diff...")
-                                            var diff = fileChangeModel.getFileDiff(filePath)
+                                            var diff = ""
+                                            var result = fileChangeModel.getFileDiffHunks(filePath)
+
+                                            if (!result.available) {
+                                                // ハンク単位の取得に未対応のサービス
+                                                diff = fileChangeModel.getFileDiff(filePath)
+                                            } else if (result.binary) {
+                                                diffNoticeLabel.text = qsTr("Binary files differ (snapshot: %1 bytes, current: %2 bytes).")
+                                                                       .arg(result.oldSize).arg(result.newSize)
+                                            } else {
+                                                diff = root.formatDiffHunks(result.hunks)
+                                                if (result.truncated) {
+                                                    diffNoticeLabel.text = qsTr("The diff is too large and has been truncated (snapshot: %1 bytes, current: %2 bytes).")
+                                                                           .arg(result.oldSize).arg(result.newSize)
+                                                }
+                                            }
 
                                             if (diff === "") {
-                                                // 新規作成されたファイル
-                                                if (changeType === 0) {
+                                                if (result.binary) {
+                                                    diffTextArea.text = ""
+                                                } else if (changeType === 0) {
+                                                    // 新規作成されたファイル
                                                     diffTextArea.text = qsTr("New file created.")
                                                 } else if (changeType === 2) {
                                                     diffTextArea.text = qsTr("File deleted.")
@@ -226,11 +313,33 @@ Dialog {
                         }
                     }
 
+                    // 読み込み中: 進捗表示
+                    RowLayout {
+                        Layout.fillWidth: true
+                        visible: fileChangeModel.loading
+                        spacing: 8
+
+                        BusyIndicator {
+                            running: fileChangeModel.loading
+                            Layout.preferredWidth: 24
+                            Layout.preferredHeight: 24
+                        }
+
+                        Label {
+                            Layout.fillWidth: true
+                            text: fileChangeModel.totalCount > 0
+                                  ? qsTr("Loading changes... (%1 / %2)").arg(fileChangeModel.loadedCount).arg(fileChangeModel.totalCount)
+                                  : qsTr("Loading changes...")
+                            color: palette.placeholderText
+                            elide: Text.ElideRight
+                        }
+                    }
+
                     // 変更がない場合: メッセージ表示
                     Item {
                         Layout.fillWidth: true
                         Layout.fillHeight: true
-                        visible: !fileChangeModel.hasChanges
+                        visible: !fileChangeModel.hasChanges && !fileChangeModel.loading
 
                         Label {
                             anchors.centerIn: parent
@@ -255,6 +364,16 @@ Dialog {
                     anchors.margins: 5
                     spacing: 5
 
+                    // 差分の打ち切りやバイナリファイルの通知
+                    Label {
+                        id: diffNoticeLabel
+                        Layout.fillWidth: true
+                        visible: text !== ""
+                        text: ""
+                        color: palette.placeholderText
+                        wrapMode: Text.WordWrap
+                    }
+
                     ScrollView {
                         Layout.fillWidth: true
                         Layout.fillHeight: true
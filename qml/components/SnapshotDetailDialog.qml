@@ -28,10 +28,19 @@ Dialog {
     // 個別ファイル/ディレクトリ復元用
     RestorePreviewDialog {
         id: restorePreviewDialog
-        configName: "root"  // 通常はrootファイルシステムの設定を使用
+        configName: SnapperService.configName  // 一覧を表示している設定を使用
         snapshotNumber: (snapshot && snapshot.number) ? snapshot.number : 0
     }
 
+    // pre/postの組の比較ダイアログ
+    // postスナップショットの変更を対応するpreスナップショットと比較して表示
+    RestorePreviewDialog {
+        id: prePostDialog
+        configName: SnapperService.configName
+        snapshotNumber: (snapshot && snapshot.previousNumber) ? snapshot.previousNumber : 0
+        compareToNumber: (snapshot && snapshot.number) ? snapshot.number : 0
+    }
+
     ColumnLayout {
         anchors.fill: parent
         spacing: 15
@@ -187,6 +196,14 @@ Dialog {
                 onClicked: restorePreviewDialog.open()
             }
 
+            // pre/post比較ボタン (postスナップショットのみ)
+            Button {
+                text: qsTr("Compare with Pre")
+                icon.name: "document-compare"
+                visible: snapshot && snapshot.snapshotTypeString === "post" && snapshot.previousNumber > 0
+                onClicked: prePostDialog.open()
+            }
+
             // システムロールバックボタン
             Button {
                 text: qsTr("System Rollback")
@@ -20,6 +20,7 @@ ItemDelegate {
     required property string snapshotTypeString         // スナップショットタイプ文字列
     required property string cleanupAlgoString          // クリーンアップアルゴリズム文字列
     required property var userdata                      // ユーザーデータマップ
+    required property real exclusiveSize                // 排他量 (バイト、不明な場合は-1)
 
     property var listModel: null                        // リストモデルへの参照
     property var detailDialog: null                     // 詳細ダイアログへの参照
@@ -103,7 +104,7 @@ ItemDelegate {
                 }
             }
 
-            // メタ情報行 (タイプ、ユーザー、前スナップショット)
+            // メタ情報行 (タイプ、ユーザー、前スナップショット、排他量)
             RowLayout {
                 spacing: 10
 
@@ -161,6 +162,20 @@ ItemDelegate {
                     font.pixelSize: 12
                     color: Qt.rgba(palette.text.r, palette.text.g, palette.text.b, 0.7)
                 }
+
+                Rectangle {
+                    width: 1
+                    height: 15
+                    color: Qt.rgba(palette.text.r, palette.text.g, palette.text.b, 0.4)
+                    visible: exclusiveSize >= 0
+                }
+
+                Label {
+                    visible: exclusiveSize >= 0
+                    text: qsTr("Exclusive: %1").arg(Qt.locale().formattedDataSize(exclusiveSize))
+                    font.pixelSize: 12
+                    color: Qt.rgba(palette.text.r, palette.text.g, palette.text.b, 0.7)
+                }
             }
 
             // タイムスタンプ表示
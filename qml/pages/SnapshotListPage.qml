@@ -72,6 +72,16 @@ Page {
             }
         }
 
+        // 削除したスナップショットの領域の解放の進捗
+        onSpaceReclaimProgress: function(pendingSubvolumes, bytesFreed) {
+            var freed = Qt.locale().formattedDataSize(bytesFreed)
+            if (pendingSubvolumes > 0) {
+                statusBar.showMessage(qsTr("Reclaiming space: %1 subvolume(s) pending, %2 freed").arg(pendingSubvolumes).arg(freed), 5000)
+            } else {
+                statusBar.showMessage(qsTr("Space reclaimed: %1 freed").arg(freed), 5000)
+            }
+        }
+
         Component.onCompleted: refresh()
     }
 
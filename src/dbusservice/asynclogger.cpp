@@ -0,0 +1,330 @@
+#include "asynclogger.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QThread>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+static constexpr int WriteChunkSize = 256 * 1024;   // 1回のwriteで書き込む最大バイト数の目安
+
+std::atomic<AsyncLogger *> AsyncLogger::s_instance(nullptr);
+
+/**
+ * @brief AsyncLoggerクラスのコンストラクタ
+ *
+ * 書き込みスレッドを開始します。ログファイルは最初の書き込み時に開きます。
+ *
+ * @param directory ログディレクトリ (存在しない場合は作成)
+ * @param fileName ログファイル名
+ */
+AsyncLogger::AsyncLogger(const QString &directory, const QString &fileName)
+    : m_directory(directory)
+    , m_filePath(directory + '/' + fileName)
+    , m_head(nullptr)
+    , m_queued(0)
+    , m_dropped(0)
+    , m_stopping(false)
+    , m_writer(nullptr)
+    , m_previousHandler(nullptr)
+    , m_fd(-1)
+    , m_fileSize(0)
+{
+    m_writer = QThread::create([this]() { writerLoop(); });
+    m_writer->start(QThread::LowPriority);
+}
+
+/**
+ * @brief AsyncLoggerクラスのデストラクタ
+ *
+ * 元のメッセージハンドラに戻し、書き込みスレッドを終了してから
+ * キューに残っているメッセージを書き込んでログファイルを閉じます。
+ */
+AsyncLogger::~AsyncLogger()
+{
+    AsyncLogger *expected = this;
+    if (s_instance.compare_exchange_strong(expected, nullptr)) {
+        qInstallMessageHandler(m_previousHandler);
+    }
+
+    m_stopping.store(true, std::memory_order_release);
+    m_wakeup.release();
+    m_writer->wait();
+    delete m_writer;
+
+    QMutexLocker locker(&m_fileMutex);
+    drain();
+    closeFile();
+}
+
+/**
+ * @brief Qtのメッセージハンドラとして登録
+ */
+void AsyncLogger::install()
+{
+    s_instance.store(this, std::memory_order_release);
+    m_previousHandler = qInstallMessageHandler(messageHandler);
+}
+
+/**
+ * @brief キューのメッセージを全て書き込む
+ *
+ * 呼び出したスレッドで書き込み、完了するまで戻りません。
+ */
+void AsyncLogger::flush()
+{
+    QMutexLocker locker(&m_fileMutex);
+    drain();
+}
+
+/**
+ * @brief Qtのメッセージハンドラ
+ *
+ * 致命的なメッセージの場合は、プロセスが終了する前に全てのメッセージを書き込みます。
+ *
+ * @param type メッセージの種類
+ * @param context メッセージの出力元 (未使用)
+ * @param message メッセージ
+ */
+void AsyncLogger::messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    Q_UNUSED(context)
+
+    AsyncLogger *logger = s_instance.load(std::memory_order_acquire);
+    if (!logger) {
+        return;
+    }
+
+    logger->enqueue(formatLine(type, message));
+
+    if (type == QtFatalMsg) {
+        logger->flush();
+    }
+}
+
+/**
+ * @brief メッセージをログの1行に整形
+ *
+ * @param type メッセージの種類
+ * @param message メッセージ
+ * @return "日時 [レベル] メッセージ"形式のUTF-8の行 (改行を含む)
+ */
+QByteArray AsyncLogger::formatLine(QtMsgType type, const QString &message)
+{
+    const char *level = nullptr;
+    switch (type) {
+        case QtDebugMsg:
+            level = "DEBUG";
+            break;
+        case QtInfoMsg:
+            level = "INFO";
+            break;
+        case QtWarningMsg:
+            level = "WARNING";
+            break;
+        case QtCriticalMsg:
+            level = "CRITICAL";
+            break;
+        case QtFatalMsg:
+            level = "FATAL";
+            break;
+    }
+
+    QByteArray line = QDateTime::currentDateTime().toString(Qt::ISODate).toLatin1();
+    line += " [";
+    line += level;
+    line += "] ";
+    line += message.toUtf8();
+    line += '\n';
+
+    return line;
+}
+
+/**
+ * @brief 行をキューに追加
+ *
+ * ロックを取らずに追加します。キューが空だった場合だけ書き込みスレッドを起こします。
+ * キューが上限に達している場合は破棄し、破棄した数を次の書き込みで記録します。
+ *
+ * @param line 整形済みの行
+ */
+void AsyncLogger::enqueue(QByteArray line)
+{
+    if (m_queued.fetch_add(1, std::memory_order_relaxed) >= MaxQueuedMessages) {
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Node *node = new Node;
+    node->line = std::move(line);
+
+    Node *head = m_head.load(std::memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!m_head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+
+    if (!head) {
+        m_wakeup.release();
+    }
+}
+
+/**
+ * @brief キューの全ての行をログファイルに書き込む
+ *
+ * キューを一度に取り出し、古い順に並べ直してまとめて書き込みます。
+ * m_fileMutexを取得した状態で呼び出します。
+ */
+void AsyncLogger::drain()
+{
+    Node *head = m_head.exchange(nullptr, std::memory_order_acquire);
+
+    // 新しい順に並んでいるため、逆順にして古い順にする
+    Node *ordered = nullptr;
+    int count = 0;
+    while (head) {
+        Node *next = head->next;
+        head->next = ordered;
+        ordered = head;
+        head = next;
+        ++count;
+    }
+    m_queued.fetch_sub(count, std::memory_order_relaxed);
+
+    QByteArray batch;
+    const int dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        batch = formatLine(QtWarningMsg, QString("%1 log messages were dropped").arg(dropped));
+    }
+
+    while (ordered) {
+        Node *next = ordered->next;
+        batch += ordered->line;
+        delete ordered;
+        ordered = next;
+
+        if (batch.size() >= WriteChunkSize) {
+            writeAll(batch);
+            batch.clear();
+        }
+    }
+
+    if (!batch.isEmpty()) {
+        writeAll(batch);
+    }
+}
+
+/**
+ * @brief 書き込みスレッドの処理
+ *
+ * 空のキューにメッセージが追加されるまで待機し、起こされるたびにキュー全体を書き込みます。
+ * 書き込んでいる間に追加されたメッセージは次のまとまりとして書き込みます。
+ */
+void AsyncLogger::writerLoop()
+{
+    while (!m_stopping.load(std::memory_order_acquire)) {
+        m_wakeup.acquire();
+
+        QMutexLocker locker(&m_fileMutex);
+        drain();
+    }
+}
+
+/**
+ * @brief ログファイルを開く
+ *
+ * ログディレクトリが存在しない場合は作成します。
+ *
+ * @return 開けた場合true
+ */
+bool AsyncLogger::openFile()
+{
+    QDir().mkpath(m_directory);
+
+    m_fd = ::open(QFile::encodeName(m_filePath).constData(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+    if (m_fd < 0) {
+        return false;
+    }
+
+    struct stat status;
+    m_fileSize = (::fstat(m_fd, &status) == 0) ? status.st_size : 0;
+
+    return true;
+}
+
+/**
+ * @brief ログファイルを閉じる
+ */
+void AsyncLogger::closeFile()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_fileSize = 0;
+}
+
+/**
+ * @brief ログファイルの世代を切り替える
+ *
+ * "ファイル名.1"から"ファイル名.N"へ順にずらし、最も古い世代は上書きします。
+ */
+void AsyncLogger::rotate()
+{
+    closeFile();
+
+    for (int i = MaxRotatedFiles - 1; i >= 1; --i) {
+        const QByteArray from = QFile::encodeName(m_filePath + '.' + QString::number(i));
+        const QByteArray to = QFile::encodeName(m_filePath + '.' + QString::number(i + 1));
+        ::rename(from.constData(), to.constData());
+    }
+
+    const QByteArray to = QFile::encodeName(m_filePath + ".1");
+    ::rename(QFile::encodeName(m_filePath).constData(), to.constData());
+
+    openFile();
+}
+
+/**
+ * @brief データをログファイルに書き込む
+ *
+ * ログファイルを開けない場合は破棄します (次の書き込みで開き直す)。
+ *
+ * @param data 書き込むデータ
+ */
+void AsyncLogger::writeAll(const QByteArray &data)
+{
+    if (m_fd < 0 && !openFile()) {
+        return;
+    }
+
+    if (m_fileSize >= MaxFileSize) {
+        rotate();
+        if (m_fd < 0) {
+            return;
+        }
+    }
+
+    const char *position = data.constData();
+    qint64 remaining = data.size();
+
+    while (remaining > 0) {
+        const ssize_t written = ::write(m_fd, position, static_cast<size_t>(remaining));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // 書き込めない場合は閉じて、次の書き込みで開き直す
+            closeFile();
+            return;
+        }
+
+        position += written;
+        remaining -= written;
+        m_fileSize += written;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef ASYNCLOGGER_H
+#define ASYNCLOGGER_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QSemaphore>
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+
+class QThread;
+
+/**
+ * @brief ログをバックグラウンドでファイルに書き込むメッセージハンドラ
+ *
+ * メッセージを出力したスレッドは整形した1行をロックフリーのキューに追加するだけで、
+ * ファイルへの書き込みは専用のスレッドがまとめて行います。
+ * ログファイルは開いたままにし、一定のサイズを超えると世代を切り替えます。
+ * 致命的なメッセージ (qFatal)は、プロセスが終了する前に出力したスレッドで
+ * キューの全てのメッセージを書き込みます。破棄時にも残りのメッセージを書き込みます。
+ *
+ * install()でQtのメッセージハンドラとして登録し、破棄時に元のハンドラに戻します。
+ * 同時に登録できるのは1つだけです。
+ */
+class AsyncLogger
+{
+private:
+    static constexpr qint64 MaxFileSize = 10 * 1024 * 1024;   // 世代を切り替えるサイズ (10MiB)
+    static constexpr int MaxRotatedFiles = 3;                   // 保持する古い世代の数
+    static constexpr int MaxQueuedMessages = 100000;            // キューの上限 (超えた分は破棄)
+
+    /**
+     * @brief キューのノード
+     */
+    struct Node {
+        QByteArray line;            // 整形済みの1行 (改行を含む)
+        Node *next = nullptr;       // 次のノード (新しい方から古い方へ)
+    };
+
+    static std::atomic<AsyncLogger *> s_instance;   // 登録中のロガー
+
+    QString m_directory;                    // ログディレクトリ
+    QString m_filePath;                     // ログファイルのパス
+    std::atomic<Node *> m_head;             // キューの先頭 (最後に追加したノード)
+    std::atomic<int> m_queued;              // キュー内のメッセージ数
+    std::atomic<int> m_dropped;             // 上限を超えて破棄したメッセージ数
+    std::atomic<bool> m_stopping;           // 書き込みスレッドの終了要求
+    QSemaphore m_wakeup;                    // 空のキューに追加されたことの通知
+    QThread *m_writer;                      // 書き込みスレッド
+    QtMessageHandler m_previousHandler;     // 登録前のメッセージハンドラ
+
+    QMutex m_fileMutex;                     // 以下のメンバーの保護 (書き込み側のみ)
+    int m_fd;                               // ログファイルのディスクリプタ (-1は未オープン)
+    qint64 m_fileSize;                      // ログファイルの現在のサイズ
+
+    static void messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message);
+    static QByteArray formatLine(QtMsgType type, const QString &message);
+
+    void enqueue(QByteArray line);
+    void drain();
+    void writerLoop();
+    bool openFile();
+    void closeFile();
+    void rotate();
+    void writeAll(const QByteArray &data);
+
+public:
+    AsyncLogger(const QString &directory, const QString &fileName);
+    ~AsyncLogger();
+
+    AsyncLogger(const AsyncLogger &) = delete;
+    AsyncLogger &operator=(const AsyncLogger &) = delete;
+
+    void install();
+    void flush();
+};
+
+#endif // ASYNCLOGGER_H
@@ -0,0 +1,187 @@
+#include "authorizer.h"
+#include <QDebug>
+#include <QDBusArgument>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusVariant>
+#include <QMap>
+
+/**
+ * @brief Authorizerクラスのコンストラクタ
+ *
+ * クライアントの切断とPolicyKitの設定変更の監視を開始します。
+ *
+ * @param connection 呼び出し元が接続しているバス
+ * @param parent 親QObjectポインタ
+ */
+Authorizer::Authorizer(const QDBusConnection &connection, QObject *parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_serviceWatcher(QString(), connection, QDBusServiceWatcher::WatchForUnregistration)
+{
+    connect(&m_serviceWatcher, &QDBusServiceWatcher::serviceUnregistered,
+            this, &Authorizer::onServiceUnregistered);
+
+    // 規則の追加やアクションの変更があった場合は認証結果が変わる可能性がある
+    m_connection.connect("org.freedesktop.PolicyKit1",
+                         "/org/freedesktop/PolicyKit1/Authority",
+                         "org.freedesktop.PolicyKit1.Authority",
+                         "Changed",
+                         this,
+                         SLOT(onAuthorityChanged()));
+}
+
+/**
+ * @brief キャッシュにより認証済みかを判定
+ *
+ * @param sender 呼び出し元のバス名
+ * @param actionId アクションID
+ * @return 有効期限内の認証結果がある場合true
+ */
+bool Authorizer::isAuthorized(const QString &sender, const QString &actionId)
+{
+    auto it = m_cache.find(qMakePair(sender, actionId));
+    if (it == m_cache.end()) {
+        return false;
+    }
+
+    if (it.value().hasExpired()) {
+        m_cache.erase(it);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief 認証を非同期で行う
+ *
+ * キャッシュにより認証済みの場合はコールバックを直ちに呼び出します。
+ * それ以外の場合はpolkitdに問い合わせ、応答を受信した時に呼び出します。
+ * 呼び出し元はプロセスIDではなくバス名で指定するため、
+ * プロセスIDの再利用による取り違えが起こりません。
+ *
+ * @param sender 呼び出し元のバス名
+ * @param actionId アクションID
+ * @param callback 認証結果を受け取るコールバック
+ */
+void Authorizer::check(const QString &sender, const QString &actionId, Callback callback)
+{
+    if (isAuthorized(sender, actionId)) {
+        callback(true);
+        return;
+    }
+
+    const Key key = qMakePair(sender, actionId);
+
+    // 同じ組の認証が進行中の場合は結果を待つ
+    auto pending = m_pending.find(key);
+    if (pending != m_pending.end()) {
+        pending.value().append(std::move(callback));
+        return;
+    }
+    m_pending.insert(key, {std::move(callback)});
+
+    // subject: (sa{sv}) = ("system-bus-name", {"name": <バス名>})
+    QDBusArgument subject;
+    subject.beginStructure();
+    subject << QStringLiteral("system-bus-name");
+    subject.beginMap(QMetaType::fromType<QString>(), QMetaType::fromType<QDBusVariant>());
+    subject.beginMapEntry();
+    subject << QStringLiteral("name") << QDBusVariant(sender);
+    subject.endMapEntry();
+    subject.endMap();
+    subject.endStructure();
+
+    QDBusMessage msg = QDBusMessage::createMethodCall(
+        "org.freedesktop.PolicyKit1",
+        "/org/freedesktop/PolicyKit1/Authority",
+        "org.freedesktop.PolicyKit1.Authority",
+        "CheckAuthorization"
+    );
+    msg << QVariant::fromValue(subject)
+        << actionId
+        << QVariant::fromValue(QMap<QString, QString>())
+        << AllowUserInteraction
+        << QString();
+
+    QDBusPendingCall pendingCall = m_connection.asyncCall(msg, CheckTimeoutMs);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, key](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+
+        QDBusPendingReply<QDBusArgument> reply = *w;
+        if (reply.isError()) {
+            qWarning() << "Authorization check for" << key.second << "failed:" << reply.error().message();
+            finish(key, false);
+            return;
+        }
+
+        // 結果: (bba{ss}) = (is_authorized, is_challenge, details)
+        bool authorized = false;
+        bool challenge = false;
+        QMap<QString, QString> details;
+
+        const QDBusArgument result = reply.argumentAt<0>();
+        result.beginStructure();
+        result >> authorized >> challenge >> details;
+        result.endStructure();
+
+        finish(key, authorized);
+    });
+}
+
+/**
+ * @brief 認証結果を待っているコールバックを呼び出す
+ *
+ * 認証に成功した場合は結果をキャッシュし、クライアントの切断の監視を開始します。
+ *
+ * @param key (バス名, アクションID)
+ * @param authorized 認証に成功した場合true
+ */
+void Authorizer::finish(const Key &key, bool authorized)
+{
+    if (authorized) {
+        m_cache.insert(key, QDeadlineTimer(CacheTtlMs));
+        if (!m_serviceWatcher.watchedServices().contains(key.first)) {
+            m_serviceWatcher.addWatchedService(key.first);
+        }
+    }
+
+    const QList<Callback> callbacks = m_pending.take(key);
+    for (const Callback &callback : callbacks) {
+        callback(authorized);
+    }
+}
+
+/**
+ * @brief クライアントの切断時に認証結果を破棄
+ *
+ * バス名は再利用されないため必須ではありませんが、
+ * 切断したクライアントのキャッシュが残り続けないようにします。
+ *
+ * @param service 切断したクライアントのバス名
+ */
+void Authorizer::onServiceUnregistered(const QString &service)
+{
+    for (auto it = m_cache.begin(); it != m_cache.end(); ) {
+        if (it.key().first == service) {
+            it = m_cache.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    m_serviceWatcher.removeWatchedService(service);
+}
+
+/**
+ * @brief PolicyKitの設定変更時に全ての認証結果を破棄
+ */
+void Authorizer::onAuthorityChanged()
+{
+    m_cache.clear();
+}
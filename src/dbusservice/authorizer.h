@@ -0,0 +1,55 @@
+#ifndef AUTHORIZER_H
+#define AUTHORIZER_H
+
+#include <QObject>
+#include <QDBusConnection>
+#include <QDBusServiceWatcher>
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <functional>
+
+/**
+ * @brief PolicyKitによる認証を非同期で行うクラス
+ *
+ * polkitdのCheckAuthorizationを非同期に呼び出すため、認証ダイアログの
+ * 入力待ちの間もサービスは他のクライアントの要求を処理できます。
+ * 認証に成功した (バス名, アクションID)の組は一定時間キャッシュし、
+ * クライアントが切断した時とPolicyKitの設定が変更された時に破棄します。
+ * 同じ組に対する認証が進行中の場合は、その結果を共有します。
+ */
+class Authorizer : public QObject
+{
+    Q_OBJECT
+
+public:
+    using Callback = std::function<void(bool authorized)>;
+
+private:
+    static constexpr int CacheTtlMs = 30 * 1000;            // 認証結果のキャッシュ期間
+    static constexpr int CheckTimeoutMs = 5 * 60 * 1000;    // 認証の待ち時間 (パスワード入力を含む)
+    static constexpr uint AllowUserInteraction = 0x1;       // CheckAuthorizationのフラグ
+
+    using Key = QPair<QString, QString>;                    // (バス名, アクションID)
+
+    QDBusConnection m_connection;                           // 呼び出し元が接続しているバス
+    QHash<Key, QDeadlineTimer> m_cache;                     // 認証済みの組 → 有効期限
+    QHash<Key, QList<Callback>> m_pending;                  // 認証中の組 → 結果を待つコールバック
+    QDBusServiceWatcher m_serviceWatcher;                   // キャッシュしたクライアントの切断の監視
+
+    void finish(const Key &key, bool authorized);
+
+public:
+    explicit Authorizer(const QDBusConnection &connection, QObject *parent = nullptr);
+
+    bool isAuthorized(const QString &sender, const QString &actionId);
+    void check(const QString &sender, const QString &actionId, Callback callback);
+
+private slots:
+    void onServiceUnregistered(const QString &service);
+    void onAuthorityChanged();
+};
+
+#endif // AUTHORIZER_H
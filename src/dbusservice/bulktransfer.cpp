@@ -0,0 +1,156 @@
+#include "bulktransfer.h"
+#include <QDebug>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef QSNAPPER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * @brief zstd圧縮が利用可能かを判定
+ *
+ * @return zstdを有効にしてビルドされている場合true
+ */
+bool BulkTransfer::isCompressionAvailable()
+{
+#ifdef QSNAPPER_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief データをファイルディスクリプタに全て書き込む
+ *
+ * @param fd 書き込み先のファイルディスクリプタ
+ * @param data 書き込むデータ
+ * @param size データのサイズ
+ * @param error エラーメッセージ (出力)
+ * @return 成功時true
+ */
+bool BulkTransfer::writeAll(int fd, const char *data, qint64 size, QString &error)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, static_cast<size_t>(size));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = QString("Failed to write memfd: %1").arg(strerror(errno));
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+/**
+ * @brief データをzstdで圧縮してファイルディスクリプタに書き込む
+ *
+ * memfdを圧縮後の最大サイズまで拡張してマップし、直接圧縮結果を書き込みます。
+ * 圧縮してもサイズが小さくならない場合は非圧縮で書き込みます。
+ *
+ * @param fd 書き込み先のファイルディスクリプタ
+ * @param data 書き込むデータ
+ * @param compressed 圧縮して書き込んだ場合true (出力)
+ * @param error エラーメッセージ (出力)
+ * @return 成功時true
+ */
+bool BulkTransfer::writeCompressed(int fd, const QByteArray &data, bool &compressed, QString &error)
+{
+    compressed = false;
+
+#ifdef QSNAPPER_HAVE_ZSTD
+    const size_t bound = ZSTD_compressBound(static_cast<size_t>(data.size()));
+    if (ftruncate(fd, static_cast<off_t>(bound)) < 0) {
+        error = QString("Failed to resize memfd: %1").arg(strerror(errno));
+        return false;
+    }
+
+    void *map = mmap(nullptr, bound, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        error = QString("Failed to map memfd: %1").arg(strerror(errno));
+        return false;
+    }
+
+    const size_t result = ZSTD_compress(map, bound, data.constData(), static_cast<size_t>(data.size()),
+                                        CompressionLevel);
+
+    // 書き込み可能なマップが残っているとF_SEAL_WRITEを設定できない
+    munmap(map, bound);
+
+    if (!ZSTD_isError(result) && result < static_cast<size_t>(data.size())) {
+        if (ftruncate(fd, static_cast<off_t>(result)) < 0) {
+            error = QString("Failed to resize memfd: %1").arg(strerror(errno));
+            return false;
+        }
+        compressed = true;
+        return true;
+    }
+
+    if (ZSTD_isError(result)) {
+        qWarning() << "zstd compression failed, sending uncompressed:" << ZSTD_getErrorName(result);
+    }
+
+    if (ftruncate(fd, 0) < 0) {
+        error = QString("Failed to resize memfd: %1").arg(strerror(errno));
+        return false;
+    }
+#endif
+
+    return writeAll(fd, data.constData(), data.size(), error);
+}
+
+/**
+ * @brief データを書き込んだ封印済みmemfdを作成
+ *
+ * 書き込み後にサイズ変更と書き込みを封印するため、受信側はデータが
+ * 途中で切り詰められる心配なくファイルをマップできます。
+ *
+ * @param name memfdの名前 (デバッグ用)
+ * @param data 書き込むデータ
+ * @param compress zstdでの圧縮を要求する場合true
+ * @param compressed 圧縮して書き込んだ場合true (出力)
+ * @param error エラーメッセージ (出力)
+ * @return ファイルディスクリプタ、失敗時は無効なファイルディスクリプタ
+ */
+QDBusUnixFileDescriptor BulkTransfer::createSealedFd(const char *name, const QByteArray &data,
+                                                     bool compress, bool &compressed, QString &error)
+{
+    compressed = false;
+
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        error = QString("Failed to create memfd: %1").arg(strerror(errno));
+        return QDBusUnixFileDescriptor();
+    }
+
+    bool success = false;
+    if (compress && isCompressionAvailable() && data.size() >= MinCompressSize) {
+        success = writeCompressed(fd, data, compressed, error);
+    }
+    else {
+        success = writeAll(fd, data.constData(), data.size(), error);
+    }
+
+    if (success && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        error = QString("Failed to seal memfd: %1").arg(strerror(errno));
+        success = false;
+    }
+
+    if (!success) {
+        close(fd);
+        return QDBusUnixFileDescriptor();
+    }
+
+    QDBusUnixFileDescriptor descriptor;
+    descriptor.giveFileDescriptor(fd);
+    return descriptor;
+}
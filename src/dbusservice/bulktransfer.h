@@ -0,0 +1,31 @@
+#ifndef BULKTRANSFER_H
+#define BULKTRANSFER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QDBusUnixFileDescriptor>
+
+/**
+ * @brief 大きな応答をファイルディスクリプタで受け渡すためのクラス
+ *
+ * データをmemfdに書き込んで封印 (seal)し、D-Busメッセージには
+ * ファイルディスクリプタだけを載せます。バスデーモンによるデータのコピーが
+ * なくなり、D-Busのメッセージサイズ上限の影響も受けません。
+ * zstdが利用可能な場合は圧縮して書き込むこともできます。
+ */
+class BulkTransfer
+{
+private:
+    static constexpr int MinCompressSize = 64 * 1024;  // 圧縮を試みる最小サイズ
+    static constexpr int CompressionLevel = 3;          // zstdの圧縮レベル
+
+    static bool writeAll(int fd, const char *data, qint64 size, QString &error);
+    static bool writeCompressed(int fd, const QByteArray &data, bool &compressed, QString &error);
+
+public:
+    static bool isCompressionAvailable();
+    static QDBusUnixFileDescriptor createSealedFd(const char *name, const QByteArray &data,
+                                                  bool compress, bool &compressed, QString &error);
+};
+
+#endif // BULKTRANSFER_H
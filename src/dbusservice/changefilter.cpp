@@ -0,0 +1,255 @@
+#include "changefilter.h"
+#include <fnmatch.h>
+#include <algorithm>
+
+static constexpr int MaxFilterEntries = 256;    // 接頭辞とglobの各上限
+
+/**
+ * @brief ChangeFilterクラスのコンストラクタ
+ *
+ * パスの接頭辞は末尾のスラッシュを取り除き、他の接頭辞に含まれるものは削除します。
+ * "/"を含む場合はパスで絞り込みません。
+ *
+ * @param pathPrefixes パスの接頭辞 (ディレクトリまたはファイルの絶対パス)
+ * @param includeGlobs 含めるglob (空の場合は全て)
+ * @param excludeGlobs 除外するglob
+ * @param statusMask 一致させるステータスのビット (0は全て)
+ */
+ChangeFilter::ChangeFilter(const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                           const QStringList &excludeGlobs, uint statusMask)
+    : m_includeGlobs(includeGlobs)
+    , m_excludeGlobs(excludeGlobs)
+    , m_statusMask(statusMask)
+    , m_include(compileGlobs(includeGlobs))
+    , m_exclude(compileGlobs(excludeGlobs))
+{
+    QStringList prefixes;
+    for (QString prefix : pathPrefixes) {
+        prefix = prefix.trimmed();
+        while (prefix.size() > 1 && prefix.endsWith('/')) {
+            prefix.chop(1);
+        }
+
+        if (prefix == "/") {
+            return;
+        }
+
+        if (!prefix.isEmpty()) {
+            prefixes.append(prefix);
+        }
+    }
+
+    // 並べ替えると、ある接頭辞に含まれる接頭辞はその直後に並ぶ
+    std::sort(prefixes.begin(), prefixes.end());
+    for (const QString &prefix : std::as_const(prefixes)) {
+        if (!m_pathPrefixes.isEmpty()) {
+            const QString &last = m_pathPrefixes.constLast();
+            if (prefix == last || prefix.startsWith(last + '/')) {
+                continue;
+            }
+        }
+        m_pathPrefixes.append(prefix);
+    }
+}
+
+/**
+ * @brief 絞り込み条件がないかを確認
+ *
+ * @return 全ての変更に一致する場合true
+ */
+bool ChangeFilter::isEmpty() const
+{
+    return m_pathPrefixes.isEmpty() && m_include.isEmpty() && m_exclude.isEmpty()
+        && (m_statusMask & AllStatus) == 0;
+}
+
+/**
+ * @brief 絞り込み条件を検証
+ *
+ * @param error 不正な場合のエラーメッセージ (出力)
+ * @return 有効な条件の場合true
+ */
+bool ChangeFilter::validate(QString &error) const
+{
+    if (m_pathPrefixes.size() > MaxFilterEntries || m_include.size() > MaxFilterEntries
+        || m_exclude.size() > MaxFilterEntries) {
+        error = "Too many filter entries";
+        return false;
+    }
+
+    for (const QString &prefix : m_pathPrefixes) {
+        if (!prefix.startsWith('/')) {
+            error = QString("Path prefix must be absolute: '%1'").arg(prefix);
+            return false;
+        }
+    }
+
+    if (m_statusMask & ~static_cast<uint>(AllStatus)) {
+        error = "Invalid status mask";
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief パスが接頭辞のいずれかに含まれるかを確認
+ *
+ * @param path ファイルの絶対パス
+ * @return 接頭辞を指定していない場合、またはいずれかの接頭辞に含まれる場合true
+ */
+bool ChangeFilter::matchesPath(QStringView path) const
+{
+    if (m_pathPrefixes.isEmpty()) {
+        return true;
+    }
+
+    for (const QString &prefix : m_pathPrefixes) {
+        if (path.startsWith(prefix)
+            && (path.size() == prefix.size() || path.at(prefix.size()) == '/')) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief ファイル変更が条件に一致するかを確認
+ *
+ * @param change "ステータス パス"形式のファイル変更
+ * @return 一致する場合true
+ */
+bool ChangeFilter::matches(const QString &change) const
+{
+    const qsizetype separator = change.indexOf(' ');
+    if (separator < 0) {
+        return false;
+    }
+
+    const QStringView status = QStringView(change).left(separator);
+    const QStringView path = QStringView(change).mid(separator + 1);
+
+    if ((m_statusMask & AllStatus) != 0 && (parseStatus(status) & m_statusMask) == 0) {
+        return false;
+    }
+
+    if (!matchesPath(path)) {
+        return false;
+    }
+
+    if (m_include.isEmpty() && m_exclude.isEmpty()) {
+        return true;
+    }
+
+    const QByteArray encodedPath = path.toUtf8();
+    const QByteArray fileName = encodedPath.mid(encodedPath.lastIndexOf('/') + 1);
+
+    if (!m_include.isEmpty() && !matchesAny(m_include, encodedPath, fileName)) {
+        return false;
+    }
+
+    return !matchesAny(m_exclude, encodedPath, fileName);
+}
+
+/**
+ * @brief ファイル変更一覧を絞り込む
+ *
+ * @param changes "ステータス パス"形式のファイル変更一覧
+ * @return 条件に一致するファイル変更一覧 (順序は保持)
+ */
+QStringList ChangeFilter::apply(const QStringList &changes) const
+{
+    if (isEmpty()) {
+        return changes;
+    }
+
+    QStringList result;
+    for (const QString &change : changes) {
+        if (matches(change)) {
+            result.append(change);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief 絞り込み条件を比較
+ *
+ * @param other 比較する条件
+ * @return 同じ条件の場合true
+ */
+bool ChangeFilter::operator==(const ChangeFilter &other) const
+{
+    return m_pathPrefixes == other.m_pathPrefixes && m_includeGlobs == other.m_includeGlobs
+        && m_excludeGlobs == other.m_excludeGlobs && m_statusMask == other.m_statusMask;
+}
+
+/**
+ * @brief ステータス文字列をビットに変換
+ *
+ * ComparisonSession::formatChangeStatusの表記 ("+....", "c.p.."など)を解析します。
+ *
+ * @param status ステータス文字列
+ * @return ステータスのビット
+ */
+uint ChangeFilter::parseStatus(QStringView status)
+{
+    uint bits = 0;
+    for (const QChar c : status) {
+        switch (c.unicode()) {
+        case '+': bits |= Created; break;
+        case '-': bits |= Deleted; break;
+        case 't': bits |= Type; break;
+        case 'c': bits |= Content; break;
+        case 'p': bits |= Permissions; break;
+        case 'u': bits |= Owner; break;
+        case 'g': bits |= Group; break;
+        case 'x': bits |= Xattrs; break;
+        case 'a': bits |= Acl; break;
+        default: break;
+        }
+    }
+
+    return bits;
+}
+
+/**
+ * @brief globを照合用に変換
+ *
+ * @param patterns globの一覧 (空文字列は無視)
+ * @return 照合用のglobの一覧
+ */
+QList<ChangeFilter::Glob> ChangeFilter::compileGlobs(const QStringList &patterns)
+{
+    QList<Glob> globs;
+    for (const QString &pattern : patterns) {
+        const QString trimmed = pattern.trimmed();
+        if (!trimmed.isEmpty()) {
+            globs.append(Glob{ trimmed.toUtf8(), trimmed.contains('/') });
+        }
+    }
+
+    return globs;
+}
+
+/**
+ * @brief いずれかのglobに一致するかを確認
+ *
+ * @param globs 照合用のglobの一覧
+ * @param path UTF-8のパス
+ * @param fileName UTF-8のファイル名
+ * @return 一致するglobがある場合true
+ */
+bool ChangeFilter::matchesAny(const QList<Glob> &globs, const QByteArray &path, const QByteArray &fileName)
+{
+    for (const Glob &glob : globs) {
+        const QByteArray &subject = glob.fullPath ? path : fileName;
+        if (fnmatch(glob.pattern.constData(), subject.constData(), 0) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,77 @@
+#ifndef CHANGEFILTER_H
+#define CHANGEFILTER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+
+/**
+ * @brief ファイル変更一覧の絞り込み条件
+ *
+ * パスの接頭辞 (ディレクトリ)、含めるglob、除外するglob、ステータスのビットマスクで
+ * ファイル変更一覧を絞り込みます。条件を指定しない項目は全てに一致します。
+ * サービス側で送信前に適用し、一致しない変更はD-Busで送信しません。
+ *
+ * globはfnmatch(3)で照合し、'/'を含まないパターンはファイル名だけと、
+ * '/'を含むパターンはパス全体と照合します。
+ */
+class ChangeFilter
+{
+public:
+    /**
+     * @brief ステータスのビット (snapperのステータスフラグと同じ値)
+     */
+    enum Status : uint {
+        Created     = 0x001,    // 作成
+        Deleted     = 0x002,    // 削除
+        Type        = 0x004,    // 種類の変更
+        Content     = 0x008,    // 内容の変更
+        Permissions = 0x010,    // パーミッションの変更
+        Owner       = 0x020,    // 所有者の変更
+        Group       = 0x040,    // グループの変更
+        Xattrs      = 0x080,    // 拡張属性の変更
+        Acl         = 0x100,    // ACLの変更
+        AllStatus   = 0x1ff
+    };
+
+private:
+    /**
+     * @brief 照合用に変換したglob
+     */
+    struct Glob {
+        QByteArray pattern;     // UTF-8のパターン
+        bool fullPath;          // パス全体と照合する場合true ('/'を含むパターン)
+    };
+
+    QStringList m_pathPrefixes;     // 正規化したパスの接頭辞 (末尾のスラッシュなし)
+    QStringList m_includeGlobs;     // 含めるglob
+    QStringList m_excludeGlobs;     // 除外するglob
+    uint m_statusMask = 0;          // 一致させるステータスのビット (0は全て)
+    QList<Glob> m_include;          // 照合用の含めるglob
+    QList<Glob> m_exclude;          // 照合用の除外するglob
+
+    static QList<Glob> compileGlobs(const QStringList &patterns);
+    static bool matchesAny(const QList<Glob> &globs, const QByteArray &path, const QByteArray &fileName);
+
+public:
+    ChangeFilter() = default;
+    ChangeFilter(const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                 const QStringList &excludeGlobs, uint statusMask);
+
+    bool isEmpty() const;
+    bool validate(QString &error) const;
+
+    const QStringList &pathPrefixes() const { return m_pathPrefixes; }
+    bool matchesPath(QStringView path) const;
+    bool matches(const QString &change) const;
+    QStringList apply(const QStringList &changes) const;
+
+    bool operator==(const ChangeFilter &other) const;
+    bool operator!=(const ChangeFilter &other) const { return !(*this == other); }
+
+    static uint parseStatus(QStringView status);
+};
+
+#endif // CHANGEFILTER_H
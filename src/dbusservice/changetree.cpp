@@ -0,0 +1,136 @@
+#include "changetree.h"
+#include <algorithm>
+
+/**
+ * @brief ChangeTreeクラスのコンストラクタ
+ *
+ * ファイル変更一覧からツリーを作成し、件数を集計します。
+ * ステータスに'+'を含む変更は作成、'-'を含む変更は削除、それ以外は変更として数えます。
+ *
+ * @param changes "ステータス パス"形式のファイル変更一覧
+ */
+ChangeTree::ChangeTree(const QStringList &changes)
+{
+    m_nodes.append(Node());
+    m_index.insert(QString(), 0);
+
+    QList<int> changed;
+    changed.reserve(changes.size());
+
+    for (const QString &change : changes) {
+        const qsizetype separator = change.indexOf(' ');
+        if (separator <= 0) {
+            continue;
+        }
+
+        const QString path = normalize(change.mid(separator + 1));
+        if (path.isEmpty()) {
+            continue;
+        }
+
+        const int position = insert(path);
+        if (!m_nodes.at(position).status.isEmpty()) {
+            continue; // 重複
+        }
+
+        m_nodes[position].status = change.left(separator);
+        changed.append(position);
+    }
+
+    // 変更されたエントリを自身と全ての祖先で数える
+    for (const int position : std::as_const(changed)) {
+        const QString &status = m_nodes.at(position).status;
+        int Node::*counter = status.contains('+') ? &Node::created
+                           : status.contains('-') ? &Node::deleted
+                           : &Node::modified;
+
+        for (int current = position; current >= 0; current = m_nodes.at(current).parent) {
+            ++(m_nodes[current].*counter);
+        }
+    }
+
+    for (Node &node : m_nodes) {
+        std::sort(node.children.begin(), node.children.end(), [this](int a, int b) {
+            return m_nodes.at(a).name < m_nodes.at(b).name;
+        });
+    }
+}
+
+/**
+ * @brief ディレクトリ直下のエントリを取得
+ *
+ * @param directory ディレクトリのパス ("/"はルート)
+ * @param nodes 直下のエントリ (出力、名前順)
+ * @return ディレクトリが変更一覧に含まれる場合true
+ */
+bool ChangeTree::children(const QString &directory, QList<ChangeNode> &nodes) const
+{
+    const auto it = m_index.constFind(normalize(directory));
+    if (it == m_index.constEnd()) {
+        return false;
+    }
+
+    const Node &parent = m_nodes.at(it.value());
+    nodes.reserve(parent.children.size());
+
+    for (const int position : parent.children) {
+        const Node &node = m_nodes.at(position);
+
+        ChangeNode child;
+        child.name = node.name;
+        child.status = node.status;
+        child.hasChildren = !node.children.isEmpty();
+        child.created = node.created;
+        child.modified = node.modified;
+        child.deleted = node.deleted;
+        nodes.append(child);
+    }
+
+    return true;
+}
+
+/**
+ * @brief パスのノードを作成
+ *
+ * 存在しない祖先のノードも作成します。
+ *
+ * @param path 正規化したパス
+ * @return ノードの位置
+ */
+int ChangeTree::insert(const QString &path)
+{
+    const auto existing = m_index.constFind(path);
+    if (existing != m_index.constEnd()) {
+        return existing.value();
+    }
+
+    const qsizetype separator = path.lastIndexOf('/');
+    const int parent = insert(path.left(qMax<qsizetype>(separator, 0)));
+
+    const int position = static_cast<int>(m_nodes.size());
+
+    Node node;
+    node.name = path.mid(separator + 1);
+    node.parent = parent;
+    m_nodes.append(node);
+    m_nodes[parent].children.append(position);
+    m_index.insert(path, position);
+
+    return position;
+}
+
+/**
+ * @brief パスを正規化
+ *
+ * @param path パス
+ * @return 末尾のスラッシュを取り除いたパス (ルートは空文字列)
+ */
+QString ChangeTree::normalize(const QString &path)
+{
+    QString normalized = path;
+    while (normalized.endsWith('/')) {
+        normalized.chop(1);
+    }
+
+    return normalized;
+}
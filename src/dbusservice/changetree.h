@@ -0,0 +1,51 @@
+#ifndef CHANGETREE_H
+#define CHANGETREE_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "dbustypes.h"
+
+/**
+ * @brief ファイル変更一覧をディレクトリ単位で参照するための索引
+ *
+ * "ステータス パス"形式のファイル変更一覧からディレクトリツリーを作成し、
+ * 各ノードにサブツリー全体の作成・変更・削除の件数を集計します。
+ * クライアントは展開したディレクトリの直下のエントリだけを取得できるため、
+ * 数十万件の変更がある場合でも全てのノードを一度に転送・作成する必要がありません。
+ * 作成後は変更されないため、複数のスレッドから同時に参照できます。
+ */
+class ChangeTree
+{
+private:
+    /**
+     * @brief ツリーのノード
+     */
+    struct Node {
+        QString name;               // エントリ名
+        QString status;             // ステータス (祖先として存在するだけの場合は空文字列)
+        int parent = -1;            // 親ノードの位置 (ルートは-1)
+        QList<int> children;        // 子ノードの位置 (名前順)
+        int created = 0;            // サブツリー内の作成されたエントリ数
+        int modified = 0;           // サブツリー内の変更されたエントリ数
+        int deleted = 0;            // サブツリー内の削除されたエントリ数
+    };
+
+    QVector<Node> m_nodes;          // ノード (先頭はルート)
+    QHash<QString, int> m_index;    // パス (末尾のスラッシュなし、ルートは空文字列) → ノードの位置
+
+    int insert(const QString &path);
+    static QString normalize(const QString &path);
+
+public:
+    explicit ChangeTree(const QStringList &changes);
+
+    ChangeTree(const ChangeTree &) = delete;
+    ChangeTree &operator=(const ChangeTree &) = delete;
+
+    bool children(const QString &directory, QList<ChangeNode> &nodes) const;
+};
+
+#endif // CHANGETREE_H
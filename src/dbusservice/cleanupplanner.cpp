@@ -0,0 +1,355 @@
+#include "cleanupplanner.h"
+#include <QDateTime>
+#include <QSet>
+#include <snapper/Snapper.h>
+#include <snapper/Snapshot.h>
+#include <snapper/Comparison.h>
+#include <snapper/File.h>
+#include <snapper/Version.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// 古いlibsnapper（7.x未満）には LIBSNAPPER_VERSION_AT_LEAST マクロが存在しない
+#ifndef LIBSNAPPER_VERSION_AT_LEAST
+#define LIBSNAPPER_VERSION_AT_LEAST(major, minor)                                            \
+    ((LIBSNAPPER_VERSION_MAJOR > (major)) ||                                                 \
+     (LIBSNAPPER_VERSION_MAJOR == (major) && LIBSNAPPER_VERSION_MINOR >= (minor)))
+#endif
+
+/**
+ * @brief スナップショットがクリーンアップの対象になり得るかを判定
+ *
+ * 現在のシステム、デフォルト (次回起動)、起動中のスナップショットは対象外です。
+ *
+ * @param snapshot スナップショット
+ * @return 対象になり得る場合true
+ */
+static bool isRemovable(const snapper::Snapshot &snapshot)
+{
+    if (snapshot.isCurrent()) {
+        return false;
+    }
+
+#if LIBSNAPPER_VERSION_AT_LEAST(5, 0)
+    if (snapshot.isDefault() || snapshot.isActive()) {
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+/**
+ * @brief スナップショットが重要 (userdataのimportant=yes)かを判定
+ *
+ * @param snapshot スナップショット
+ * @return 重要な場合true
+ */
+static bool isImportant(const snapper::Snapshot &snapshot)
+{
+    const std::map<std::string, std::string> &userdata = snapshot.getUserdata();
+    auto it = userdata.find("important");
+    return it != userdata.end() && it->second == "yes";
+}
+
+/**
+ * @brief CleanupPlannerクラスのコンストラクタ
+ *
+ * @param snapper 対象のSnapperインスタンス (スナップショット一覧を読み込み済み)
+ */
+CleanupPlanner::CleanupPlanner(const snapper::Snapper *snapper)
+    : m_snapper(snapper)
+    , m_now(time(nullptr))
+{
+}
+
+/**
+ * @brief アルゴリズム名を解析
+ *
+ * @param name アルゴリズム名 ("number"、"timeline"、"empty-pre-post")
+ * @param algorithm 解析したアルゴリズム (出力)
+ * @return 既知のアルゴリズム名の場合true
+ */
+bool CleanupPlanner::parseAlgorithm(const QString &name, Algorithm &algorithm)
+{
+    if (name == "number") {
+        algorithm = Algorithm::Number;
+    }
+    else if (name == "timeline") {
+        algorithm = Algorithm::Timeline;
+    }
+    else if (name == "empty-pre-post") {
+        algorithm = Algorithm::EmptyPrePost;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief 削除対象のスナップショットを計算
+ *
+ * @param algorithm クリーンアップアルゴリズム
+ * @return 削除対象のスナップショット番号 (番号順)
+ * @throws snapper::Exception empty-pre-postの比較に失敗した場合
+ */
+QList<int> CleanupPlanner::plan(Algorithm algorithm) const
+{
+    QList<int> numbers;
+
+    switch (algorithm) {
+        case Algorithm::Number:
+            numbers = keepPrePairs(planNumber());
+            break;
+        case Algorithm::Timeline:
+            numbers = keepPrePairs(planTimeline());
+            break;
+        case Algorithm::EmptyPrePost:
+            numbers = planEmptyPrePost();
+            break;
+    }
+
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+/**
+ * @brief 設定ファイルの値を取得
+ *
+ * @param key キー
+ * @param defaultValue 設定されていない場合の値
+ * @return 設定値
+ */
+QString CleanupPlanner::configValue(const char *key, const QString &defaultValue) const
+{
+    std::string value;
+    if (m_snapper->getConfigInfo().getValue(key, value)) {
+        return QString::fromStdString(value).trimmed();
+    }
+
+    return defaultValue;
+}
+
+/**
+ * @brief 設定ファイルの上限値を取得
+ *
+ * "10"のような値、または"2-10"のような範囲を受け付け、範囲の場合は上限側を返します。
+ *
+ * @param key キー
+ * @param defaultValue 設定されていない場合や不正な場合の値
+ * @return 上限値
+ */
+int CleanupPlanner::limitValue(const char *key, int defaultValue) const
+{
+    const QString value = configValue(key, QString());
+    const QString upper = value.section('-', -1).trimmed();
+
+    bool ok = false;
+    const int limit = upper.toInt(&ok);
+
+    return ok && limit >= 0 ? limit : defaultValue;
+}
+
+/**
+ * @brief numberアルゴリズムの削除対象を計算
+ *
+ * cleanupが"number"のスナップショットを新しい順に数え、重要なものは
+ * NUMBER_LIMIT_IMPORTANT、それ以外はNUMBER_LIMITを超えた分を削除対象にします。
+ * NUMBER_MIN_AGEより新しいスナップショットは削除しません。
+ *
+ * @return 削除対象のスナップショット番号
+ */
+QList<int> CleanupPlanner::planNumber() const
+{
+    const int limit = limitValue("NUMBER_LIMIT", 50);
+    const int limitImportant = limitValue("NUMBER_LIMIT_IMPORTANT", 10);
+    const int minAge = limitValue("NUMBER_MIN_AGE", DefaultMinAge);
+
+    std::vector<const snapper::Snapshot *> candidates;
+    const snapper::Snapshots &snapshots = m_snapper->getSnapshots();
+    for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+        if (isRemovable(*it) && it->getCleanup() == "number") {
+            candidates.push_back(&*it);
+        }
+    }
+
+    // 新しい順 (番号の大きい順)に数える
+    std::sort(candidates.begin(), candidates.end(), [](const snapper::Snapshot *a, const snapper::Snapshot *b) {
+        return a->getNum() > b->getNum();
+    });
+
+    QList<int> numbers;
+    int kept = 0;
+    int keptImportant = 0;
+
+    for (const snapper::Snapshot *snapshot : candidates) {
+        bool keep;
+        if (isImportant(*snapshot)) {
+            keep = keptImportant++ < limitImportant;
+        }
+        else {
+            keep = kept++ < limit;
+        }
+
+        if (!keep && m_now - snapshot->getDate() >= minAge) {
+            numbers.append(snapshot->getNum());
+        }
+    }
+
+    return numbers;
+}
+
+/**
+ * @brief timelineアルゴリズムの削除対象を計算
+ *
+ * cleanupが"timeline"のスナップショットのうち、各時間・日・週・月・四半期・年で
+ * 最初のものを新しい順にTIMELINE_LIMIT_*個ずつ残し、残りを削除対象にします。
+ * TIMELINE_MIN_AGEより新しいスナップショットは削除しません。
+ *
+ * @return 削除対象のスナップショット番号
+ */
+QList<int> CleanupPlanner::planTimeline() const
+{
+    // 時間・日・週・月・四半期・年の順
+    constexpr int PeriodCount = 6;
+    const int limits[PeriodCount] = {
+        limitValue("TIMELINE_LIMIT_HOURLY", 10),
+        limitValue("TIMELINE_LIMIT_DAILY", 10),
+        limitValue("TIMELINE_LIMIT_WEEKLY", 0),
+        limitValue("TIMELINE_LIMIT_MONTHLY", 10),
+        limitValue("TIMELINE_LIMIT_QUARTERLY", 0),
+        limitValue("TIMELINE_LIMIT_YEARLY", 10)
+    };
+    const int minAge = limitValue("TIMELINE_MIN_AGE", DefaultMinAge);
+
+    struct Candidate {
+        const snapper::Snapshot *snapshot;
+        qint64 periods[PeriodCount];        // 各期間の識別値
+        bool first[PeriodCount];            // 各期間で最初 (最も古い)のスナップショットの場合true
+    };
+
+    std::vector<Candidate> candidates;
+    const snapper::Snapshots &snapshots = m_snapper->getSnapshots();
+    for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+        if (!isRemovable(*it) || it->getCleanup() != "timeline") {
+            continue;
+        }
+
+        const QDateTime dateTime = QDateTime::fromSecsSinceEpoch(it->getDate());
+        const QDate date = dateTime.date();
+        int weekYear = 0;
+        const int week = date.weekNumber(&weekYear);
+
+        Candidate candidate {};
+        candidate.snapshot = &*it;
+        candidate.periods[0] = date.toJulianDay() * 24 + dateTime.time().hour();
+        candidate.periods[1] = date.toJulianDay();
+        candidate.periods[2] = static_cast<qint64>(weekYear) * 100 + week;
+        candidate.periods[3] = static_cast<qint64>(date.year()) * 12 + date.month();
+        candidate.periods[4] = static_cast<qint64>(date.year()) * 4 + (date.month() - 1) / 3;
+        candidate.periods[5] = date.year();
+        candidates.push_back(candidate);
+    }
+
+    // 古い順に並べ、各期間で最初のものを求める
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.snapshot->getDate() < b.snapshot->getDate()
+            || (a.snapshot->getDate() == b.snapshot->getDate() && a.snapshot->getNum() < b.snapshot->getNum());
+    });
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        for (int p = 0; p < PeriodCount; ++p) {
+            candidates[i].first[p] = i == 0 || candidates[i - 1].periods[p] != candidates[i].periods[p];
+        }
+    }
+
+    // 新しい順に、各期間の上限まで残す
+    QList<int> numbers;
+    int kept[PeriodCount] = {};
+
+    for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+        bool keep = false;
+        for (int p = 0; p < PeriodCount; ++p) {
+            if (it->first[p] && kept[p] < limits[p]) {
+                kept[p]++;
+                keep = true;
+            }
+        }
+
+        if (!keep && m_now - it->snapshot->getDate() >= minAge) {
+            numbers.append(it->snapshot->getNum());
+        }
+    }
+
+    return numbers;
+}
+
+/**
+ * @brief empty-pre-postアルゴリズムの削除対象を計算
+ *
+ * postスナップショットがEMPTY_PRE_POST_MIN_AGEより古いpre/postの組を比較し、
+ * 差分がない組を両方とも削除対象にします。
+ * btrfsではスナップショットをマウントせずに比較します。
+ *
+ * @return 削除対象のスナップショット番号
+ * @throws snapper::Exception 比較に失敗した場合
+ */
+QList<int> CleanupPlanner::planEmptyPrePost() const
+{
+    const int minAge = limitValue("EMPTY_PRE_POST_MIN_AGE", DefaultMinAge);
+
+    QList<int> numbers;
+    const snapper::Snapshots &snapshots = m_snapper->getSnapshots();
+
+    for (auto pre = snapshots.begin(); pre != snapshots.end(); ++pre) {
+        if (pre->getType() != snapper::PRE || !isRemovable(*pre)) {
+            continue;
+        }
+
+        auto post = snapshots.findPost(pre);
+        if (post == snapshots.end() || !isRemovable(*post) || m_now - post->getDate() < minAge) {
+            continue;
+        }
+
+        snapper::Comparison comparison(m_snapper, pre, post, false);
+        const snapper::Files &files = comparison.getFiles();
+        if (files.begin() == files.end()) {
+            numbers.append(pre->getNum());
+            numbers.append(post->getNum());
+        }
+    }
+
+    return numbers;
+}
+
+/**
+ * @brief 対のpostを残すpreスナップショットを削除対象から外す
+ *
+ * preだけを削除して、対のないpostが残らないようにします。
+ *
+ * @param numbers 削除対象のスナップショット番号
+ * @return 調整後の削除対象のスナップショット番号
+ */
+QList<int> CleanupPlanner::keepPrePairs(const QList<int> &numbers) const
+{
+    const QSet<int> removing(numbers.cbegin(), numbers.cend());
+    const snapper::Snapshots &snapshots = m_snapper->getSnapshots();
+
+    QList<int> result;
+    for (int number : numbers) {
+        auto snapshot = snapshots.find(number);
+        if (snapshot != snapshots.end() && snapshot->getType() == snapper::PRE) {
+            auto post = snapshots.findPost(snapshot);
+            if (post != snapshots.end() && !removing.contains(post->getNum())) {
+                continue;
+            }
+        }
+
+        result.append(number);
+    }
+
+    return result;
+}
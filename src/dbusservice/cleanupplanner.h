@@ -0,0 +1,54 @@
+#ifndef CLEANUPPLANNER_H
+#define CLEANUPPLANNER_H
+
+#include <QList>
+#include <QString>
+#include <ctime>
+
+namespace snapper {
+    class Snapper;
+}
+
+/**
+ * @brief Snapperのクリーンアップで削除されるスナップショットを計算するクラス
+ *
+ * snapperコマンドのcleanupと同じ規則で、設定ファイルの上限値
+ * (NUMBER_LIMIT、TIMELINE_LIMIT_*、*_MIN_AGEなど)から削除対象を選びます。
+ * 削除は行わず、読み込み済みのスナップショット一覧だけから計算します
+ * (empty-pre-postはpre/postの組を比較します)。
+ * 範囲指定の上限値 ("2-10"など)は、空き容量に関わらず上限側を使用します。
+ */
+class CleanupPlanner
+{
+public:
+    /**
+     * @brief クリーンアップアルゴリズム
+     */
+    enum class Algorithm {
+        Number,         // 番号 (作成順)で古いものから削除
+        Timeline,       // 時間・日・週・月・四半期・年ごとに残して削除
+        EmptyPrePost    // 差分のないpre/postの組を削除
+    };
+
+private:
+    static constexpr int DefaultMinAge = 1800;          // *_MIN_AGEの既定値 (秒)
+
+    const snapper::Snapper *m_snapper;      // 対象のSnapperインスタンス
+    time_t m_now;                           // 計算の基準時刻
+
+    QString configValue(const char *key, const QString &defaultValue) const;
+    int limitValue(const char *key, int defaultValue) const;
+    QList<int> planNumber() const;
+    QList<int> planTimeline() const;
+    QList<int> planEmptyPrePost() const;
+    QList<int> keepPrePairs(const QList<int> &numbers) const;
+
+public:
+    explicit CleanupPlanner(const snapper::Snapper *snapper);
+
+    static bool parseAlgorithm(const QString &name, Algorithm &algorithm);
+
+    QList<int> plan(Algorithm algorithm) const;
+};
+
+#endif // CLEANUPPLANNER_H
@@ -0,0 +1,253 @@
+#include "comparisoncache.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QVector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <limits>
+
+static const char CacheMagic[8] = { 'Q', 'S', 'N', 'P', 'C', 'M', 'P', '\0' };
+static const char CacheSuffix[] = ".cache";
+
+/**
+ * @brief ComparisonCacheクラスのコンストラクタ
+ *
+ * ディレクトリは最初の保存時に作成します。
+ *
+ * @param directory 保存先のディレクトリ
+ */
+ComparisonCache::ComparisonCache(const QString &directory)
+    : m_directory(directory)
+{
+}
+
+/**
+ * @brief 保存済みの比較結果を読み込む
+ *
+ * ファイルをmmapし、ヘッダーのスナップショット番号、サブボリュームの世代、
+ * 作成日時がキーと一致する場合だけ読み込みます。
+ *
+ * @param key 比較結果のキー
+ * @param changes ファイル変更一覧 (出力、"ステータス パス"形式)
+ * @return 読み込めた場合true
+ */
+bool ComparisonCache::load(const Key &key, QStringList &changes) const
+{
+    const QByteArray path = QFile::encodeName(filePath(key.configName, key.number1, key.number2));
+
+    const int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header))) {
+        ::close(fd);
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(info.st_size);
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    const char *base = static_cast<const char *>(mapped);
+
+    Header header;
+    memcpy(&header, base, sizeof(header));
+
+    bool valid = memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) == 0
+        && header.version == FormatVersion
+        && header.number1 == key.number1 && header.number2 == key.number2
+        && header.generation1 == key.generation1 && header.generation2 == key.generation2
+        && header.date1 == key.date1 && header.date2 == key.date2;
+
+    const size_t tableSize = static_cast<size_t>(header.count) * sizeof(quint32);
+    valid = valid && size - sizeof(Header) >= tableSize;
+
+    QStringList result;
+    if (valid) {
+        const char *table = base + sizeof(Header);
+        const char *data = table + tableSize;
+        const size_t dataSize = size - sizeof(Header) - tableSize;
+
+        result.reserve(header.count);
+
+        quint32 begin = 0;
+        for (quint32 i = 0; i < header.count; ++i) {
+            quint32 end;
+            memcpy(&end, table + i * sizeof(quint32), sizeof(end));
+
+            if (end < begin || end > dataSize) {
+                valid = false;
+                break;
+            }
+
+            result.append(QString::fromUtf8(data + begin, static_cast<qsizetype>(end - begin)));
+            begin = end;
+        }
+    }
+
+    munmap(mapped, size);
+
+    if (!valid) {
+        return false;
+    }
+
+    changes = std::move(result);
+    return true;
+}
+
+/**
+ * @brief 比較結果を保存
+ *
+ * 一時ファイルに書き込んでから置き換えるため、読み込み中のファイルが
+ * 壊れることはありません。保存に失敗しても比較結果の利用には影響しないため、
+ * 警告を出力するだけです。
+ *
+ * @param key 比較結果のキー
+ * @param changes ファイル変更一覧 ("ステータス パス"形式)
+ */
+void ComparisonCache::store(const Key &key, const QStringList &changes)
+{
+    QByteArray data;
+    QVector<quint32> ends;
+    ends.reserve(changes.size());
+
+    for (const QString &change : changes) {
+        data.append(change.toUtf8());
+        if (data.size() > static_cast<qsizetype>(std::numeric_limits<quint32>::max())) {
+            // 終了位置を32ビットで表せない大きさの結果は保存しない
+            return;
+        }
+        ends.append(static_cast<quint32>(data.size()));
+    }
+
+    Header header {};
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = FormatVersion;
+    header.count = static_cast<quint32>(ends.size());
+    header.number1 = key.number1;
+    header.number2 = key.number2;
+    header.generation1 = key.generation1;
+    header.generation2 = key.generation2;
+    header.date1 = key.date1;
+    header.date2 = key.date2;
+
+    QMutexLocker locker(&m_mutex);
+
+    if (!ensureDirectory()) {
+        return;
+    }
+
+    QSaveFile file(filePath(key.configName, key.number1, key.number2));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to write comparison cache:" << file.errorString();
+        return;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(ends.constData()),
+               static_cast<qint64>(ends.size()) * static_cast<qint64>(sizeof(quint32)));
+    file.write(data);
+
+    if (!file.commit()) {
+        qWarning() << "Failed to write comparison cache:" << file.errorString();
+        return;
+    }
+
+    prune();
+}
+
+/**
+ * @brief スナップショットを含む比較結果を削除
+ *
+ * @param configName Snapper設定名
+ * @param number 削除されたスナップショット番号
+ */
+void ComparisonCache::evict(const QString &configName, int number)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const QString prefix = configPrefix(configName);
+    const QLatin1String suffix(CacheSuffix);
+
+    QDir dir(m_directory);
+    const QStringList names = dir.entryList({prefix + "*" + suffix}, QDir::Files);
+
+    for (const QString &name : names) {
+        const QStringList numbers = name.mid(prefix.size(), name.size() - prefix.size() - suffix.size()).split('-');
+        if (numbers.size() == 2 && (numbers.at(0).toInt() == number || numbers.at(1).toInt() == number)) {
+            dir.remove(name);
+        }
+    }
+}
+
+/**
+ * @brief 設定のファイル名の接頭辞を取得
+ *
+ * 設定名にファイル名として使えない文字が含まれていても良いように、
+ * UTF-8の16進表記を使います。
+ *
+ * @param configName Snapper設定名
+ * @return ファイル名の接頭辞
+ */
+QString ComparisonCache::configPrefix(const QString &configName) const
+{
+    return QString::fromLatin1(configName.toUtf8().toHex()) + '-';
+}
+
+/**
+ * @brief 比較結果のファイルパスを取得
+ *
+ * @param configName Snapper設定名
+ * @param number1 比較元のスナップショット番号
+ * @param number2 比較先のスナップショット番号
+ * @return ファイルパス
+ */
+QString ComparisonCache::filePath(const QString &configName, int number1, int number2) const
+{
+    return QString("%1/%2%3-%4%5").arg(m_directory, configPrefix(configName))
+        .arg(number1).arg(number2).arg(QLatin1String(CacheSuffix));
+}
+
+/**
+ * @brief 保存先のディレクトリを作成
+ *
+ * 比較結果にはファイルパスが含まれるため、rootだけが読めるようにします。
+ *
+ * @return ディレクトリを使用できる場合true
+ */
+bool ComparisonCache::ensureDirectory() const
+{
+    if (!QDir().mkpath(m_directory)) {
+        qWarning() << "Failed to create comparison cache directory" << m_directory;
+        return false;
+    }
+
+    QFile::setPermissions(m_directory, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+    return true;
+}
+
+/**
+ * @brief 上限を超えた古い比較結果を削除
+ */
+void ComparisonCache::prune()
+{
+    QDir dir(m_directory);
+    const QStringList names = dir.entryList({QString("*") + QLatin1String(CacheSuffix)}, QDir::Files, QDir::Time);
+
+    // 新しい順に並んでいる
+    for (qsizetype i = MaxEntries; i < names.size(); ++i) {
+        dir.remove(names.at(i));
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef COMPARISONCACHE_H
+#define COMPARISONCACHE_H
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief スナップショット同士の比較結果 (ファイル変更一覧)をディスクに保存するクラス
+ *
+ * 読み取り専用のスナップショット同士の比較結果は変化しないため、
+ * 設定名とスナップショット番号の組ごとに1つのファイルに保存し、
+ * 次回以降はsnapper::Comparisonを作成せずにmmapで読み込みます。
+ * 現在のシステムとの比較は内容が変化するため保存しません。
+ *
+ * ファイルはヘッダー、各エントリの終了位置の配列、UTF-8のエントリ本体からなります。
+ * ヘッダーにはサブボリュームの世代と作成日時を記録し、番号が再利用された
+ * スナップショットの古い結果を使わないようにします。
+ * スナップショットの削除時はevict()で、そのスナップショットを含む結果を削除します。
+ */
+class ComparisonCache
+{
+public:
+    /**
+     * @brief 比較結果を識別するキー
+     */
+    struct Key {
+        QString configName;         // Snapper設定名
+        int number1 = 0;            // 比較元のスナップショット番号
+        int number2 = 0;            // 比較先のスナップショット番号
+        quint64 generation1 = 0;    // 比較元のサブボリュームの世代 (btrfs以外は0)
+        quint64 generation2 = 0;    // 比較先のサブボリュームの世代 (btrfs以外は0)
+        qint64 date1 = 0;           // 比較元の作成日時 (UNIX時刻)
+        qint64 date2 = 0;           // 比較先の作成日時 (UNIX時刻)
+    };
+
+private:
+    static constexpr quint32 FormatVersion = 1;     // ファイル形式のバージョン
+    static constexpr int MaxEntries = 64;           // 保持するファイル数の上限 (超えた分は古いものから削除)
+
+    /**
+     * @brief ファイルの先頭に置くヘッダー
+     */
+    struct Header {
+        char magic[8];              // "QSNPCMP" + '\0'
+        quint32 version;            // ファイル形式のバージョン
+        quint32 count;              // エントリ数
+        qint32 number1;             // 比較元のスナップショット番号
+        qint32 number2;             // 比較先のスナップショット番号
+        quint64 generation1;        // 比較元のサブボリュームの世代
+        quint64 generation2;        // 比較先のサブボリュームの世代
+        qint64 date1;               // 比較元の作成日時
+        qint64 date2;               // 比較先の作成日時
+    };
+
+    QString m_directory;            // 保存先のディレクトリ
+    QMutex m_mutex;                 // 保存と削除の直列化
+
+    QString configPrefix(const QString &configName) const;
+    QString filePath(const QString &configName, int number1, int number2) const;
+    bool ensureDirectory() const;
+    void prune();
+
+public:
+    explicit ComparisonCache(const QString &directory = QStringLiteral(QSNAPPER_CACHE_DIR));
+
+    ComparisonCache(const ComparisonCache &) = delete;
+    ComparisonCache &operator=(const ComparisonCache &) = delete;
+
+    bool load(const Key &key, QStringList &changes) const;
+    void store(const Key &key, const QStringList &changes);
+    void evict(const QString &configName, int number);
+};
+
+#endif // COMPARISONCACHE_H
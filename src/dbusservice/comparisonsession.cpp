@@ -0,0 +1,285 @@
+#include "comparisonsession.h"
+#include "servicemetrics.h"
+#include <snapper/Snapper.h>
+#include <snapper/Snapshot.h>
+#include <snapper/Comparison.h>
+#include <snapper/File.h>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+/**
+ * @brief ComparisonSessionクラスのコンストラクタ
+ *
+ * 2つのスナップショットを比較し、比較先のファイルを参照できるよう
+ * スナップショットをマウントします。
+ *
+ * @param snapper 比較に使用するSnapperインスタンス
+ * @param configName Snapper設定名
+ * @param number1 比較元のスナップショット番号
+ * @param number2 比較先のスナップショット番号 (0は現在のシステム)
+ * @param owner セッションを開いたクライアントのバス名 (一時的な比較の場合は空文字列)
+ * @param mountLock 設定のマウント・アンマウントのロック
+ * @throws std::runtime_error スナップショットが存在しない場合
+ * @throws snapper::Exception 比較に失敗した場合
+ */
+ComparisonSession::ComparisonSession(std::shared_ptr<snapper::Snapper> snapper, const QString &configName,
+                                     int number1, int number2, const QString &owner,
+                                     std::shared_ptr<QMutex> mountLock)
+    : m_snapper(std::move(snapper))
+    , m_mounted1(nullptr)
+    , m_mounted2(nullptr)
+    , m_configName(configName)
+    , m_number1(number1)
+    , m_number2(number2)
+    , m_owner(owner)
+    , m_mountLock(std::move(mountLock))
+    , m_changesValid(false)
+    , m_stale(false)
+{
+    compare();
+    m_lastUsed.start();
+}
+
+/**
+ * @brief ComparisonSessionクラスのデストラクタ
+ *
+ * Comparisonを破棄してスナップショットをアンマウントします。
+ */
+ComparisonSession::~ComparisonSession()
+{
+    m_comparison.reset();
+    unmount();
+}
+
+/**
+ * @brief スナップショットを比較
+ *
+ * 既存のComparisonがあれば破棄 (アンマウント)してから作成し直します。
+ * libsnapperのマウントの参照カウントはスレッドセーフではないため、
+ * 同じ設定のマウントとアンマウントは設定ごとのロックで直列化します。
+ * ファイルシステム全体の比較は時間がかかるため、ロックはマウントとアンマウントの間だけ取得し、
+ * Comparisonにはマウントさせません。
+ */
+void ComparisonSession::compare()
+{
+    ServiceMetrics::StageTimer timer(ServiceMetrics::Compare);
+
+    m_comparison.reset();
+    unmount();
+    m_changesValid = false;
+    m_stale = false;
+
+    const snapper::Snapshots &snapshots = m_snapper->getSnapshots();
+
+    snapper::Snapshots::const_iterator snapshot1 = snapshots.find(m_number1);
+    snapper::Snapshots::const_iterator snapshot2 = m_number2 == 0 ? m_snapper->getSnapshotCurrent()
+                                                                  : snapshots.find(m_number2);
+
+    if (snapshot1 == snapshots.end() || snapshot2 == snapshots.end()) {
+        throw std::runtime_error("Snapshot not found");
+    }
+
+    mount(*snapshot1, *snapshot2);
+    try {
+        m_comparison = std::make_unique<snapper::Comparison>(m_snapper.get(), snapshot1, snapshot2, false);
+    }
+    catch (...) {
+        unmount();
+        throw;
+    }
+
+    const snapper::Files &files = m_comparison->getFiles();
+    ServiceMetrics::addFiles(std::distance(files.begin(), files.end()));
+}
+
+/**
+ * @brief 比較するスナップショットをマウント
+ *
+ * 現在のシステムはマウントしません。
+ *
+ * @param snapshot1 比較元のスナップショット
+ * @param snapshot2 比較先のスナップショット
+ * @throws snapper::Exception マウントに失敗した場合
+ */
+void ComparisonSession::mount(const snapper::Snapshot &snapshot1, const snapper::Snapshot &snapshot2)
+{
+    QMutexLocker locker(m_mountLock.get());
+
+    if (!snapshot1.isCurrent()) {
+        snapshot1.mountFilesystemSnapshot(false);
+        m_mounted1 = &snapshot1;
+    }
+
+    if (!snapshot2.isCurrent()) {
+        try {
+            snapshot2.mountFilesystemSnapshot(false);
+        }
+        catch (...) {
+            locker.unlock();
+            unmount();
+            throw;
+        }
+        m_mounted2 = &snapshot2;
+    }
+}
+
+/**
+ * @brief マウントしたスナップショットをアンマウント
+ *
+ * アンマウントに失敗しても比較結果には影響しないため、例外は無視します。
+ */
+void ComparisonSession::unmount()
+{
+    QMutexLocker locker(m_mountLock.get());
+
+    for (const snapper::Snapshot **mounted : {&m_mounted2, &m_mounted1}) {
+        if (const snapper::Snapshot *snapshot = std::exchange(*mounted, nullptr)) {
+            try {
+                snapshot->umountFilesystemSnapshot(false);
+            }
+            catch (...) {
+                // 残りのスナップショットのアンマウントを続ける
+            }
+        }
+    }
+}
+
+/**
+ * @brief セッションが指定された比較に対応するかを判定
+ *
+ * @param configName Snapper設定名
+ * @param number1 比較元のスナップショット番号
+ * @param number2 比較先のスナップショット番号
+ * @param owner クライアントのバス名
+ * @return 全て一致する場合true
+ */
+bool ComparisonSession::matches(const QString &configName, int number1, int number2, const QString &owner) const
+{
+    return m_configName == configName && m_number1 == number1 && m_number2 == number2 && m_owner == owner;
+}
+
+/**
+ * @brief セッションが指定されたスナップショットを使用しているかを判定
+ *
+ * @param configName Snapper設定名
+ * @param number スナップショット番号
+ * @return 比較元または比較先が指定されたスナップショットの場合true
+ */
+bool ComparisonSession::involves(const QString &configName, int number) const
+{
+    return m_configName == configName && (m_number1 == number || m_number2 == number);
+}
+
+/**
+ * @brief 比較結果を取得
+ *
+ * 差分表示や復元に使用します。復元後もファイルのパスは変わらないため、
+ * 古くなった比較結果をそのまま返します。
+ *
+ * @return 比較結果
+ */
+snapper::Comparison &ComparisonSession::comparison()
+{
+    return *m_comparison;
+}
+
+/**
+ * @brief ファイル変更一覧を取得
+ *
+ * 一度作成した一覧はキャッシュします。復元によりファイルシステムが
+ * 変化した後は、比較をやり直して一覧を作成し直します。
+ *
+ * @return "ステータス パス"形式のファイル変更一覧
+ * @throws std::runtime_error スナップショットが存在しない場合
+ * @throws snapper::Exception 比較に失敗した場合
+ */
+const QStringList &ComparisonSession::changes()
+{
+    if (m_stale) {
+        compare();
+    }
+
+    if (!m_changesValid) {
+        m_changes = formatChanges(m_comparison->getFiles());
+        m_changesValid = true;
+    }
+
+    return m_changes;
+}
+
+/**
+ * @brief 比較結果が古くなったことを記録
+ *
+ * ファイルの復元後に呼び出します。次回のファイル変更一覧の取得時に比較をやり直します。
+ */
+void ComparisonSession::markStale()
+{
+    m_stale = true;
+}
+
+/**
+ * @brief 最終使用時刻を更新
+ */
+void ComparisonSession::touch()
+{
+    m_lastUsed.restart();
+}
+
+/**
+ * @brief 最後に使用されてからの経過時間を取得
+ *
+ * @return 経過時間 (ミリ秒)
+ */
+qint64 ComparisonSession::idleTime() const
+{
+    return m_lastUsed.elapsed();
+}
+
+/**
+ * @brief ファイル変更のステータスフラグを文字列に変換
+ *
+ * snapper statusと同様の5文字以上の表記 ("+....", "c.p.."など)に変換します。
+ *
+ * @param status snapperのステータスフラグ
+ * @return ステータス文字列
+ */
+QString ComparisonSession::formatChangeStatus(unsigned int status)
+{
+    QString statusStr;
+    if (status & snapper::CREATED) statusStr += "+";
+    if (status & snapper::DELETED) statusStr += "-";
+    if (status & snapper::TYPE) statusStr += "t";
+    if (status & snapper::CONTENT) statusStr += "c";
+    if (status & snapper::PERMISSIONS) statusStr += "p";
+    if (status & snapper::OWNER) statusStr += "u";
+    if (status & snapper::GROUP) statusStr += "g";
+    if (status & snapper::XATTRS) statusStr += "x";
+    if (status & snapper::ACL) statusStr += "a";
+
+    if (statusStr.isEmpty()) statusStr = ".....";
+
+    // パディングして出力フォーマットを整える
+    return statusStr.leftJustified(5, '.');
+}
+
+/**
+ * @brief 比較結果のファイル一覧をファイル変更一覧に変換
+ *
+ * 各要素は "ステータス パス" 形式で、パスの昇順に並びます。
+ *
+ * @param files 比較結果のファイル一覧
+ * @return ファイル変更一覧
+ */
+QStringList ComparisonSession::formatChanges(const snapper::Files &files)
+{
+    QStringList changes;
+    changes.reserve(static_cast<int>(files.size()));
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        const snapper::File &file = *it;
+        changes.append(formatChangeStatus(file.getPreToPostStatus()) + " " +
+                       QString::fromStdString(file.getName()));
+    }
+
+    return changes;
+}
@@ -0,0 +1,79 @@
+#ifndef COMPARISONSESSION_H
+#define COMPARISONSESSION_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <memory>
+
+namespace snapper {
+    class Snapper;
+    class Snapshot;
+    class Comparison;
+    class Files;
+}
+
+/**
+ * @brief 2つのスナップショットの比較結果を保持するクラス
+ *
+ * snapper::Comparisonの作成にはファイルシステム全体の比較とスナップショットの
+ * マウントが必要なため、同じ組み合わせに対する変更一覧の取得、差分表示、
+ * ファイル復元で1つのComparisonを使い回します。
+ * Snapperインスタンスを共有所有するため、サービス側でSnapperが
+ * 再作成されても比較結果は有効なままです。
+ * 複数のスレッドから使用する場合は、使用する間mutex()をロックします。
+ */
+class ComparisonSession
+{
+private:
+    std::shared_ptr<snapper::Snapper> m_snapper;        // 比較に使用するSnapperインスタンス
+    std::unique_ptr<snapper::Comparison> m_comparison;  // 比較結果 (マウントはこのクラスで管理)
+    const snapper::Snapshot *m_mounted1;                // マウントした比較元のスナップショット (未マウントはnullptr)
+    const snapper::Snapshot *m_mounted2;                // マウントした比較先のスナップショット (未マウントはnullptr)
+    QString m_configName;                               // Snapper設定名
+    int m_number1;                                      // 比較元のスナップショット番号
+    int m_number2;                                      // 比較先のスナップショット番号 (0は現在のシステム)
+    QString m_owner;                                    // セッションを開いたクライアントのバス名
+    std::shared_ptr<QMutex> m_mountLock;                // 設定のマウント・アンマウントのロック
+    QMutex m_mutex;                                     // セッションの使用中のロック
+    QStringList m_changes;                              // ファイル変更一覧のキャッシュ
+    bool m_changesValid;                                // ファイル変更一覧のキャッシュが有効な場合true
+    bool m_stale;                                       // 復元によりファイルシステムが変化した場合true
+    QElapsedTimer m_lastUsed;                           // 最後に使用されてからの経過時間
+
+    void compare();
+    void mount(const snapper::Snapshot &snapshot1, const snapper::Snapshot &snapshot2);
+    void unmount();
+
+public:
+    ComparisonSession(std::shared_ptr<snapper::Snapper> snapper, const QString &configName,
+                      int number1, int number2, const QString &owner,
+                      std::shared_ptr<QMutex> mountLock);
+    ~ComparisonSession();
+
+    ComparisonSession(const ComparisonSession &) = delete;
+    ComparisonSession &operator=(const ComparisonSession &) = delete;
+
+    QString configName() const { return m_configName; }
+    int number1() const { return m_number1; }
+    int number2() const { return m_number2; }
+    QString owner() const { return m_owner; }
+
+    bool matches(const QString &configName, int number1, int number2, const QString &owner) const;
+    bool involves(const QString &configName, int number) const;
+
+    QMutex &mutex() { return m_mutex; }
+
+    snapper::Comparison &comparison();
+    const QStringList &changes();
+    void markStale();
+
+    void touch();
+    qint64 idleTime() const;
+
+    static QString formatChangeStatus(unsigned int status);
+    static QStringList formatChanges(const snapper::Files &files);
+};
+
+#endif // COMPARISONSESSION_H
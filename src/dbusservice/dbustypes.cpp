@@ -0,0 +1,277 @@
+#include "dbustypes.h"
+#include <QDBusMetaType>
+
+/**
+ * @brief SnapshotRecordをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param record 書き込むスナップショット情報
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const SnapshotRecord &record)
+{
+    argument.beginStructure();
+    argument << record.number << record.type << record.preNumber << record.date
+             << record.uid << record.cleanup << record.description << record.userdata;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からSnapshotRecordを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param record 読み込み先のスナップショット情報
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, SnapshotRecord &record)
+{
+    argument.beginStructure();
+    argument >> record.number >> record.type >> record.preNumber >> record.date
+             >> record.uid >> record.cleanup >> record.description >> record.userdata;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief DiffHunkをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param hunk 書き込むハンク
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const DiffHunk &hunk)
+{
+    argument.beginStructure();
+    argument << hunk.oldStart << hunk.oldCount << hunk.newStart << hunk.newCount << hunk.lines;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からDiffHunkを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param hunk 読み込み先のハンク
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, DiffHunk &hunk)
+{
+    argument.beginStructure();
+    argument >> hunk.oldStart >> hunk.oldCount >> hunk.newStart >> hunk.newCount >> hunk.lines;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief DeletionResultをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param result 書き込む削除結果
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const DeletionResult &result)
+{
+    argument.beginStructure();
+    argument << result.number << result.success << result.error;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からDeletionResultを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param result 読み込み先の削除結果
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, DeletionResult &result)
+{
+    argument.beginStructure();
+    argument >> result.number >> result.success >> result.error;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief SnapshotSizeをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param size 書き込む使用量
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const SnapshotSize &size)
+{
+    argument.beginStructure();
+    argument << size.number << size.referenced << size.exclusive;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からSnapshotSizeを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param size 読み込み先の使用量
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, SnapshotSize &size)
+{
+    argument.beginStructure();
+    argument >> size.number >> size.referenced >> size.exclusive;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief ChangeNodeをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param node 書き込むノード
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const ChangeNode &node)
+{
+    argument.beginStructure();
+    argument << node.name << node.status << node.hasChildren << node.created << node.modified << node.deleted;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からChangeNodeを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param node 読み込み先のノード
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, ChangeNode &node)
+{
+    argument.beginStructure();
+    argument >> node.name >> node.status >> node.hasChildren >> node.created >> node.modified >> node.deleted;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief HistogramBucketをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param bucket 書き込むバケット
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const HistogramBucket &bucket)
+{
+    argument.beginStructure();
+    argument << bucket.value << bucket.count;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からHistogramBucketを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param bucket 読み込み先のバケット
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, HistogramBucket &bucket)
+{
+    argument.beginStructure();
+    argument >> bucket.value >> bucket.count;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief StageStatsをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param stats 書き込む所要時間
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const StageStats &stats)
+{
+    argument.beginStructure();
+    argument << stats.stage << stats.count << stats.sum << stats.max
+             << stats.p50 << stats.p90 << stats.p99 << stats.buckets;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からStageStatsを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param stats 読み込み先の所要時間
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, StageStats &stats)
+{
+    argument.beginStructure();
+    argument >> stats.stage >> stats.count >> stats.sum >> stats.max
+             >> stats.p50 >> stats.p90 >> stats.p99 >> stats.buckets;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief MethodStatsをD-Bus引数に書き込む
+ *
+ * @param argument 書き込み先のD-Bus引数
+ * @param stats 書き込む統計
+ * @return 書き込み後のD-Bus引数
+ */
+QDBusArgument &operator<<(QDBusArgument &argument, const MethodStats &stats)
+{
+    argument.beginStructure();
+    argument << stats.method << stats.calls << stats.errors << stats.bytesReturned
+             << stats.filesCompared << stats.undoSteps << stats.stages;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus引数からMethodStatsを読み込む
+ *
+ * @param argument 読み込み元のD-Bus引数
+ * @param stats 読み込み先の統計
+ * @return 読み込み後のD-Bus引数
+ */
+const QDBusArgument &operator>>(const QDBusArgument &argument, MethodStats &stats)
+{
+    argument.beginStructure();
+    argument >> stats.method >> stats.calls >> stats.errors >> stats.bytesReturned
+             >> stats.filesCompared >> stats.undoSteps >> stats.stages;
+    argument.endStructure();
+    return argument;
+}
+
+/**
+ * @brief D-Bus用のカスタム型を登録
+ *
+ * オブジェクトをD-Busに登録する前に呼び出す必要があります。
+ * 未登録の型を返すスロットはエクスポートされません。
+ */
+void registerDBusTypes()
+{
+    qDBusRegisterMetaType<SnapshotRecord>();
+    qDBusRegisterMetaType<QList<SnapshotRecord>>();
+    qDBusRegisterMetaType<DiffHunk>();
+    qDBusRegisterMetaType<QList<DiffHunk>>();
+    qDBusRegisterMetaType<DeletionResult>();
+    qDBusRegisterMetaType<QList<DeletionResult>>();
+    qDBusRegisterMetaType<SnapshotSize>();
+    qDBusRegisterMetaType<QList<SnapshotSize>>();
+    qDBusRegisterMetaType<ChangeNode>();
+    qDBusRegisterMetaType<QList<ChangeNode>>();
+    qDBusRegisterMetaType<HistogramBucket>();
+    qDBusRegisterMetaType<QList<HistogramBucket>>();
+    qDBusRegisterMetaType<StageStats>();
+    qDBusRegisterMetaType<QList<StageStats>>();
+    qDBusRegisterMetaType<MethodStats>();
+    qDBusRegisterMetaType<QList<MethodStats>>();
+
+    // PolicyKitのCheckAuthorizationの引数 (a{ss})
+    qDBusRegisterMetaType<QMap<QString, QString>>();
+}
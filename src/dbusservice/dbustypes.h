@@ -0,0 +1,176 @@
+#ifndef DBUSTYPES_H
+#define DBUSTYPES_H
+
+#include <QDBusArgument>
+#include <QList>
+#include <QMap>
+#include <QMetaType>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief D-Bus経由で送信するスナップショット情報
+ *
+ * D-Bus型シグネチャ "(iiixussa{ss})" に対応します。
+ * typeはsnapper::SnapshotTypeの値 (0: single, 1: pre, 2: post)、
+ * dateはUNIX時刻 (秒) です。
+ */
+struct SnapshotRecord
+{
+    int number = 0;                         // スナップショット番号
+    int type = 0;                           // スナップショットタイプ
+    int preNumber = 0;                      // 対応するPreスナップショット番号
+    qint64 date = 0;                        // 作成日時 (UNIX時刻)
+    uint uid = 0;                           // 作成ユーザーのUID
+    QString cleanup;                        // クリーンアップアルゴリズム名
+    QString description;                    // 説明文
+    QMap<QString, QString> userdata;        // ユーザーデータ
+};
+
+Q_DECLARE_METATYPE(SnapshotRecord)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const SnapshotRecord &record);
+const QDBusArgument &operator>>(const QDBusArgument &argument, SnapshotRecord &record);
+
+/**
+ * @brief D-Bus経由で送信する差分のハンク
+ *
+ * D-Bus型シグネチャ "(iiiias)" に対応します。
+ * 開始行と行数はunified diffのハンク見出しと同じ表記です。
+ * 各行の先頭には ' ' (共通)、'-' (削除)、'+' (追加)、'\' (注記)が付きます。
+ */
+struct DiffHunk
+{
+    int oldStart = 0;                       // 比較元の開始行
+    int oldCount = 0;                       // 比較元の行数
+    int newStart = 0;                       // 比較先の開始行
+    int newCount = 0;                       // 比較先の行数
+    QStringList lines;                      // ハンクの行 (改行を含まない)
+};
+
+Q_DECLARE_METATYPE(DiffHunk)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const DiffHunk &hunk);
+const QDBusArgument &operator>>(const QDBusArgument &argument, DiffHunk &hunk);
+
+/**
+ * @brief D-Bus経由で送信するスナップショット削除の結果
+ *
+ * D-Bus型シグネチャ "(ibs)" に対応します。
+ */
+struct DeletionResult
+{
+    int number = 0;                         // スナップショット番号
+    bool success = false;                   // 削除に成功した場合true
+    QString error;                          // 失敗時のエラーメッセージ
+};
+
+Q_DECLARE_METATYPE(DeletionResult)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const DeletionResult &result);
+const QDBusArgument &operator>>(const QDBusArgument &argument, DeletionResult &result);
+
+/**
+ * @brief D-Bus経由で送信するスナップショットの使用量
+ *
+ * D-Bus型シグネチャ "(ixx)" に対応します。
+ * 使用量を取得できない場合 (btrfs以外、クォータが無効)は-1です。
+ */
+struct SnapshotSize
+{
+    int number = 0;                         // スナップショット番号
+    qint64 referenced = -1;                 // 参照しているデータ量 (バイト)
+    qint64 exclusive = -1;                  // このスナップショットだけが参照しているデータ量 (バイト)
+};
+
+Q_DECLARE_METATYPE(SnapshotSize)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const SnapshotSize &size);
+const QDBusArgument &operator>>(const QDBusArgument &argument, SnapshotSize &size);
+
+/**
+ * @brief D-Bus経由で送信するファイル変更ツリーのノード
+ *
+ * D-Bus型シグネチャ "(ssbiii)" に対応します。
+ * 変更されたエントリの祖先として存在するだけのディレクトリはstatusが空文字列です。
+ * 件数はノード自体を含むサブツリー全体の変更数です。
+ */
+struct ChangeNode
+{
+    QString name;                           // エントリ名
+    QString status;                         // ステータス ("+...."など、変更がない場合は空文字列)
+    bool hasChildren = false;               // 子孫に変更がある場合true
+    int created = 0;                        // 作成されたエントリ数
+    int modified = 0;                       // 変更されたエントリ数
+    int deleted = 0;                        // 削除されたエントリ数
+};
+
+Q_DECLARE_METATYPE(ChangeNode)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const ChangeNode &node);
+const QDBusArgument &operator>>(const QDBusArgument &argument, ChangeNode &node);
+
+/**
+ * @brief D-Bus経由で送信するヒストグラムのバケット
+ *
+ * D-Bus型シグネチャ "(tt)" に対応します。
+ */
+struct HistogramBucket
+{
+    qulonglong value = 0;                   // バケットに含まれる最大の値 (マイクロ秒)
+    qulonglong count = 0;                   // 記録数
+};
+
+Q_DECLARE_METATYPE(HistogramBucket)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const HistogramBucket &bucket);
+const QDBusArgument &operator>>(const QDBusArgument &argument, HistogramBucket &bucket);
+
+/**
+ * @brief D-Bus経由で送信する処理段階ごとの所要時間
+ *
+ * D-Bus型シグネチャ "(stttttta(tt))" に対応します。時間の単位はマイクロ秒です。
+ * bucketsは複数のサービスの分布を合算するための生のヒストグラムです。
+ */
+struct StageStats
+{
+    QString stage;                          // 処理段階 ("auth", "queue", "snapper", "compare", "serialize", "total")
+    qulonglong count = 0;                   // 記録数
+    qulonglong sum = 0;                     // 合計
+    qulonglong max = 0;                     // 最大値
+    qulonglong p50 = 0;                     // 50パーセンタイル
+    qulonglong p90 = 0;                     // 90パーセンタイル
+    qulonglong p99 = 0;                     // 99パーセンタイル
+    QList<HistogramBucket> buckets;         // 記録のあるバケット (値の昇順)
+};
+
+Q_DECLARE_METATYPE(StageStats)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const StageStats &stats);
+const QDBusArgument &operator>>(const QDBusArgument &argument, StageStats &stats);
+
+/**
+ * @brief D-Bus経由で送信するメソッドごとの統計
+ *
+ * D-Bus型シグネチャ "(sttttta(stttttta(tt)))" に対応します。
+ * 値はサービスの起動時からの累計です。
+ */
+struct MethodStats
+{
+    QString method;                         // メソッド名 (バックグラウンドの復元ジョブは"RestoreJob")
+    qulonglong calls = 0;                   // 呼び出し回数
+    qulonglong errors = 0;                  // エラー応答を返した回数
+    qulonglong bytesReturned = 0;           // 返したファイル変更一覧と差分の量 (バイト)
+    qulonglong filesCompared = 0;           // 比較で検出したファイル変更の数
+    qulonglong undoSteps = 0;               // 実行した復元ステップの数
+    QList<StageStats> stages;               // 処理段階ごとの所要時間 (記録のある段階のみ)
+};
+
+Q_DECLARE_METATYPE(MethodStats)
+
+QDBusArgument &operator<<(QDBusArgument &argument, const MethodStats &stats);
+const QDBusArgument &operator>>(const QDBusArgument &argument, MethodStats &stats);
+
+void registerDBusTypes();
+
+#endif // DBUSTYPES_H
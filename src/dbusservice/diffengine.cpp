@@ -0,0 +1,814 @@
+#include "diffengine.h"
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief 比較範囲の中央のスネークを探す
+ *
+ * Myersの線形空間アルゴリズムにより、編集距離が最小となる経路の
+ * 中央付近の分割点を求めます。前方と後方から同時に探索し、
+ * 経路が重なった位置で分割します。
+ *
+ * 編集距離がtooExpensiveを超えた場合は、GNU diffのヒューリスティックと同様に
+ * 前方の探索で最も先に進んだ位置で分割し、最小でない差分を許容します。
+ * 探索した対角線と一致した行の数をbudgetから差し引き、使い切った場合は分割を諦めます。
+ *
+ * @param a 比較元の行ID
+ * @param n 比較元の行数
+ * @param b 比較先の行ID
+ * @param m 比較先の行数
+ * @param tooExpensive 最小の差分を探す編集距離の上限
+ * @param budget 残りの探索量 (入出力)
+ * @param splitA 比較元の分割位置 (出力)
+ * @param splitB 比較先の分割位置 (出力)
+ * @return 分割点が見つかった場合true
+ */
+static bool bisect(const int *a, int n, const int *b, int m, int tooExpensive, qint64 &budget,
+                   int &splitA, int &splitB)
+{
+    const int maxD = (n + m + 1) / 2;
+    const int vOffset = maxD;
+    const int vLength = 2 * maxD + 2;
+
+    std::vector<int> v1(vLength, -1);
+    std::vector<int> v2(vLength, -1);
+    v1[vOffset + 1] = 0;
+    v2[vOffset + 1] = 0;
+
+    const int delta = n - m;
+    const bool front = (delta % 2 != 0);    // 前方の探索で重なりを確認する場合true
+
+    // 範囲外に出た対角線を次回から探索しないための境界
+    int k1Start = 0;
+    int k1End = 0;
+    int k2Start = 0;
+    int k2End = 0;
+
+    for (int d = 0; d < maxD; ++d) {
+        // 前方の探索
+        for (int k1 = -d + k1Start; k1 <= d - k1End; k1 += 2) {
+            const int k1Offset = vOffset + k1;
+            int x1;
+            if (k1 == -d || (k1 != d && v1[k1Offset - 1] < v1[k1Offset + 1])) {
+                x1 = v1[k1Offset + 1];
+            }
+            else {
+                x1 = v1[k1Offset - 1] + 1;
+            }
+            int y1 = x1 - k1;
+            const int snakeStart1 = x1;
+            while (x1 < n && y1 < m && a[x1] == b[y1]) {
+                ++x1;
+                ++y1;
+            }
+            v1[k1Offset] = x1;
+            budget -= 1 + (x1 - snakeStart1);
+
+            if (x1 > n) {
+                k1End += 2;
+            }
+            else if (y1 > m) {
+                k1Start += 2;
+            }
+            else if (front) {
+                const int k2Offset = vOffset + delta - k1;
+                if (k2Offset >= 0 && k2Offset < vLength && v2[k2Offset] != -1) {
+                    const int x2 = n - v2[k2Offset];
+                    if (x1 >= x2) {
+                        splitA = x1;
+                        splitB = y1;
+                        return true;
+                    }
+                }
+            }
+        }
+
+        // 後方の探索
+        for (int k2 = -d + k2Start; k2 <= d - k2End; k2 += 2) {
+            const int k2Offset = vOffset + k2;
+            int x2;
+            if (k2 == -d || (k2 != d && v2[k2Offset - 1] < v2[k2Offset + 1])) {
+                x2 = v2[k2Offset + 1];
+            }
+            else {
+                x2 = v2[k2Offset - 1] + 1;
+            }
+            int y2 = x2 - k2;
+            const int snakeStart2 = x2;
+            while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                ++x2;
+                ++y2;
+            }
+            v2[k2Offset] = x2;
+            budget -= 1 + (x2 - snakeStart2);
+
+            if (x2 > n) {
+                k2End += 2;
+            }
+            else if (y2 > m) {
+                k2Start += 2;
+            }
+            else if (!front) {
+                const int k1Offset = vOffset + delta - k2;
+                if (k1Offset >= 0 && k1Offset < vLength && v1[k1Offset] != -1) {
+                    const int x1 = v1[k1Offset];
+                    const int y1 = vOffset + x1 - k1Offset;
+                    if (x1 >= n - x2) {
+                        splitA = x1;
+                        splitB = y1;
+                        return true;
+                    }
+                }
+            }
+        }
+
+        if (budget <= 0) {
+            return false;
+        }
+
+        // 編集距離が大きい場合は、前方の探索で最も先に進んだ対角線で分割する
+        if (d >= tooExpensive) {
+            int best = -1;
+            for (int k1 = -d + k1Start; k1 <= d - k1End; k1 += 2) {
+                const int x1 = v1[vOffset + k1];
+                const int y1 = x1 - k1;
+                if (x1 >= 0 && x1 <= n && y1 >= 0 && y1 <= m && x1 + y1 > best) {
+                    best = x1 + y1;
+                    splitA = x1;
+                    splitB = y1;
+                }
+            }
+            return best > 0;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Inputのデストラクタ
+ *
+ * マップを解除してファイルを閉じます。
+ */
+DiffEngine::Input::~Input()
+{
+    if (data) {
+        munmap(const_cast<char *>(data), static_cast<size_t>(size));
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/**
+ * @brief 比較対象のファイルを開く
+ *
+ * 存在しないファイルは空のファイルとして扱います (diff -Nと同様)。
+ * 通常ファイル以外 (ディレクトリ、シンボリックリンク、FIFO、デバイスなど)は
+ * 開かずに内容を比較しません。FIFOやデバイスを開いて読み込みが止まらないよう、
+ * lstatで確認してから、シンボリックリンクをたどらず非ブロッキングで開きます。
+ *
+ * @param filePath ファイルパス
+ * @param error エラーメッセージ (出力)
+ * @return 成功時true
+ */
+bool DiffEngine::Input::open(const QString &filePath, QString &error)
+{
+    path = filePath;
+
+    const QByteArray encodedPath = QFile::encodeName(filePath);
+    if (lstat(encodedPath.constData(), &status) < 0) {
+        if (errno == ENOENT) {
+            exists = false;
+            return true;
+        }
+        error = QString("Failed to stat %1: %2").arg(filePath, strerror(errno));
+        return false;
+    }
+
+    exists = true;
+    if (!S_ISREG(status.st_mode)) {
+        size = 0;
+        return true;
+    }
+
+    fd = ::open(encodedPath.constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            exists = false;
+            return true;
+        }
+        error = QString("Failed to open %1: %2").arg(filePath, strerror(errno));
+        return false;
+    }
+
+    // lstatの後に置き換えられた場合に備えて、開いたファイルを確認し直す
+    if (fstat(fd, &status) < 0) {
+        error = QString("Failed to stat %1: %2").arg(filePath, strerror(errno));
+        return false;
+    }
+
+    if (!S_ISREG(status.st_mode)) {
+        close(fd);
+        fd = -1;
+        size = 0;
+        return true;
+    }
+
+    size = status.st_size;
+
+    return true;
+}
+
+/**
+ * @brief ファイルの内容をマップ
+ *
+ * @param error エラーメッセージ (出力)
+ * @return 成功時true
+ */
+bool DiffEngine::Input::map(QString &error)
+{
+    if (data || size == 0) {
+        return true;
+    }
+
+    void *mapped = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        error = QString("Failed to map %1: %2").arg(path, strerror(errno));
+        return false;
+    }
+
+    madvise(mapped, static_cast<size_t>(size), MADV_SEQUENTIAL);
+    data = static_cast<const char *>(mapped);
+
+    return true;
+}
+
+/**
+ * @brief バイナリファイルかを判定
+ *
+ * diffコマンドと同様に、先頭にNUL文字が含まれる場合はバイナリとみなします。
+ *
+ * @return バイナリファイルの場合true
+ */
+bool DiffEngine::Input::isBinary() const
+{
+    if (!data) {
+        return false;
+    }
+
+    return memchr(data, '\0', static_cast<size_t>(qMin(size, BinaryCheckSize))) != nullptr;
+}
+
+/**
+ * @brief ファイルの内容を行に分割
+ *
+ * 各行は末尾の改行を含むため、最終行に改行がないファイルとの違いも検出できます。
+ */
+void DiffEngine::Input::splitLines()
+{
+    lines.clear();
+
+    const char *pos = data;
+    const char *end = data + size;
+    while (pos < end) {
+        const char *newline = static_cast<const char *>(memchr(pos, '\n', static_cast<size_t>(end - pos)));
+        const char *next = newline ? newline + 1 : end;
+        lines.append(QByteArrayView(pos, next - pos));
+        pos = next;
+    }
+}
+
+/**
+ * @brief unified diffのヘッダに表示するラベルを作成
+ *
+ * diff -uと同じく、パスと更新日時 (ナノ秒とタイムゾーンを含む)を表示します。
+ *
+ * @return ラベル
+ */
+QByteArray DiffEngine::Input::label() const
+{
+    qint64 seconds = 0;
+    long nanoseconds = 0;
+    if (exists) {
+        seconds = status.st_mtim.tv_sec;
+        nanoseconds = status.st_mtim.tv_nsec;
+    }
+
+    const QDateTime modified = QDateTime::fromSecsSinceEpoch(seconds);
+    const int offset = modified.offsetFromUtc() / 60;
+
+    return QFile::encodeName(path) + '\t'
+         + modified.toString("yyyy-MM-dd HH:mm:ss").toLatin1()
+         + '.' + QByteArray::number(static_cast<qlonglong>(nanoseconds)).rightJustified(9, '0')
+         + ' ' + (offset < 0 ? '-' : '+')
+         + QByteArray::number(qAbs(offset) / 60).rightJustified(2, '0')
+         + QByteArray::number(qAbs(offset) % 60).rightJustified(2, '0');
+}
+
+/**
+ * @brief 2つのファイルが全てのエクステントを共有しているかを判定
+ *
+ * btrfsのスナップショットでは、変更されていないファイルは元のファイルと
+ * 同じエクステントを参照します。全てのエクステントの論理位置、物理位置、
+ * 長さが一致すれば、内容を読まずに同一と判定できます。
+ * 未書き込みのデータを反映させるため、FIEMAP_FLAG_SYNCを指定します。
+ *
+ * @param fd1 比較元のファイルディスクリプタ
+ * @param fd2 比較先のファイルディスクリプタ
+ * @return 全てのエクステントが一致する場合true、判定できない場合もfalse
+ */
+bool DiffEngine::sameExtents(int fd1, int fd2)
+{
+    const size_t bufferSize = sizeof(struct fiemap) + MaxCompareExtents * sizeof(struct fiemap_extent);
+
+    auto readExtents = [bufferSize](int fd, std::vector<char> &buffer) -> struct fiemap * {
+        buffer.assign(bufferSize, 0);
+        auto *map = reinterpret_cast<struct fiemap *>(buffer.data());
+        map->fm_start = 0;
+        map->fm_length = FIEMAP_MAX_OFFSET;
+        map->fm_flags = FIEMAP_FLAG_SYNC;
+        map->fm_extent_count = MaxCompareExtents;
+
+        if (ioctl(fd, FS_IOC_FIEMAP, map) < 0 || map->fm_mapped_extents == 0) {
+            return nullptr;
+        }
+
+        // エクステントが多すぎて全てを取得できなかった
+        if (!(map->fm_extents[map->fm_mapped_extents - 1].fe_flags & FIEMAP_EXTENT_LAST)) {
+            return nullptr;
+        }
+
+        // 位置を比較できないエクステントを含む
+        constexpr __u32 unreliable = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC
+                                   | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED;
+        for (__u32 i = 0; i < map->fm_mapped_extents; ++i) {
+            if (map->fm_extents[i].fe_flags & unreliable) {
+                return nullptr;
+            }
+        }
+
+        return map;
+    };
+
+    std::vector<char> buffer1;
+    std::vector<char> buffer2;
+    const struct fiemap *map1 = readExtents(fd1, buffer1);
+    const struct fiemap *map2 = readExtents(fd2, buffer2);
+
+    if (!map1 || !map2 || map1->fm_mapped_extents != map2->fm_mapped_extents) {
+        return false;
+    }
+
+    for (__u32 i = 0; i < map1->fm_mapped_extents; ++i) {
+        const struct fiemap_extent &extent1 = map1->fm_extents[i];
+        const struct fiemap_extent &extent2 = map2->fm_extents[i];
+        if (extent1.fe_logical != extent2.fe_logical || extent1.fe_physical != extent2.fe_physical
+            || extent1.fe_length != extent2.fe_length) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief 2つのファイルを比較
+ *
+ * 内容を読まずに判定できる場合 (同じinode、共有エクステント)は
+ * ファイルをマップしません。
+ * 内容を比較するファイルのどちらかがmaxSizeを超える場合は、マップせずにTooLargeを返します。
+ *
+ * @param oldPath 比較元のファイルパス
+ * @param newPath 比較先のファイルパス
+ * @param maxSize 内容を比較するファイルサイズの上限 (MaxCompareSizeを超える値はMaxCompareSize)
+ * @return 比較結果
+ * @throws std::runtime_error ファイルを読み込めない場合
+ */
+DiffEngine::Result DiffEngine::compare(const QString &oldPath, const QString &newPath, qint64 maxSize)
+{
+    QString error;
+    if (!m_old.open(oldPath, error) || !m_new.open(newPath, error)) {
+        throw std::runtime_error(error.toStdString());
+    }
+
+    m_changes.clear();
+    m_result = Result::Identical;
+
+    if (!m_old.exists && !m_new.exists) {
+        return m_result;
+    }
+
+    if (m_old.exists && m_new.exists) {
+        if (m_old.status.st_dev == m_new.status.st_dev && m_old.status.st_ino == m_new.status.st_ino) {
+            return m_result;
+        }
+
+        if (m_old.size == m_new.size && (m_old.size == 0 || sameExtents(m_old.fd, m_new.fd))) {
+            return m_result;
+        }
+    }
+
+    // 大きなファイルはマップせず、比較できないことだけを返す
+    const qint64 limit = qMin(maxSize, MaxCompareSize);
+    if (m_old.size > limit || m_new.size > limit) {
+        m_result = Result::TooLarge;
+        return m_result;
+    }
+
+    if (!m_old.map(error) || !m_new.map(error)) {
+        throw std::runtime_error(error.toStdString());
+    }
+
+    const bool sameContent = m_old.size == m_new.size
+                             && memcmp(m_old.data, m_new.data, static_cast<size_t>(m_old.size)) == 0;
+    if (sameContent) {
+        return m_result;
+    }
+
+    // バイナリファイルは先頭のブロックだけで判定し、行に分割しない
+    if (m_old.isBinary() || m_new.isBinary()) {
+        m_result = Result::Binary;
+        return m_result;
+    }
+
+    m_old.splitLines();
+    m_new.splitLines();
+    computeChanges();
+    collectChanges();
+
+    m_result = m_changes.isEmpty() ? Result::Identical : Result::Different;
+    return m_result;
+}
+
+/**
+ * @brief 削除・追加された行を求める
+ *
+ * 各行を整数IDに変換してから、共通の先頭と末尾を除いた範囲を
+ * 中央のスネークで再帰的に分割します (スタックを使い反復で処理します)。
+ * 大きく異なるファイルでも時間がかからないよう、探索量に上限を設けます
+ * (上限に達した場合の差分は正しいものの、最小とは限りません)。
+ */
+void DiffEngine::computeChanges()
+{
+    const int n = static_cast<int>(m_old.lines.size());
+    const int m = static_cast<int>(m_new.lines.size());
+
+    // 同じ内容の行に同じIDを割り当てる
+    QHash<QByteArrayView, int> ids;
+    ids.reserve(n + m);
+    auto intern = [&ids](QByteArrayView line) {
+        auto it = ids.constFind(line);
+        if (it == ids.constEnd()) {
+            it = ids.insert(line, static_cast<int>(ids.size()));
+        }
+        return it.value();
+    };
+
+    std::vector<int> a;
+    std::vector<int> b;
+    a.reserve(n);
+    b.reserve(m);
+    for (QByteArrayView line : std::as_const(m_old.lines)) {
+        a.push_back(intern(line));
+    }
+    for (QByteArrayView line : std::as_const(m_new.lines)) {
+        b.push_back(intern(line));
+    }
+
+    m_oldChanged.assign(n, false);
+    m_newChanged.assign(m, false);
+
+    struct Range {
+        int aBegin;
+        int aEnd;
+        int bBegin;
+        int bEnd;
+    };
+
+    // GNU diffと同様に、最小の差分を探す編集距離の上限を行数の平方根程度にする
+    int tooExpensive = 1;
+    for (qint64 diagonals = static_cast<qint64>(n) + m + 3; diagonals != 0; diagonals >>= 2) {
+        tooExpensive <<= 1;
+    }
+    tooExpensive = qMax(MinTooExpensive, tooExpensive);
+
+    qint64 budget = MaxDiffCost;
+
+    std::vector<Range> stack;
+    stack.push_back({0, n, 0, m});
+
+    while (!stack.empty()) {
+        Range range = stack.back();
+        stack.pop_back();
+
+        // 共通の先頭と末尾を除く
+        while (range.aBegin < range.aEnd && range.bBegin < range.bEnd && a[range.aBegin] == b[range.bBegin]) {
+            ++range.aBegin;
+            ++range.bBegin;
+        }
+        while (range.aBegin < range.aEnd && range.bBegin < range.bEnd && a[range.aEnd - 1] == b[range.bEnd - 1]) {
+            --range.aEnd;
+            --range.bEnd;
+        }
+
+        if (range.aBegin == range.aEnd || range.bBegin == range.bEnd) {
+            std::fill(m_oldChanged.begin() + range.aBegin, m_oldChanged.begin() + range.aEnd, true);
+            std::fill(m_newChanged.begin() + range.bBegin, m_newChanged.begin() + range.bEnd, true);
+            continue;
+        }
+
+        // 探索量を使い切った後は、残りの範囲を分割せずに全て置き換える
+        int splitA = 0;
+        int splitB = 0;
+        const bool found = budget > 0
+                           && bisect(a.data() + range.aBegin, range.aEnd - range.aBegin,
+                                     b.data() + range.bBegin, range.bEnd - range.bBegin,
+                                     tooExpensive, budget, splitA, splitB);
+        splitA += range.aBegin;
+        splitB += range.bBegin;
+
+        // 共通部分がない、または分割しても範囲が小さくならない場合は全て置き換える
+        if (!found || (splitA == range.aBegin && splitB == range.bBegin)
+            || (splitA == range.aEnd && splitB == range.bEnd)) {
+            std::fill(m_oldChanged.begin() + range.aBegin, m_oldChanged.begin() + range.aEnd, true);
+            std::fill(m_newChanged.begin() + range.bBegin, m_newChanged.begin() + range.bEnd, true);
+            continue;
+        }
+
+        stack.push_back({splitA, range.aEnd, splitB, range.bEnd});
+        stack.push_back({range.aBegin, splitA, range.bBegin, splitB});
+    }
+}
+
+/**
+ * @brief 削除・追加された行を連続する変更にまとめる
+ */
+void DiffEngine::collectChanges()
+{
+    const int n = static_cast<int>(m_oldChanged.size());
+    const int m = static_cast<int>(m_newChanged.size());
+
+    m_changes.clear();
+
+    int i = 0;
+    int j = 0;
+    while (i < n || j < m) {
+        if (i < n && j < m && !m_oldChanged[i] && !m_newChanged[j]) {
+            ++i;
+            ++j;
+            continue;
+        }
+
+        Change change {i, 0, j, 0};
+        while (i < n && m_oldChanged[i]) {
+            ++i;
+            ++change.oldCount;
+        }
+        while (j < m && m_newChanged[j]) {
+            ++j;
+            ++change.newCount;
+        }
+
+        if (change.oldCount == 0 && change.newCount == 0) {
+            break;  // 変更されていない行数が一致しない (起こらない)
+        }
+
+        m_changes.append(change);
+    }
+}
+
+/**
+ * @brief 変更を前後の表示範囲が重なるものごとにハンクへまとめる
+ *
+ * @param contextLines 変更の前後に表示する行数
+ * @return ハンクごとの変更と表示範囲
+ */
+QList<DiffEngine::HunkRange> DiffEngine::hunkRanges(int contextLines) const
+{
+    const int context = qMax(0, contextLines);
+    const int oldLines = static_cast<int>(m_old.lines.size());
+
+    QList<HunkRange> ranges;
+
+    qsizetype first = 0;
+    while (first < m_changes.size()) {
+        qsizetype last = first;
+        while (last + 1 < m_changes.size()) {
+            const Change &current = m_changes.at(last);
+            if (m_changes.at(last + 1).oldIndex - (current.oldIndex + current.oldCount) > 2 * context) {
+                break;
+            }
+            ++last;
+        }
+
+        const Change &head = m_changes.at(first);
+        const Change &tail = m_changes.at(last);
+
+        HunkRange range;
+        range.first = first;
+        range.last = last;
+        range.oldStart = qMax(0, head.oldIndex - context);
+        range.newStart = head.newIndex - (head.oldIndex - range.oldStart);
+        range.oldEnd = qMin(oldLines, tail.oldIndex + tail.oldCount + context);
+        range.newEnd = tail.newIndex + tail.newCount + (range.oldEnd - (tail.oldIndex + tail.oldCount));
+        ranges.append(range);
+
+        first = last + 1;
+    }
+
+    return ranges;
+}
+
+/**
+ * @brief 差分の1行を出力
+ *
+ * 改行で終わらない行には、diffコマンドと同じ注記を付けます。
+ *
+ * @param out 出力先
+ * @param prefix 行頭の記号 (' ', '-', '+')
+ * @param line 行 (末尾の改行を含む)
+ */
+void DiffEngine::appendLine(QByteArray &out, char prefix, QByteArrayView line)
+{
+    out.append(prefix);
+    out.append(line);
+    if (!line.endsWith('\n')) {
+        out.append('\n');
+        out.append(NoNewlineMarker);
+        out.append('\n');
+    }
+}
+
+/**
+ * @brief ハンク見出しの行範囲を整形
+ *
+ * @param index 開始行 (0始まり)
+ * @param count 行数
+ * @return "開始行,行数"形式の文字列 (行数が1の場合は開始行のみ)
+ */
+QByteArray DiffEngine::formatRange(int index, int count)
+{
+    if (count == 1) {
+        return QByteArray::number(index + 1);
+    }
+
+    // 行数が0の場合は直前の行番号を示す
+    return QByteArray::number(count == 0 ? index : index + 1) + ',' + QByteArray::number(count);
+}
+
+/**
+ * @brief 比較結果をunified diff形式で出力
+ *
+ * @param contextLines 変更の前後に表示する行数
+ * @return unified diff形式の差分、同一の場合は空
+ */
+QByteArray DiffEngine::unified(int contextLines) const
+{
+    if (m_result == Result::Identical) {
+        return QByteArray();
+    }
+
+    if (m_result == Result::Binary) {
+        return "Binary files " + QFile::encodeName(m_old.path) + " and "
+             + QFile::encodeName(m_new.path) + " differ\n";
+    }
+
+    if (m_result == Result::TooLarge) {
+        return "Files " + QFile::encodeName(m_old.path) + " and "
+             + QFile::encodeName(m_new.path) + " are too large to compare\n";
+    }
+
+    QByteArray out;
+    out.append("--- " + m_old.label() + '\n');
+    out.append("+++ " + m_new.label() + '\n');
+
+    const QList<HunkRange> ranges = hunkRanges(contextLines);
+    for (const HunkRange &range : ranges) {
+        out.append("@@ -" + formatRange(range.oldStart, range.oldEnd - range.oldStart)
+                   + " +" + formatRange(range.newStart, range.newEnd - range.newStart) + " @@\n");
+
+        int position = range.oldStart;
+        for (qsizetype index = range.first; index <= range.last; ++index) {
+            const Change &change = m_changes.at(index);
+            for (; position < change.oldIndex; ++position) {
+                appendLine(out, ' ', m_old.lines.at(position));
+            }
+            for (int i = 0; i < change.oldCount; ++i) {
+                appendLine(out, '-', m_old.lines.at(change.oldIndex + i));
+            }
+            for (int i = 0; i < change.newCount; ++i) {
+                appendLine(out, '+', m_new.lines.at(change.newIndex + i));
+            }
+            position = change.oldIndex + change.oldCount;
+        }
+        for (; position < range.oldEnd; ++position) {
+            appendLine(out, ' ', m_old.lines.at(position));
+        }
+    }
+
+    return out;
+}
+
+/**
+ * @brief 比較結果を上限付きのハンクの一覧で出力
+ *
+ * 行数またはバイト数の上限に達した時点で出力を打ち切ります。
+ * 打ち切ったハンクの行数は、実際に含まれる行から計算し直します。
+ *
+ * @param contextLines 変更の前後に表示する行数
+ * @param maxLines 出力する最大行数
+ * @param maxBytes 出力する最大バイト数 (UTF-8)
+ * @param truncated 上限により打ち切った場合、またはファイルが大きすぎて比較していない場合true (出力)
+ * @return ハンクの一覧、同一、バイナリ、または大きすぎる場合は空
+ */
+QList<DiffEngine::Hunk> DiffEngine::hunks(int contextLines, qint64 maxLines, qint64 maxBytes,
+                                          bool &truncated) const
+{
+    truncated = false;
+
+    QList<Hunk> result;
+    if (m_result == Result::TooLarge) {
+        truncated = true;
+        return result;
+    }
+    if (m_result != Result::Different) {
+        return result;
+    }
+
+    qint64 lineBudget = maxLines;
+    qint64 byteBudget = maxBytes;
+
+    // 上限内であれば行を追加し、追加できない場合はfalseを返す
+    auto addLine = [&](Hunk &hunk, char prefix, QByteArrayView line) {
+        const bool missingNewline = !line.endsWith('\n');
+        const QByteArrayView text = missingNewline ? line : line.chopped(1);
+        const qint64 lines = missingNewline ? 2 : 1;
+        if (lineBudget < lines || byteBudget < text.size() + 1) {
+            truncated = true;
+            return false;
+        }
+
+        hunk.lines.append(QChar(prefix) + QString::fromUtf8(text));
+        if (missingNewline) {
+            hunk.lines.append(QString::fromLatin1(NoNewlineMarker));
+        }
+        lineBudget -= lines;
+        byteBudget -= text.size() + 1;
+
+        if (prefix != '+') {
+            ++hunk.oldCount;
+        }
+        if (prefix != '-') {
+            ++hunk.newCount;
+        }
+        return true;
+    };
+
+    const QList<HunkRange> ranges = hunkRanges(contextLines);
+    for (const HunkRange &range : ranges) {
+        Hunk hunk;
+        bool full = true;
+
+        int position = range.oldStart;
+        for (qsizetype index = range.first; index <= range.last && full; ++index) {
+            const Change &change = m_changes.at(index);
+            for (; position < change.oldIndex && full; ++position) {
+                full = addLine(hunk, ' ', m_old.lines.at(position));
+            }
+            for (int i = 0; i < change.oldCount && full; ++i) {
+                full = addLine(hunk, '-', m_old.lines.at(change.oldIndex + i));
+            }
+            for (int i = 0; i < change.newCount && full; ++i) {
+                full = addLine(hunk, '+', m_new.lines.at(change.newIndex + i));
+            }
+            position = change.oldIndex + change.oldCount;
+        }
+        for (; position < range.oldEnd && full; ++position) {
+            full = addLine(hunk, ' ', m_old.lines.at(position));
+        }
+
+        if (!hunk.lines.isEmpty()) {
+            hunk.oldStart = hunk.oldCount == 0 ? range.oldStart : range.oldStart + 1;
+            hunk.newStart = hunk.newCount == 0 ? range.newStart : range.newStart + 1;
+            result.append(hunk);
+        }
+
+        if (!full) {
+            break;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,136 @@
+#ifndef DIFFENGINE_H
+#define DIFFENGINE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <sys/stat.h>
+#include <vector>
+
+/**
+ * @brief 2つのファイルの差分をプロセス内で計算するクラス
+ *
+ * 外部のdiffコマンドを起動せず、mmapしたファイルを行単位で
+ * Myersのアルゴリズム (線形空間版)により比較し、unified diff形式で出力します。
+ * 同じinodeのファイルや、btrfsのスナップショットで全てのエクステントを
+ * 共有しているファイルは内容を読まずに同一と判定します。
+ * 行の比較の探索量には上限があり、上限を超える場合は最小でない差分を出力します。
+ * 上限 (既定はMaxCompareSize)を超えるファイルは、マップや行への分割をせずに内容を比較しません。
+ * 差分はunified diff形式のテキスト、または行数・バイト数の上限付きの
+ * ハンクの一覧として取得できます。
+ */
+class DiffEngine
+{
+public:
+    static constexpr int DefaultContextLines = 3;   // unified diffの前後の行数
+    static constexpr qint64 MaxCompareSize = 64 * 1024 * 1024;     // 内容を比較するファイルサイズの上限
+
+    /**
+     * @brief 比較結果
+     */
+    enum class Result {
+        Identical,  // 内容が同一
+        Different,  // テキストとして差分がある
+        Binary,     // バイナリファイルで内容が異なる
+        TooLarge    // ファイルが大きすぎるため内容を比較していない
+    };
+
+    /**
+     * @brief 連続する変更 (削除と追加の組)
+     */
+    struct Change {
+        int oldIndex;   // 比較元の削除開始行 (0始まり)
+        int oldCount;   // 削除された行数
+        int newIndex;   // 比較先の追加開始行 (0始まり)
+        int newCount;   // 追加された行数
+    };
+
+    /**
+     * @brief 差分のハンク
+     *
+     * 開始行と行数はunified diffのハンク見出しと同じ表記です
+     * (1始まり、行数が0の場合は直前の行番号)。
+     */
+    struct Hunk {
+        int oldStart = 0;       // 比較元の開始行
+        int oldCount = 0;       // 比較元の行数
+        int newStart = 0;       // 比較先の開始行
+        int newCount = 0;       // 比較先の行数
+        QStringList lines;      // 行頭に' ', '-', '+'を付けた行 (改行を含まない)
+    };
+
+private:
+    static constexpr qint64 BinaryCheckSize = 32 * 1024;   // NUL文字を探す先頭の範囲
+    static constexpr qint64 MaxDiffCost = 100 * 1000 * 1000;       // 行の比較で探索する量の上限
+    static constexpr int MinTooExpensive = 4096;    // 最小の差分を探す編集距離の上限の最小値
+    static constexpr const char *NoNewlineMarker = "\\ No newline at end of file";
+
+    /**
+     * @brief 1つのハンクにまとめる変更の範囲
+     */
+    struct HunkRange {
+        qsizetype first;    // 最初の変更のインデックス
+        qsizetype last;     // 最後の変更のインデックス
+        int oldStart;       // 比較元の表示開始行 (0始まり)
+        int oldEnd;         // 比較元の表示終了行 (この行を含まない)
+        int newStart;       // 比較先の表示開始行 (0始まり)
+        int newEnd;         // 比較先の表示終了行 (この行を含まない)
+    };
+    static constexpr int MaxCompareExtents = 1024;         // エクステントを比較する上限数
+
+    /**
+     * @brief mmapした比較対象のファイル
+     */
+    struct Input {
+        QString path;                   // ファイルパス
+        int fd = -1;                    // ファイルディスクリプタ
+        bool exists = false;            // ファイルが存在する場合true
+        struct stat status {};          // ファイルの状態
+        const char *data = nullptr;     // マップしたファイルの内容
+        qint64 size = 0;                // 比較するサイズ (通常ファイル以外は0)
+        QList<QByteArrayView> lines;    // 行 (末尾の改行を含む)
+
+        Input() = default;
+        ~Input();
+        Input(const Input &) = delete;
+        Input &operator=(const Input &) = delete;
+
+        bool open(const QString &filePath, QString &error);
+        bool map(QString &error);
+        bool isBinary() const;
+        void splitLines();
+        QByteArray label() const;
+    };
+
+    Result m_result = Result::Identical;  // 比較結果
+    Input m_old;                        // 比較元
+    Input m_new;                        // 比較先
+    std::vector<bool> m_oldChanged;     // 比較元の各行が削除された場合true
+    std::vector<bool> m_newChanged;     // 比較先の各行が追加された場合true
+    QList<Change> m_changes;            // 変更の一覧 (行番号順)
+
+    void computeChanges();
+    void collectChanges();
+    QList<HunkRange> hunkRanges(int contextLines) const;
+    static void appendLine(QByteArray &out, char prefix, QByteArrayView line);
+    static QByteArray formatRange(int index, int count);
+
+public:
+    DiffEngine() = default;
+
+    DiffEngine(const DiffEngine &) = delete;
+    DiffEngine &operator=(const DiffEngine &) = delete;
+
+    Result compare(const QString &oldPath, const QString &newPath, qint64 maxSize = MaxCompareSize);
+    static bool sameExtents(int fd1, int fd2);
+    Result result() const { return m_result; }
+    qint64 oldSize() const { return m_old.exists ? m_old.status.st_size : 0; }
+    qint64 newSize() const { return m_new.exists ? m_new.status.st_size : 0; }
+    const QList<Change> &changes() const { return m_changes; }
+    QByteArray unified(int contextLines = DefaultContextLines) const;
+    QList<Hunk> hunks(int contextLines, qint64 maxLines, qint64 maxBytes, bool &truncated) const;
+};
+
+#endif // DIFFENGINE_H
@@ -0,0 +1,142 @@
+#include "latencyhistogram.h"
+#include <cmath>
+
+/**
+ * @brief LatencyHistogramクラスのコンストラクタ
+ */
+LatencyHistogram::LatencyHistogram()
+    : m_sum(0)
+    , m_max(0)
+{
+    for (std::atomic<quint64> &bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief 値を記録
+ *
+ * 範囲を超える値は最後のバケットに記録します (最大値は正確に保持)。
+ *
+ * @param value 記録する値 (マイクロ秒)
+ */
+void LatencyHistogram::record(quint64 value)
+{
+    m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    quint64 current = m_max.load(std::memory_order_relaxed);
+    while (value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief 記録数を取得
+ *
+ * @return 全てのバケットの記録数の合計
+ */
+quint64 LatencyHistogram::count() const
+{
+    quint64 total = 0;
+    for (const std::atomic<quint64> &bucket : m_buckets) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
+/**
+ * @brief パーセンタイル値を取得
+ *
+ * HdrHistogramと同様に、該当するバケットに含まれる最大の値を返します (記録した最大値を超えない)。
+ *
+ * @param percent パーセンタイル (0〜100)
+ * @return パーセンタイル値、記録がない場合は0
+ */
+quint64 LatencyHistogram::percentile(double percent) const
+{
+    quint64 counts[BucketCount];
+    quint64 total = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    const double clamped = qBound(0.0, percent, 100.0);
+    const quint64 target = qMax<quint64>(1, static_cast<quint64>(std::ceil(clamped / 100.0 * total)));
+
+    quint64 cumulative = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        cumulative += counts[i];
+        if (cumulative >= target) {
+            return qMin(bucketUpperBound(i), max());
+        }
+    }
+
+    return max();
+}
+
+/**
+ * @brief 記録のあるバケットを取得
+ *
+ * 複数のプロセスのヒストグラムを合算できるよう、バケットの境界と記録数をそのまま返します。
+ *
+ * @return バケットに含まれる最大の値と記録数の組 (値の昇順)
+ */
+QList<QPair<quint64, quint64>> LatencyHistogram::buckets() const
+{
+    QList<QPair<quint64, quint64>> result;
+    for (int i = 0; i < BucketCount; ++i) {
+        const quint64 count = m_buckets[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+            result.append(qMakePair(bucketUpperBound(i), count));
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief 値が属するバケットの位置を計算
+ *
+ * 64未満の値は1ずつのバケットに、それ以上の値は2のべき乗ごとに32個のバケットに分けます。
+ *
+ * @param value 値
+ * @return バケットの位置
+ */
+int LatencyHistogram::bucketIndex(quint64 value)
+{
+    if (value < SubBucketCount) {
+        return static_cast<int>(value);
+    }
+
+    const int highestBit = 63 - __builtin_clzll(value);
+    const int shift = highestBit - (SubBucketBits - 1);
+    if (shift > MaxShift) {
+        return BucketCount - 1;
+    }
+
+    const int subBucket = static_cast<int>(value >> shift);    // SubBucketHalf以上SubBucketCount未満
+    return SubBucketCount + (shift - 1) * SubBucketHalf + (subBucket - SubBucketHalf);
+}
+
+/**
+ * @brief バケットに含まれる最大の値を計算
+ *
+ * @param index バケットの位置
+ * @return バケットに含まれる最大の値
+ */
+quint64 LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < SubBucketCount) {
+        return static_cast<quint64>(index);
+    }
+
+    const int shift = (index - SubBucketCount) / SubBucketHalf + 1;
+    const quint64 subBucket = SubBucketHalf + (index - SubBucketCount) % SubBucketHalf;
+    return ((subBucket + 1) << shift) - 1;
+}
@@ -0,0 +1,48 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QList>
+#include <QPair>
+#include <QtGlobal>
+#include <atomic>
+
+/**
+ * @brief 所要時間の分布を記録するヒストグラム
+ *
+ * HdrHistogramと同じ対数・線形のバケットで、1マイクロ秒から約12日までの値を
+ * 有効数字約1.5桁 (相対誤差3%以内)で記録します。
+ * バケットは固定の配列で、記録はロックを取らずに複数のスレッドから行えます。
+ * 読み出しは記録と並行して行えますが、読み出し中に記録された値は含まれないことがあります。
+ */
+class LatencyHistogram
+{
+private:
+    static constexpr int SubBucketBits = 6;                         // 2のべき乗ごとのバケット数の対数
+    static constexpr int SubBucketCount = 1 << SubBucketBits;       // 最初の線形部分のバケット数 (64)
+    static constexpr int SubBucketHalf = SubBucketCount / 2;        // 2つ目以降の2のべき乗ごとのバケット数 (32)
+    static constexpr int MaxShift = 34;                             // 最大のシフト量 (約2^40マイクロ秒まで)
+    static constexpr int BucketCount = SubBucketCount + MaxShift * SubBucketHalf;
+
+    std::atomic<quint64> m_buckets[BucketCount];    // バケットごとの記録数
+    std::atomic<quint64> m_sum;                     // 記録した値の合計
+    std::atomic<quint64> m_max;                     // 記録した最大値
+
+    static int bucketIndex(quint64 value);
+    static quint64 bucketUpperBound(int index);
+
+public:
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    void record(quint64 value);
+
+    quint64 count() const;
+    quint64 sum() const { return m_sum.load(std::memory_order_relaxed); }
+    quint64 max() const { return m_max.load(std::memory_order_relaxed); }
+    quint64 percentile(double percent) const;
+    QList<QPair<quint64, quint64>> buckets() const;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -1,63 +1,16 @@
 #include "snapshotoperations.h"
+#include "dbustypes.h"
+#include "asynclogger.h"
 #include <QCoreApplication>
 #include <QDBusConnection>
 #include <QDBusError>
 #include <QDebug>
-#include <QDir>
-#include <QFile>
-#include <QTextStream>
-#include <QDateTime>
-
-static const QString &logDir()
-{
-    static const QString dir = QStringLiteral(QSNAPPER_LOG_DIR);
-    return dir;
-}
-
-static const QString &logFile()
-{
-    static const QString file = logDir() + QStringLiteral("/qsnapper-dbus.log");
-    return file;
-}
-
-static void fileMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
-{
-    Q_UNUSED(context)
-
-    QDir().mkpath(logDir());
-
-    QFile file(logFile());
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
-        return;
-
-    const char *level = nullptr;
-    switch (type) {
-        case QtDebugMsg:
-            level = "DEBUG";
-            break;
-        case QtInfoMsg:
-            level = "INFO";
-            break;
-        case QtWarningMsg:
-            level = "WARNING";
-            break;
-        case QtCriticalMsg:
-            level = "CRITICAL";
-            break;
-        case QtFatalMsg:
-            level = "FATAL";
-            break;
-    }
-
-    QTextStream stream(&file);
-    stream << QDateTime::currentDateTime().toString(Qt::ISODate)
-           << " [" << level << "] "
-           << msg << "\n";
-}
 
 int main(int argc, char *argv[])
 {
-    qInstallMessageHandler(fileMessageHandler);
+    // ログはバックグラウンドで書き込む (アプリケーションより後に破棄され、残りを書き込む)
+    AsyncLogger logger(QStringLiteral(QSNAPPER_LOG_DIR), QStringLiteral("qsnapper-dbus.log"));
+    logger.install();
 
     QCoreApplication app(argc, argv);
     app.setOrganizationName("Presire");
@@ -77,6 +30,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    // カスタム型を登録 (オブジェクト登録前に必要)
+    registerDBusTypes();
+
     // オブジェクトを作成して登録 (シグナルもエクスポート)
     SnapshotOperations operations;
     if (!connection.registerObject("/com/presire/qsnapper/Operations", &operations,
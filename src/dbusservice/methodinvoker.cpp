@@ -0,0 +1,108 @@
+#include "methodinvoker.h"
+#include <QObject>
+#include <QMetaMethod>
+#include <QMetaObject>
+#include <QDBusArgument>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+
+/**
+ * @brief メソッド呼び出しを実行
+ *
+ * @param object 呼び出し先のオブジェクト
+ * @param message 実行するメソッド呼び出しのメッセージ
+ * @param outputs 戻り値と出力引数 (出力、D-Busの応答と同じ順序)
+ * @param error エラーメッセージ (出力)
+ * @return スロットを呼び出せた場合true
+ */
+bool MethodInvoker::invoke(QObject *object, const QDBusMessage &message,
+                           QList<QVariant> &outputs, QString &error)
+{
+    const QMetaObject *metaObject = object->metaObject();
+    const QByteArray member = message.member().toLatin1();
+    const QList<QVariant> inputs = message.arguments();
+
+    for (int index = metaObject->methodOffset(); index < metaObject->methodCount(); ++index) {
+        const QMetaMethod method = metaObject->method(index);
+        if (method.methodType() != QMetaMethod::Slot || method.access() != QMetaMethod::Public
+            || method.name() != member) {
+            continue;
+        }
+
+        const QList<QByteArray> typeNames = method.parameterTypes();
+
+        // 引数の格納領域 (呼び出し中にアドレスが変わらないよう先に確保する)
+        QList<QVariant> arguments;
+        arguments.reserve(typeNames.size());
+        QList<int> outputIndexes;
+        int inputIndex = 0;
+        bool matched = true;
+
+        for (int i = 0; i < typeNames.size() && matched; ++i) {
+            QByteArray typeName = typeNames.at(i);
+            const bool isOutput = typeName.endsWith('&');
+            if (isOutput) {
+                typeName.chop(1);
+            }
+
+            const QMetaType type = QMetaType::fromName(typeName);
+            if (!type.isValid()) {
+                matched = false;
+                break;
+            }
+
+            QVariant value(type);
+            if (isOutput) {
+                outputIndexes.append(i);
+            }
+            else if (inputIndex >= inputs.size()) {
+                matched = false;
+            }
+            else {
+                const QVariant &input = inputs.at(inputIndex++);
+                if (input.metaType() == QMetaType::fromType<QDBusArgument>()) {
+                    // 配列や構造体はQDBusArgumentのまま届く
+                    matched = QDBusMetaType::demarshall(qvariant_cast<QDBusArgument>(input), type, value.data());
+                }
+                else {
+                    value = input;
+                    matched = value.convert(type);
+                }
+            }
+
+            arguments.append(value);
+        }
+
+        if (!matched || inputIndex != inputs.size()) {
+            continue;
+        }
+
+        QVariant result;
+        const QMetaType returnType = method.returnMetaType();
+        if (returnType.id() != QMetaType::Void) {
+            result = QVariant(returnType);
+        }
+
+        QList<void *> argv;
+        argv.reserve(arguments.size() + 1);
+        argv.append(result.isValid() ? result.data() : nullptr);
+        for (QVariant &argument : arguments) {
+            argv.append(argument.data());
+        }
+
+        QMetaObject::metacall(object, QMetaObject::InvokeMetaMethod, index, argv.data());
+
+        outputs.clear();
+        if (result.isValid()) {
+            outputs.append(result);
+        }
+        for (int i : outputIndexes) {
+            outputs.append(arguments.at(i));
+        }
+
+        return true;
+    }
+
+    error = QString("No such method '%1' with the given arguments").arg(message.member());
+    return false;
+}
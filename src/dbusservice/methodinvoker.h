@@ -0,0 +1,25 @@
+#ifndef METHODINVOKER_H
+#define METHODINVOKER_H
+
+#include <QList>
+#include <QString>
+#include <QVariant>
+
+class QObject;
+class QDBusMessage;
+
+/**
+ * @brief D-Busメソッド呼び出しをスロットに配送するクラス
+ *
+ * 応答を遅延させたメソッド呼び出しを後から実行するために使用します。
+ * QtDBusと同様に、メッセージのメンバー名と同名の公開スロットを探し、
+ * 入力引数を変換して呼び出し、戻り値と出力引数 (非const参照の引数)を返します。
+ */
+class MethodInvoker
+{
+public:
+    static bool invoke(QObject *object, const QDBusMessage &message,
+                       QList<QVariant> &outputs, QString &error);
+};
+
+#endif // METHODINVOKER_H
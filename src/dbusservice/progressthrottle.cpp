@@ -0,0 +1,84 @@
+#include "progressthrottle.h"
+#include <QMutexLocker>
+
+/**
+ * @brief ProgressThrottleクラスのコンストラクタ
+ *
+ * 間隔が両方とも0の場合は、全ての進捗をそのまま通知します。
+ *
+ * @param intervalMs 通知の最小間隔 (ミリ秒、0は時間で通知しない)
+ * @param stepInterval 通知するステップ数の間隔 (0はステップ数で通知しない)
+ * @param callback 通知先
+ */
+ProgressThrottle::ProgressThrottle(int intervalMs, int stepInterval, Callback callback)
+    : m_intervalMs(intervalMs)
+    , m_stepInterval(stepInterval)
+    , m_callback(std::move(callback))
+    , m_reported(0)
+    , m_current(0)
+    , m_total(0)
+{
+    m_elapsed.start();
+}
+
+/**
+ * @brief 進捗を報告
+ *
+ * 並行して実行したステップは完了の順序が前後するため、
+ * 最も進んだ進捗だけを保持します。
+ *
+ * @param current 完了したステップ数
+ * @param total ステップの総数
+ * @param filePath 処理したファイルパス
+ */
+void ProgressThrottle::report(int current, int total, const QString &filePath)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (current <= m_current) {
+        return;
+    }
+
+    m_current = current;
+    m_total = total;
+    m_filePath = filePath;
+
+    const bool unthrottled = m_intervalMs <= 0 && m_stepInterval <= 0;
+    const bool due = unthrottled
+                  || current >= total
+                  || (m_intervalMs > 0 && m_elapsed.hasExpired(m_intervalMs))
+                  || (m_stepInterval > 0 && current - m_reported >= m_stepInterval);
+
+    if (due) {
+        notify();
+    }
+}
+
+/**
+ * @brief 通知されていない最新の進捗を通知
+ *
+ * 中止などで最後のステップまで進まずに終了した場合に呼び出します。
+ */
+void ProgressThrottle::flush()
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_current > m_reported) {
+        notify();
+    }
+}
+
+/**
+ * @brief 最新の進捗を通知 (m_mutexをロックして呼び出す)
+ *
+ * ロックしたまま通知し、通知の順序が進捗の順序と一致するようにします。
+ */
+void ProgressThrottle::notify()
+{
+    m_reported = m_current;
+    m_elapsed.restart();
+
+    if (m_callback) {
+        m_callback(m_current, m_total, m_filePath);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef PROGRESSTHROTTLE_H
+#define PROGRESSTHROTTLE_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <functional>
+
+/**
+ * @brief 進捗の通知をまとめて間引くクラス
+ *
+ * 前回の通知から一定時間が経過した場合、または一定数のステップが
+ * 完了した場合にだけ最新の進捗を通知します。
+ * 最後のステップ (current == total)は必ず通知し、途中で終了した場合は
+ * flush()で通知されていない最新の進捗を通知します。
+ * 複数のスレッドから呼び出せます。通知する進捗は単調に増加します。
+ */
+class ProgressThrottle
+{
+public:
+    using Callback = std::function<void(int current, int total, const QString &filePath)>;
+
+private:
+    QMutex m_mutex;                 // 以下のメンバーの保護
+    int m_intervalMs;               // 通知の最小間隔 (ミリ秒、0は時間で通知しない)
+    int m_stepInterval;             // 通知するステップ数の間隔 (0はステップ数で通知しない)
+    Callback m_callback;            // 通知先
+    QElapsedTimer m_elapsed;        // 前回の通知からの経過時間
+    int m_reported;                 // 前回通知した完了ステップ数
+    int m_current;                  // 最新の完了ステップ数
+    int m_total;                    // 最新のステップの総数
+    QString m_filePath;             // 最新のファイルパス
+
+    void notify();
+
+public:
+    ProgressThrottle(int intervalMs, int stepInterval, Callback callback);
+
+    ProgressThrottle(const ProgressThrottle &) = delete;
+    ProgressThrottle &operator=(const ProgressThrottle &) = delete;
+
+    void report(int current, int total, const QString &filePath);
+    void flush();
+};
+
+#endif // PROGRESSTHROTTLE_H
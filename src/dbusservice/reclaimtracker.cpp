@@ -0,0 +1,210 @@
+#include "reclaimtracker.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * @brief ReclaimTrackerクラスのコンストラクタ
+ *
+ * @param parent 親QObjectポインタ
+ */
+ReclaimTracker::ReclaimTracker(QObject *parent)
+    : QObject(parent)
+{
+    m_pollTimer.setInterval(PollIntervalMs);
+    connect(&m_pollTimer, &QTimer::timeout, this, &ReclaimTracker::poll);
+}
+
+/**
+ * @brief 削除したサブボリュームの追跡を開始
+ *
+ * 同じ設定を追跡中の場合は、解放待ちのサブボリュームに追加します
+ * (解放量は最初の追跡開始時からの値のまま)。
+ *
+ * @param configName 設定名
+ * @param path ファイルシステム上のパス (設定のサブボリューム)
+ * @param subvolumeIds 削除したサブボリュームのID (0は無視)
+ */
+void ReclaimTracker::track(const QString &configName, const QString &path, const QList<quint64> &subvolumeIds)
+{
+    QSet<quint64> ids;
+    for (quint64 id : subvolumeIds) {
+        if (id != 0) {
+            ids.insert(id);
+        }
+    }
+
+    if (ids.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_reclaims.find(configName);
+    if (it == m_reclaims.end()) {
+        // 削除の直後に呼び出されるため、空き容量はまだほとんど増えていない
+        Reclaim reclaim;
+        reclaim.path = path;
+        reclaim.initialFree = freeBytes(path);
+        it = m_reclaims.insert(configName, reclaim);
+    }
+
+    it->pending.unite(ids);
+
+    emit reclaimProgress(configName, it->pending.size(), it->bytesFreed);
+
+    if (!m_pollTimer.isActive()) {
+        m_pollTimer.start();
+    }
+}
+
+/**
+ * @brief 解放を追跡中かを判定
+ *
+ * @return 解放待ちのサブボリュームがある設定が存在する場合true
+ */
+bool ReclaimTracker::isTracking() const
+{
+    QMutexLocker locker(&m_mutex);
+    return !m_reclaims.isEmpty();
+}
+
+/**
+ * @brief 追跡中の解放状況を取得
+ *
+ * 任意のスレッドから呼び出せます。
+ *
+ * @param configName 設定名
+ * @param pendingSubvolumes 解放待ちのサブボリューム数 (出力)
+ * @param bytesFreed 前回通知した解放量 (出力)
+ * @return 追跡中の場合true
+ */
+bool ReclaimTracker::status(const QString &configName, int &pendingSubvolumes, qint64 &bytesFreed) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_reclaims.constFind(configName);
+    if (it == m_reclaims.constEnd()) {
+        pendingSubvolumes = 0;
+        bytesFreed = 0;
+        return false;
+    }
+
+    pendingSubvolumes = it->pending.size();
+    bytesFreed = it->bytesFreed;
+    return true;
+}
+
+/**
+ * @brief 解放待ちのサブボリュームを確認
+ *
+ * 数または解放量が変化した設定について通知し、
+ * 全てのサブボリュームが解放された設定は追跡を終了します。
+ */
+void ReclaimTracker::poll()
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (auto it = m_reclaims.begin(); it != m_reclaims.end(); ) {
+        Reclaim &reclaim = it.value();
+        const int previousPending = reclaim.pending.size();
+        bool failed = false;
+
+        const int fd = ::open(reclaim.path.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            qWarning() << "Failed to open" << reclaim.path << "for reclaim tracking:" << strerror(errno);
+            failed = true;
+        }
+        else {
+            for (auto id = reclaim.pending.begin(); id != reclaim.pending.end(); ) {
+                bool exists = false;
+                if (!subvolumeExists(fd, *id, exists)) {
+                    failed = true;
+                    break;
+                }
+                id = exists ? std::next(id) : reclaim.pending.erase(id);
+            }
+            ::close(fd);
+        }
+
+        if (failed) {
+            // 確認できない場合は追跡をやめる (完了として通知する)
+            reclaim.pending.clear();
+        }
+
+        const qint64 bytesFreed = qMax<qint64>(0, freeBytes(reclaim.path) - reclaim.initialFree);
+        if (reclaim.pending.size() != previousPending || bytesFreed != reclaim.bytesFreed) {
+            reclaim.bytesFreed = bytesFreed;
+            emit reclaimProgress(it.key(), reclaim.pending.size(), bytesFreed);
+        }
+
+        if (reclaim.pending.isEmpty()) {
+            it = m_reclaims.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    if (m_reclaims.isEmpty()) {
+        m_pollTimer.stop();
+    }
+}
+
+/**
+ * @brief サブボリュームがcleanerに未処理かを確認
+ *
+ * ルートツリーを検索し、サブボリュームのROOT_ITEMが残っているかを調べます。
+ *
+ * @param fd ファイルシステム上のディレクトリのファイルディスクリプタ
+ * @param id サブボリュームID
+ * @param exists ROOT_ITEMが残っている場合true (出力)
+ * @return 検索できた場合true
+ */
+bool ReclaimTracker::subvolumeExists(int fd, quint64 id, bool &exists)
+{
+    struct btrfs_ioctl_search_args args {};
+    struct btrfs_ioctl_search_key &key = args.key;
+
+    key.tree_id = BTRFS_ROOT_TREE_OBJECTID;
+    key.min_objectid = id;
+    key.max_objectid = id;
+    key.min_type = BTRFS_ROOT_ITEM_KEY;
+    key.max_type = BTRFS_ROOT_ITEM_KEY;
+    key.min_offset = 0;
+    key.max_offset = static_cast<__u64>(-1);
+    key.min_transid = 0;
+    key.max_transid = static_cast<__u64>(-1);
+    key.nr_items = 1;
+
+    if (ioctl(fd, BTRFS_IOC_TREE_SEARCH, &args) != 0) {
+        qWarning() << "Failed to search btrfs root tree:" << strerror(errno);
+        return false;
+    }
+
+    exists = key.nr_items > 0;
+    return true;
+}
+
+/**
+ * @brief ファイルシステムの空き容量を取得
+ *
+ * @param path ファイルシステム上のパス
+ * @return 空き容量 (バイト)、取得できない場合は0
+ */
+qint64 ReclaimTracker::freeBytes(const QString &path)
+{
+    struct statvfs info {};
+    if (statvfs(path.toLocal8Bit().constData(), &info) != 0) {
+        return 0;
+    }
+
+    return static_cast<qint64>(info.f_bfree) * static_cast<qint64>(info.f_frsize);
+}
@@ -0,0 +1,68 @@
+#ifndef RECLAIMTRACKER_H
+#define RECLAIMTRACKER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+
+/**
+ * @brief 削除したbtrfsサブボリュームの領域の解放を追跡するクラス
+ *
+ * btrfsではサブボリュームを削除してもディレクトリから外れるだけで、
+ * 領域はカーネルのcleanerスレッドが後から解放します。
+ * 削除したサブボリュームのIDを記録し、ルートツリーにROOT_ITEMが残っている
+ * (cleanerが未処理の)サブボリュームを定期的に数えて通知します。
+ * 解放量は追跡開始時からのファイルシステムの空き容量の増加分です
+ * (他の書き込みの影響を受ける目安の値です)。
+ * 追跡はメインスレッドで行い、解放状況は任意のスレッドから取得できます。
+ */
+class ReclaimTracker : public QObject
+{
+    Q_OBJECT
+
+private:
+    static constexpr int PollIntervalMs = 2000;     // サブボリューム一覧を確認する間隔
+
+    /**
+     * @brief 設定ごとの追跡状態
+     */
+    struct Reclaim {
+        QString path;               // ファイルシステム上のパス (設定のサブボリューム)
+        QSet<quint64> pending;      // 解放待ちのサブボリュームID
+        qint64 initialFree = 0;     // 追跡開始時の空き容量 (バイト)
+        qint64 bytesFreed = 0;      // 前回通知した解放量 (バイト)
+    };
+
+    QHash<QString, Reclaim> m_reclaims;             // 設定名 → 追跡状態
+    mutable QMutex m_mutex;                         // m_reclaimsの保護
+    QTimer m_pollTimer;                             // 確認用のタイマー
+
+    static bool subvolumeExists(int fd, quint64 id, bool &exists);
+    static qint64 freeBytes(const QString &path);
+
+public:
+    explicit ReclaimTracker(QObject *parent = nullptr);
+
+    void track(const QString &configName, const QString &path, const QList<quint64> &subvolumeIds);
+    bool isTracking() const;
+    bool status(const QString &configName, int &pendingSubvolumes, qint64 &bytesFreed) const;
+
+signals:
+    /**
+     * @brief 領域の解放の進捗を通知
+     *
+     * @param configName 設定名
+     * @param pendingSubvolumes 解放待ちのサブボリューム数 (0で完了)
+     * @param bytesFreed 追跡開始時からの空き容量の増加分 (バイト)
+     */
+    void reclaimProgress(const QString &configName, int pendingSubvolumes, qint64 bytesFreed);
+
+private slots:
+    void poll();
+};
+
+#endif // RECLAIMTRACKER_H
@@ -0,0 +1,81 @@
+#ifndef RESTOREJOB_H
+#define RESTOREJOB_H
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include "changefilter.h"
+
+/**
+ * @brief サービス側で実行するファイル復元ジョブ
+ *
+ * StartRestoreで開始し、認証・比較・スナップショットのマウントを
+ * ジョブ全体で1回だけ行います。
+ * 中止の要求は実行中のステップの完了後に反映されます。
+ */
+class RestoreJob
+{
+public:
+    /**
+     * @brief 復元の結果
+     */
+    struct Result {
+        int total = 0;                      // 復元ステップの総数
+        int succeeded = 0;                  // 成功したステップ数
+        bool cancelled = false;             // 中止によりステップを残して終了した場合true
+        QMap<QString, QString> failures;    // 失敗したファイルパス → エラーメッセージ
+    };
+
+    /**
+     * @brief 進捗を通知する間隔 (SetRestoreProgressRateでクライアントごとに設定)
+     */
+    struct ProgressRate {
+        int intervalMs = 0;                 // 進捗を通知する最小間隔 (0は時間で通知しない)
+        int stepInterval = 0;               // 進捗を通知するステップ数 (0はステップ数で通知しない)
+    };
+
+private:
+    uint m_id;                              // ジョブID (0はRestoreFilesによる同期的な復元)
+    QString m_configName;                   // Snapper設定名
+    int m_snapshotNumber;                   // 復元元のスナップショット番号
+    int m_compareTo;                        // 比較先のスナップショット番号 (0は現在のシステム)
+    QStringList m_filePaths;                // 復元するファイルパス
+    ChangeFilter m_filter;                  // ディレクトリ指定の復元に適用する一覧の絞り込み
+    QString m_owner;                        // ジョブを開始したクライアントのバス名
+    ProgressRate m_progressRate;            // ジョブを開始したクライアントが設定した進捗の通知間隔
+    std::atomic<bool> m_cancelRequested;    // 中止が要求された場合true
+
+public:
+    RestoreJob(uint id, const QString &configName, int snapshotNumber, int compareTo,
+               const QStringList &filePaths, const ChangeFilter &filter, const QString &owner,
+               const ProgressRate &progressRate)
+        : m_id(id)
+        , m_configName(configName)
+        , m_snapshotNumber(snapshotNumber)
+        , m_compareTo(compareTo)
+        , m_filePaths(filePaths)
+        , m_filter(filter)
+        , m_owner(owner)
+        , m_progressRate(progressRate)
+        , m_cancelRequested(false)
+    {
+    }
+
+    RestoreJob(const RestoreJob &) = delete;
+    RestoreJob &operator=(const RestoreJob &) = delete;
+
+    uint id() const { return m_id; }
+    QString configName() const { return m_configName; }
+    int snapshotNumber() const { return m_snapshotNumber; }
+    int compareTo() const { return m_compareTo; }
+    const QStringList &filePaths() const { return m_filePaths; }
+    const ChangeFilter &filter() const { return m_filter; }
+    QString owner() const { return m_owner; }
+    const ProgressRate &progressRate() const { return m_progressRate; }
+
+    void cancel() { m_cancelRequested = true; }
+    const std::atomic<bool> &cancelFlag() const { return m_cancelRequested; }
+};
+
+#endif // RESTOREJOB_H
@@ -0,0 +1,511 @@
+#include "scopedcomparison.h"
+#include "comparisonsession.h"
+#include "diffengine.h"
+#include "servicemetrics.h"
+#include <QFile>
+#include <QMutexLocker>
+#include <snapper/Snapper.h>
+#include <snapper/Snapshot.h>
+#include <snapper/File.h>
+#include <algorithm>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cstring>
+
+static constexpr size_t CompareBlockSize = 64 * 1024;  // 内容を比較する単位
+
+/**
+ * @brief ScopedComparisonクラスのコンストラクタ
+ *
+ * 比較するスナップショットをマウントします。
+ *
+ * @param snapper Snapperインスタンスへのポインタ (このオブジェクトより長く有効であること)
+ * @param number1 比較元のスナップショット番号
+ * @param number2 比較先のスナップショット番号 (0は現在のシステム)
+ * @param mountLock 設定のマウント・アンマウントのロック
+ * @throws std::runtime_error スナップショットが存在しない場合
+ * @throws snapper::Exception マウントに失敗した場合
+ */
+ScopedComparison::ScopedComparison(snapper::Snapper *snapper, int number1, int number2,
+                                   std::shared_ptr<QMutex> mountLock)
+    : m_mountLock(std::move(mountLock))
+{
+    const snapper::Snapshots &snapshots = snapper->getSnapshots();
+
+    snapper::Snapshots::const_iterator snapshot1 = snapshots.find(number1);
+    snapper::Snapshots::const_iterator snapshot2 = number2 == 0 ? snapper->getSnapshotCurrent()
+                                                                : snapshots.find(number2);
+
+    if (snapshot1 == snapshots.end() || snapshot2 == snapshots.end()) {
+        throw std::runtime_error("Snapshot not found");
+    }
+
+    m_side1.snapshot = &*snapshot1;
+    m_side2.snapshot = &*snapshot2;
+
+    QMutexLocker locker(m_mountLock.get());
+
+    mount(m_side1);
+    try {
+        mount(m_side2);
+    }
+    catch (...) {
+        unmount(m_side1);
+        throw;
+    }
+}
+
+/**
+ * @brief ScopedComparisonクラスのデストラクタ
+ *
+ * コンストラクタでマウントしたスナップショットをアンマウントします。
+ */
+ScopedComparison::~ScopedComparison()
+{
+    QMutexLocker locker(m_mountLock.get());
+
+    try {
+        unmount(m_side2);
+        unmount(m_side1);
+    }
+    catch (...) {
+        // アンマウントに失敗しても比較結果には影響しない
+    }
+}
+
+/**
+ * @brief 指定されたディレクトリのファイル変更一覧を作成
+ *
+ * 各要素は "ステータス パス" 形式で、パスの昇順に並びます。
+ * ディレクトリ自体の変更も含みます。
+ *
+ * @param roots 比較するディレクトリ (サブボリューム内の絶対パス、重複しないこと)
+ * @return ファイル変更一覧
+ */
+QStringList ScopedComparison::changes(const QStringList &roots) const
+{
+    ServiceMetrics::StageTimer timer(ServiceMetrics::Compare);
+
+    QList<Change> changes;
+    for (const QString &root : roots) {
+        compareRoot(QFile::encodeName(root), changes);
+    }
+
+    std::sort(changes.begin(), changes.end(), [](const Change &a, const Change &b) {
+        return a.first < b.first;
+    });
+
+    QStringList result;
+    result.reserve(changes.size());
+    for (const Change &change : std::as_const(changes)) {
+        result.append(ComparisonSession::formatChangeStatus(change.second) + " " + QFile::decodeName(change.first));
+    }
+
+    ServiceMetrics::addFiles(result.size());
+    return result;
+}
+
+/**
+ * @brief 比較元のファイルの絶対パスを取得
+ *
+ * @param path サブボリューム内のパス
+ * @return 比較元のスナップショット内の絶対パス
+ */
+QString ScopedComparison::absolutePath1(const QString &path) const
+{
+    return QFile::decodeName(m_side1.root) + path;
+}
+
+/**
+ * @brief 比較先のファイルの絶対パスを取得
+ *
+ * @param path サブボリューム内のパス
+ * @return 比較先のスナップショット (または現在のシステム)内の絶対パス
+ */
+QString ScopedComparison::absolutePath2(const QString &path) const
+{
+    return QFile::decodeName(m_side2.root) + path;
+}
+
+/**
+ * @brief スナップショットをマウント
+ *
+ * 現在のシステムはマウントしません。マウントの参照カウントはlibsnapperが管理するため、
+ * 比較セッションが同じスナップショットをマウントしていても問題ありません。
+ * 呼び出し側でマウントのロックを取得していること。
+ *
+ * @param side 比較する一方のスナップショット
+ */
+void ScopedComparison::mount(Side &side)
+{
+    if (!side.snapshot->isCurrent()) {
+        side.snapshot->mountFilesystemSnapshot(false);
+        side.mounted = true;
+    }
+
+    side.root = QByteArray::fromStdString(side.snapshot->snapshotDir());
+    while (side.root.endsWith('/')) {
+        side.root.chop(1);
+    }
+
+    struct stat status {};
+    if (lstat(side.root.isEmpty() ? "/" : side.root.constData(), &status) == 0) {
+        side.device = status.st_dev;
+    }
+}
+
+/**
+ * @brief マウントしたスナップショットをアンマウント
+ *
+ * 呼び出し側でマウントのロックを取得していること。
+ *
+ * @param side 比較する一方のスナップショット
+ */
+void ScopedComparison::unmount(Side &side)
+{
+    if (side.mounted) {
+        side.mounted = false;
+        side.snapshot->umountFilesystemSnapshot(false);
+    }
+}
+
+/**
+ * @brief サブボリューム内のパスを確認
+ *
+ * 途中の要素がディレクトリでない場合 (シンボリックリンクを含む)や、
+ * 入れ子のサブボリュームやマウントポイントを経由する場合は存在しないものとして扱います。
+ *
+ * @param side 比較する一方のスナップショット
+ * @param path サブボリューム内の絶対パス
+ * @param status パスのlstatの結果 (出力)
+ * @return パスが存在する場合true
+ */
+bool ScopedComparison::locate(const Side &side, const QByteArray &path, struct stat &status)
+{
+    QByteArray current = side.root;
+    const QList<QByteArray> components = path.split('/');
+    bool found = false;
+
+    for (qsizetype i = 0; i < components.size(); ++i) {
+        const QByteArray &component = components.at(i);
+        if (component.isEmpty()) {
+            continue;
+        }
+        if (component == "." || component == "..") {
+            return false;
+        }
+
+        current += '/' + component;
+        if (lstat(current.constData(), &status) != 0) {
+            return false;
+        }
+
+        const bool last = (i == components.size() - 1);
+        if (!last && (!S_ISDIR(status.st_mode) || status.st_dev != side.device)) {
+            return false;
+        }
+
+        found = true;
+    }
+
+    // サブボリュームのルート自体は比較しない
+    return found;
+}
+
+/**
+ * @brief ディレクトリのエントリを名前順に取得
+ *
+ * @param directory ディレクトリの絶対パス
+ * @return エントリの一覧 (読めない場合は空)
+ */
+QList<ScopedComparison::Entry> ScopedComparison::readDirectory(const QByteArray &directory)
+{
+    QList<Entry> entries;
+
+    DIR *dir = opendir(directory.constData());
+    if (!dir) {
+        return entries;
+    }
+
+    const int fd = dirfd(dir);
+    while (struct dirent *entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        Entry item;
+        item.name = QByteArray(entry->d_name);
+        if (fstatat(fd, entry->d_name, &item.status, AT_SYMLINK_NOFOLLOW) == 0) {
+            entries.append(std::move(item));
+        }
+    }
+
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.name < b.name;
+    });
+
+    return entries;
+}
+
+/**
+ * @brief 2つのエントリを比較してステータスを判定
+ *
+ * 種類が異なる場合はTYPEだけを返します。
+ *
+ * @param path1 比較元の絶対パス
+ * @param status1 比較元のlstatの結果
+ * @param path2 比較先の絶対パス
+ * @param status2 比較先のlstatの結果
+ * @return snapperのステータスフラグ (変更がない場合は0)
+ */
+unsigned int ScopedComparison::compareEntries(const QByteArray &path1, const struct stat &status1,
+                                              const QByteArray &path2, const struct stat &status2)
+{
+    if ((status1.st_mode & S_IFMT) != (status2.st_mode & S_IFMT)) {
+        return snapper::TYPE;
+    }
+
+    unsigned int status = 0;
+
+    if (S_ISREG(status1.st_mode)) {
+        if (!sameContent(path1, status1, path2, status2)) {
+            status |= snapper::CONTENT;
+        }
+    }
+    else if (S_ISLNK(status1.st_mode)) {
+        char target1[PATH_MAX];
+        char target2[PATH_MAX];
+        const ssize_t length1 = readlink(path1.constData(), target1, sizeof(target1));
+        const ssize_t length2 = readlink(path2.constData(), target2, sizeof(target2));
+        if (length1 != length2 || (length1 > 0 && memcmp(target1, target2, static_cast<size_t>(length1)) != 0)) {
+            status |= snapper::CONTENT;
+        }
+    }
+    else if (S_ISCHR(status1.st_mode) || S_ISBLK(status1.st_mode)) {
+        if (status1.st_rdev != status2.st_rdev) {
+            status |= snapper::CONTENT;
+        }
+    }
+
+    if ((status1.st_mode ^ status2.st_mode) & 07777) {
+        status |= snapper::PERMISSIONS;
+    }
+    if (status1.st_uid != status2.st_uid) {
+        status |= snapper::OWNER;
+    }
+    if (status1.st_gid != status2.st_gid) {
+        status |= snapper::GROUP;
+    }
+
+    return status;
+}
+
+/**
+ * @brief 2つの通常ファイルの内容が同一かを判定
+ *
+ * btrfsのスナップショットでは変更されていないファイルのinode番号、更新日時、
+ * 変更日時が元のファイルと同じになるため、これらが一致すれば内容を読みません。
+ * 次に全てのエクステントを共有しているかを確認し、最後に内容を比較します。
+ *
+ * @param path1 比較元の絶対パス
+ * @param status1 比較元のlstatの結果
+ * @param path2 比較先の絶対パス
+ * @param status2 比較先のlstatの結果
+ * @return 内容が同一の場合true
+ */
+bool ScopedComparison::sameContent(const QByteArray &path1, const struct stat &status1,
+                                   const QByteArray &path2, const struct stat &status2)
+{
+    if (status1.st_size != status2.st_size) {
+        return false;
+    }
+
+    if (status1.st_size == 0) {
+        return true;
+    }
+
+    if (status1.st_ino == status2.st_ino
+        && status1.st_mtim.tv_sec == status2.st_mtim.tv_sec && status1.st_mtim.tv_nsec == status2.st_mtim.tv_nsec
+        && status1.st_ctim.tv_sec == status2.st_ctim.tv_sec && status1.st_ctim.tv_nsec == status2.st_ctim.tv_nsec) {
+        return true;
+    }
+
+    const int fd1 = ::open(path1.constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd1 < 0) {
+        return false;
+    }
+
+    const int fd2 = ::open(path2.constData(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd2 < 0) {
+        ::close(fd1);
+        return false;
+    }
+
+    bool same = DiffEngine::sameExtents(fd1, fd2);
+    if (!same) {
+        std::unique_ptr<char[]> buffer1(new char[CompareBlockSize]);
+        std::unique_ptr<char[]> buffer2(new char[CompareBlockSize]);
+
+        same = true;
+        for (;;) {
+            const ssize_t read1 = ::read(fd1, buffer1.get(), CompareBlockSize);
+            const ssize_t read2 = ::read(fd2, buffer2.get(), CompareBlockSize);
+            if (read1 < 0 || read1 != read2
+                || memcmp(buffer1.get(), buffer2.get(), static_cast<size_t>(read1)) != 0) {
+                same = false;
+                break;
+            }
+            if (read1 == 0) {
+                break;
+            }
+        }
+    }
+
+    ::close(fd2);
+    ::close(fd1);
+
+    return same;
+}
+
+/**
+ * @brief 一方にしかないディレクトリの中身を全て変更として追加
+ *
+ * @param side ディレクトリがある側のスナップショット
+ * @param path サブボリューム内のディレクトリのパス
+ * @param status 追加するステータス (CREATEDまたはDELETED)
+ * @param changes ファイル変更の一覧 (追加先)
+ */
+void ScopedComparison::collectSubtree(const Side &side, const QByteArray &path, unsigned int status,
+                                      QList<Change> &changes)
+{
+    QList<QByteArray> pending{path};
+
+    while (!pending.isEmpty()) {
+        const QByteArray directory = pending.takeLast();
+
+        const QList<Entry> entries = readDirectory(side.root + directory);
+        for (const Entry &entry : entries) {
+            const QByteArray child = directory + '/' + entry.name;
+            changes.append(qMakePair(child, status));
+
+            if (S_ISDIR(entry.status.st_mode) && entry.status.st_dev == side.device) {
+                pending.append(child);
+            }
+        }
+    }
+}
+
+/**
+ * @brief 両方にあるディレクトリの中身を比較
+ *
+ * @param path サブボリューム内のディレクトリのパス
+ * @param changes ファイル変更の一覧 (追加先)
+ */
+void ScopedComparison::compareDirectories(const QByteArray &path, QList<Change> &changes) const
+{
+    QList<QByteArray> pending{path};
+
+    while (!pending.isEmpty()) {
+        const QByteArray directory = pending.takeLast();
+
+        const QList<Entry> entries1 = readDirectory(m_side1.root + directory);
+        const QList<Entry> entries2 = readDirectory(m_side2.root + directory);
+
+        // 名前順に並んだ2つの一覧を突き合わせる
+        qsizetype i1 = 0;
+        qsizetype i2 = 0;
+        while (i1 < entries1.size() || i2 < entries2.size()) {
+            const Entry *entry1 = i1 < entries1.size() ? &entries1.at(i1) : nullptr;
+            const Entry *entry2 = i2 < entries2.size() ? &entries2.at(i2) : nullptr;
+
+            if (entry1 && (!entry2 || entry1->name < entry2->name)) {
+                const QByteArray child = directory + '/' + entry1->name;
+                changes.append(qMakePair(child, static_cast<unsigned int>(snapper::DELETED)));
+                if (S_ISDIR(entry1->status.st_mode) && entry1->status.st_dev == m_side1.device) {
+                    collectSubtree(m_side1, child, snapper::DELETED, changes);
+                }
+                ++i1;
+                continue;
+            }
+
+            if (entry2 && (!entry1 || entry2->name < entry1->name)) {
+                const QByteArray child = directory + '/' + entry2->name;
+                changes.append(qMakePair(child, static_cast<unsigned int>(snapper::CREATED)));
+                if (S_ISDIR(entry2->status.st_mode) && entry2->status.st_dev == m_side2.device) {
+                    collectSubtree(m_side2, child, snapper::CREATED, changes);
+                }
+                ++i2;
+                continue;
+            }
+
+            const QByteArray child = directory + '/' + entry1->name;
+            const unsigned int status = compareEntries(m_side1.root + child, entry1->status,
+                                                       m_side2.root + child, entry2->status);
+            if (status != 0) {
+                changes.append(qMakePair(child, status));
+            }
+
+            const bool dir1 = S_ISDIR(entry1->status.st_mode) && entry1->status.st_dev == m_side1.device;
+            const bool dir2 = S_ISDIR(entry2->status.st_mode) && entry2->status.st_dev == m_side2.device;
+            if (dir1 && dir2) {
+                pending.append(child);
+            }
+            else if (dir1) {
+                collectSubtree(m_side1, child, snapper::DELETED, changes);
+            }
+            else if (dir2) {
+                collectSubtree(m_side2, child, snapper::CREATED, changes);
+            }
+
+            ++i1;
+            ++i2;
+        }
+    }
+}
+
+/**
+ * @brief 比較するディレクトリ自体とその中身を比較
+ *
+ * @param path サブボリューム内のディレクトリのパス
+ * @param changes ファイル変更の一覧 (追加先)
+ */
+void ScopedComparison::compareRoot(const QByteArray &path, QList<Change> &changes) const
+{
+    struct stat status1 {};
+    struct stat status2 {};
+    const bool exists1 = locate(m_side1, path, status1);
+    const bool exists2 = locate(m_side2, path, status2);
+
+    const bool dir1 = exists1 && S_ISDIR(status1.st_mode) && status1.st_dev == m_side1.device;
+    const bool dir2 = exists2 && S_ISDIR(status2.st_mode) && status2.st_dev == m_side2.device;
+
+    if (exists1 && exists2) {
+        const unsigned int status = compareEntries(m_side1.root + path, status1, m_side2.root + path, status2);
+        if (status != 0) {
+            changes.append(qMakePair(path, status));
+        }
+
+        if (dir1 && dir2) {
+            compareDirectories(path, changes);
+            return;
+        }
+    }
+    else if (exists1) {
+        changes.append(qMakePair(path, static_cast<unsigned int>(snapper::DELETED)));
+    }
+    else if (exists2) {
+        changes.append(qMakePair(path, static_cast<unsigned int>(snapper::CREATED)));
+    }
+
+    if (dir1) {
+        collectSubtree(m_side1, path, snapper::DELETED, changes);
+    }
+    if (dir2) {
+        collectSubtree(m_side2, path, snapper::CREATED, changes);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SCOPEDCOMPARISON_H
+#define SCOPEDCOMPARISON_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <sys/stat.h>
+
+namespace snapper {
+    class Snapper;
+    class Snapshot;
+}
+
+/**
+ * @brief 指定されたディレクトリだけを比較するクラス
+ *
+ * snapper::Comparisonはサブボリューム全体を比較するため、大きなルートファイルシステムでは
+ * 数分かかります。このクラスは指定されたディレクトリ (サブボリューム内のパス)だけを
+ * 2つのスナップショットで走査して比較するため、比較の時間は対象のディレクトリの
+ * 大きさに比例します。
+ *
+ * ステータスはsnapperと同じ規則 (種類、内容、パーミッション、所有者、グループ)で判定します。
+ * 拡張属性とACLは比較しません。入れ子のサブボリュームやマウントポイントの中には入らず、
+ * シンボリックリンクはたどりません。
+ * スナップショットは作成時にマウントし、破棄時にアンマウントします。
+ */
+class ScopedComparison
+{
+private:
+    /**
+     * @brief ディレクトリのエントリ
+     */
+    struct Entry {
+        QByteArray name;        // エントリ名
+        struct stat status;     // lstatの結果
+    };
+
+    /**
+     * @brief 比較する一方のスナップショット
+     */
+    struct Side {
+        const snapper::Snapshot *snapshot = nullptr;    // スナップショット
+        QByteArray root;                                // スナップショットのディレクトリ
+        dev_t device = 0;                               // スナップショットのデバイス番号
+        bool mounted = false;                           // このクラスがマウントした場合true
+    };
+
+    using Change = QPair<QByteArray, unsigned int>;     // パス、ステータス
+
+    std::shared_ptr<QMutex> m_mountLock;    // 設定のマウント・アンマウントのロック
+    Side m_side1;                           // 比較元
+    Side m_side2;                           // 比較先
+
+    static void mount(Side &side);
+    static void unmount(Side &side);
+    static bool locate(const Side &side, const QByteArray &path, struct stat &status);
+    static QList<Entry> readDirectory(const QByteArray &directory);
+    static unsigned int compareEntries(const QByteArray &path1, const struct stat &status1,
+                                       const QByteArray &path2, const struct stat &status2);
+    static bool sameContent(const QByteArray &path1, const struct stat &status1,
+                            const QByteArray &path2, const struct stat &status2);
+    static void collectSubtree(const Side &side, const QByteArray &path, unsigned int status,
+                               QList<Change> &changes);
+
+    void compareDirectories(const QByteArray &path, QList<Change> &changes) const;
+    void compareRoot(const QByteArray &path, QList<Change> &changes) const;
+
+public:
+    ScopedComparison(snapper::Snapper *snapper, int number1, int number2, std::shared_ptr<QMutex> mountLock);
+    ~ScopedComparison();
+
+    ScopedComparison(const ScopedComparison &) = delete;
+    ScopedComparison &operator=(const ScopedComparison &) = delete;
+
+    QStringList changes(const QStringList &roots) const;
+    QString absolutePath1(const QString &path) const;
+    QString absolutePath2(const QString &path) const;
+};
+
+#endif // SCOPEDCOMPARISON_H
@@ -0,0 +1,239 @@
+#include "servicemetrics.h"
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <algorithm>
+
+static thread_local ServiceMetrics::Call *currentMetrics = nullptr;     // このスレッドで実行中の呼び出し
+
+/**
+ * @brief 処理段階の所要時間を加算
+ *
+ * @param stage 処理段階
+ * @param us 所要時間 (マイクロ秒)
+ */
+void ServiceMetrics::Call::addStage(Stage stage, qint64 us)
+{
+    stageUs[stage] += qMax<qint64>(us, 0);
+    stages |= 1u << stage;
+}
+
+/**
+ * @brief CallScopeクラスのコンストラクタ
+ *
+ * @param metrics 記録先
+ * @param method メソッド名
+ * @param priorUs 実行開始までに経過した時間 (全体の所要時間に含める、マイクロ秒)
+ */
+ServiceMetrics::CallScope::CallScope(ServiceMetrics &metrics, const QString &method, qint64 priorUs)
+    : m_metrics(metrics)
+    , m_method(method)
+    , m_priorUs(priorUs)
+    , m_previous(currentMetrics)
+{
+    m_timer.start();
+    currentMetrics = &m_call;
+}
+
+/**
+ * @brief CallScopeクラスのデストラクタ
+ *
+ * 全体の所要時間を加えて記録し、外側の呼び出しに戻します。
+ */
+ServiceMetrics::CallScope::~CallScope()
+{
+    currentMetrics = m_previous;
+
+    m_call.addStage(Total, m_priorUs + m_timer.nsecsElapsed() / 1000);
+    m_metrics.record(m_method, m_call);
+}
+
+/**
+ * @brief StageTimerクラスのコンストラクタ
+ *
+ * @param stage 計測する処理段階
+ */
+ServiceMetrics::StageTimer::StageTimer(Stage stage)
+    : m_stage(stage)
+{
+    m_timer.start();
+}
+
+/**
+ * @brief StageTimerクラスのデストラクタ
+ *
+ * 経過時間を現在の呼び出しに加算します。
+ */
+ServiceMetrics::StageTimer::~StageTimer()
+{
+    if (currentMetrics) {
+        currentMetrics->addStage(m_stage, m_timer.nsecsElapsed() / 1000);
+    }
+}
+
+/**
+ * @brief 呼び出しを記録
+ *
+ * @param method メソッド名
+ * @param call 呼び出しの記録
+ */
+void ServiceMetrics::record(const QString &method, const Call &call)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        QReadLocker locker(&m_lock);
+        entry = m_entries.value(method);
+    }
+
+    if (!entry) {
+        QWriteLocker locker(&m_lock);
+        std::shared_ptr<Entry> &slot = m_entries[method];
+        if (!slot) {
+            slot = std::make_shared<Entry>();
+        }
+        entry = slot;
+    }
+
+    entry->calls.fetch_add(1, std::memory_order_relaxed);
+    if (call.failed) {
+        entry->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    entry->bytes.fetch_add(call.bytes, std::memory_order_relaxed);
+    entry->files.fetch_add(call.files, std::memory_order_relaxed);
+    entry->undoSteps.fetch_add(call.undoSteps, std::memory_order_relaxed);
+
+    for (int stage = 0; stage < StageCount; ++stage) {
+        if (call.stages & (1u << stage)) {
+            entry->stages[stage].record(static_cast<quint64>(call.stageUs[stage]));
+        }
+    }
+}
+
+/**
+ * @brief 統計を取得
+ *
+ * @return メソッドごとの統計 (メソッド名の順)
+ */
+QList<MethodStats> ServiceMetrics::snapshot() const
+{
+    QList<QPair<QString, std::shared_ptr<Entry>>> entries;
+    {
+        QReadLocker locker(&m_lock);
+        for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+            entries.append(qMakePair(it.key(), it.value()));
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    });
+
+    QList<MethodStats> result;
+    result.reserve(entries.size());
+
+    for (const auto &[method, entry] : std::as_const(entries)) {
+        MethodStats stats;
+        stats.method = method;
+        stats.calls = entry->calls.load(std::memory_order_relaxed);
+        stats.errors = entry->errors.load(std::memory_order_relaxed);
+        stats.bytesReturned = entry->bytes.load(std::memory_order_relaxed);
+        stats.filesCompared = entry->files.load(std::memory_order_relaxed);
+        stats.undoSteps = entry->undoSteps.load(std::memory_order_relaxed);
+
+        for (int stage = 0; stage < StageCount; ++stage) {
+            const LatencyHistogram &histogram = entry->stages[stage];
+            const quint64 count = histogram.count();
+            if (count == 0) {
+                continue;
+            }
+
+            StageStats stageStats;
+            stageStats.stage = QString::fromLatin1(stageName(static_cast<Stage>(stage)));
+            stageStats.count = count;
+            stageStats.sum = histogram.sum();
+            stageStats.max = histogram.max();
+            stageStats.p50 = histogram.percentile(50.0);
+            stageStats.p90 = histogram.percentile(90.0);
+            stageStats.p99 = histogram.percentile(99.0);
+
+            const QList<QPair<quint64, quint64>> buckets = histogram.buckets();
+            stageStats.buckets.reserve(buckets.size());
+            for (const auto &[value, bucketCount] : buckets) {
+                HistogramBucket bucket;
+                bucket.value = value;
+                bucket.count = bucketCount;
+                stageStats.buckets.append(bucket);
+            }
+
+            stats.stages.append(stageStats);
+        }
+
+        result.append(stats);
+    }
+
+    return result;
+}
+
+/**
+ * @brief 返したデータ量を現在の呼び出しに加算
+ *
+ * @param bytes データ量 (バイト)
+ */
+void ServiceMetrics::addBytes(quint64 bytes)
+{
+    if (currentMetrics) {
+        currentMetrics->bytes += bytes;
+    }
+}
+
+/**
+ * @brief 比較で検出したファイル変更の数を現在の呼び出しに加算
+ *
+ * @param files ファイル変更の数
+ */
+void ServiceMetrics::addFiles(quint64 files)
+{
+    if (currentMetrics) {
+        currentMetrics->files += files;
+    }
+}
+
+/**
+ * @brief 実行した復元ステップの数を現在の呼び出しに加算
+ *
+ * @param steps 復元ステップの数
+ */
+void ServiceMetrics::addUndoSteps(quint64 steps)
+{
+    if (currentMetrics) {
+        currentMetrics->undoSteps += steps;
+    }
+}
+
+/**
+ * @brief 現在の呼び出しをエラーとして記録
+ */
+void ServiceMetrics::markFailed()
+{
+    if (currentMetrics) {
+        currentMetrics->failed = true;
+    }
+}
+
+/**
+ * @brief 処理段階の名前を取得
+ *
+ * @param stage 処理段階
+ * @return GetMetricsで返す名前
+ */
+const char *ServiceMetrics::stageName(Stage stage)
+{
+    switch (stage) {
+    case Auth:      return "auth";
+    case Queue:     return "queue";
+    case Snapper:   return "snapper";
+    case Compare:   return "compare";
+    case Serialize: return "serialize";
+    case Total:     return "total";
+    default:        return "unknown";
+    }
+}
@@ -0,0 +1,130 @@
+#ifndef SERVICEMETRICS_H
+#define SERVICEMETRICS_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QReadWriteLock>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include "dbustypes.h"
+#include "latencyhistogram.h"
+
+/**
+ * @brief D-Busメソッドごとの所要時間と処理量の統計
+ *
+ * メソッド呼び出しごとに、処理段階 (認証、ワーカースレッドの待ち、Snapperの初期化、比較、
+ * 応答の作成・送信、全体)の所要時間をヒストグラムに記録し、
+ * 返したデータ量、比較で検出したファイル数、実行した復元ステップ数を累計します。
+ *
+ * 実行中の呼び出しはスレッドごとに保持するため、スロットやその下の処理は
+ * StageTimerや静的なadd関数で現在の呼び出しに記録するだけです。
+ * 呼び出しの外 (CallScopeがないスレッド)での記録は無視されます。
+ */
+class ServiceMetrics
+{
+public:
+    /**
+     * @brief 処理段階
+     */
+    enum Stage {
+        Auth,           // PolicyKitによる認証
+        Queue,          // ワーカースレッドでの実行待ち
+        Snapper,        // Snapperインスタンスの取得・初期化
+        Compare,        // スナップショットの比較
+        Serialize,      // 応答の作成・送信
+        Total,          // 呼び出し全体
+        StageCount
+    };
+
+    /**
+     * @brief 1回の呼び出しの記録
+     */
+    struct Call {
+        qint64 stageUs[StageCount] = {};    // 処理段階ごとの所要時間 (マイクロ秒)
+        uint stages = 0;                    // 記録のある処理段階のビット
+        quint64 bytes = 0;                  // 返したデータ量
+        quint64 files = 0;                  // 比較で検出したファイル変更の数
+        quint64 undoSteps = 0;              // 実行した復元ステップの数
+        bool failed = false;                // エラー応答を返した場合true
+
+        void addStage(Stage stage, qint64 us);
+    };
+
+    /**
+     * @brief 呼び出しの範囲
+     *
+     * 作成したスレッドの現在の呼び出しとし、破棄時に全体の所要時間とともに記録します。
+     */
+    class CallScope
+    {
+    private:
+        ServiceMetrics &m_metrics;      // 記録先
+        QString m_method;               // メソッド名
+        Call m_call;                    // 記録中の呼び出し
+        qint64 m_priorUs;               // このスコープの前に経過した時間 (認証、待ち)
+        QElapsedTimer m_timer;          // スコープ内の経過時間
+        Call *m_previous;               // 外側の呼び出し
+
+    public:
+        CallScope(ServiceMetrics &metrics, const QString &method, qint64 priorUs = 0);
+        ~CallScope();
+
+        CallScope(const CallScope &) = delete;
+        CallScope &operator=(const CallScope &) = delete;
+
+        Call &call() { return m_call; }
+    };
+
+    /**
+     * @brief 処理段階の所要時間を現在の呼び出しに記録するタイマー
+     */
+    class StageTimer
+    {
+    private:
+        Stage m_stage;                  // 処理段階
+        QElapsedTimer m_timer;          // 経過時間
+
+    public:
+        explicit StageTimer(Stage stage);
+        ~StageTimer();
+
+        StageTimer(const StageTimer &) = delete;
+        StageTimer &operator=(const StageTimer &) = delete;
+    };
+
+private:
+    /**
+     * @brief メソッドごとの累計
+     */
+    struct Entry {
+        std::atomic<quint64> calls{0};          // 呼び出し回数
+        std::atomic<quint64> errors{0};         // エラー応答の回数
+        std::atomic<quint64> bytes{0};          // 返したデータ量
+        std::atomic<quint64> files{0};          // 比較で検出したファイル変更の数
+        std::atomic<quint64> undoSteps{0};      // 実行した復元ステップの数
+        LatencyHistogram stages[StageCount];    // 処理段階ごとの所要時間
+    };
+
+    mutable QReadWriteLock m_lock;                          // m_entriesの保護 (各Entryは不要)
+    QHash<QString, std::shared_ptr<Entry>> m_entries;       // メソッド名 → 累計
+
+    static const char *stageName(Stage stage);
+
+public:
+    ServiceMetrics() = default;
+
+    ServiceMetrics(const ServiceMetrics &) = delete;
+    ServiceMetrics &operator=(const ServiceMetrics &) = delete;
+
+    void record(const QString &method, const Call &call);
+    QList<MethodStats> snapshot() const;
+
+    static void addBytes(quint64 bytes);
+    static void addFiles(quint64 files);
+    static void addUndoSteps(quint64 steps);
+    static void markFailed();
+};
+
+#endif // SERVICEMETRICS_H
@@ -0,0 +1,171 @@
+#include "snapshotjournal.h"
+#include <QDateTime>
+#include <QMap>
+#include <iterator>
+
+/**
+ * @brief SnapshotJournalクラスのコンストラクタ
+ *
+ * 世代番号をサービス起動時刻 (マイクロ秒)で初期化します。
+ * 再起動前のサービスから取得した世代番号は必ず現在の値より小さくなり、
+ * 差分ではなく全件の再取得が要求されます。
+ */
+SnapshotJournal::SnapshotJournal()
+    : m_generation(static_cast<quint64>(QDateTime::currentMSecsSinceEpoch()) * 1000)
+{
+}
+
+/**
+ * @brief 設定の変更履歴が初期化済みかを判定
+ *
+ * @param configName Snapper設定名
+ * @return 初期化済みの場合true
+ */
+bool SnapshotJournal::isSeeded(const QString &configName) const
+{
+    return m_configs.contains(configName);
+}
+
+/**
+ * @brief 設定の変更履歴を初期化
+ *
+ * 現在存在するスナップショット番号の集合を登録します。
+ * これより前の世代からの差分は計算できません。
+ *
+ * @param configName Snapper設定名
+ * @param numbers 現在存在するスナップショット番号
+ */
+void SnapshotJournal::seed(const QString &configName, const QSet<int> &numbers)
+{
+    ConfigState &state = m_configs[configName];
+    state.known = numbers;
+    state.entries.clear();
+    state.floor = ++m_generation;
+}
+
+/**
+ * @brief スナップショットの変更を記録
+ *
+ * 既に反映済みの変更 (存在するスナップショットの追加、存在しない
+ * スナップショットの削除)は無視されます。初期化されていない設定の
+ * 変更も、差分を要求するクライアントが存在しないため記録しません。
+ *
+ * @param configName Snapper設定名
+ * @param number スナップショット番号
+ * @param change 変更の種類
+ * @return 変更が記録された場合true
+ */
+bool SnapshotJournal::record(const QString &configName, int number, Change change)
+{
+    auto it = m_configs.find(configName);
+    if (it == m_configs.end()) {
+        return false;
+    }
+
+    ConfigState &state = it.value();
+    switch (change) {
+    case Change::Added:
+        if (state.known.contains(number)) {
+            return false;
+        }
+        state.known.insert(number);
+        break;
+    case Change::Removed:
+        if (!state.known.remove(number)) {
+            return false;
+        }
+        break;
+    case Change::Modified:
+        if (!state.known.contains(number)) {
+            return false;
+        }
+        break;
+    }
+
+    state.entries.push_back({++m_generation, number, change});
+
+    // 上限を超えた古い履歴は破棄し、それ以前からの差分は全件再取得とする
+    while (static_cast<int>(state.entries.size()) > MaxEntries) {
+        state.floor = state.entries.front().generation;
+        state.entries.pop_front();
+    }
+
+    return true;
+}
+
+/**
+ * @brief 現在存在するスナップショット番号を取得
+ *
+ * @param configName Snapper設定名
+ * @return スナップショット番号の集合 (未初期化の場合は空)
+ */
+QSet<int> SnapshotJournal::numbers(const QString &configName) const
+{
+    return m_configs.value(configName).known;
+}
+
+/**
+ * @brief 指定された世代以降の差分を取得
+ *
+ * 指定世代より新しい履歴だけを走査するため、計算量は変更数に比例します。
+ * 同じ番号に対する複数の変更は最終的な状態にまとめられます
+ * (例: 追加後に削除された番号は結果に含まれません)。
+ *
+ * @param configName Snapper設定名
+ * @param generation クライアントが保持している世代番号
+ * @return 差分 (completeがfalseの場合は全件の再取得が必要)
+ */
+SnapshotJournal::Delta SnapshotJournal::since(const QString &configName, quint64 generation) const
+{
+    Delta delta;
+    delta.generation = m_generation;
+
+    auto it = m_configs.constFind(configName);
+    if (it == m_configs.constEnd()) {
+        return delta;
+    }
+
+    const ConfigState &state = it.value();
+    if (generation < state.floor || generation > m_generation) {
+        return delta;
+    }
+
+    // 指定世代より新しい履歴の開始位置を末尾から探す
+    auto first = state.entries.end();
+    while (first != state.entries.begin() && std::prev(first)->generation > generation) {
+        --first;
+    }
+
+    // 番号ごとに「指定世代時点で存在したか」と「最後の変更」をまとめる
+    struct NetChange {
+        bool existedBefore;
+        Change last;
+    };
+    QMap<int, NetChange> changes;
+
+    for (auto entry = first; entry != state.entries.end(); ++entry) {
+        auto found = changes.find(entry->number);
+        if (found == changes.end()) {
+            changes.insert(entry->number, {entry->change != Change::Added, entry->change});
+        }
+        else {
+            found->last = entry->change;
+        }
+    }
+
+    for (auto change = changes.constBegin(); change != changes.constEnd(); ++change) {
+        bool existsNow = change->last != Change::Removed;
+        if (change->existedBefore && !existsNow) {
+            delta.removed.append(change.key());
+        }
+        else if (!change->existedBefore && existsNow) {
+            delta.added.append(change.key());
+        }
+        else if (change->existedBefore && existsNow) {
+            delta.modified.append(change.key());
+        }
+    }
+
+    delta.complete = true;
+    return delta;
+}
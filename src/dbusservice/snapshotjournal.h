@@ -0,0 +1,65 @@
+#ifndef SNAPSHOTJOURNAL_H
+#define SNAPSHOTJOURNAL_H
+
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <deque>
+
+/**
+ * @brief スナップショット一覧の変更履歴を世代番号で管理するクラス
+ *
+ * スナップショットの追加・削除・変更を単調増加する世代番号と共に記録し、
+ * 指定された世代以降の差分だけを返せるようにします。
+ * 世代番号はサービス起動時刻から始まるため、サービスが再起動しても
+ * 古い世代番号と衝突しません。
+ */
+class SnapshotJournal
+{
+public:
+    enum class Change {
+        Added,      // 追加
+        Removed,    // 削除
+        Modified    // 変更
+    };
+
+    struct Delta {
+        QList<int> added;           // 追加されたスナップショット番号
+        QList<int> removed;         // 削除されたスナップショット番号
+        QList<int> modified;        // 変更されたスナップショット番号
+        quint64 generation = 0;     // 現在の世代番号
+        bool complete = false;      // 差分を計算できた場合true (falseの場合は全件の再取得が必要)
+    };
+
+private:
+    static constexpr int MaxEntries = 4096;     // 設定ごとに保持する履歴の上限
+
+    struct Entry {
+        quint64 generation;     // 変更時の世代番号
+        int number;             // スナップショット番号
+        Change change;          // 変更の種類
+    };
+
+    struct ConfigState {
+        QSet<int> known;                // 現在存在するスナップショット番号
+        std::deque<Entry> entries;      // 変更履歴 (古い順)
+        quint64 floor = 0;              // 差分を計算できる最古の世代番号
+    };
+
+    QHash<QString, ConfigState> m_configs;     // 設定名 → 変更履歴
+    quint64 m_generation;                       // 現在の世代番号
+
+public:
+    SnapshotJournal();
+
+    quint64 generation() const { return m_generation; }
+
+    bool isSeeded(const QString &configName) const;
+    void seed(const QString &configName, const QSet<int> &numbers);
+    bool record(const QString &configName, int number, Change change);
+    QSet<int> numbers(const QString &configName) const;
+    Delta since(const QString &configName, quint64 generation) const;
+};
+
+#endif // SNAPSHOTJOURNAL_H
@@ -1,20 +1,33 @@
 #include "snapshotoperations.h"
+#include "bulktransfer.h"
+#include "cleanupplanner.h"
+#include "diffengine.h"
+#include "methodinvoker.h"
+#include "progressthrottle.h"
+#include "reclaimtracker.h"
+#include "scopedcomparison.h"
+#include "subvolumeusage.h"
+#include "undoexecutor.h"
 #include <QCoreApplication>
 #include <QDebug>
 #include <QDBusConnection>
-#include <QDBusConnectionInterface>
 #include <QDBusMessage>
 #include <QDBusError>
 #include <QDateTime>
-#include <QProcess>
-#include <PolkitQt1/Authority>
-#include <PolkitQt1/Subject>
+#include <QDir>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QSet>
+#include <QWriteLocker>
 #include <snapper/Snapper.h>
 #include <snapper/Snapshot.h>
 #include <snapper/Comparison.h>
 #include <snapper/File.h>
 #include <snapper/Exception.h>
 #include <snapper/Version.h>
+#include <algorithm>
+#include <stdexcept>
 
 // 古いlibsnapper（7.x未満）には LIBSNAPPER_VERSION_AT_LEAST マクロが存在しない
 #ifndef LIBSNAPPER_VERSION_AT_LEAST
@@ -39,6 +52,73 @@ static void logPluginReport(const snapper::Plugins::Report& report)
 }
 #endif
 
+/**
+ * @brief スナップショット番号の範囲指定を解析
+ *
+ * "42"のような番号、または"100-450"のような両端を含む範囲を受け付けます。
+ *
+ * @param specs 範囲指定のリスト
+ * @param ranges 解析した範囲 (出力、先頭と末尾の組)
+ * @param error 解析に失敗した場合のエラーメッセージ (出力)
+ * @return 全ての範囲指定を解析できた場合true
+ */
+static bool parseNumberRanges(const QStringList &specs, QList<QPair<int, int>> &ranges, QString &error)
+{
+    if (specs.isEmpty()) {
+        error = "No snapshots specified for deletion";
+        return false;
+    }
+
+    for (const QString &spec : specs) {
+        const QStringList bounds = spec.trimmed().split('-');
+        bool firstOk = false;
+        bool lastOk = false;
+        int first = 0;
+        int last = 0;
+
+        if (bounds.size() == 1) {
+            first = last = bounds.at(0).trimmed().toInt(&firstOk);
+            lastOk = firstOk;
+        }
+        else if (bounds.size() == 2) {
+            first = bounds.at(0).trimmed().toInt(&firstOk);
+            last = bounds.at(1).trimmed().toInt(&lastOk);
+        }
+
+        if (!firstOk || !lastOk || first <= 0 || last < first) {
+            error = QString("Invalid snapshot range: '%1'").arg(spec);
+            return false;
+        }
+
+        ranges.append(qMakePair(first, last));
+    }
+
+    return true;
+}
+
+/**
+ * @brief 比較するスナップショット番号の組み合わせを確認
+ *
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @return 比較できる組み合わせの場合true
+ */
+static bool isValidComparison(int snapshotNumber, int compareTo)
+{
+    return snapshotNumber > 0 && compareTo >= 0 && compareTo != snapshotNumber;
+}
+
+/**
+ * @brief ワーカースレッドで実行中のメソッド呼び出し
+ */
+struct CallContext
+{
+    QDBusMessage message;   // 実行中のメソッド呼び出し
+    bool replied = false;   // エラー応答を送信済みの場合true
+};
+
+static thread_local CallContext *currentCall = nullptr;
+
 /**
  * @brief SnapshotOperationsクラスのコンストラクタ
  *
@@ -48,25 +128,85 @@ static void logPluginReport(const snapper::Plugins::Report& report)
  */
 SnapshotOperations::SnapshotOperations(QObject *parent)
     : QObject(parent)
-    , m_snapper(nullptr)
-    , m_currentConfig("")
+    , m_nextSessionHandle(1)
+    , m_nextRestoreJobId(1)
+    , m_nextCleanupPlanId(1)
+    , m_authorizer(QDBusConnection::systemBus())
 {
+    m_workers.setMaxThreadCount(MaxWorkers);
+    m_undoWorkers.setMaxThreadCount(MaxUndoWorkers);
+    m_jobWorkers.setMaxThreadCount(MaxRestoreJobs);
+
     m_idleTimer.setSingleShot(true);
     m_idleTimer.setInterval(IdleTimeoutMs);
-    connect(&m_idleTimer, &QTimer::timeout, this, []() {
+    connect(&m_idleTimer, &QTimer::timeout, this, [this]() {
+        // 実行中のメソッド呼び出しや、追跡中の領域の解放がある場合は終了しない
+        if (isBusy()) {
+            m_idleTimer.start();
+            return;
+        }
+
         qInfo() << "Idle timeout reached, shutting down...";
         QCoreApplication::quit();
     });
     m_idleTimer.start();
+
+    m_quitTimer.setInterval(QuitPollMs);
+    connect(&m_quitTimer, &QTimer::timeout, this, [this]() {
+        if (!isBusy()) {
+            qInfo() << "Pending work finished, shutting down...";
+            QCoreApplication::quit();
+        }
+    });
+
+    connect(&m_watcher, &SnapshotWatcher::snapshotsTouched,
+            this, &SnapshotOperations::onSnapshotsTouched);
+
+    connect(&m_reclaimTracker, &ReclaimTracker::reclaimProgress,
+            this, &SnapshotOperations::SpaceReclaimProgress);
+
+    m_sessionTimer.setInterval(SessionSweepMs);
+    connect(&m_sessionTimer, &QTimer::timeout, this, &SnapshotOperations::expireSessions);
 }
 
 /**
  * @brief SnapshotOperationsクラスのデストラクタ
  *
- * リソースのクリーンアップを行います。
+ * 実行中のメソッド呼び出しの完了を待ってから、リソースのクリーンアップを行います。
  */
 SnapshotOperations::~SnapshotOperations()
 {
+    // 実行中の復元ジョブは残りのステップを実行せずに終了させる
+    {
+        QMutexLocker jobsLocker(&m_restoreJobsMutex);
+        for (const std::shared_ptr<RestoreJob> &job : std::as_const(m_restoreJobs)) {
+            job->cancel();
+        }
+    }
+
+    m_workers.waitForDone();
+    m_jobWorkers.waitForDone();
+    m_undoWorkers.waitForDone();
+}
+
+/**
+ * @brief 終了を待つ処理があるかを判定
+ *
+ * 実行中のメソッド呼び出し、実行中・待機中の復元ジョブ、追跡中の領域の解放がある場合は終了しません。
+ *
+ * @return 処理中の場合true
+ */
+bool SnapshotOperations::isBusy()
+{
+    {
+        QMutexLocker jobsLocker(&m_restoreJobsMutex);
+        if (!m_restoreJobs.isEmpty()) {
+            return true;
+        }
+    }
+
+    return m_workers.activeThreadCount() > 0 || m_jobWorkers.activeThreadCount() > 0
+        || m_reclaimTracker.isTracking();
 }
 
 /**
@@ -80,14 +220,42 @@ void SnapshotOperations::resetIdleTimer()
     m_idleTimer.start();
 }
 
+/**
+ * @brief メソッドごとの統計を取得
+ *
+ * サービスの起動時からの呼び出し回数、エラー数、処理量と、
+ * 処理段階ごとの所要時間の分布 (マイクロ秒)を返します。
+ * 分布は複数のサービスで合算できるよう、パーセンタイルとともにバケットをそのまま返します。
+ *
+ * @return メソッドごとの統計 (メソッド名の順)
+ */
+QList<MethodStats> SnapshotOperations::GetMetrics()
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QList<MethodStats>();
+    }
+
+    return m_metrics.snapshot();
+}
+
 /**
  * @brief D-Busサービスを終了
  *
  * GUIアプリケーションの終了時にD-Bus経由で呼び出され、
  * サービスプロセスを終了させます。
+ * 復元ジョブやメソッド呼び出しの実行中は、他のクライアントの処理を中止しないよう
+ * 全ての処理が終わるまで終了を延期します。
  */
 void SnapshotOperations::Quit()
 {
+    ServiceMetrics::CallScope metricsScope(m_metrics, QStringLiteral("Quit"));
+
+    if (isBusy()) {
+        qInfo() << "Quit requested via D-Bus, shutting down after pending work finishes...";
+        m_quitTimer.start();
+        return;
+    }
+
     qInfo() << "Quit requested via D-Bus, shutting down...";
     QCoreApplication::quit();
 }
@@ -95,46 +263,189 @@ void SnapshotOperations::Quit()
 /**
  * @brief PolicyKitによる認証チェックを実行
  *
- * 指定されたアクションIDに対してユーザーが権限を持っているかを確認します。
+ * 指定されたアクションIDに対して呼び出し元が権限を持っているかを確認します。
+ * D-Busから直接呼び出された場合は応答を遅延させて非同期に認証を行い、
+ * 認証に成功した時点で同じメソッド呼び出しをワーカースレッドで実行します。
+ * 認証や長時間の処理を待つ間も、他のクライアントの要求は処理されます。
  * 権限がない場合はD-Busエラー応答を送信します。
+ * 認証にかかった時間は、メソッドの統計に記録します。
  *
  * @param actionId チェックするアクションID
- * @return 認証成功時true、失敗時false
+ * @return ワーカースレッドで実行中 (認証済み)の場合true、それ以外はfalse
  */
 bool SnapshotOperations::checkAuthorization(const QString &actionId)
 {
+    // 認証済みの呼び出しをワーカースレッドで実行している
+    if (currentCall) {
+        return true;
+    }
+
     resetIdleTimer();
 
-    PolkitQt1::UnixProcessSubject subject(QDBusConnection::systemBus().interface()->servicePid(message().service()));
-    PolkitQt1::Authority::Result result = PolkitQt1::Authority::instance()->checkAuthorizationSync(
-        actionId, subject, PolkitQt1::Authority::AllowUserInteraction);
+    setDelayedReply(true);
+    const QDBusMessage call = message();
 
-    if (result == PolkitQt1::Authority::Yes) {
-        return true;
-    }
+    QElapsedTimer received;
+    received.start();
+
+    m_authorizer.check(call.service(), actionId, [this, call, received](bool authorized) {
+        const qint64 authUs = received.nsecsElapsed() / 1000;
+
+        if (!authorized) {
+            QDBusConnection::systemBus().send(call.createErrorReply(QDBusError::AccessDenied, "Authorization failed"));
+
+            ServiceMetrics::Call rejected;
+            rejected.addStage(ServiceMetrics::Auth, authUs);
+            rejected.addStage(ServiceMetrics::Total, received.nsecsElapsed() / 1000);
+            rejected.failed = true;
+            m_metrics.record(call.member(), rejected);
+            return;
+        }
+
+        dispatch(call, authUs);
+    });
 
-    sendErrorReply(QDBusError::AccessDenied, "Authorization failed");
     return false;
 }
 
 /**
- * @brief Snapperインスタンスを取得
+ * @brief 認証済みのメソッド呼び出しをワーカースレッドに渡す
+ *
+ * @param call 認証済みのメソッド呼び出し
+ * @param authUs 認証にかかった時間 (マイクロ秒)
+ */
+void SnapshotOperations::dispatch(const QDBusMessage &call, qint64 authUs)
+{
+    QElapsedTimer queued;
+    queued.start();
+
+    m_workers.start([this, call, authUs, queued]() {
+        execute(call, authUs, queued.nsecsElapsed() / 1000);
+    });
+}
+
+/**
+ * @brief メソッド呼び出しをワーカースレッドで実行
+ *
+ * 呼び出しを改めてスロットに配送し、戻り値と出力引数を応答として送信します。
+ * スロット内でエラー応答を送信した場合は通常の応答を送信しません。
+ * スロットは設定ごとのロックを取得するため、同じ設定の読み取り同士や
+ * 別の設定に対する操作は並行して実行されます。
+ * 認証と実行待ちを含む各処理段階の所要時間は、メソッドの統計に記録します。
+ *
+ * @param call 実行するメソッド呼び出し
+ * @param authUs 認証にかかった時間 (マイクロ秒)
+ * @param queueUs ワーカースレッドでの実行待ちの時間 (マイクロ秒)
+ */
+void SnapshotOperations::execute(const QDBusMessage &call, qint64 authUs, qint64 queueUs)
+{
+    ServiceMetrics::CallScope metricsScope(m_metrics, call.member(), authUs + queueUs);
+    metricsScope.call().addStage(ServiceMetrics::Auth, authUs);
+    metricsScope.call().addStage(ServiceMetrics::Queue, queueUs);
+
+    CallContext context;
+    context.message = call;
+    currentCall = &context;
+
+    QList<QVariant> outputs;
+    QString error;
+    const bool invoked = MethodInvoker::invoke(this, call, outputs, error);
+
+    if (!invoked) {
+        replyError(QDBusError::UnknownMethod, error);
+    }
+    else if (!context.replied) {
+        ServiceMetrics::StageTimer serializeTimer(ServiceMetrics::Serialize);
+        QDBusConnection::systemBus().send(call.createReply(outputs));
+    }
+
+    currentCall = nullptr;
+}
+
+/**
+ * @brief 呼び出し元にエラー応答を送信
+ *
+ * ワーカースレッドで実行中の呼び出しでも使用できるsendErrorReplyです。
+ *
+ * @param type エラーの種類
+ * @param text エラーメッセージ
+ */
+void SnapshotOperations::replyError(QDBusError::ErrorType type, const QString &text)
+{
+    ServiceMetrics::markFailed();
+
+    if (!currentCall) {
+        sendErrorReply(type, text);
+        return;
+    }
+
+    if (!currentCall->replied) {
+        QDBusConnection::systemBus().send(currentCall->message.createErrorReply(type, text));
+        currentCall->replied = true;
+    }
+}
+
+/**
+ * @brief 呼び出し元のバス名を取得
+ *
+ * @return 呼び出し元のバス名、D-Bus経由の呼び出しでない場合は空文字列
+ */
+QString SnapshotOperations::callerName() const
+{
+    if (currentCall) {
+        return currentCall->message.service();
+    }
+
+    return calledFromDBus() ? message().service() : QString();
+}
+
+/**
+ * @brief Snapperインスタンスを共有所有で取得
  *
- * 指定された設定名でSnapperインスタンスを取得または作成します。
- * 設定が変更された場合は新しいインスタンスを作成します。
+ * Snapperインスタンスは設定ごとにプールし、設定を切り替えても
+ * 作り直さないようにします (作成時に全スナップショットのinfo.xmlを読み込むため)。
+ * プールにない場合は新しいインスタンスを作成し、その設定の
+ * スナップショットディレクトリの監視を開始します。
+ * 使用中に他のスレッドがプールから破棄しても有効なよう、共有所有で返します。
  *
  * @param configName Snapper設定名
- * @return Snapperインスタンスへのポインタ、失敗時はnullptr
+ * @return Snapperインスタンス、失敗時はnullptr
  */
-snapper::Snapper* SnapshotOperations::getSnapper(const QString &configName)
+std::shared_ptr<snapper::Snapper> SnapshotOperations::acquireSnapper(const QString &configName)
 {
+    ServiceMetrics::StageTimer timer(ServiceMetrics::Snapper);
+
+    {
+        QMutexLocker locker(&m_stateMutex);
+        auto it = m_snappers.constFind(configName);
+        if (it != m_snappers.constEnd()) {
+            return it.value();
+        }
+    }
+
     try {
-        // 設定が変更された場合、または初回の場合は新しいSnapperインスタンスを作成
-        if (!m_snapper || m_currentConfig != configName) {
-            m_snapper.reset(new snapper::Snapper(configName.toStdString(), "/"));
-            m_currentConfig = configName;
+        // 作成には時間がかかるため、他の設定の取得を妨げないようロックの外で作成する
+        auto snapper = std::make_shared<snapper::Snapper>(configName.toStdString(), "/");
+
+        {
+            QMutexLocker locker(&m_stateMutex);
+            auto it = m_snappers.constFind(configName);
+            if (it != m_snappers.constEnd()) {
+                return it.value();      // 他のスレッドが先に作成した
+            }
+            m_snappers.insert(configName, snapper);
         }
-        return m_snapper.get();
+
+        // 他のツールによるスナップショットの作成・削除を検出するため監視を開始
+        // (SnapshotWatcherのソケット通知はメインスレッドで作成する必要がある)
+        ensureJournal(configName, snapper.get());
+        const QDir subvolume(QString::fromStdString(snapper->subvolumeDir()));
+        const QString snapshotsDir = subvolume.filePath(".snapshots");
+        QMetaObject::invokeMethod(&m_watcher, [this, configName, snapshotsDir]() {
+            m_watcher.watch(configName, snapshotsDir);
+        });
+
+        return snapper;
     }
     catch (const snapper::Exception &e) {
         qWarning() << "Failed to create Snapper instance:" << e.what();
@@ -142,6 +453,64 @@ snapper::Snapper* SnapshotOperations::getSnapper(const QString &configName)
     }
 }
 
+/**
+ * @brief 設定のSnapperインスタンスを破棄
+ *
+ * 他のツールによりスナップショットが変更された場合に呼び出します。
+ * 次回の取得時にスナップショット一覧を読み込み直します。
+ * 他の設定のインスタンスには影響しません。
+ *
+ * @param configName Snapper設定名
+ */
+void SnapshotOperations::invalidateSnapper(const QString &configName)
+{
+    QMutexLocker locker(&m_stateMutex);
+    m_snappers.remove(configName);
+}
+
+/**
+ * @brief 設定のスナップショット一覧のロックを取得
+ *
+ * スナップショット一覧を参照する操作は読み取りロック、作成・削除・ロールバックは
+ * 書き込みロックを取得します。長時間の比較や復元の間も、同じ設定の一覧の取得は
+ * 並行して実行できます。
+ *
+ * @param configName Snapper設定名
+ * @return ロック (サービスの終了まで有効)
+ */
+QReadWriteLock *SnapshotOperations::configLock(const QString &configName)
+{
+    QMutexLocker locker(&m_stateMutex);
+
+    std::shared_ptr<QReadWriteLock> &lock = m_configLocks[configName];
+    if (!lock) {
+        lock = std::make_shared<QReadWriteLock>();
+    }
+
+    return lock.get();
+}
+
+/**
+ * @brief 設定のマウント・アンマウントのロックを取得
+ *
+ * libsnapperのスナップショットのマウントの参照カウントはスレッドセーフではないため、
+ * 同じ設定のスナップショットをマウントする比較はこのロックで直列化します。
+ *
+ * @param configName Snapper設定名
+ * @return ロック
+ */
+std::shared_ptr<QMutex> SnapshotOperations::mountLock(const QString &configName)
+{
+    QMutexLocker locker(&m_stateMutex);
+
+    std::shared_ptr<QMutex> &lock = m_mountLocks[configName];
+    if (!lock) {
+        lock = std::make_shared<QMutex>();
+    }
+
+    return lock;
+}
+
 /**
  * @brief スナップショットタイプを文字列に変換
  *
@@ -226,113 +595,584 @@ QString SnapshotOperations::formatSnapshotToCSV(const snapper::Snapper *snapper)
 /**
  * @brief スナップショット一覧を取得
  *
- * システム上の全スナップショットをCSV形式で取得します。
+ * 指定された設定の全スナップショットをCSV形式で取得します。
  * PolicyKit認証を必要とします。
  *
+ * @param configName Snapper設定名
  * @return CSV形式のスナップショット一覧、失敗時は空文字列
  */
-QString SnapshotOperations::ListSnapshots()
+QString SnapshotOperations::ListSnapshots(const QString &configName)
 {
     if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
         return QString();
     }
 
+    QReadLocker locker(configLock(configName));
+
     try {
-        snapper::Snapper *snapper = getSnapper("root");
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
         if (!snapper) {
-            sendErrorReply(QDBusError::Failed, "Failed to initialize Snapper");
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
             return QString();
         }
 
-        return formatSnapshotToCSV(snapper);
+        return formatSnapshotToCSV(snapper.get());
     }
     catch (const snapper::Exception &e) {
         qWarning() << "Failed to list snapshots:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Failed to list snapshots: %1").arg(e.what()));
+        replyError(QDBusError::Failed, QString("Failed to list snapshots: %1").arg(e.what()));
         return QString();
     }
 }
 
 /**
- * @brief 新しいスナップショットを作成
+ * @brief スナップショット情報をD-Bus送信用の構造体に変換
  *
- * 指定されたパラメータで新しいスナップショットを作成します。
- * single、pre、postの3種類のタイプをサポートします。
+ * 文字列への整形を行わず、snapperのスナップショット情報を
+ * そのままSnapshotRecordへ詰め替えます。
  *
- * @param type スナップショットのタイプ ("single", "pre", "post")
- * @param description スナップショットの説明
- * @param preNumber postタイプの場合の対応するpreスナップショット番号
- * @param cleanup クリーンアップアルゴリズム名
- * @param important 重要フラグ
- * @return 作成されたスナップショットのCSV情報、失敗時は空文字列
+ * @param snapshot 変換元のスナップショット
+ * @return D-Bus送信用のスナップショット情報
  */
-QString SnapshotOperations::CreateSnapshot(const QString &type, const QString &description,
-                                          int preNumber, const QString &cleanup, bool important)
+SnapshotRecord SnapshotOperations::snapshotToRecord(const snapper::Snapshot &snapshot)
 {
-    if (!checkAuthorization("com.presire.qsnapper.create-snapshot")) {
-        return QString();
+    SnapshotRecord record;
+    record.number = snapshot.getNum();
+    record.type = snapshot.getType();
+    record.preNumber = snapshot.getPreNum();
+    record.date = snapshot.getDate();
+    record.uid = snapshot.getUid();
+    record.cleanup = QString::fromStdString(snapshot.getCleanup());
+    record.description = QString::fromStdString(snapshot.getDescription());
+
+    const std::map<std::string, std::string> &userdata = snapshot.getUserdata();
+    for (const auto &pair : userdata) {
+        record.userdata.insert(QString::fromStdString(pair.first), QString::fromStdString(pair.second));
+    }
+
+    return record;
+}
+
+/**
+ * @brief スナップショット一覧を型付きで取得
+ *
+ * ListSnapshotsと異なりCSV文字列を経由せず、a(iiixussa{ss})型の配列として
+ * スナップショット一覧を返します。説明文やユーザーデータにカンマが
+ * 含まれていても正しく送信されます。
+ * 現在のシステム状態 (番号0)は含まれません。
+ * PolicyKit認証を必要とします。
+ *
+ * @param configName Snapper設定名
+ * @return スナップショット情報の配列、失敗時は空の配列
+ */
+QList<SnapshotRecord> SnapshotOperations::ListSnapshotsV2(const QString &configName)
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QList<SnapshotRecord>();
     }
 
+    QReadLocker locker(configLock(configName));
+
     try {
-        snapper::Snapper *snapper = getSnapper("root");
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
         if (!snapper) {
-            sendErrorReply(QDBusError::Failed, "Failed to initialize Snapper");
-            return QString();
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return QList<SnapshotRecord>();
         }
 
-        snapper::SCD scd;
-        scd.description = description.toStdString();
-        scd.cleanup = cleanup.toStdString();
-        scd.read_only = true;
+        const snapper::Snapshots &snapshots = snapper->getSnapshots();
 
-        if (important) {
-            scd.userdata["important"] = "yes";
+        QList<SnapshotRecord> records;
+        records.reserve(static_cast<int>(snapshots.size()));
+        for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+            if (it->isCurrent()) {
+                continue;
+            }
+            records.append(snapshotToRecord(*it));
         }
 
-        snapper::Snapshots::iterator newSnapshot;
-        snapper::SnapshotType snapType = static_cast<snapper::SnapshotType>(stringToSnapshotType(type));
+        return records;
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to list snapshots:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to list snapshots: %1").arg(e.what()));
+        return QList<SnapshotRecord>();
+    }
+}
 
-#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
-        snapper::Plugins::Report report;
-#endif
-        if (snapType == snapper::PRE) {
-#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
-            newSnapshot = snapper->createPreSnapshot(scd, report);
-#else
-            newSnapshot = snapper->createPreSnapshot(scd);
-#endif
+/**
+ * @brief 設定の変更履歴を初期化
+ *
+ * 変更履歴が未初期化の場合、Snapperインスタンスが保持している
+ * スナップショット番号で初期化します。
+ *
+ * @param configName Snapper設定名
+ * @param snapper Snapperインスタンスへのポインタ
+ */
+void SnapshotOperations::ensureJournal(const QString &configName, const snapper::Snapper *snapper)
+{
+    QMutexLocker locker(&m_stateMutex);
+
+    if (!snapper || m_journal.isSeeded(configName)) {
+        return;
+    }
+
+    QSet<int> numbers;
+    const snapper::Snapshots &snapshots = snapper->getSnapshots();
+    for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+        if (!it->isCurrent()) {
+            numbers.insert(it->getNum());
         }
-        else if (snapType == snapper::POST && preNumber > 0) {
-            snapper::Snapshots::const_iterator preSnap = snapper->getSnapshots().find(preNumber);
-            if (preSnap == snapper->getSnapshots().end()) {
-                sendErrorReply(QDBusError::Failed, "Pre-snapshot not found");
-                return QString();
+    }
+    m_journal.seed(configName, numbers);
+}
+
+/**
+ * @brief スナップショット一覧の変更を記録して通知
+ *
+ * 変更履歴に記録し、実際に記録された (未反映だった)変更がある場合に
+ * SnapshotsChangedシグナルを発行します。サービス自身による作成・削除と
+ * inotifyによる検出が重複しても、通知は一度だけ行われます。
+ * 変更 (説明やユーザーデータの書き換え)だけの場合、シグナルの追加・削除は空となり、
+ * クライアントはListSnapshotsSinceで変更された番号を取得します。
+ * ワーカースレッドから呼び出された場合、シグナルはメインスレッドから発行します。
+ *
+ * @param configName Snapper設定名
+ * @param added 追加されたスナップショット番号
+ * @param removed 削除されたスナップショット番号
+ * @param modified 変更されたスナップショット番号
+ */
+void SnapshotOperations::publishChanges(const QString &configName, const QList<int> &added,
+                                        const QList<int> &removed, const QList<int> &modified)
+{
+    QList<int> recordedAdded;
+    QList<int> recordedRemoved;
+    bool recordedModified = false;
+
+    {
+        QMutexLocker locker(&m_stateMutex);
+        for (int number : added) {
+            if (m_journal.record(configName, number, SnapshotJournal::Change::Added)) {
+                recordedAdded.append(number);
             }
-#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
-            newSnapshot = snapper->createPostSnapshot(preSnap, scd, report);
-#else
-            newSnapshot = snapper->createPostSnapshot(preSnap, scd);
-#endif
         }
-        else {
-#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
-            newSnapshot = snapper->createSingleSnapshot(scd, report);
-#else
-            newSnapshot = snapper->createSingleSnapshot(scd);
-#endif
+        for (int number : removed) {
+            if (m_journal.record(configName, number, SnapshotJournal::Change::Removed)) {
+                recordedRemoved.append(number);
+            }
         }
-#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
-        logPluginReport(report);
-#endif
+        for (int number : modified) {
+            if (m_journal.record(configName, number, SnapshotJournal::Change::Modified)) {
+                recordedModified = true;
+            }
+        }
+    }
 
-        // 新しく作成されたスナップショットのCSV情報を返す
-        QString csv = "number,type,pre-number,date,user,cleanup,description,userdata\n";
-        csv += QString::number(newSnapshot->getNum()) + ",";
-        csv += snapshotTypeToString(newSnapshot->getType()) + ",";
-        csv += QString::number(newSnapshot->getPreNum()) + ",";
+    // 削除されたスナップショットを使用している比較セッションは無効になる
+    releaseSessions(closeSessions(configName, removed));
 
-        QDateTime dateTime = QDateTime::fromSecsSinceEpoch(newSnapshot->getDate());
-        csv += dateTime.toString(Qt::ISODate) + ",";
+    // 削除されたスナップショットの比較結果は使われなくなる
+    for (int number : removed) {
+        m_comparisonCache.evict(configName, number);
+    }
+
+    if (!recordedAdded.isEmpty() || !recordedRemoved.isEmpty() || recordedModified) {
+        QMetaObject::invokeMethod(this, [this, configName, recordedAdded, recordedRemoved]() {
+            emit SnapshotsChanged(configName, recordedAdded, recordedRemoved);
+        });
+    }
+}
+
+/**
+ * @brief スナップショットディレクトリの変化を処理
+ *
+ * SnapshotWatcherが検出した番号と変更履歴を突き合わせ、
+ * 追加・削除・変更されたスナップショットを通知します。
+ * 外部で変更された場合、キャッシュ済みのSnapperインスタンスは
+ * 古い一覧を保持しているため破棄します。
+ *
+ * @param configName Snapper設定名
+ * @param present イベントが発生し、現在存在する番号
+ * @param absent イベントが発生し、現在存在しない番号
+ * @param modified info.xmlが書き換えられた番号
+ * @param rescan trueの場合presentは存在する全番号
+ */
+void SnapshotOperations::onSnapshotsTouched(const QString &configName, const QList<int> &present,
+                                            const QList<int> &absent, const QList<int> &modified,
+                                            bool rescan)
+{
+    QSet<int> known;
+    {
+        QMutexLocker locker(&m_stateMutex);
+        known = m_journal.numbers(configName);
+    }
+
+    QList<int> added;
+    QList<int> removed;
+
+    for (int number : present) {
+        if (!known.contains(number)) {
+            added.append(number);
+        }
+    }
+
+    if (rescan) {
+        const QSet<int> presentSet(present.begin(), present.end());
+        for (int number : known) {
+            if (!presentSet.contains(number)) {
+                removed.append(number);
+            }
+        }
+    }
+    else {
+        for (int number : absent) {
+            if (known.contains(number)) {
+                removed.append(number);
+            }
+        }
+    }
+
+    QList<int> changed;
+    for (int number : modified) {
+        if (known.contains(number) && !removed.contains(number)) {
+            changed.append(number);
+        }
+    }
+
+    if (added.isEmpty() && removed.isEmpty() && changed.isEmpty()) {
+        return;
+    }
+
+    std::sort(added.begin(), added.end());
+    std::sort(removed.begin(), removed.end());
+    std::sort(changed.begin(), changed.end());
+
+    invalidateSnapper(configName);
+
+    qInfo() << "Snapshots changed externally in config" << configName
+            << "- added:" << added.size() << "removed:" << removed.size() << "modified:" << changed.size();
+
+    publishChanges(configName, added, removed, changed);
+}
+
+/**
+ * @brief 指定された世代以降のスナップショット一覧の差分を取得
+ *
+ * 追加・削除・変更されたスナップショット番号と新しい世代番号を返します。
+ * 計算量は一覧の件数ではなく変更数に比例します。
+ * 差分を計算できない場合 (初回呼び出し、サービス再起動、履歴の破棄)は
+ * completeがfalseとなり、クライアントはListSnapshotsV2で全件を再取得します。
+ * 全件取得の前にこのメソッドで世代番号を取得しておくことで、
+ * 取得中に発生した変更も次回の差分に含まれます。
+ * PolicyKit認証を必要とします。
+ *
+ * @param configName Snapper設定名
+ * @param generation クライアントが保持している世代番号 (初回は0)
+ * @param removed 削除されたスナップショット番号 (出力)
+ * @param modified 変更されたスナップショット番号 (出力)
+ * @param newGeneration 現在の世代番号 (出力)
+ * @param complete 差分を計算できた場合true (出力)
+ * @return 追加されたスナップショット番号
+ */
+QList<int> SnapshotOperations::ListSnapshotsSince(const QString &configName, qulonglong generation,
+                                                  QList<int> &removed, QList<int> &modified,
+                                                  qulonglong &newGeneration, bool &complete)
+{
+    newGeneration = 0;
+    complete = false;
+
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QList<int>();
+    }
+
+    QReadLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return QList<int>();
+        }
+
+        ensureJournal(configName, snapper.get());
+
+        SnapshotJournal::Delta delta;
+        {
+            QMutexLocker stateLocker(&m_stateMutex);
+            delta = m_journal.since(configName, generation);
+        }
+        removed = delta.removed;
+        modified = delta.modified;
+        newGeneration = delta.generation;
+        complete = delta.complete;
+
+        return delta.added;
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to list snapshot changes:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to list snapshot changes: %1").arg(e.what()));
+        return QList<int>();
+    }
+}
+
+/**
+ * @brief 指定された番号のスナップショット情報を取得
+ *
+ * ListSnapshotsSinceで通知された番号の情報だけを取得するために使用します。
+ * 存在しない番号は結果に含まれません。
+ * PolicyKit認証を必要とします。
+ *
+ * @param configName Snapper設定名
+ * @param numbers 取得するスナップショット番号
+ * @return スナップショット情報の配列、失敗時は空の配列
+ */
+QList<SnapshotRecord> SnapshotOperations::GetSnapshots(const QString &configName, const QList<int> &numbers)
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QList<SnapshotRecord>();
+    }
+
+    QReadLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return QList<SnapshotRecord>();
+        }
+
+        const snapper::Snapshots &snapshots = snapper->getSnapshots();
+
+        QList<SnapshotRecord> records;
+        records.reserve(numbers.size());
+        for (int number : numbers) {
+            if (number <= 0) {
+                continue;
+            }
+            snapper::Snapshots::const_iterator snapshot = snapshots.find(number);
+            if (snapshot != snapshots.end()) {
+                records.append(snapshotToRecord(*snapshot));
+            }
+        }
+
+        return records;
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to get snapshots:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get snapshots: %1").arg(e.what()));
+        return QList<SnapshotRecord>();
+    }
+}
+
+/**
+ * @brief スナップショットの使用量を取得
+ *
+ * btrfsのクォータ (qgroup)から、スナップショットごとの参照量と排他量を返します。
+ * クォータツリーを1回検索して全てのスナップショットの値をまとめて読み取り、
+ * 設定ごとにキャッシュします。スナップショット一覧が変わった場合は、
+ * 追加・削除・変更されたスナップショットのサブボリュームIDだけを取得し直します
+ * (ファイルの変更でも値は変わるため、30秒経過した場合は読み直します)。
+ * btrfs以外のファイルシステムやクォータが無効な場合、使用量は-1です。
+ *
+ * @param configName Snapper設定名
+ * @param numbers 取得するスナップショット番号のリスト (空の場合は全て)
+ * @return スナップショットごとの使用量 (存在しない番号は含まない)
+ */
+QList<SnapshotSize> SnapshotOperations::GetSnapshotSizes(const QString &configName, const QList<int> &numbers)
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QList<SnapshotSize>();
+    }
+
+    QReadLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return QList<SnapshotSize>();
+        }
+
+        ensureJournal(configName, snapper.get());
+
+        const snapper::Snapshots &snapshots = snapper->getSnapshots();
+
+        QMutexLocker cacheLocker(&m_sizeCachesMutex);
+        SizeCache &cache = m_sizeCaches[configName];
+
+        // この設定のスナップショット一覧の差分だけを反映する
+        // (他の設定の変更では世代番号が進んでも差分は空になる)
+        SnapshotJournal::Delta delta;
+        if (cache.generation != 0) {
+            QMutexLocker stateLocker(&m_stateMutex);
+            delta = m_journal.since(configName, cache.generation);
+        }
+
+        if (delta.complete) {
+            for (int number : std::as_const(delta.removed)) {
+                cache.subvolumeIds.remove(number);
+            }
+
+            QList<int> changed = delta.added;
+            changed.append(delta.modified);
+            for (int number : std::as_const(changed)) {
+                snapper::Snapshots::const_iterator snapshot = snapshots.find(number);
+                if (snapshot != snapshots.end() && !snapshot->isCurrent()) {
+                    cache.subvolumeIds.insert(number,
+                                              SubvolumeUsage::subvolumeId(QString::fromStdString(snapshot->snapshotDir())));
+                }
+            }
+
+            // 追加されたスナップショットのqgroupはまだ読み取っていない
+            if (!delta.added.isEmpty()) {
+                cache.read.invalidate();
+            }
+        }
+        else {
+            // 初回や差分を計算できない場合はサブボリュームIDを全て取得し直す
+            {
+                QMutexLocker stateLocker(&m_stateMutex);
+                delta.generation = m_journal.generation();
+            }
+
+            cache.subvolumeIds.clear();
+            for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+                if (!it->isCurrent()) {
+                    cache.subvolumeIds.insert(it->getNum(),
+                                              SubvolumeUsage::subvolumeId(QString::fromStdString(it->snapshotDir())));
+                }
+            }
+            cache.read.invalidate();
+        }
+        cache.generation = delta.generation;
+
+        if (!cache.read.isValid() || cache.read.hasExpired(SizeCacheMaxAgeMs)) {
+            cache.quotaEnabled = SubvolumeUsage::readQgroups(QString::fromStdString(snapper->subvolumeDir()),
+                                                             cache.usage);
+            cache.read.start();
+        }
+
+        QList<int> targets = numbers;
+        if (targets.isEmpty()) {
+            targets = cache.subvolumeIds.keys();
+            std::sort(targets.begin(), targets.end());
+        }
+
+        QList<SnapshotSize> sizes;
+        sizes.reserve(targets.size());
+        for (int number : std::as_const(targets)) {
+            auto id = cache.subvolumeIds.constFind(number);
+            if (id == cache.subvolumeIds.constEnd()) {
+                continue;
+            }
+
+            SnapshotSize size;
+            size.number = number;
+
+            auto usage = cache.usage.constFind(id.value());
+            if (cache.quotaEnabled && usage != cache.usage.constEnd()) {
+                size.referenced = usage->referenced;
+                size.exclusive = usage->exclusive;
+            }
+
+            sizes.append(size);
+        }
+
+        return sizes;
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to get snapshot sizes:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get snapshot sizes: %1").arg(e.what()));
+        return QList<SnapshotSize>();
+    }
+}
+
+/**
+ * @brief 新しいスナップショットを作成
+ *
+ * 指定されたパラメータで新しいスナップショットを作成します。
+ * single、pre、postの3種類のタイプをサポートします。
+ *
+ * @param configName Snapper設定名
+ * @param type スナップショットのタイプ ("single", "pre", "post")
+ * @param description スナップショットの説明
+ * @param preNumber postタイプの場合の対応するpreスナップショット番号
+ * @param cleanup クリーンアップアルゴリズム名
+ * @param important 重要フラグ
+ * @return 作成されたスナップショットのCSV情報、失敗時は空文字列
+ */
+QString SnapshotOperations::CreateSnapshot(const QString &configName, const QString &type,
+                                          const QString &description, int preNumber,
+                                          const QString &cleanup, bool important)
+{
+    if (!checkAuthorization("com.presire.qsnapper.create-snapshot")) {
+        return QString();
+    }
+
+    QWriteLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return QString();
+        }
+
+        snapper::SCD scd;
+        scd.description = description.toStdString();
+        scd.cleanup = cleanup.toStdString();
+        scd.read_only = true;
+
+        if (important) {
+            scd.userdata["important"] = "yes";
+        }
+
+        snapper::Snapshots::iterator newSnapshot;
+        snapper::SnapshotType snapType = static_cast<snapper::SnapshotType>(stringToSnapshotType(type));
+
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+        snapper::Plugins::Report report;
+#endif
+        if (snapType == snapper::PRE) {
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+            newSnapshot = snapper->createPreSnapshot(scd, report);
+#else
+            newSnapshot = snapper->createPreSnapshot(scd);
+#endif
+        }
+        else if (snapType == snapper::POST && preNumber > 0) {
+            snapper::Snapshots::const_iterator preSnap = snapper->getSnapshots().find(preNumber);
+            if (preSnap == snapper->getSnapshots().end()) {
+                replyError(QDBusError::Failed, "Pre-snapshot not found");
+                return QString();
+            }
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+            newSnapshot = snapper->createPostSnapshot(preSnap, scd, report);
+#else
+            newSnapshot = snapper->createPostSnapshot(preSnap, scd);
+#endif
+        }
+        else {
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+            newSnapshot = snapper->createSingleSnapshot(scd, report);
+#else
+            newSnapshot = snapper->createSingleSnapshot(scd);
+#endif
+        }
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+        logPluginReport(report);
+#endif
+
+        publishChanges(configName, {static_cast<int>(newSnapshot->getNum())}, {});
+
+        // 新しく作成されたスナップショットのCSV情報を返す
+        QString csv = "number,type,pre-number,date,user,cleanup,description,userdata\n";
+        csv += QString::number(newSnapshot->getNum()) + ",";
+        csv += snapshotTypeToString(newSnapshot->getType()) + ",";
+        csv += QString::number(newSnapshot->getPreNum()) + ",";
+
+        QDateTime dateTime = QDateTime::fromSecsSinceEpoch(newSnapshot->getDate());
+        csv += dateTime.toString(Qt::ISODate) + ",";
 
         csv += QString::number(newSnapshot->getUid()) + ",";
         csv += QString::fromStdString(newSnapshot->getCleanup()) + ",";
@@ -346,296 +1186,2008 @@ QString SnapshotOperations::CreateSnapshot(const QString &type, const QString &d
         }
         csv += userdataPairs.join(",");
 
-        return csv;
+        return csv;
+
+    } catch (const snapper::Exception &e) {
+        qWarning() << "Failed to create snapshot:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to create snapshot: %1").arg(e.what()));
+        return QString();
+    }
+}
+
+/**
+ * @brief スナップショットを削除
+ *
+ * 指定された番号のスナップショットを削除します。
+ * サブボリュームがディレクトリから外れた時点で応答し、
+ * btrfsのcleanerによる領域の解放はSpaceReclaimProgressシグナルで通知します。
+ * PolicyKit認証を必要とします。
+ *
+ * @param configName Snapper設定名
+ * @param number 削除するスナップショット番号
+ * @return 削除成功時true、失敗時false
+ */
+bool SnapshotOperations::DeleteSnapshot(const QString &configName, int number)
+{
+    if (!checkAuthorization("com.presire.qsnapper.delete-snapshot")) {
+        return false;
+    }
+
+    QWriteLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return false;
+        }
+
+        snapper::Snapshots::iterator snapshot = snapper->getSnapshots().find(number);
+        if (snapshot == snapper->getSnapshots().end()) {
+            replyError(QDBusError::Failed, "Snapshot not found");
+            return false;
+        }
+
+        // 復元は設定のロックを解放して実行するため、使用中のスナップショットは削除しない
+        if (isRestoring(configName, number)) {
+            replyError(QDBusError::Failed, "Snapshot is being used by a restore");
+            return false;
+        }
+
+        // 削除前にスナップショットを使用している比較セッションを閉じてアンマウントする
+        // (書き込みロック中で復元にも使用されていないため、他のスレッドはセッションを使用していない)
+        closeSessions(configName, {number}).clear();
+
+        // 領域の解放を追跡するため、削除前にサブボリュームIDを取得する
+        const quint64 subvolumeId = SubvolumeUsage::subvolumeId(QString::fromStdString(snapshot->snapshotDir()));
+
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+        snapper::Plugins::Report report;
+        snapper->deleteSnapshot(snapshot, report);
+        logPluginReport(report);
+#else
+        snapper->deleteSnapshot(snapshot);
+#endif
+        publishChanges(configName, {}, {number});
+        trackReclaim(configName, snapper.get(), {subvolumeId});
+        return true;
+
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to delete snapshot:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to delete snapshot: %1").arg(e.what()));
+        return false;
+    }
+}
+
+/**
+ * @brief 複数のスナップショットを一括削除
+ *
+ * 認証とスナップショット一覧のロックを1回だけ行い、指定された範囲の
+ * スナップショットをまとめて削除します。
+ * 範囲は"42"のような番号、または"100-450"のような両端を含む範囲で指定します。
+ * 範囲に含まれる番号のうち存在しないものは無視し、
+ * 単独で指定した番号が存在しない場合は失敗として結果に含めます。
+ * 現在のシステム (番号0)は削除しません。
+ * 領域の解放を待たずに応答し、解放の進捗はSpaceReclaimProgressシグナルで通知します。
+ *
+ * @param configName Snapper設定名
+ * @param ranges 削除するスナップショット番号の範囲
+ * @return 番号ごとの削除結果 (番号順)
+ */
+QList<DeletionResult> SnapshotOperations::DeleteSnapshots(const QString &configName, const QStringList &ranges)
+{
+    if (!checkAuthorization("com.presire.qsnapper.delete-snapshot")) {
+        return {};
+    }
+
+    QList<QPair<int, int>> numberRanges;
+    QString error;
+    if (!parseNumberRanges(ranges, numberRanges, error)) {
+        replyError(QDBusError::InvalidArgs, error);
+        return {};
+    }
+
+    QWriteLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return {};
+        }
+
+        snapper::Snapshots &snapshots = snapper->getSnapshots();
+
+        auto inRanges = [&numberRanges](int number) {
+            return std::any_of(numberRanges.cbegin(), numberRanges.cend(), [number](const QPair<int, int> &range) {
+                return number >= range.first && number <= range.second;
+            });
+        };
+
+        // 削除するスナップショットを一度に選ぶ
+        QList<int> targets;
+        for (auto it = snapshots.begin(); it != snapshots.end(); ++it) {
+            if (!it->isCurrent() && inRanges(it->getNum())) {
+                targets.append(it->getNum());
+            }
+        }
+
+        QList<DeletionResult> results;
+        for (const QPair<int, int> &range : std::as_const(numberRanges)) {
+            if (range.first == range.second && !targets.contains(range.first)) {
+                DeletionResult result;
+                result.number = range.first;
+                result.error = "Snapshot not found";
+                results.append(result);
+            }
+        }
+
+        results.append(deleteSnapshots(configName, snapper.get(), targets));
+
+        std::sort(results.begin(), results.end(), [](const DeletionResult &a, const DeletionResult &b) {
+            return a.number < b.number;
+        });
+
+        return results;
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to delete snapshots:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to delete snapshots: %1").arg(e.what()));
+        return {};
+    }
+}
+
+/**
+ * @brief 指定されたスナップショットを削除
+ *
+ * 対象のスナップショットを使用している比較セッションを閉じてから1つずつ削除し、
+ * 削除できたスナップショットをまとめてSnapshotsChangedシグナルで通知します。
+ * 設定の書き込みロックを取得した状態で呼び出してください。
+ *
+ * @param configName Snapper設定名
+ * @param snapper 設定のSnapperインスタンス
+ * @param numbers 削除するスナップショット番号
+ * @return 番号ごとの削除結果 (numbersの順)
+ */
+QList<DeletionResult> SnapshotOperations::deleteSnapshots(const QString &configName, snapper::Snapper *snapper,
+                                                          const QList<int> &numbers)
+{
+    snapper::Snapshots &snapshots = snapper->getSnapshots();
+
+    // 復元は設定のロックを解放して実行するため、使用中のスナップショットは削除しない
+    QList<int> deletable;
+    for (int number : numbers) {
+        if (!isRestoring(configName, number)) {
+            deletable.append(number);
+        }
+    }
+
+    // 削除前に対象のスナップショットを使用している比較セッションを閉じてアンマウントする
+    // (書き込みロック中で復元にも使用されていないため、他のスレッドはセッションを使用していない)
+    closeSessions(configName, deletable).clear();
+
+    QList<DeletionResult> results;
+    QList<int> removed;
+    QList<quint64> subvolumeIds;
+    for (int number : numbers) {
+        DeletionResult result;
+        result.number = number;
+
+        try {
+            snapper::Snapshots::iterator snapshot = snapshots.find(number);
+            if (snapshot == snapshots.end()) {
+                result.error = "Snapshot not found";
+            }
+            else if (!deletable.contains(number)) {
+                result.error = "Snapshot is being used by a restore";
+            }
+            else {
+                const quint64 subvolumeId = SubvolumeUsage::subvolumeId(
+                    QString::fromStdString(snapshot->snapshotDir()));
+
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+                snapper::Plugins::Report report;
+                snapper->deleteSnapshot(snapshot, report);
+                logPluginReport(report);
+#else
+                snapper->deleteSnapshot(snapshot);
+#endif
+                result.success = true;
+                removed.append(number);
+                subvolumeIds.append(subvolumeId);
+            }
+        }
+        catch (const snapper::Exception &e) {
+            qWarning() << "Failed to delete snapshot" << number << ":" << e.what();
+            result.error = QString("Failed to delete snapshot: %1").arg(e.what());
+        }
+
+        results.append(result);
+    }
+
+    if (!removed.isEmpty()) {
+        publishChanges(configName, {}, removed);
+        trackReclaim(configName, snapper, subvolumeIds);
+    }
+
+    qWarning() << "Deleted" << removed.size() << "of" << numbers.size() << "snapshots in" << configName;
+
+    return results;
+}
+
+/**
+ * @brief クリーンアップの計画を作成
+ *
+ * 設定ファイルの上限値 (NUMBER_LIMIT、TIMELINE_LIMIT_*など)に従って、
+ * snapperのcleanupで削除されるスナップショットを計算します。スナップショットは削除しません。
+ * 計画はRunCleanupで実行でき、作成したクライアントだけが10分以内に実行できます。
+ * 解放される容量の見積もりは、btrfsのクォータが有効な場合の対象スナップショットの
+ * 排他量の合計です (スナップショット間で共有しているデータは含まない下限値です)。
+ *
+ * @param configName Snapper設定名
+ * @param algorithm クリーンアップアルゴリズム ("number"、"timeline"、"empty-pre-post")
+ * @param numbers 削除されるスナップショット番号 (出力、番号順)
+ * @param estimatedBytes 解放される容量の見積もり (出力、バイト、見積もれない場合は-1)
+ * @return 計画ID、失敗時は0
+ */
+uint SnapshotOperations::PlanCleanup(const QString &configName, const QString &algorithm,
+                                     QList<int> &numbers, qlonglong &estimatedBytes)
+{
+    numbers.clear();
+    estimatedBytes = -1;
+
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return 0;
+    }
+
+    CleanupPlanner::Algorithm cleanupAlgorithm;
+    if (!CleanupPlanner::parseAlgorithm(algorithm, cleanupAlgorithm)) {
+        replyError(QDBusError::InvalidArgs, QString("Unknown cleanup algorithm: '%1'").arg(algorithm));
+        return 0;
+    }
+
+    try {
+        QReadLocker locker(configLock(configName));
+
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return 0;
+        }
+
+        {
+            // empty-pre-postの比較はスナップショットをマウントする場合がある
+            std::shared_ptr<QMutex> mount = mountLock(configName);
+            QMutexLocker mountLocker(cleanupAlgorithm == CleanupPlanner::Algorithm::EmptyPrePost
+                                     ? mount.get() : nullptr);
+
+            numbers = CleanupPlanner(snapper.get()).plan(cleanupAlgorithm);
+        }
+
+        QHash<quint64, SubvolumeUsage::Usage> usage;
+        if (SubvolumeUsage::readQgroups(QString::fromStdString(snapper->subvolumeDir()), usage)) {
+            const snapper::Snapshots &snapshots = snapper->getSnapshots();
+
+            estimatedBytes = 0;
+            for (int number : std::as_const(numbers)) {
+                auto snapshot = snapshots.find(number);
+                if (snapshot != snapshots.end()) {
+                    const quint64 id = SubvolumeUsage::subvolumeId(QString::fromStdString(snapshot->snapshotDir()));
+                    estimatedBytes += usage.value(id).exclusive;
+                }
+            }
+        }
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to plan cleanup:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to plan cleanup: %1").arg(e.what()));
+        numbers.clear();
+        return 0;
+    }
+
+    CleanupPlan plan;
+    plan.configName = configName;
+    plan.numbers = numbers;
+    plan.owner = callerName();
+    plan.created.start();
+
+    QMutexLocker plansLocker(&m_cleanupPlansMutex);
+
+    // 期限切れの計画と、上限を超えた古い計画を破棄する
+    for (auto it = m_cleanupPlans.begin(); it != m_cleanupPlans.end(); ) {
+        it = it->created.hasExpired(CleanupPlanLifetimeMs) ? m_cleanupPlans.erase(it) : std::next(it);
+    }
+
+    while (m_cleanupPlans.size() >= MaxCleanupPlans) {
+        auto oldest = std::max_element(m_cleanupPlans.begin(), m_cleanupPlans.end(),
+                                       [](const CleanupPlan &a, const CleanupPlan &b) {
+            return a.created.elapsed() < b.created.elapsed();
+        });
+        m_cleanupPlans.erase(oldest);
+    }
+
+    uint id = m_nextCleanupPlanId++;
+    if (id == 0) {
+        id = m_nextCleanupPlanId++;
+    }
+    m_cleanupPlans.insert(id, plan);
+
+    qWarning() << "PlanCleanup:" << algorithm << "cleanup of" << configName << "would delete"
+               << numbers.size() << "snapshots (plan" << id << ")";
+
+    return id;
+}
+
+/**
+ * @brief クリーンアップの計画を実行
+ *
+ * PlanCleanupで計算したスナップショットだけを一括削除します
+ * (計画後に作成されたスナップショットは対象になりません)。
+ * 計画後に削除されたスナップショットは失敗として結果に含めます。
+ * 計画は1回だけ実行できます。
+ * PolicyKit認証を必要とします。
+ *
+ * @param planId PlanCleanupが返した計画ID
+ * @return 番号ごとの削除結果 (番号順)
+ */
+QList<DeletionResult> SnapshotOperations::RunCleanup(uint planId)
+{
+    if (!checkAuthorization("com.presire.qsnapper.delete-snapshot")) {
+        return {};
+    }
+
+    CleanupPlan plan;
+    {
+        QMutexLocker plansLocker(&m_cleanupPlansMutex);
+
+        auto it = m_cleanupPlans.find(planId);
+        if (it == m_cleanupPlans.end() || it->created.hasExpired(CleanupPlanLifetimeMs)) {
+            replyError(QDBusError::InvalidArgs, "Unknown or expired cleanup plan");
+            return {};
+        }
+
+        if (it->owner != callerName()) {
+            replyError(QDBusError::AccessDenied, "Cleanup plan belongs to another client");
+            return {};
+        }
+
+        plan = it.value();
+        m_cleanupPlans.erase(it);
+    }
+
+    if (plan.numbers.isEmpty()) {
+        return {};
+    }
+
+    QWriteLocker locker(configLock(plan.configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(plan.configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return {};
+        }
+
+        return deleteSnapshots(plan.configName, snapper.get(), plan.numbers);
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to run cleanup:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to run cleanup: %1").arg(e.what()));
+        return {};
+    }
+}
+
+/**
+ * @brief 削除したスナップショットの領域の解放状況を取得
+ *
+ * SpaceReclaimProgressシグナルの最新の値を返します。
+ * 後から接続したクライアントが現在の状況を知るために使用します。
+ * PolicyKit認証を必要とします。
+ *
+ * @param configName Snapper設定名
+ * @param pendingSubvolumes 解放待ちのサブボリューム数 (出力)
+ * @param bytesFreed 追跡開始時からの空き容量の増加分 (出力、バイト)
+ * @return 解放を追跡中の場合true
+ */
+bool SnapshotOperations::GetSpaceReclaimStatus(const QString &configName, int &pendingSubvolumes,
+                                               qlonglong &bytesFreed)
+{
+    pendingSubvolumes = 0;
+    bytesFreed = 0;
+
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return false;
+    }
+
+    qint64 freed = 0;
+    const bool tracking = m_reclaimTracker.status(configName, pendingSubvolumes, freed);
+    bytesFreed = freed;
+    return tracking;
+}
+
+/**
+ * @brief 削除したサブボリュームの領域の解放の追跡を開始
+ *
+ * ワーカースレッドから呼び出せます (追跡はメインスレッドで行います)。
+ *
+ * @param configName Snapper設定名
+ * @param snapper 削除に使用したSnapperインスタンス
+ * @param subvolumeIds 削除したサブボリュームのID (btrfs以外は0)
+ */
+void SnapshotOperations::trackReclaim(const QString &configName, const snapper::Snapper *snapper,
+                                      const QList<quint64> &subvolumeIds)
+{
+    const QString path = QString::fromStdString(snapper->subvolumeDir());
+
+    QMetaObject::invokeMethod(this, [this, configName, path, subvolumeIds]() {
+        m_reclaimTracker.track(configName, path, subvolumeIds);
+    });
+}
+
+/**
+ * @brief スナップショットにロールバック
+ *
+ * 指定されたスナップショットをデフォルトに設定し、次回起動時に
+ * そのスナップショットの状態で起動するようにします。
+ *
+ * @param configName Snapper設定名
+ * @param number ロールバック先のスナップショット番号
+ * @return 設定成功時true、失敗時false
+ */
+bool SnapshotOperations::RollbackSnapshot(const QString &configName, int number)
+{
+    if (!checkAuthorization("com.presire.qsnapper.rollback-snapshot")) {
+        return false;
+    }
+
+    QWriteLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return false;
+        }
+
+        snapper::Snapshots::iterator snapshot = snapper->getSnapshots().find(number);
+        if (snapshot == snapper->getSnapshots().end()) {
+            replyError(QDBusError::Failed, "Snapshot not found");
+            return false;
+        }
+
+        // スナップショットをデフォルトに設定 (次回起動時に適用される)
+#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
+        snapper::Plugins::Report report;
+        snapshot->setDefault(report);
+        logPluginReport(report);
+#else
+        snapshot->setDefault();
+#endif
+        return true;
+
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to rollback snapshot:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to rollback snapshot: %1").arg(e.what()));
+        return false;
+    }
+}
+
+/**
+ * @brief スナップショットを比較してファイル変更一覧を作成
+ *
+ * 各要素は "ステータス パス" 形式で、パスの昇順に並びます。
+ * スナップショット同士の比較結果は変化しないため、ディスクキャッシュに保存し、
+ * 次回以降はキャッシュから読み込みます。
+ * scopeを指定した場合は、キャッシュがなければファイルシステム全体を比較せず、
+ * 指定されたディレクトリだけを走査します (この結果はキャッシュに保存しません)。
+ *
+ * @param configName Snapper設定名
+ * @param snapper Snapperインスタンスへのポインタ
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param scope 比較するディレクトリ (空の場合はファイルシステム全体)
+ * @return ファイル変更一覧 (scopeを指定した場合は、その外の変更を含むことがある)
+ * @throws snapper::Exception 比較に失敗した場合
+ * @throws std::runtime_error スナップショットが存在しない場合
+ */
+QStringList SnapshotOperations::collectFileChanges(const QString &configName, snapper::Snapper *snapper,
+                                                   int snapshotNumber, int compareTo, const QStringList &scope)
+{
+    // snapshot1: 比較元 (指定されたスナップショット)
+    // snapshot2: 比較先 (指定されたスナップショット、または現在のシステム状態)
+    const snapper::Snapshots &snapshots = snapper->getSnapshots();
+    snapper::Snapshots::const_iterator snapshot1 = snapshots.find(snapshotNumber);
+    snapper::Snapshots::const_iterator snapshot2 = compareTo == 0 ? snapper->getSnapshotCurrent()
+                                                                  : snapshots.find(compareTo);
+
+    if (snapshot1 == snapshots.end() || snapshot2 == snapshots.end()) {
+        throw std::runtime_error("Snapshot not found");
+    }
+
+    ComparisonCache::Key key;
+    if (compareTo != 0) {
+        key.configName = configName;
+        key.number1 = snapshotNumber;
+        key.number2 = compareTo;
+        key.generation1 = SubvolumeUsage::generation(QString::fromStdString(snapshot1->snapshotDir()));
+        key.generation2 = SubvolumeUsage::generation(QString::fromStdString(snapshot2->snapshotDir()));
+        key.date1 = snapshot1->getDate();
+        key.date2 = snapshot2->getDate();
+
+        QStringList changes;
+        if (m_comparisonCache.load(key, changes)) {
+            return changes;
+        }
+    }
+
+    if (!scope.isEmpty()) {
+        ScopedComparison comparison(snapper, snapshotNumber, compareTo, mountLock(configName));
+        return comparison.changes(scope);
+    }
+
+    // Comparisonオブジェクトを作成してファイル変更を取得
+    // snapshot1からsnapshot2への変更を取得
+    ServiceMetrics::StageTimer timer(ServiceMetrics::Compare);
+    snapper::Comparison comparison(snapper, snapshot1, snapshot2, false);
+    const QStringList changes = ComparisonSession::formatChanges(comparison.getFiles());
+    ServiceMetrics::addFiles(changes.size());
+
+    if (compareTo != 0) {
+        m_comparisonCache.store(key, changes);
+    }
+
+    return changes;
+}
+
+/**
+ * @brief 比較セッションを開く
+ *
+ * 2つのスナップショットを比較してスナップショットをマウントし、その結果を保持します。
+ * セッションを開いたクライアントからの同じ組み合わせに対するファイル変更一覧の取得、
+ * 差分の取得、ファイルの復元は、比較をやり直さずにこの結果を使います。
+ * 一定時間使用されなかったセッションは自動的に閉じられます。
+ *
+ * @param configName Snapper設定名
+ * @param snapshot1 比較元のスナップショット番号
+ * @param snapshot2 比較先のスナップショット番号 (0は現在のシステム)
+ * @return セッションのハンドル、失敗時は0
+ */
+uint SnapshotOperations::OpenComparison(const QString &configName, int snapshot1, int snapshot2)
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return 0;
+    }
+
+    if (!isValidComparison(snapshot1, snapshot2)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return 0;
+    }
+
+    // 同じクライアントが同じ組み合わせを開いている場合は再利用
+    // 他の呼び出しが同じ組み合わせを比較中の場合は、比較し直さずその完了を待つ
+    const QString owner = callerName();
+    const QString openingKey = sessionKey(configName, snapshot1, snapshot2, owner);
+    {
+        QMutexLocker sessionsLocker(&m_sessionsMutex);
+        for (;;) {
+            for (auto it = m_sessions.constBegin(); it != m_sessions.constEnd(); ++it) {
+                if (it.value()->matches(configName, snapshot1, snapshot2, owner)) {
+                    it.value()->touch();
+                    return it.key();
+                }
+            }
+
+            if (!m_openingSessions.contains(openingKey)) {
+                break;
+            }
+            m_sessionOpened.wait(&m_sessionsMutex);
+        }
+
+        m_openingSessions.insert(openingKey);
+    }
+
+    std::shared_ptr<ComparisonSession> session;
+    QString error;
+
+    {
+        QReadLocker locker(configLock(configName));
+
+        try {
+            std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+            if (snapper) {
+                session = std::make_shared<ComparisonSession>(snapper, configName, snapshot1, snapshot2, owner,
+                                                              mountLock(configName));
+            }
+            else {
+                error = "Failed to initialize Snapper";
+            }
+        }
+        catch (const snapper::Exception &e) {
+            qWarning() << "Failed to open comparison:" << e.what();
+            error = QString("Failed to open comparison: %1").arg(e.what());
+        }
+        catch (const std::runtime_error &e) {
+            error = e.what();
+        }
+    }
+
+    std::shared_ptr<ComparisonSession> evicted;
+    uint handle = 0;
+    {
+        QMutexLocker sessionsLocker(&m_sessionsMutex);
+
+        if (session) {
+            // 上限に達している場合は最も長く使われていないセッションを閉じる
+            if (m_sessions.size() >= MaxSessions) {
+                auto oldest = std::max_element(m_sessions.begin(), m_sessions.end(),
+                    [](const std::shared_ptr<ComparisonSession> &a, const std::shared_ptr<ComparisonSession> &b) {
+                        return a->idleTime() < b->idleTime();
+                    });
+                evicted = oldest.value();
+                m_sessions.erase(oldest);
+            }
+
+            handle = m_nextSessionHandle++;
+            m_sessions.insert(handle, session);
+        }
+
+        // 完了を待っている呼び出しは、セッションを再利用するか自身で比較し直す
+        m_openingSessions.remove(openingKey);
+        m_sessionOpened.wakeAll();
+    }
+
+    if (!session) {
+        replyError(QDBusError::Failed, error);
+        return 0;
+    }
+
+    // タイマーはメインスレッドで開始する
+    QMetaObject::invokeMethod(&m_sessionTimer, [this]() {
+        if (!m_sessionTimer.isActive()) {
+            m_sessionTimer.start();
+        }
+    });
+
+    return handle;
+}
+
+/**
+ * @brief 比較セッションを閉じる
+ *
+ * スナップショットをアンマウントし、比較結果を破棄します。
+ * 他のクライアントが開いたセッションは閉じられません。
+ *
+ * @param handle OpenComparisonが返したハンドル
+ */
+void SnapshotOperations::CloseComparison(uint handle)
+{
+    ServiceMetrics::CallScope metricsScope(m_metrics, QStringLiteral("CloseComparison"));
+    resetIdleTimer();
+
+    std::shared_ptr<ComparisonSession> session;
+    {
+        QMutexLocker sessionsLocker(&m_sessionsMutex);
+        auto it = m_sessions.find(handle);
+        if (it == m_sessions.end() || it.value()->owner() != callerName()) {
+            replyError(QDBusError::InvalidArgs, "Unknown comparison handle");
+            return;
+        }
+
+        session = it.value();
+        m_sessions.erase(it);
+    }
+
+    releaseSessions({session});
+}
+
+/**
+ * @brief 比較セッションを検索
+ *
+ * 指定されたクライアントが開いたセッションのうち、指定された組み合わせのものを返します。
+ * セッションを使用する間は、セッションのmutex()をロックします。
+ * 同じ組み合わせのセッションをOpenComparisonが比較中の場合は、その完了を待ちます。
+ * 復元ジョブのスレッドではD-Busの呼び出し元を参照できないため、所有者は呼び出し側が渡します。
+ *
+ * @param configName Snapper設定名
+ * @param number1 比較元のスナップショット番号
+ * @param number2 比較先のスナップショット番号 (0は現在のシステム)
+ * @param owner セッションを開いたクライアントのバス名
+ * @return セッション、開かれていない場合はnullptr
+ */
+std::shared_ptr<ComparisonSession> SnapshotOperations::findSession(const QString &configName,
+                                                                   int number1, int number2,
+                                                                   const QString &owner)
+{
+    if (owner.isEmpty()) {
+        return nullptr;
+    }
+
+    const QString openingKey = sessionKey(configName, number1, number2, owner);
+
+    QMutexLocker sessionsLocker(&m_sessionsMutex);
+    for (;;) {
+        for (const std::shared_ptr<ComparisonSession> &session : std::as_const(m_sessions)) {
+            if (session->matches(configName, number1, number2, owner)) {
+                session->touch();
+                return session;
+            }
+        }
+
+        // OpenComparisonが同じ組み合わせを比較中の場合は、比較し直さずその完了を待つ
+        if (!m_openingSessions.contains(openingKey)) {
+            return nullptr;
+        }
+        m_sessionOpened.wait(&m_sessionsMutex);
+    }
+}
+
+/**
+ * @brief 比較中のセッションを識別するキーを作成
+ *
+ * @param configName Snapper設定名
+ * @param number1 比較元のスナップショット番号
+ * @param number2 比較先のスナップショット番号 (0は現在のシステム)
+ * @param owner セッションを開くクライアントのバス名
+ * @return キー
+ */
+QString SnapshotOperations::sessionKey(const QString &configName, int number1, int number2, const QString &owner)
+{
+    return owner + '\n' + configName + '\n' + QString::number(number1) + '\n' + QString::number(number2);
+}
+
+/**
+ * @brief 指定されたスナップショットを使用している比較セッションを閉じる
+ *
+ * セッションの一覧から取り除いたセッションを返します。
+ * 最後の参照が破棄された時点でスナップショットがアンマウントされます。
+ *
+ * @param configName Snapper設定名
+ * @param numbers スナップショット番号
+ * @return 閉じたセッション
+ */
+QList<std::shared_ptr<ComparisonSession>> SnapshotOperations::closeSessions(const QString &configName,
+                                                                           const QList<int> &numbers)
+{
+    QList<std::shared_ptr<ComparisonSession>> closed;
+
+    QMutexLocker sessionsLocker(&m_sessionsMutex);
+    for (auto it = m_sessions.begin(); it != m_sessions.end(); ) {
+        const bool involved = std::any_of(numbers.begin(), numbers.end(), [&](int number) {
+            return it.value()->involves(configName, number);
+        });
+
+        if (involved) {
+            closed.append(it.value());
+            it = m_sessions.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    return closed;
+}
+
+/**
+ * @brief 閉じた比較セッションをワーカースレッドで破棄
+ *
+ * アンマウントは同じ設定の比較が終わるまで待つことがあるため、
+ * メインスレッドを止めないようワーカースレッドで行います。
+ *
+ * @param sessions 閉じたセッション
+ */
+void SnapshotOperations::releaseSessions(QList<std::shared_ptr<ComparisonSession>> sessions)
+{
+    if (sessions.isEmpty()) {
+        return;
+    }
+
+    m_workers.start([sessions = std::move(sessions)]() mutable {
+        sessions.clear();
+    });
+}
+
+/**
+ * @brief スナップショットが復元に使用されているかを確認
+ *
+ * 設定の書き込みロックを取得した状態で呼び出してください。
+ *
+ * @param configName Snapper設定名
+ * @param number スナップショット番号
+ * @return 復元に使用されている場合true
+ */
+bool SnapshotOperations::isRestoring(const QString &configName, int number)
+{
+    QMutexLocker restoringLocker(&m_restoringMutex);
+    return m_restoringSnapshots.value(configName).value(number) > 0;
+}
+
+/**
+ * @brief RestoringScopeクラスのコンストラクタ
+ *
+ * @param operations 登録先
+ * @param configName Snapper設定名
+ * @param numbers 復元に使用するスナップショット番号 (0は登録しない)
+ */
+SnapshotOperations::RestoringScope::RestoringScope(SnapshotOperations *operations, const QString &configName,
+                                                   const QList<int> &numbers)
+    : m_operations(operations)
+    , m_configName(configName)
+{
+    for (int number : numbers) {
+        if (number != 0) {
+            m_numbers.append(number);
+        }
+    }
+
+    QMutexLocker restoringLocker(&m_operations->m_restoringMutex);
+    QHash<int, int> &restoring = m_operations->m_restoringSnapshots[m_configName];
+    for (int number : std::as_const(m_numbers)) {
+        ++restoring[number];
+    }
+}
+
+/**
+ * @brief RestoringScopeクラスのデストラクタ
+ */
+SnapshotOperations::RestoringScope::~RestoringScope()
+{
+    QMutexLocker restoringLocker(&m_operations->m_restoringMutex);
+    QHash<int, int> &restoring = m_operations->m_restoringSnapshots[m_configName];
+    for (int number : std::as_const(m_numbers)) {
+        if (--restoring[number] <= 0) {
+            restoring.remove(number);
+        }
+    }
+
+    if (restoring.isEmpty()) {
+        m_operations->m_restoringSnapshots.remove(m_configName);
+    }
+}
+
+/**
+ * @brief 期限切れの比較セッションを閉じる
+ *
+ * 一定時間使用されていないセッションを閉じ、スナップショットをアンマウントします。
+ */
+void SnapshotOperations::expireSessions()
+{
+    QList<std::shared_ptr<ComparisonSession>> expired;
+    bool empty = false;
+
+    {
+        QMutexLocker sessionsLocker(&m_sessionsMutex);
+        for (auto it = m_sessions.begin(); it != m_sessions.end(); ) {
+            if (it.value()->idleTime() > SessionIdleMs) {
+                qInfo() << "Closing idle comparison session" << it.key();
+                expired.append(it.value());
+                it = m_sessions.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        empty = m_sessions.isEmpty();
+    }
+
+    releaseSessions(std::move(expired));
+
+    if (empty) {
+        m_sessionTimer.stop();
+    }
+}
+
+/**
+ * @brief ファイル変更一覧を取得
+ *
+ * 指定されたスナップショットと比較先 (別のスナップショット、または現在のシステム状態)を
+ * 比較し、変更されたファイルの一覧を取得します。
+ * 絞り込み条件に一致しない変更は送信しません。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param pathPrefixes 含めるパスの接頭辞 (空の場合は全て)
+ * @param includeGlobs 含めるglob (空の場合は全て)
+ * @param excludeGlobs 除外するglob
+ * @param statusMask 含めるステータスのビット (ChangeFilter::Status、0は全て)
+ * @return ファイル変更のステータスとパスの一覧、失敗時は空文字列
+ */
+QString SnapshotOperations::GetFileChanges(const QString &configName, int snapshotNumber, int compareTo,
+                                           const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                                           const QStringList &excludeGlobs, uint statusMask)
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QString();
+    }
+
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return QString();
+    }
+
+    const ChangeFilter filter(pathPrefixes, includeGlobs, excludeGlobs, statusMask);
+    QString filterError;
+    if (!filter.validate(filterError)) {
+        replyError(QDBusError::InvalidArgs, filterError);
+        return QString();
+    }
+
+    QReadLocker locker(configLock(configName));
+
+    try {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return QString();
+        }
+
+        const QStringList changes = filter.apply(
+            collectFileChanges(configName, snapper.get(), snapshotNumber, compareTo, filter.pathPrefixes()));
+        if (changes.isEmpty()) {
+            return QString();
+        }
+
+        ServiceMetrics::StageTimer serializeTimer(ServiceMetrics::Serialize);
+        const QString result = changes.join('\n') + '\n';
+        ServiceMetrics::addBytes(result.size());
+
+        return result;
+
+    } catch (const snapper::Exception &e) {
+        qWarning() << "Failed to get file changes:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get file changes: %1").arg(e.what()));
+        return QString();
+    } catch (const std::runtime_error &e) {
+        replyError(QDBusError::Failed, e.what());
+        return QString();
+    }
+}
+
+/**
+ * @brief ファイル変更一覧をページ単位で取得
+ *
+ * 大量の変更がある場合に一度のD-Busメッセージで全件を送信しないよう、
+ * 指定された範囲だけを返します。offsetが0の呼び出しで比較を実行して
+ * 結果をキャッシュし、同じ設定とスナップショットの組、同じ絞り込み条件に対する
+ * offsetが1以上の呼び出しはキャッシュから返します。
+ * 絞り込みは送信前に行い、totalは絞り込み後の件数です。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param pathPrefixes 含めるパスの接頭辞 (空の場合は全て)
+ * @param includeGlobs 含めるglob (空の場合は全て)
+ * @param excludeGlobs 除外するglob
+ * @param statusMask 含めるステータスのビット (ChangeFilter::Status、0は全て)
+ * @param offset 取得開始位置
+ * @param limit 取得する最大件数 (最大50000)
+ * @param total ファイル変更の総数 (出力)
+ * @return "ステータス パス"形式のファイル変更一覧、失敗時は空のリスト
+ */
+QStringList SnapshotOperations::GetFileChangesPage(const QString &configName, int snapshotNumber,
+                                                   int compareTo, const QStringList &pathPrefixes,
+                                                   const QStringList &includeGlobs,
+                                                   const QStringList &excludeGlobs, uint statusMask,
+                                                   int offset, int limit, int &total)
+{
+    total = 0;
+
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QStringList();
+    }
+
+    if (offset < 0 || limit <= 0) {
+        replyError(QDBusError::InvalidArgs, "Invalid offset or limit");
+        return QStringList();
+    }
+
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return QStringList();
+    }
+
+    const ChangeFilter filter(pathPrefixes, includeGlobs, excludeGlobs, statusMask);
+    QString filterError;
+    if (!filter.validate(filterError)) {
+        replyError(QDBusError::InvalidArgs, filterError);
+        return QStringList();
+    }
+
+    QReadLocker locker(configLock(configName));
+
+    try {
+        const QStringList changeList = loadChangeList(configName, snapshotNumber, compareTo, filter, offset > 0);
+
+        total = changeList.size();
+        const QStringList page = changeList.mid(offset, qMin(limit, MaxPageSize));
+
+        qsizetype size = 0;
+        for (const QString &change : page) {
+            size += change.size() + 1;
+        }
+        ServiceMetrics::addBytes(size);
+
+        return page;
+
+    } catch (const snapper::Exception &e) {
+        qWarning() << "Failed to get file changes:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get file changes: %1").arg(e.what()));
+        return QStringList();
+    } catch (const std::runtime_error &e) {
+        replyError(QDBusError::Failed, e.what());
+        return QStringList();
+    }
+}
+
+/**
+ * @brief ファイル変更一覧をキャッシュに読み込む
+ *
+ * キャッシュはクライアントと比較、絞り込み条件ごとに保持するため、
+ * 他のクライアントの取得や復元で入れ替わりません。
+ * 比較はキャッシュのロックの外で行うため、他のスレッドの取得を妨げません。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filter 絞り込み条件
+ * @param reuse 呼び出し元のクライアントに同じ比較と絞り込み条件のキャッシュがあれば再利用する場合true
+ * @return 絞り込み後のファイル変更一覧
+ * @throws std::runtime_error Snapperの初期化に失敗した場合、スナップショットが存在しない場合
+ */
+QStringList SnapshotOperations::loadChangeList(const QString &configName, int snapshotNumber, int compareTo,
+                                               const ChangeFilter &filter, bool reuse)
+{
+    const QString owner = callerName();
+
+    if (reuse) {
+        QMutexLocker cacheLocker(&m_changeListMutex);
+        if (ChangeListCache *cache = findChangeList(owner, configName, snapshotNumber, compareTo, filter)) {
+            cache->used.start();
+            return cache->changes;
+        }
+    }
+
+    QStringList changeList;
+
+    // 比較セッションが開かれている場合はその比較結果を使う
+    if (std::shared_ptr<ComparisonSession> session = findSession(configName, snapshotNumber, compareTo, owner)) {
+        QMutexLocker sessionLocker(&session->mutex());
+        changeList = session->changes();
+    }
+    else {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+        if (!snapper) {
+            throw std::runtime_error("Failed to initialize Snapper");
+        }
+
+        changeList = collectFileChanges(configName, snapper.get(), snapshotNumber, compareTo,
+                                        filter.pathPrefixes());
+    }
+
+    changeList = filter.apply(changeList);
+
+    QMutexLocker cacheLocker(&m_changeListMutex);
+
+    ChangeListCache *cache = findChangeList(owner, configName, snapshotNumber, compareTo, filter);
+    if (!cache) {
+        // 上限を超える場合は、最も使われていない一覧を破棄する
+        while (m_changeLists.size() >= MaxChangeLists) {
+            auto oldest = std::max_element(m_changeLists.begin(), m_changeLists.end(),
+                                           [](const ChangeListCache &a, const ChangeListCache &b) {
+                return a.used.elapsed() < b.used.elapsed();
+            });
+            m_changeLists.erase(oldest);
+        }
+
+        ChangeListCache entry;
+        entry.owner = owner;
+        entry.configName = configName;
+        entry.snapshotNumber = snapshotNumber;
+        entry.compareTo = compareTo;
+        entry.filter = filter;
+        m_changeLists.append(entry);
+        cache = &m_changeLists.last();
+    }
+
+    cache->changes = changeList;
+    cache->tree.reset();
+    cache->used.start();
+
+    return changeList;
+}
+
+/**
+ * @brief ファイル変更一覧のツリーを取得
+ *
+ * ツリーはファイル変更一覧のキャッシュと一緒に保持し、
+ * ファイル変更一覧を読み込み直すと破棄します。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filter 絞り込み条件
+ * @param reuse 呼び出し元のクライアントに同じ比較と絞り込み条件のキャッシュがあれば再利用する場合true
+ * @return 絞り込み後のファイル変更一覧のツリー
+ * @throws std::runtime_error Snapperの初期化に失敗した場合、スナップショットが存在しない場合
+ */
+std::shared_ptr<const ChangeTree> SnapshotOperations::loadChangeTree(const QString &configName, int snapshotNumber,
+                                                                     int compareTo, const ChangeFilter &filter,
+                                                                     bool reuse)
+{
+    const QString owner = callerName();
+
+    if (reuse) {
+        QMutexLocker cacheLocker(&m_changeListMutex);
+        ChangeListCache *cache = findChangeList(owner, configName, snapshotNumber, compareTo, filter);
+        if (cache && cache->tree) {
+            cache->used.start();
+            return cache->tree;
+        }
+    }
+
+    const QStringList changeList = loadChangeList(configName, snapshotNumber, compareTo, filter, reuse);
+    auto tree = std::make_shared<const ChangeTree>(changeList);
+
+    // 作成中に一覧が破棄された場合は保存しない
+    QMutexLocker cacheLocker(&m_changeListMutex);
+    if (ChangeListCache *cache = findChangeList(owner, configName, snapshotNumber, compareTo, filter)) {
+        cache->tree = tree;
+    }
+
+    return tree;
+}
+
+/**
+ * @brief キャッシュしているファイル変更一覧を検索
+ *
+ * m_changeListMutexを取得した状態で呼び出します。
+ *
+ * @param owner クライアントのバス名
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filter 絞り込み条件
+ * @return 一致するキャッシュ、存在しない場合はnullptr
+ */
+SnapshotOperations::ChangeListCache *SnapshotOperations::findChangeList(const QString &owner,
+                                                                        const QString &configName,
+                                                                        int snapshotNumber, int compareTo,
+                                                                        const ChangeFilter &filter)
+{
+    for (ChangeListCache &cache : m_changeLists) {
+        if (cache.owner == owner && cache.configName == configName && cache.snapshotNumber == snapshotNumber
+            && cache.compareTo == compareTo && cache.filter == filter) {
+            return &cache;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief スナップショットを含むファイル変更一覧のキャッシュを破棄
+ *
+ * 復元で内容が変化したスナップショット (0は現在のシステム)を比較した一覧だけを破棄し、
+ * 他の比較の一覧は残します。
+ *
+ * @param configName Snapper設定名
+ * @param number 内容が変化したスナップショット番号
+ */
+void SnapshotOperations::invalidateChangeLists(const QString &configName, int number)
+{
+    QMutexLocker cacheLocker(&m_changeListMutex);
+
+    m_changeLists.removeIf([&](const ChangeListCache &cache) {
+        return cache.configName == configName
+               && (cache.snapshotNumber == number || cache.compareTo == number);
+    });
+}
+
+/**
+ * @brief ディレクトリ直下のファイル変更を取得
+ *
+ * ファイル変更一覧をディレクトリツリーとして扱い、指定されたディレクトリ直下の
+ * エントリだけを返します。各エントリにはサブツリー全体の作成・変更・削除の件数が含まれるため、
+ * クライアントは展開されたディレクトリだけを取得して表示できます。
+ * ルート ("/")を取得したときに比較し直し、それ以外のディレクトリはキャッシュを再利用します。
+ * 比較セッションが開かれている場合はその比較結果を使います。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param pathPrefixes 含めるパスの接頭辞 (空の場合は全て)
+ * @param includeGlobs 含めるglob (空の場合は全て)
+ * @param excludeGlobs 除外するglob
+ * @param statusMask 含めるステータスのビット (ChangeFilter::Status、0は全て)
+ * @param dirPath ディレクトリの絶対パス ("/"はルート)
+ * @return 直下のエントリ (名前順)、失敗時は空のリスト
+ */
+QList<ChangeNode> SnapshotOperations::GetChildren(const QString &configName, int snapshotNumber, int compareTo,
+                                                  const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                                                  const QStringList &excludeGlobs, uint statusMask,
+                                                  const QString &dirPath)
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QList<ChangeNode>();
+    }
+
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return QList<ChangeNode>();
+    }
+
+    if (!dirPath.startsWith('/') || dirPath.contains("/../") || dirPath.endsWith("/..")) {
+        replyError(QDBusError::InvalidArgs, "Directory path must be absolute");
+        return QList<ChangeNode>();
+    }
+
+    const ChangeFilter filter(pathPrefixes, includeGlobs, excludeGlobs, statusMask);
+    QString filterError;
+    if (!filter.validate(filterError)) {
+        replyError(QDBusError::InvalidArgs, filterError);
+        return QList<ChangeNode>();
+    }
+
+    QReadLocker locker(configLock(configName));
+
+    try {
+        const std::shared_ptr<const ChangeTree> tree = loadChangeTree(configName, snapshotNumber, compareTo,
+                                                                      filter, dirPath != "/");
+
+        QList<ChangeNode> nodes;
+        if (!tree->children(dirPath, nodes)) {
+            replyError(QDBusError::InvalidArgs, QString("Directory not in change set: %1").arg(dirPath));
+            return QList<ChangeNode>();
+        }
+
+        return nodes;
+
+    } catch (const snapper::Exception &e) {
+        qWarning() << "Failed to get file changes:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get file changes: %1").arg(e.what()));
+        return QList<ChangeNode>();
+    } catch (const std::runtime_error &e) {
+        replyError(QDBusError::Failed, e.what());
+        return QList<ChangeNode>();
+    }
+}
+
+/**
+ * @brief ファイル変更一覧をファイルディスクリプタで取得
+ *
+ * offset以降の全てのファイル変更を改行区切りのUTF-8テキストとして
+ * 封印済みmemfdに書き込んで返します。D-Busメッセージにデータを載せないため、
+ * 数十万件の変更でもメッセージサイズの上限を受けずに転送できます。
+ * キャッシュと絞り込みの扱いはGetFileChangesPageと同じです。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param pathPrefixes 含めるパスの接頭辞 (空の場合は全て)
+ * @param includeGlobs 含めるglob (空の場合は全て)
+ * @param excludeGlobs 除外するglob
+ * @param statusMask 含めるステータスのビット (ChangeFilter::Status、0は全て)
+ * @param offset 取得開始位置
+ * @param compress zstdでの圧縮を要求する場合true
+ * @param total ファイル変更の総数 (出力)
+ * @param compressed 実際に圧縮された場合true (出力)
+ * @return "ステータス パス"形式の行を格納したファイルディスクリプタ
+ */
+QDBusUnixFileDescriptor SnapshotOperations::GetFileChangesFd(const QString &configName, int snapshotNumber,
+                                                             int compareTo, const QStringList &pathPrefixes,
+                                                             const QStringList &includeGlobs,
+                                                             const QStringList &excludeGlobs, uint statusMask,
+                                                             int offset, bool compress,
+                                                             int &total, bool &compressed)
+{
+    total = 0;
+    compressed = false;
+
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QDBusUnixFileDescriptor();
+    }
+
+    if (offset < 0) {
+        replyError(QDBusError::InvalidArgs, "Invalid offset");
+        return QDBusUnixFileDescriptor();
+    }
+
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return QDBusUnixFileDescriptor();
+    }
+
+    const ChangeFilter filter(pathPrefixes, includeGlobs, excludeGlobs, statusMask);
+    QString filterError;
+    if (!filter.validate(filterError)) {
+        replyError(QDBusError::InvalidArgs, filterError);
+        return QDBusUnixFileDescriptor();
+    }
+
+    QReadLocker locker(configLock(configName));
+
+    try {
+        const QStringList changeList = loadChangeList(configName, snapshotNumber, compareTo, filter, offset > 0);
+        total = changeList.size();
+
+        ServiceMetrics::StageTimer serializeTimer(ServiceMetrics::Serialize);
+        qsizetype size = 0;
+        for (qsizetype i = offset; i < changeList.size(); ++i) {
+            size += changeList.at(i).size() + 1;
+        }
+
+        QByteArray data;
+        data.reserve(size);
+        for (qsizetype i = offset; i < changeList.size(); ++i) {
+            data.append(changeList.at(i).toUtf8());
+            data.append('\n');
+        }
+
+        ServiceMetrics::addBytes(data.size());
+
+        QString error;
+        QDBusUnixFileDescriptor fd = BulkTransfer::createSealedFd("qsnapper-changes", data, compress,
+                                                                  compressed, error);
+        if (!fd.isValid()) {
+            replyError(QDBusError::Failed, error);
+        }
+
+        return fd;
+
+    } catch (const snapper::Exception &e) {
+        qWarning() << "Failed to get file changes:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get file changes: %1").arg(e.what()));
+        return QDBusUnixFileDescriptor();
+    } catch (const std::runtime_error &e) {
+        replyError(QDBusError::Failed, e.what());
+        return QDBusUnixFileDescriptor();
+    }
+}
+
+/**
+ * @brief ファイルの差分を取得
+ *
+ * 指定されたスナップショット内のファイルと比較先 (別のスナップショット、または
+ * 現在のシステム)のファイルとの差分をunified diff形式で取得します。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filePath 差分を取得するファイルパス
+ * @return unified diff形式の差分、ファイルが見つからない場合は空文字列
+ */
+QString SnapshotOperations::GetFileDiff(const QString &configName, int snapshotNumber, int compareTo,
+                                        const QString &filePath)
+{
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QString();
+    }
+
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return QString();
+    }
+
+    QReadLocker locker(configLock(configName));
 
-    } catch (const snapper::Exception &e) {
-        qWarning() << "Failed to create snapshot:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Failed to create snapshot: %1").arg(e.what()));
+    try {
+        QByteArray diff;
+        diffFile(configName, snapshotNumber, compareTo, filePath, [&diff](const DiffEngine &engine) {
+            diff = engine.unified();
+        }, DiffEngine::MaxCompareSize);
+
+        ServiceMetrics::addBytes(diff.size());
+        return QString::fromUtf8(diff);
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Failed to get file diff:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get file diff: %1").arg(e.what()));
+        return QString();
+    }
+    catch (const std::runtime_error &e) {
+        replyError(QDBusError::Failed, e.what());
         return QString();
     }
 }
 
 /**
- * @brief スナップショットを削除
+ * @brief ファイルの差分をファイルディスクリプタで取得
  *
- * 指定された番号のスナップショットを削除します。
- * PolicyKit認証を必要とします。
+ * GetFileDiffと同じ差分を封印済みmemfdに書き込んで返します。
+ * 大きなファイルの差分でもD-Busメッセージのサイズ上限を受けません。
  *
- * @param number 削除するスナップショット番号
- * @return 削除成功時true、失敗時false
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filePath 差分を取得するファイルパス
+ * @param compress zstdでの圧縮を要求する場合true
+ * @param compressed 実際に圧縮された場合true (出力)
+ * @return unified diff形式の差分を格納したファイルディスクリプタ
  */
-bool SnapshotOperations::DeleteSnapshot(int number)
+QDBusUnixFileDescriptor SnapshotOperations::GetFileDiffFd(const QString &configName, int snapshotNumber,
+                                                          int compareTo, const QString &filePath,
+                                                          bool compress, bool &compressed)
 {
-    if (!checkAuthorization("com.presire.qsnapper.delete-snapshot")) {
-        return false;
+    compressed = false;
+
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QDBusUnixFileDescriptor();
     }
 
-    try {
-        snapper::Snapper *snapper = getSnapper("root");
-        if (!snapper) {
-            sendErrorReply(QDBusError::Failed, "Failed to initialize Snapper");
-            return false;
-        }
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return QDBusUnixFileDescriptor();
+    }
 
-        snapper::Snapshots::iterator snapshot = snapper->getSnapshots().find(number);
-        if (snapshot == snapper->getSnapshots().end()) {
-            sendErrorReply(QDBusError::Failed, "Snapshot not found");
-            return false;
-        }
+    QReadLocker locker(configLock(configName));
 
-#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
-        snapper::Plugins::Report report;
-        snapper->deleteSnapshot(snapshot, report);
-        logPluginReport(report);
-#else
-        snapper->deleteSnapshot(snapshot);
-#endif
-        return true;
+    try {
+        QByteArray diff;
+        diffFile(configName, snapshotNumber, compareTo, filePath, [&diff](const DiffEngine &engine) {
+            diff = engine.unified();
+        }, DiffEngine::MaxCompareSize);
+
+        ServiceMetrics::StageTimer serializeTimer(ServiceMetrics::Serialize);
+        ServiceMetrics::addBytes(diff.size());
+
+        QString error;
+        QDBusUnixFileDescriptor fd = BulkTransfer::createSealedFd("qsnapper-diff", diff, compress,
+                                                                  compressed, error);
+        if (!fd.isValid()) {
+            replyError(QDBusError::Failed, error);
+        }
 
+        return fd;
     }
     catch (const snapper::Exception &e) {
-        qWarning() << "Failed to delete snapshot:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Failed to delete snapshot: %1").arg(e.what()));
-        return false;
+        qWarning() << "Failed to get file diff:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get file diff: %1").arg(e.what()));
+        return QDBusUnixFileDescriptor();
+    }
+    catch (const std::runtime_error &e) {
+        replyError(QDBusError::Failed, e.what());
+        return QDBusUnixFileDescriptor();
     }
 }
 
 /**
- * @brief スナップショットにロールバック
+ * @brief ファイルの構造化された差分を取得
  *
- * 指定されたスナップショットをデフォルトに設定し、次回起動時に
- * そのスナップショットの状態で起動するようにします。
+ * 差分をハンクの一覧として返します。行数とバイト数の上限を超える部分は返さず、
+ * truncatedをtrueにします。どちらかのファイルがバイト数の上限より大きい場合は、
+ * 差分を計算せずにtruncatedとファイルサイズだけを返します。
+ * バイナリファイルは先頭のブロックで判定し、内容の代わりにファイルサイズだけを返します。
+ * 上限に0以下を指定した場合はサービスの上限を使用します。
  *
- * @param number ロールバック先のスナップショット番号
- * @return 設定成功時true、失敗時false
+ * @param configName Snapper設定名
+ * @param snapshotNumber 比較元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filePath 差分を取得するファイルパス
+ * @param contextLines 変更の前後に表示する行数
+ * @param maxLines 返す最大行数
+ * @param maxBytes 返す最大バイト数
+ * @param binary バイナリファイルで内容が異なる場合true (出力)
+ * @param truncated 上限により打ち切った場合true (出力)
+ * @param oldSize スナップショット内のファイルサイズ (出力)
+ * @param newSize 比較先のファイルサイズ (出力)
+ * @return ハンクの一覧、差分がない場合は空の配列
  */
-bool SnapshotOperations::RollbackSnapshot(int number)
+QList<DiffHunk> SnapshotOperations::GetFileDiffHunks(const QString &configName, int snapshotNumber,
+                                                     int compareTo, const QString &filePath, int contextLines,
+                                                     int maxLines, int maxBytes,
+                                                     bool &binary, bool &truncated,
+                                                     qlonglong &oldSize, qlonglong &newSize)
 {
-    if (!checkAuthorization("com.presire.qsnapper.rollback-snapshot")) {
-        return false;
+    binary = false;
+    truncated = false;
+    oldSize = 0;
+    newSize = 0;
+
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return QList<DiffHunk>();
     }
 
-    try {
-        snapper::Snapper *snapper = getSnapper("root");
-        if (!snapper) {
-            sendErrorReply(QDBusError::Failed, "Failed to initialize Snapper");
-            return false;
-        }
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return QList<DiffHunk>();
+    }
 
-        snapper::Snapshots::iterator snapshot = snapper->getSnapshots().find(number);
-        if (snapshot == snapper->getSnapshots().end()) {
-            sendErrorReply(QDBusError::Failed, "Snapshot not found");
-            return false;
-        }
+    const int context = qBound(0, contextLines, MaxDiffContextLines);
+    const int lineBudget = maxLines > 0 ? qMin(maxLines, MaxDiffLines) : MaxDiffLines;
+    const int byteBudget = maxBytes > 0 ? qMin(maxBytes, MaxDiffBytes) : MaxDiffBytes;
 
-        // スナップショットをデフォルトに設定 (次回起動時に適用される)
-#if LIBSNAPPER_VERSION_AT_LEAST(7, 4)
-        snapper::Plugins::Report report;
-        snapshot->setDefault(report);
-        logPluginReport(report);
-#else
-        snapshot->setDefault();
-#endif
-        return true;
+    QReadLocker locker(configLock(configName));
+
+    try {
+        QList<DiffHunk> hunks;
+        // 上限を超える大きさのファイルは、マップや行の比較をせずにサイズだけを返す
+        diffFile(configName, snapshotNumber, compareTo, filePath, [&](const DiffEngine &engine) {
+            binary = engine.result() == DiffEngine::Result::Binary;
+            oldSize = engine.oldSize();
+            newSize = engine.newSize();
+
+            const QList<DiffEngine::Hunk> engineHunks = engine.hunks(context, lineBudget, byteBudget, truncated);
+            hunks.reserve(engineHunks.size());
+            for (const DiffEngine::Hunk &engineHunk : engineHunks) {
+                DiffHunk hunk;
+                hunk.oldStart = engineHunk.oldStart;
+                hunk.oldCount = engineHunk.oldCount;
+                hunk.newStart = engineHunk.newStart;
+                hunk.newCount = engineHunk.newCount;
+                hunk.lines = engineHunk.lines;
+                hunks.append(hunk);
+            }
+        }, byteBudget);
 
+        return hunks;
     }
     catch (const snapper::Exception &e) {
-        qWarning() << "Failed to rollback snapshot:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Failed to rollback snapshot: %1").arg(e.what()));
-        return false;
+        qWarning() << "Failed to get file diff:" << e.what();
+        replyError(QDBusError::Failed, QString("Failed to get file diff: %1").arg(e.what()));
+        return QList<DiffHunk>();
+    }
+    catch (const std::runtime_error &e) {
+        replyError(QDBusError::Failed, e.what());
+        return QList<DiffHunk>();
     }
 }
 
 /**
- * @brief ファイル変更一覧を取得
+ * @brief ファイルの差分を生成
  *
- * 指定されたスナップショットと現在のシステム状態を比較し、
- * 変更されたファイルの一覧を取得します。
+ * 比較セッションが開かれている場合はlibsnapperのComparisonクラスを使用して
+ * ファイルパスを取得し、開かれていない場合はファイルシステム全体を比較せずに
+ * ScopedComparisonで指定されたファイルだけを比較します。
+ * ファイルの内容はDiffEngineによりプロセス内で比較します。
+ * 外部のdiffコマンドを起動しないため、出力が途中で切れることもありません。
+ * スナップショットがマウントされている間に結果を出力する必要があるため、
+ * 比較結果は出力用の関数に渡します。
  *
  * @param configName Snapper設定名
  * @param snapshotNumber 比較元のスナップショット番号
- * @return ファイル変更のステータスとパスの一覧、失敗時は空文字列
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filePath 差分を取得するファイルパス
+ * @param output 比較結果を出力する関数 (ファイルが見つからない、または変更がない場合は呼び出さない)
+ * @param maxSize 内容を比較するファイルサイズの上限 (超える場合はDiffEngine::Result::TooLarge)
+ * @throws std::runtime_error Snapperの初期化に失敗した場合、スナップショットが存在しない場合、
+ *         ファイルを読み込めない場合
  */
-QString SnapshotOperations::GetFileChanges(const QString &configName, int snapshotNumber)
+void SnapshotOperations::diffFile(const QString &configName, int snapshotNumber, int compareTo,
+                                  const QString &filePath, const std::function<void(const DiffEngine &engine)> &output,
+                                  qint64 maxSize)
 {
-    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
-        return QString();
-    }
+    std::shared_ptr<ComparisonSession> session = findSession(configName, snapshotNumber, compareTo, callerName());
 
-    try {
-        snapper::Snapper *snapper = getSnapper(configName);
+    if (!session) {
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
         if (!snapper) {
-            sendErrorReply(QDBusError::Failed, "Failed to initialize Snapper");
-            return QString();
+            throw std::runtime_error("Failed to initialize Snapper");
         }
 
-        // snapshot1: 比較元 (指定されたスナップショット)
-        // snapshot2: 比較先 (現在のシステム状態)
-        snapper::Snapshots::const_iterator snapshot1 = snapper->getSnapshots().find(snapshotNumber);
-        snapper::Snapshots::const_iterator snapshot2 = snapper->getSnapshotCurrent();
+        // 比較セッションが開かれていない場合は、指定されたファイルだけを比較する
+        // (ファイルパスはサブボリューム内のパスに変換する)
+        QString path = filePath;
+        const QString subvolume = QString::fromStdString(snapper->subvolumeDir());
+        if (subvolume != "/" && path.startsWith(subvolume + '/')) {
+            path = path.mid(subvolume.size());
+        }
 
-        if (snapshot1 == snapper->getSnapshots().end()) {
-            sendErrorReply(QDBusError::Failed, "Snapshot not found");
-            return QString();
+        ScopedComparison comparison(snapper.get(), snapshotNumber, compareTo, mountLock(configName));
+        if (comparison.changes({path}).isEmpty()) {
+            return; // ファイルが見つからない、または変更がない場合は差分なし
         }
 
-        // Comparisonオブジェクトを作成してファイル変更を取得
-        // snapshot1からsnapshot2への変更を取得
-        snapper::Comparison comparison(snapper, snapshot1, snapshot2, false);
-        const snapper::Files &files = comparison.getFiles();
+        DiffEngine engine;
+        engine.compare(comparison.absolutePath1(path), comparison.absolutePath2(path), maxSize);
+        output(engine);
+        return;
+    }
+
+    QMutexLocker sessionLocker(&session->mutex());
+    const snapper::Files &files = session->comparison().getFiles();
 
-        QString output;
-        for (auto it = files.begin(); it != files.end(); ++it) {
-            const snapper::File &file = *it;
-            unsigned int status = file.getPreToPostStatus();
+    // 指定されたファイルを検索
+    auto fileIt = files.findAbsolutePath(filePath.toStdString());
+    if (fileIt == files.end()) {
+        return; // ファイルが見つからない場合は差分なし
+    }
+
+    // ファイルの絶対パスを取得
+    // LOC_PRE: 比較元のスナップショット内のファイル
+    // LOC_POST: 比較先のスナップショット内のファイル
+    // LOC_SYSTEM: 現在のシステムのファイル
+    QString file1Path = QString::fromStdString(fileIt->getAbsolutePath(snapper::LOC_PRE));
+    QString file2Path = QString::fromStdString(
+        fileIt->getAbsolutePath(compareTo == 0 ? snapper::LOC_SYSTEM : snapper::LOC_POST));
+
+    // 差分を生成 (比較元 -> 比較先)
+    DiffEngine engine;
+    engine.compare(file1Path, file2Path, maxSize);
+    output(engine);
+}
+
+/**
+ * @brief ファイルをスナップショットから復元
+ *
+ * 指定されたファイルリストを指定されたスナップショットの状態に復元します。
+ * 復元の進捗はrestoreProgressシグナルで通知されます
+ * (呼び出し元がSetRestoreProgressRateで設定した間隔で間引き、最後の進捗は必ず通知)。
+ * 大量のファイルを復元する場合は、中止できるStartRestoreを使用します。
+ *
+ * compareToにスナップショット番号を指定した場合は、`snapper undochange N1..N2`と同様に
+ * 2つのスナップショット間の変更だけを現在のシステムで元に戻します。
+ *
+ * @param configName Snapper設定名
+ * @param snapshotNumber 復元元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filePaths 復元するファイルパスのリスト (末尾が"/"のパスはそのディレクトリ以下の変更のうち絞り込みに一致するもの)
+ * @param pathPrefixes 一覧で含めたパスの接頭辞 (空の場合は全て)
+ * @param includeGlobs 一覧で含めたglob (空の場合は全て)
+ * @param excludeGlobs 一覧で除外したglob
+ * @param statusMask 一覧で含めたステータスのビット (ChangeFilter::Status、0は全て)
+ * @return 全ファイルの復元が成功した場合true、それ以外はfalse
+ */
+bool SnapshotOperations::RestoreFiles(const QString &configName, int snapshotNumber, int compareTo,
+                                      const QStringList &filePaths, const QStringList &pathPrefixes,
+                                      const QStringList &includeGlobs, const QStringList &excludeGlobs,
+                                      uint statusMask)
+{
+    if (!checkAuthorization("com.presire.qsnapper.rollback-snapshot")) {
+        return false;
+    }
+
+    if (filePaths.isEmpty()) {
+        replyError(QDBusError::InvalidArgs, "No files specified for restore");
+        return false;
+    }
 
-            // ステータスフラグを文字列に変換
-            QString statusStr;
-            if (status & snapper::CREATED) statusStr += "+";
-            if (status & snapper::DELETED) statusStr += "-";
-            if (status & snapper::TYPE) statusStr += "t";
-            if (status & snapper::CONTENT) statusStr += "c";
-            if (status & snapper::PERMISSIONS) statusStr += "p";
-            if (status & snapper::OWNER) statusStr += "u";
-            if (status & snapper::GROUP) statusStr += "g";
-            if (status & snapper::XATTRS) statusStr += "x";
-            if (status & snapper::ACL) statusStr += "a";
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return false;
+    }
 
-            if (statusStr.isEmpty()) statusStr = ".....";
+    const ChangeFilter filter(pathPrefixes, includeGlobs, excludeGlobs, statusMask);
+    QString filterError;
+    if (!filter.validate(filterError)) {
+        replyError(QDBusError::InvalidArgs, filterError);
+        return false;
+    }
 
-            // パディングして出力フォーマットを整える
-            statusStr = statusStr.leftJustified(5, '.');
+    qWarning() << "RestoreFiles: Starting restore for" << filePaths.size() << "files from snapshot" << snapshotNumber;
 
-            output += statusStr + " " + QString::fromStdString(file.getName()) + "\n";
-        }
+    const QString owner = callerName();
+    RestoreJob job(0, configName, snapshotNumber, compareTo, filePaths, filter, owner, progressRate(owner));
+    RestoreJob::Result result;
+    QString error;
 
-        return output;
+    const bool restored = restore(job, [this](int current, int total, const QString &fileName) {
+        // D-Busシグナルはメインスレッドから発行する
+        QMetaObject::invokeMethod(this, [this, current, total, fileName]() {
+            emit restoreProgress(current, total, fileName);
+        });
+    }, result, error);
 
-    } catch (const snapper::Exception &e) {
-        qWarning() << "Failed to get file changes:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Failed to get file changes: %1").arg(e.what()));
-        return QString();
+    if (!restored) {
+        replyError(QDBusError::Failed, error);
+        return false;
+    }
+
+    // 実際の復元失敗がある場合のみエラーを返す
+    if (result.succeeded != result.total) {
+        QString errorMsg = QString("Failed to restore %1 out of %2 files")
+                               .arg(result.total - result.succeeded).arg(result.total);
+        replyError(QDBusError::Failed, errorMsg);
+        return false;
     }
+
+    return true;
 }
 
 /**
- * @brief ファイルの差分を取得
+ * @brief ファイル復元ジョブを開始
  *
- * 指定されたスナップショット内のファイルと現在のシステムの
- * ファイルとの差分をunified diff形式で取得します。
+ * 認証とスナップショットの確認だけを行って直ちにジョブIDを返し、
+ * 復元はジョブ用のスレッドで実行します。
+ * ジョブ全体で認証・比較・スナップショットのマウントは1回だけです。
+ * 進捗はRestoreJobProgressシグナル、結果はRestoreJobFinishedシグナルで通知されます。
  *
  * @param configName Snapper設定名
- * @param snapshotNumber 比較元のスナップショット番号
- * @param filePath 差分を取得するファイルパス
- * @return unified diff形式の差分、ファイルが見つからない場合は空文字列
+ * @param snapshotNumber 復元元のスナップショット番号
+ * @param compareTo 比較先のスナップショット番号 (0は現在のシステム)
+ * @param filePaths 復元するファイルパスのリスト (末尾が"/"のパスはそのディレクトリ以下の変更のうち絞り込みに一致するもの)
+ * @param pathPrefixes 一覧で含めたパスの接頭辞 (空の場合は全て)
+ * @param includeGlobs 一覧で含めたglob (空の場合は全て)
+ * @param excludeGlobs 一覧で除外したglob
+ * @param statusMask 一覧で含めたステータスのビット (ChangeFilter::Status、0は全て)
+ * @return ジョブID、失敗時は0
  */
-QString SnapshotOperations::GetFileDiff(const QString &configName, int snapshotNumber, const QString &filePath)
+uint SnapshotOperations::StartRestore(const QString &configName, int snapshotNumber, int compareTo,
+                                      const QStringList &filePaths, const QStringList &pathPrefixes,
+                                      const QStringList &includeGlobs, const QStringList &excludeGlobs,
+                                      uint statusMask)
 {
-    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
-        return QString();
+    if (!checkAuthorization("com.presire.qsnapper.rollback-snapshot")) {
+        return 0;
+    }
+
+    if (filePaths.isEmpty()) {
+        replyError(QDBusError::InvalidArgs, "No files specified for restore");
+        return 0;
+    }
+
+    if (!isValidComparison(snapshotNumber, compareTo)) {
+        replyError(QDBusError::InvalidArgs, "Invalid snapshot numbers");
+        return 0;
+    }
+
+    const ChangeFilter filter(pathPrefixes, includeGlobs, excludeGlobs, statusMask);
+    QString filterError;
+    if (!filter.validate(filterError)) {
+        replyError(QDBusError::InvalidArgs, filterError);
+        return 0;
     }
 
     try {
-        // diffの取得には外部コマンド(diff)を使用する必要があるため、
-        // libsnapperのComparisonクラスを使用してファイルパスを取得し、
-        // 外部のdiffコマンドで差分を生成する
-        snapper::Snapper *snapper = getSnapper(configName);
+        QReadLocker locker(configLock(configName));
+
+        std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
         if (!snapper) {
-            sendErrorReply(QDBusError::Failed, "Failed to initialize Snapper");
-            return QString();
+            replyError(QDBusError::Failed, "Failed to initialize Snapper");
+            return 0;
         }
 
-        snapper::Snapshots::const_iterator snapshot1 = snapper->getSnapshots().find(snapshotNumber);
-        snapper::Snapshots::const_iterator snapshot2 = snapper->getSnapshotCurrent();
-
-        if (snapshot1 == snapper->getSnapshots().end()) {
-            sendErrorReply(QDBusError::Failed, "Snapshot not found");
-            return QString();
+        const snapper::Snapshots &snapshots = snapper->getSnapshots();
+        if (snapshots.find(snapshotNumber) == snapshots.end()
+            || (compareTo != 0 && snapshots.find(compareTo) == snapshots.end())) {
+            replyError(QDBusError::Failed, "Snapshot not found");
+            return 0;
         }
+    }
+    catch (const snapper::Exception &e) {
+        replyError(QDBusError::Failed, QString("Failed to start restore: %1").arg(e.what()));
+        return 0;
+    }
 
-        // スナップショットをマウント
-        snapper::Comparison comparison(snapper, snapshot1, snapshot2, true);
-        const snapper::Files &files = comparison.getFiles();
+    const QString owner = callerName();
+    std::shared_ptr<RestoreJob> job;
+    {
+        QMutexLocker jobsLocker(&m_restoreJobsMutex);
 
-        // 指定されたファイルを検索
-        auto fileIt = files.findAbsolutePath(filePath.toStdString());
-        if (fileIt == files.end()) {
-            return QString(); // ファイルが見つからない場合は空文字列を返す
+        uint id = m_nextRestoreJobId++;
+        if (id == 0) {
+            id = m_nextRestoreJobId++;
         }
 
-        // ファイルの絶対パスを取得
-        // LOC_PRE: スナップショット内のファイル
-        // LOC_SYSTEM: 現在のシステムのファイル
-        QString file1Path = QString::fromStdString(fileIt->getAbsolutePath(snapper::LOC_PRE));
-        QString file2Path = QString::fromStdString(fileIt->getAbsolutePath(snapper::LOC_SYSTEM));
+        job = std::make_shared<RestoreJob>(id, configName, snapshotNumber, compareTo, filePaths, filter,
+                                           owner, progressRate(owner));
+        m_restoreJobs.insert(id, job);
+    }
+
+    qWarning() << "StartRestore: Job" << job->id() << "restores" << filePaths.size()
+               << "files from snapshot" << snapshotNumber;
+
+    m_jobWorkers.start([this, job]() {
+        runRestoreJob(job);
+    });
 
-        // diffコマンドを実行 (スナップショット -> 現在の状態)
-        QProcess process;
-        process.start("diff", QStringList() << "-u" << file1Path << file2Path);
-        process.waitForFinished(10000);
+    return job->id();
+}
 
-        QString output = QString::fromUtf8(process.readAllStandardOutput());
-        return output;
+/**
+ * @brief ファイル復元ジョブを中止
+ *
+ * 実行中のステップの完了後に残りのステップを実行せずジョブを終了します。
+ * 既に復元されたファイルはそのまま残ります。
+ * ジョブを開始したクライアントだけが中止できます。
+ *
+ * @param jobId StartRestoreが返したジョブID
+ */
+void SnapshotOperations::CancelRestore(uint jobId)
+{
+    ServiceMetrics::CallScope metricsScope(m_metrics, QStringLiteral("CancelRestore"));
+    std::shared_ptr<RestoreJob> job;
+    {
+        QMutexLocker jobsLocker(&m_restoreJobsMutex);
+        job = m_restoreJobs.value(jobId);
+    }
 
+    if (!job) {
+        // 既に終了したジョブの中止は何もしない
+        return;
     }
-    catch (const snapper::Exception &e) {
-        qWarning() << "Failed to get file diff:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Failed to get file diff: %1").arg(e.what()));
-        return QString();
+
+    if (job->owner() != callerName()) {
+        replyError(QDBusError::AccessDenied, "Restore job belongs to another client");
+        return;
     }
+
+    qWarning() << "CancelRestore: Cancel requested for job" << jobId;
+    job->cancel();
 }
 
 /**
- * @brief ファイルをスナップショットから復元
+ * @brief 復元の進捗を通知する間隔を設定
  *
- * 指定されたファイルリストを指定されたスナップショットの状態に復元します。
- * 復元の進捗はrestoreProgressシグナルで通知されます。
+ * 呼び出し元のクライアントが以降に開始する復元 (RestoreFiles、StartRestore)に適用されます。
+ * 他のクライアントの復元には影響しません。
+ * 前回の通知からintervalMsが経過するか、stepIntervalステップが完了した時点で
+ * 最新の進捗を通知します。最後の進捗は間隔に関わらず通知します。
+ * 両方とも0の場合は、ステップごとに通知します。
  *
- * @param configName Snapper設定名
- * @param snapshotNumber 復元元のスナップショット番号
- * @param filePaths 復元するファイルパスのリスト
- * @return 全ファイルの復元が成功した場合true、それ以外はfalse
+ * @param intervalMs 通知の最小間隔 (ミリ秒、0は時間で通知しない)
+ * @param stepInterval 通知するステップ数の間隔 (0はステップ数で通知しない)
  */
-bool SnapshotOperations::RestoreFiles(const QString &configName, int snapshotNumber, const QStringList &filePaths)
+void SnapshotOperations::SetRestoreProgressRate(int intervalMs, int stepInterval)
 {
-    if (!checkAuthorization("com.presire.qsnapper.rollback-snapshot")) {
-        return false;
+    if (!checkAuthorization("com.presire.qsnapper.list-snapshots")) {
+        return;
     }
 
-    if (filePaths.isEmpty()) {
-        sendErrorReply(QDBusError::InvalidArgs, "No files specified for restore");
-        return false;
+    if (intervalMs < 0 || intervalMs > MaxProgressIntervalMs || stepInterval < 0) {
+        replyError(QDBusError::InvalidArgs,
+                   QString("Progress interval must be 0-%1 ms and the step interval must not be negative")
+                       .arg(MaxProgressIntervalMs));
+        return;
     }
 
-    qWarning() << "RestoreFiles: Starting restore for" << filePaths.size() << "files from snapshot" << snapshotNumber;
+    ClientProgressRate entry;
+    entry.rate.intervalMs = intervalMs;
+    entry.rate.stepInterval = stepInterval;
+    entry.updated.start();
+
+    const QString client = callerName();
+
+    QMutexLocker ratesLocker(&m_progressRatesMutex);
+
+    // 上限を超える場合は、最も古い設定を破棄する
+    while (!m_progressRates.contains(client) && m_progressRates.size() >= MaxProgressRates) {
+        auto oldest = std::max_element(m_progressRates.begin(), m_progressRates.end(),
+                                       [](const ClientProgressRate &a, const ClientProgressRate &b) {
+            return a.updated.elapsed() < b.updated.elapsed();
+        });
+        m_progressRates.erase(oldest);
+    }
+
+    m_progressRates.insert(client, entry);
+}
+
+/**
+ * @brief クライアントが設定した復元の進捗の通知間隔を取得
+ *
+ * @param client クライアントのバス名
+ * @return 通知間隔、設定されていない場合は既定値
+ */
+RestoreJob::ProgressRate SnapshotOperations::progressRate(const QString &client)
+{
+    QMutexLocker ratesLocker(&m_progressRatesMutex);
+
+    auto it = m_progressRates.constFind(client);
+    if (it != m_progressRates.constEnd()) {
+        return it->rate;
+    }
+
+    RestoreJob::ProgressRate rate;
+    rate.intervalMs = DefaultProgressIntervalMs;
+    rate.stepInterval = DefaultProgressStepInterval;
+    return rate;
+}
+
+/**
+ * @brief ファイル復元ジョブを実行
+ *
+ * ジョブ用のスレッドで実行し、終了時にRestoreJobFinishedシグナルを発行します。
+ *
+ * @param job 実行するジョブ
+ */
+void SnapshotOperations::runRestoreJob(const std::shared_ptr<RestoreJob> &job)
+{
+    // バックグラウンドのジョブはD-Busの呼び出しと別に記録する
+    ServiceMetrics::CallScope metricsScope(m_metrics, QStringLiteral("RestoreJob"));
+
+    const uint jobId = job->id();
+
+    RestoreJob::Result result;
+    QString error;
+
+    const bool restored = restore(*job, [this, jobId](int current, int total, const QString &fileName) {
+        QMetaObject::invokeMethod(this, [this, jobId, current, total, fileName]() {
+            emit RestoreJobProgress(jobId, current, total, fileName);
+        });
+    }, result, error);
+
+    {
+        QMutexLocker jobsLocker(&m_restoreJobsMutex);
+        m_restoreJobs.remove(jobId);
+    }
+
+    const bool success = restored && !result.cancelled && result.succeeded == result.total;
+    metricsScope.call().failed = !success;
+
+    QMetaObject::invokeMethod(this, [this, jobId, success, result, error]() {
+        emit RestoreJobFinished(jobId, success, result.cancelled, result.succeeded, result.total,
+                                result.failures, error);
+    });
+}
+
+/**
+ * @brief ファイルをスナップショットから復元
+ *
+ * RestoreFilesと復元ジョブで共通の処理です。
+ * 比較セッションが開かれている場合はその比較結果を使い、
+ * ない場合はこの復元のためだけに比較します。
+ * 設定の読み取りロックはセッションの取得までとし、復元に使用するスナップショットは
+ * 削除されないよう復元の終了まで登録します。
+ *
+ * @param job 復元の内容と中止要求
+ * @param progress 進捗の通知先 (ワーカースレッドから呼び出される)
+ * @param result 復元の結果 (出力)
+ * @param error 復元を実行できなかった場合のエラーメッセージ (出力)
+ * @return 復元を実行できた場合true (個々のファイルの失敗はresultに記録)
+ */
+bool SnapshotOperations::restore(const RestoreJob &job, const UndoExecutor::ProgressCallback &progress,
+                                 RestoreJob::Result &result, QString &error)
+{
+    const QString &configName = job.configName();
+    const int snapshotNumber = job.snapshotNumber();
+    const int compareTo = job.compareTo();
+    const QStringList &filePaths = job.filePaths();
+
+    QReadLocker locker(configLock(configName));
 
     try {
-        snapper::Snapper *snapper = getSnapper(configName);
-        if (!snapper) {
-            qWarning() << "Failed to get Snapper instance";
-            sendErrorReply(QDBusError::Failed, "Failed to initialize Snapper");
-            return false;
-        }
+        // 復元は長時間かかることがあるため、設定のロックはセッションの取得までとする
+        // (待機中の書き込みが後続の読み取りを止め、ワーカーを使い切らないように)
+        // 使用中のスナップショットは登録しておき、セッションを破棄するまで削除を拒否する
+        RestoringScope restoring(this, configName, {snapshotNumber, compareTo});
+
+        // 比較セッションが開かれている場合は、比較し直さずその比較結果を使う
+        std::shared_ptr<ComparisonSession> session = findSession(configName, snapshotNumber, compareTo,
+                                                                 job.owner());
+
+        if (!session) {
+            std::shared_ptr<snapper::Snapper> snapper = acquireSnapper(configName);
+            if (!snapper) {
+                qWarning() << "Failed to get Snapper instance";
+                error = "Failed to initialize Snapper";
+                return false;
+            }
 
-        snapper::Snapshots::const_iterator snapshot1 = snapper->getSnapshots().find(snapshotNumber);
-        snapper::Snapshots::const_iterator snapshot2 = snapper->getSnapshotCurrent();
+            const snapper::Snapshots &snapshots = snapper->getSnapshots();
+            if (snapshots.find(snapshotNumber) == snapshots.end()
+                || (compareTo != 0 && snapshots.find(compareTo) == snapshots.end())) {
+                qWarning() << "Snapshot not found:" << snapshotNumber << compareTo;
+                error = "Snapshot not found";
+                return false;
+            }
 
-        if (snapshot1 == snapper->getSnapshots().end()) {
-            qWarning() << "Snapshot not found:" << snapshotNumber;
-            sendErrorReply(QDBusError::Failed, "Snapshot not found");
-            return false;
+            // この復元のためだけに比較する (スナップショットをマウント)
+            session = std::make_shared<ComparisonSession>(snapper, configName, snapshotNumber, compareTo, QString(),
+                                                          mountLock(configName));
         }
 
-        // Comparisonオブジェクトを作成 (スナップショットをマウント)
-        snapper::Comparison comparison(snapper, snapshot1, snapshot2, true);
+        locker.unlock();
+
+        // undoフラグは比較結果に記録されるため、復元中は他のスレッドに使わせない
+        QMutexLocker sessionLocker(&session->mutex());
+
+        snapper::Comparison &comparison = session->comparison();
         snapper::Files &files = comparison.getFiles();
 
-        // まず、バッチ内の全ファイルをundoフラグでマーク（差分があるファイルのみ）
+        // まず、全ファイルをundoフラグでマーク（差分があるファイルのみ）
+        // 末尾が'/'のパスは、そのディレクトリ以下の全ての変更を表す
         QStringList notFoundFiles;
-        QStringList noDiffFiles;
-        int markedCount = 0;
+        QList<snapper::File *> markedFiles;
+        QSet<QString> subtrees;
 
         for (const QString &filePath : filePaths) {
+            if (filePath.size() > 1 && filePath.endsWith('/')) {
+                subtrees.insert(filePath.chopped(1));
+                continue;
+            }
+
             auto fileIt = files.findAbsolutePath(filePath.toStdString());
 
             if (fileIt == files.end()) {
@@ -643,7 +3195,7 @@ bool SnapshotOperations::RestoreFiles(const QString &configName, int snapshotNum
                 auto fileIt2 = files.find(filePath.toStdString());
                 if (fileIt2 != files.end()) {
                     fileIt2->setUndo(true);
-                    markedCount++;
+                    markedFiles.append(&*fileIt2);
                 }
                 else {
                     // ディレクトリまたは差分のないファイルの可能性
@@ -652,10 +3204,35 @@ bool SnapshotOperations::RestoreFiles(const QString &configName, int snapshotNum
             }
             else {
                 fileIt->setUndo(true);
-                markedCount++;
+                markedFiles.append(&*fileIt);
+            }
+        }
+
+        // 一覧のパス (GetChildren, GetFileChanges)と同じサブボリューム内のパスで照合する
+        // 一覧で表示されていなかった変更を復元しないよう、一覧と同じ絞り込みを適用する
+        if (!subtrees.isEmpty()) {
+            const ChangeFilter &filter = job.filter();
+            for (snapper::File &file : files) {
+                const QString name = QString::fromStdString(file.getName());
+                if (!filter.isEmpty()
+                    && !filter.matches(ComparisonSession::formatChangeStatus(file.getPreToPostStatus()) + " " + name)) {
+                    continue;
+                }
+
+                QString path = name;
+                while (!path.isEmpty()) {
+                    if (subtrees.contains(path)) {
+                        file.setUndo(true);
+                        markedFiles.append(&file);
+                        break;
+                    }
+                    path.truncate(path.lastIndexOf('/'));
+                }
             }
         }
 
+        const int markedCount = markedFiles.size();
+
         // undoフラグが立っているファイルのUndoStepsを一度に取得
         std::vector<snapper::UndoStep> undoSteps = comparison.getUndoSteps();
 
@@ -664,11 +3241,8 @@ bool SnapshotOperations::RestoreFiles(const QString &configName, int snapshotNum
             qWarning() << "No undo steps generated. Files may already be in sync or are directories. Marked files:" << markedCount;
 
             // undoフラグをクリア
-            for (const QString &filePath : filePaths) {
-                auto fileIt = files.findAbsolutePath(filePath.toStdString());
-                if (fileIt != files.end()) {
-                    fileIt->setUndo(false);
-                }
+            for (snapper::File *file : std::as_const(markedFiles)) {
+                file->setUndo(false);
             }
 
             // エラーではなく成功として扱う（差分がないため復元不要）
@@ -676,67 +3250,50 @@ bool SnapshotOperations::RestoreFiles(const QString &configName, int snapshotNum
         }
 
         // 各UndoStepを実行し、進捗を通知
-        bool allSuccess = true;
-        int total = undoSteps.size();
-        int current = 0;
-        int successCount = 0;
-
-        for (const auto &step : undoSteps) {
-            current++;
-            QString fileName = QString::fromStdString(step.name);
-
-            // 進捗を通知 (D-Busシグナル)
-            emit restoreProgress(current, total, fileName);
-
-            // ファイルを復元
-            try {
-                bool success = comparison.doUndoStep(step);
-                if (!success) {
-                    qWarning() << "Failed to restore:" << fileName;
-                    allSuccess = false;
-                }
-                else {
-                    successCount++;
-                }
-            }
-            catch (const snapper::Exception &e) {
-                qWarning() << "Exception during restore:" << fileName << "-" << e.what();
-                allSuccess = false;
-            }
-        }
+        // ステップ数が多い場合は、依存関係のない (同じ深さの)ステップを並行して実行する
+        // 進捗はステップごとにシグナルを発行せず、設定された間隔でまとめて通知する
+        ProgressThrottle throttle(job.progressRate().intervalMs, job.progressRate().stepInterval, progress);
+        UndoExecutor executor(comparison, &m_undoWorkers);
+        executor.setProgressCallback([&throttle](int current, int total, const QString &fileName) {
+            throttle.report(current, total, fileName);
+        });
+        executor.setCancelFlag(&job.cancelFlag());
+
+        executor.run(undoSteps, undoSteps.size() >= ParallelRestoreThreshold);
+        throttle.flush();
+        ServiceMetrics::addUndoSteps(executor.succeeded() + executor.failures().size());
+        result.total = executor.total();
+        result.succeeded = executor.succeeded();
+        result.cancelled = executor.cancelled();
+        result.failures = executor.failures();
 
         // undoフラグをクリア
-        for (const QString &filePath : filePaths) {
-            auto fileIt = files.findAbsolutePath(filePath.toStdString());
-            if (fileIt != files.end()) {
-                fileIt->setUndo(false);
-            }
+        for (snapper::File *file : std::as_const(markedFiles)) {
+            file->setUndo(false);
         }
 
-        qWarning() << "RestoreFiles: Completed. Successful:" << successCount << "Failed:" << (total - successCount);
+        // 復元先が変化したため、復元先を含むファイル変更一覧は次回の取得時に作成し直す
+        session->markStale();
+        invalidateChangeLists(configName, compareTo);
+
+        qWarning() << "Restore: Completed. Successful:" << result.succeeded
+                   << "Failed:" << result.failures.size() << "Cancelled:" << result.cancelled;
 
         // notFoundFilesは警告のみ（ディレクトリや差分のないファイルの可能性）
         if (!notFoundFiles.isEmpty()) {
             qWarning() << "Some files were not found in comparison (may be directories or already in sync):" << notFoundFiles.size();
         }
 
-        // 実際の復元失敗がある場合のみエラーを返す
-        if (!allSuccess) {
-            QString errorMsg = QString("Failed to restore %1 out of %2 files").arg(total - successCount).arg(total);
-            sendErrorReply(QDBusError::Failed, errorMsg);
-        }
-
-        return allSuccess;
-
+        return true;
     }
     catch (const snapper::Exception &e) {
         qWarning() << "Failed to restore files:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Failed to restore files: %1").arg(e.what()));
+        error = QString("Failed to restore files: %1").arg(e.what());
         return false;
     }
     catch (const std::exception &e) {
         qWarning() << "Unexpected error during restore:" << e.what();
-        sendErrorReply(QDBusError::Failed, QString("Unexpected error: %1").arg(e.what()));
+        error = QString("Unexpected error: %1").arg(e.what());
         return false;
     }
 }
@@ -5,11 +5,38 @@
 #include <QString>
 #include <QStringList>
 #include <QDBusContext>
+#include <QDBusError>
+#include <QDBusMessage>
+#include <QDBusUnixFileDescriptor>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QThreadPool>
 #include <QTimer>
+#include <QWaitCondition>
+#include <functional>
 #include <memory>
+#include "dbustypes.h"
+#include "snapshotjournal.h"
+#include "snapshotwatcher.h"
+#include "comparisoncache.h"
+#include "comparisonsession.h"
+#include "authorizer.h"
+#include "changefilter.h"
+#include "changetree.h"
+#include "reclaimtracker.h"
+#include "servicemetrics.h"
+#include "subvolumeusage.h"
+#include "restorejob.h"
+#include "undoexecutor.h"
+
+class DiffEngine;
 
 namespace snapper {
     class Snapper;
+    class Snapshot;
 }
 
 class SnapshotOperations : public QObject, protected QDBusContext
@@ -19,10 +46,156 @@ class SnapshotOperations : public QObject, protected QDBusContext
 
 private:
     static constexpr int IdleTimeoutMs = 5 * 60 * 1000; // 5分
-    std::unique_ptr<snapper::Snapper> m_snapper;    // Snapperインスタンス
-    QString m_currentConfig;                        // 現在の設定名
+    QHash<QString, std::shared_ptr<snapper::Snapper>> m_snappers;  // 設定名 → Snapperインスタンス (比較セッションと共有)
     QTimer m_idleTimer;                             // アイドルタイムアウト用タイマー
+    static constexpr int QuitPollMs = 1000;         // Quitを延期した場合に処理の終了を確認する間隔
+    QTimer m_quitTimer;                             // 延期したQuitの確認用タイマー
+    SnapshotJournal m_journal;                      // スナップショット一覧の変更履歴
+    SnapshotWatcher m_watcher;                      // スナップショットディレクトリの監視
+
+    // ページ単位取得用のファイル変更一覧キャッシュ (クライアントと比較ごと)
+    static constexpr int MaxPageSize = 50000;       // 1ページの最大件数
+    static constexpr int MaxChangeLists = 8;        // 保持する一覧の上限 (超えた分は最も使われていないものから破棄)
+
+    /**
+     * @brief クライアントが取得中のファイル変更一覧
+     */
+    struct ChangeListCache {
+        QString owner;                              // 取得したクライアントのバス名
+        QString configName;                         // Snapper設定名
+        int snapshotNumber = -1;                    // 比較元のスナップショット番号
+        int compareTo = 0;                          // 比較先のスナップショット番号 (0は現在のシステム)
+        ChangeFilter filter;                        // 一覧の絞り込み条件
+        QStringList changes;                        // ファイル変更一覧 ("ステータス パス"形式)
+        std::shared_ptr<const ChangeTree> tree;     // changesのツリー (未作成の場合はnullptr)
+        QElapsedTimer used;                         // 最後に使われてからの経過時間
+    };
+
+    QList<ChangeListCache> m_changeLists;           // 最近使われたファイル変更一覧
+
+    // スナップショット同士の比較結果のディスクキャッシュ
+    ComparisonCache m_comparisonCache;
+
+    // 比較セッション
+    static constexpr int SessionIdleMs = 2 * 60 * 1000;     // 未使用のセッションを閉じるまでの時間
+    static constexpr int SessionSweepMs = 30 * 1000;        // 期限切れセッションの確認間隔
+    static constexpr int MaxSessions = 8;                   // 同時に開けるセッションの上限
+    QHash<uint, std::shared_ptr<ComparisonSession>> m_sessions;    // ハンドル → セッション
+    uint m_nextSessionHandle;                       // 次に割り当てるハンドル
+    QTimer m_sessionTimer;                          // 期限切れセッションの確認用タイマー
+    QSet<QString> m_openingSessions;                // OpenComparisonが比較中のセッションのキー
+    QWaitCondition m_sessionOpened;                 // 比較中のセッションの完了の通知
+
+    // 復元ジョブ
+    static constexpr int MaxRestoreJobs = 2;        // 同時に実行する復元ジョブの上限 (超えた分は待機)
+    QThreadPool m_jobWorkers;                       // 復元ジョブを実行するスレッドプール
+    QHash<uint, std::shared_ptr<RestoreJob>> m_restoreJobs;    // ジョブID → 実行中・待機中のジョブ
+    uint m_nextRestoreJobId;                        // 次に割り当てるジョブID
+    QMutex m_restoreJobsMutex;                      // m_restoreJobs, m_nextRestoreJobIdの保護
+
+    // 復元の進捗通知の間隔 (クライアントごと)
+    static constexpr int DefaultProgressIntervalMs = 100;   // 進捗を通知する最小間隔 (ミリ秒)
+    static constexpr int DefaultProgressStepInterval = 1000;    // 時間に関わらず進捗を通知するステップ数
+    static constexpr int MaxProgressIntervalMs = 10 * 1000;     // 設定できる通知間隔の上限
+    static constexpr int MaxProgressRates = 64;     // 保持する設定の上限 (超えた分は古いものから破棄)
+
+    /**
+     * @brief SetRestoreProgressRateで設定された通知間隔
+     */
+    struct ClientProgressRate {
+        RestoreJob::ProgressRate rate;      // 通知間隔
+        QElapsedTimer updated;              // 設定からの経過時間
+    };
+
+    QHash<QString, ClientProgressRate> m_progressRates;     // クライアントのバス名 → 通知間隔
+    QMutex m_progressRatesMutex;                    // m_progressRatesの保護
+
+    // 復元中のスナップショット (設定のロックを解放して復元する間、削除させない)
+    QHash<QString, QHash<int, int>> m_restoringSnapshots;  // 設定名 → スナップショット番号 → 復元の数
+    QMutex m_restoringMutex;                        // m_restoringSnapshotsの保護
+
+    /**
+     * @brief 復元に使用するスナップショットを登録するスコープ
+     *
+     * 設定のロックを取得した状態で作成します。破棄時に登録を解除します。
+     */
+    class RestoringScope
+    {
+    private:
+        SnapshotOperations *m_operations;   // 登録先
+        QString m_configName;               // Snapper設定名
+        QList<int> m_numbers;               // 登録したスナップショット番号
+
+    public:
+        RestoringScope(SnapshotOperations *operations, const QString &configName, const QList<int> &numbers);
+        ~RestoringScope();
 
+        RestoringScope(const RestoringScope &) = delete;
+        RestoringScope &operator=(const RestoringScope &) = delete;
+    };
+
+    // クリーンアップの計画
+    static constexpr int CleanupPlanLifetimeMs = 10 * 60 * 1000;   // 計画を実行できる期間
+    static constexpr int MaxCleanupPlans = 16;      // 保持する計画の上限 (超えた分は古いものから破棄)
+
+    /**
+     * @brief PlanCleanupで計算したクリーンアップの計画
+     */
+    struct CleanupPlan {
+        QString configName;         // 設定名
+        QList<int> numbers;         // 削除するスナップショット番号
+        QString owner;              // 計画を作成したクライアントのバス名
+        QElapsedTimer created;      // 作成からの経過時間
+    };
+
+    QHash<uint, CleanupPlan> m_cleanupPlans;        // 計画ID → 計画
+    uint m_nextCleanupPlanId;                       // 次に割り当てる計画ID
+    QMutex m_cleanupPlansMutex;                     // m_cleanupPlans, m_nextCleanupPlanIdの保護
+
+    // スナップショットの使用量のキャッシュ
+    static constexpr int SizeCacheMaxAgeMs = 30 * 1000;     // qgroupを読み直すまでの時間
+
+    /**
+     * @brief 設定ごとのスナップショットの使用量
+     */
+    struct SizeCache {
+        quint64 generation = 0;                 // サブボリュームIDに反映済みのスナップショット一覧の世代番号 (0は未取得)
+        QHash<int, quint64> subvolumeIds;       // スナップショット番号 → サブボリュームID
+        QHash<quint64, SubvolumeUsage::Usage> usage;    // サブボリュームID → 使用量
+        bool quotaEnabled = false;              // qgroupを読み取れた場合true
+        QElapsedTimer read;                     // qgroupを読み取ってからの経過時間
+    };
+
+    QHash<QString, SizeCache> m_sizeCaches;         // 設定名 → 使用量
+    QMutex m_sizeCachesMutex;                       // m_sizeCachesの保護
+
+    // 削除したスナップショットの領域の解放 (追跡はメインスレッド、状況の取得は任意のスレッド)
+    ReclaimTracker m_reclaimTracker;
+
+    // 構造化された差分の上限
+    static constexpr int MaxDiffContextLines = 100;         // 前後に表示する行数の上限
+    static constexpr int MaxDiffLines = 100000;             // 1回に返す行数の上限
+    static constexpr int MaxDiffBytes = 16 * 1024 * 1024;   // 1回に返すバイト数の上限
+
+    // メソッドごとの所要時間と処理量の統計
+    ServiceMetrics m_metrics;
+
+    // 認証
+    Authorizer m_authorizer;                        // PolicyKitによる非同期認証
+
+    // 並行実行
+    static constexpr int MaxWorkers = 4;            // メソッドを実行するワーカースレッドの上限
+    QThreadPool m_workers;                          // メソッド呼び出しを実行するスレッドプール
+    static constexpr int MaxUndoWorkers = 8;        // 復元ステップを並行して実行するスレッドの上限
+    static constexpr size_t ParallelRestoreThreshold = 64;  // 並列モードで復元するステップ数の下限
+    QThreadPool m_undoWorkers;                      // 復元ステップを実行するスレッドプール (m_workersとは別)
+    QMutex m_stateMutex;                            // m_snappers, m_journal, 設定ごとのロックの保護
+    QHash<QString, std::shared_ptr<QReadWriteLock>> m_configLocks;  // 設定名 → スナップショット一覧のロック
+    QHash<QString, std::shared_ptr<QMutex>> m_mountLocks;           // 設定名 → マウント・アンマウントのロック
+    QMutex m_sessionsMutex;                         // m_sessions, m_nextSessionHandle, m_openingSessionsの保護
+    QMutex m_changeListMutex;                       // m_changeListsの保護
+
+    bool isBusy();
     void resetIdleTimer();
 
 public:
@@ -30,23 +203,109 @@ public:
     ~SnapshotOperations();
 
 public slots:
-    QString ListSnapshots();
-    QString CreateSnapshot(const QString &type, const QString &description,
+    QString ListSnapshots(const QString &configName);
+    QList<SnapshotRecord> ListSnapshotsV2(const QString &configName);
+    QList<int> ListSnapshotsSince(const QString &configName, qulonglong generation,
+                                  QList<int> &removed, QList<int> &modified,
+                                  qulonglong &newGeneration, bool &complete);
+    QList<SnapshotRecord> GetSnapshots(const QString &configName, const QList<int> &numbers);
+    QList<SnapshotSize> GetSnapshotSizes(const QString &configName, const QList<int> &numbers);
+    QString CreateSnapshot(const QString &configName, const QString &type, const QString &description,
                           int preNumber, const QString &cleanup, bool important);
-    bool DeleteSnapshot(int number);
-    bool RollbackSnapshot(int number);
-    QString GetFileChanges(const QString &configName, int snapshotNumber);
-    QString GetFileDiff(const QString &configName, int snapshotNumber, const QString &filePath);
-    bool RestoreFiles(const QString &configName, int snapshotNumber, const QStringList &filePaths);
+    bool DeleteSnapshot(const QString &configName, int number);
+    QList<DeletionResult> DeleteSnapshots(const QString &configName, const QStringList &ranges);
+    uint PlanCleanup(const QString &configName, const QString &algorithm,
+                     QList<int> &numbers, qlonglong &estimatedBytes);
+    QList<DeletionResult> RunCleanup(uint planId);
+    bool GetSpaceReclaimStatus(const QString &configName, int &pendingSubvolumes, qlonglong &bytesFreed);
+    bool RollbackSnapshot(const QString &configName, int number);
+    QString GetFileChanges(const QString &configName, int snapshotNumber, int compareTo,
+                           const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                           const QStringList &excludeGlobs, uint statusMask);
+    uint OpenComparison(const QString &configName, int snapshot1, int snapshot2);
+    void CloseComparison(uint handle);
+    QStringList GetFileChangesPage(const QString &configName, int snapshotNumber, int compareTo,
+                                   const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                                   const QStringList &excludeGlobs, uint statusMask,
+                                   int offset, int limit, int &total);
+    QDBusUnixFileDescriptor GetFileChangesFd(const QString &configName, int snapshotNumber, int compareTo,
+                                             const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                                             const QStringList &excludeGlobs, uint statusMask,
+                                             int offset, bool compress, int &total, bool &compressed);
+    QList<ChangeNode> GetChildren(const QString &configName, int snapshotNumber, int compareTo,
+                                  const QStringList &pathPrefixes, const QStringList &includeGlobs,
+                                  const QStringList &excludeGlobs, uint statusMask, const QString &dirPath);
+    QString GetFileDiff(const QString &configName, int snapshotNumber, int compareTo, const QString &filePath);
+    QDBusUnixFileDescriptor GetFileDiffFd(const QString &configName, int snapshotNumber, int compareTo,
+                                          const QString &filePath, bool compress, bool &compressed);
+    QList<DiffHunk> GetFileDiffHunks(const QString &configName, int snapshotNumber, int compareTo,
+                                     const QString &filePath,
+                                     int contextLines, int maxLines, int maxBytes,
+                                     bool &binary, bool &truncated, qlonglong &oldSize, qlonglong &newSize);
+    bool RestoreFiles(const QString &configName, int snapshotNumber, int compareTo,
+                      const QStringList &filePaths, const QStringList &pathPrefixes,
+                      const QStringList &includeGlobs, const QStringList &excludeGlobs, uint statusMask);
+    uint StartRestore(const QString &configName, int snapshotNumber, int compareTo,
+                      const QStringList &filePaths, const QStringList &pathPrefixes,
+                      const QStringList &includeGlobs, const QStringList &excludeGlobs, uint statusMask);
+    void CancelRestore(uint jobId);
+    void SetRestoreProgressRate(int intervalMs, int stepInterval);
+    QList<MethodStats> GetMetrics();
     void Quit();
 
 signals:
     void restoreProgress(int current, int total, const QString &filePath);
+    void RestoreJobProgress(uint jobId, int current, int total, const QString &filePath);
+    void RestoreJobFinished(uint jobId, bool success, bool cancelled, int succeeded, int total,
+                            const QMap<QString, QString> &failures, const QString &error);
+    void SnapshotsChanged(const QString &configName, const QList<int> &added, const QList<int> &removed);
+    void SpaceReclaimProgress(const QString &configName, int pendingSubvolumes, qlonglong bytesFreed);
+
+private slots:
+    void onSnapshotsTouched(const QString &configName, const QList<int> &present,
+                            const QList<int> &absent, const QList<int> &modified, bool rescan);
+    void expireSessions();
 
 private:
     bool checkAuthorization(const QString &actionId);
-    snapper::Snapper* getSnapper(const QString &configName = "root");
+    void dispatch(const QDBusMessage &call, qint64 authUs);
+    void execute(const QDBusMessage &call, qint64 authUs, qint64 queueUs);
+    void replyError(QDBusError::ErrorType type, const QString &text);
+    QString callerName() const;
+    std::shared_ptr<snapper::Snapper> acquireSnapper(const QString &configName);
+    void invalidateSnapper(const QString &configName);
+    QReadWriteLock *configLock(const QString &configName);
+    std::shared_ptr<QMutex> mountLock(const QString &configName);
     QString formatSnapshotToCSV(const snapper::Snapper *snapper);
+    SnapshotRecord snapshotToRecord(const snapper::Snapshot &snapshot);
+    void ensureJournal(const QString &configName, const snapper::Snapper *snapper);
+    void publishChanges(const QString &configName, const QList<int> &added, const QList<int> &removed,
+                        const QList<int> &modified = QList<int>());
+    QStringList collectFileChanges(const QString &configName, snapper::Snapper *snapper,
+                                   int snapshotNumber, int compareTo, const QStringList &scope);
+    QStringList loadChangeList(const QString &configName, int snapshotNumber, int compareTo,
+                               const ChangeFilter &filter, bool reuse);
+    std::shared_ptr<const ChangeTree> loadChangeTree(const QString &configName, int snapshotNumber, int compareTo,
+                                                     const ChangeFilter &filter, bool reuse);
+    ChangeListCache *findChangeList(const QString &owner, const QString &configName, int snapshotNumber,
+                                    int compareTo, const ChangeFilter &filter);
+    void invalidateChangeLists(const QString &configName, int number);
+    void diffFile(const QString &configName, int snapshotNumber, int compareTo, const QString &filePath,
+                  const std::function<void(const DiffEngine &engine)> &output, qint64 maxSize);
+    RestoreJob::ProgressRate progressRate(const QString &client);
+    std::shared_ptr<ComparisonSession> findSession(const QString &configName, int number1, int number2,
+                                                   const QString &owner);
+    static QString sessionKey(const QString &configName, int number1, int number2, const QString &owner);
+    QList<std::shared_ptr<ComparisonSession>> closeSessions(const QString &configName, const QList<int> &numbers);
+    void releaseSessions(QList<std::shared_ptr<ComparisonSession>> sessions);
+    bool isRestoring(const QString &configName, int number);
+    bool restore(const RestoreJob &job, const UndoExecutor::ProgressCallback &progress,
+                 RestoreJob::Result &result, QString &error);
+    void runRestoreJob(const std::shared_ptr<RestoreJob> &job);
+    QList<DeletionResult> deleteSnapshots(const QString &configName, snapper::Snapper *snapper,
+                                          const QList<int> &numbers);
+    void trackReclaim(const QString &configName, const snapper::Snapper *snapper,
+                      const QList<quint64> &subvolumeIds);
     QString snapshotTypeToString(int type);
     int stringToSnapshotType(const QString &typeStr);
 };
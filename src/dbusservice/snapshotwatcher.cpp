@@ -0,0 +1,355 @@
+#include "snapshotwatcher.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSocketNotifier>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * @brief SnapshotWatcherクラスのコンストラクタ
+ *
+ * inotifyインスタンスを作成し、イベントをイベントループで受信できるようにします。
+ *
+ * @param parent 親QObjectポインタ
+ */
+SnapshotWatcher::SnapshotWatcher(QObject *parent)
+    : QObject(parent)
+    , m_fd(-1)
+    , m_notifier(nullptr)
+{
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        qWarning() << "Failed to initialize inotify:" << strerror(errno);
+    }
+    else {
+        m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &SnapshotWatcher::readEvents);
+    }
+
+    m_debounceTimer.setSingleShot(true);
+    m_debounceTimer.setInterval(DebounceMs);
+    connect(&m_debounceTimer, &QTimer::timeout, this, &SnapshotWatcher::flushPending);
+}
+
+/**
+ * @brief SnapshotWatcherクラスのデストラクタ
+ *
+ * inotifyインスタンスを閉じます。
+ */
+SnapshotWatcher::~SnapshotWatcher()
+{
+    delete m_notifier;
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+/**
+ * @brief 設定のディレクトリを監視中かを判定
+ *
+ * @param configName 設定名
+ * @return 監視中の場合true
+ */
+bool SnapshotWatcher::isWatching(const QString &configName) const
+{
+    return m_configWatches.contains(configName);
+}
+
+/**
+ * @brief スナップショットディレクトリの監視を開始
+ *
+ * 番号ディレクトリの作成・削除・移動と、各番号ディレクトリ直下のinfo.xmlの
+ * 書き換えを監視します。スナップショットの内容 (snapshotサブボリューム)は
+ * 監視しないため、ウォッチ数は設定ごとに1つとスナップショットごとに1つです。
+ *
+ * @param configName 設定名
+ * @param snapshotsDir 監視する.snapshotsディレクトリのパス
+ * @return 監視を開始できた場合 (既に監視中の場合を含む)true
+ */
+bool SnapshotWatcher::watch(const QString &configName, const QString &snapshotsDir)
+{
+    if (m_fd < 0) {
+        return false;
+    }
+
+    if (isWatching(configName)) {
+        return true;
+    }
+
+    int wd = inotify_add_watch(m_fd, QFile::encodeName(snapshotsDir).constData(),
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd < 0) {
+        qWarning() << "Failed to watch" << snapshotsDir << ":" << strerror(errno);
+        return false;
+    }
+
+    m_watchConfigs.insert(wd, configName);
+    m_configWatches.insert(configName, wd);
+    m_directories.insert(configName, snapshotsDir);
+
+    const QStringList entries = QDir(snapshotsDir).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &entry : entries) {
+        int number = 0;
+        if (parseNumber(QFile::encodeName(entry).constData(), number)) {
+            watchSnapshot(configName, number);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief スナップショットディレクトリの監視を終了
+ *
+ * @param configName 設定名
+ */
+void SnapshotWatcher::unwatch(const QString &configName)
+{
+    auto it = m_configWatches.find(configName);
+    if (it == m_configWatches.end()) {
+        return;
+    }
+
+    inotify_rm_watch(m_fd, it.value());
+    m_watchConfigs.remove(it.value());
+    m_configWatches.erase(it);
+
+    const QHash<int, int> snapshotWds = m_snapshotWds.take(configName);
+    for (int wd : snapshotWds) {
+        inotify_rm_watch(m_fd, wd);
+        m_snapshotWatches.remove(wd);
+    }
+
+    m_directories.remove(configName);
+    m_pending.remove(configName);
+}
+
+/**
+ * @brief ディレクトリ名をスナップショット番号として解釈
+ *
+ * @param name ディレクトリ名
+ * @param number スナップショット番号 (出力)
+ * @return 正の整数のみで構成される名前の場合true
+ */
+bool SnapshotWatcher::parseNumber(const char *name, int &number)
+{
+    bool ok = false;
+    number = QByteArray(name).toInt(&ok);
+    return ok && number > 0 && name[0] >= '0' && name[0] <= '9';
+}
+
+/**
+ * @brief スナップショットのinfo.xmlの更新日時を取得
+ *
+ * @param configName 設定名
+ * @param number スナップショット番号
+ * @return 更新日時、info.xmlが存在しない場合は無効な値
+ */
+QDateTime SnapshotWatcher::infoModified(const QString &configName, int number) const
+{
+    const QDir dir(m_directories.value(configName));
+    return QFileInfo(dir.filePath(QString::number(number) + "/info.xml")).lastModified();
+}
+
+/**
+ * @brief 番号ディレクトリのinfo.xmlの書き換えの監視を開始
+ *
+ * snapperはinfo.xmlを一時ファイルに書き込んでから置き換えるため、
+ * 書き込みの完了と移動による置き換えを監視します。
+ * 既に監視中の場合は、info.xmlの更新日時だけを記録し直します。
+ *
+ * @param configName 設定名
+ * @param number スナップショット番号
+ */
+void SnapshotWatcher::watchSnapshot(const QString &configName, int number)
+{
+    const QDir dir(m_directories.value(configName));
+    const QString path = dir.filePath(QString::number(number));
+
+    int wd = inotify_add_watch(m_fd, QFile::encodeName(path).constData(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd < 0) {
+        qWarning() << "Failed to watch" << path << ":" << strerror(errno);
+        return;
+    }
+
+    m_snapshotWatches.insert(wd, {configName, number, infoModified(configName, number)});
+    m_snapshotWds[configName].insert(number, wd);
+}
+
+/**
+ * @brief 削除された番号ディレクトリの監視情報を破棄
+ *
+ * ディレクトリの削除でウォッチは自動的に解除されるため、記録だけを削除します。
+ *
+ * @param configName 設定名
+ * @param number スナップショット番号
+ */
+void SnapshotWatcher::forgetSnapshot(const QString &configName, int number)
+{
+    auto wds = m_snapshotWds.find(configName);
+    if (wds == m_snapshotWds.end()) {
+        return;
+    }
+
+    auto wd = wds->constFind(number);
+    if (wd != wds->constEnd()) {
+        m_snapshotWatches.remove(wd.value());
+        wds->erase(wd);
+    }
+}
+
+/**
+ * @brief inotifyイベントを読み込む
+ *
+ * 読み込めるイベントを全て取り出して設定ごとに蓄積し、
+ * デバウンスタイマーを再始動します。
+ */
+void SnapshotWatcher::readEvents()
+{
+    alignas(struct inotify_event) char buffer[4096];
+
+    for (;;) {
+        ssize_t length = read(m_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+
+        for (char *ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            // キューが溢れた場合はどの番号が変化したか分からないため全件を再走査する
+            if (event->mask & IN_Q_OVERFLOW) {
+                qWarning() << "inotify event queue overflowed, rescanning snapshot directories";
+                for (auto it = m_configWatches.constBegin(); it != m_configWatches.constEnd(); ++it) {
+                    m_pending[it.key()].rescan = true;
+                }
+                continue;
+            }
+
+            // 番号ディレクトリのイベント (info.xmlの書き換え、ディレクトリの削除によるウォッチの解除)
+            auto snapshot = m_snapshotWatches.constFind(event->wd);
+            if (snapshot != m_snapshotWatches.constEnd()) {
+                if (event->mask & IN_IGNORED) {
+                    m_snapshotWds[snapshot->configName].remove(snapshot->number);
+                    m_snapshotWatches.erase(snapshot);
+                }
+                else if (event->len > 0 && std::strcmp(event->name, "info.xml") == 0) {
+                    m_pending[snapshot->configName].modified.insert(snapshot->number);
+                }
+                continue;
+            }
+
+            const QString configName = m_watchConfigs.value(event->wd);
+            if (configName.isEmpty()) {
+                continue;
+            }
+
+            // ディレクトリ自体が削除された場合、ウォッチは自動的に解除される
+            if (event->mask & IN_IGNORED) {
+                m_watchConfigs.remove(event->wd);
+                m_configWatches.remove(configName);
+                m_pending[configName].rescan = true;
+                continue;
+            }
+
+            int number = 0;
+            if (event->len > 0 && parseNumber(event->name, number)) {
+                m_pending[configName].numbers.insert(number);
+            }
+        }
+    }
+
+    if (!m_pending.isEmpty()) {
+        m_debounceTimer.start();
+    }
+}
+
+/**
+ * @brief 蓄積したイベントを通知
+ *
+ * デバウンスタイマーの満了時に呼び出されます。snapperは番号ディレクトリを
+ * 作成した後にinfo.xmlを書き込むため、info.xmlがまだ存在しない番号は
+ * 次回のタイマー満了まで通知を保留します。
+ * 再走査では、info.xmlの更新日時を記録と比較して書き換えを検出します。
+ */
+void SnapshotWatcher::flushPending()
+{
+    QHash<QString, PendingChanges> pending;
+    pending.swap(m_pending);
+
+    for (auto it = pending.constBegin(); it != pending.constEnd(); ++it) {
+        const QString &configName = it.key();
+        const PendingChanges &changes = it.value();
+        const QDir dir(m_directories.value(configName));
+
+        QList<int> present;
+        QList<int> absent;
+        QList<int> modified;
+
+        if (changes.rescan) {
+            const QHash<int, int> watched = m_snapshotWds.value(configName);
+            const QStringList entries = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+            for (const QString &entry : entries) {
+                int number = 0;
+                if (parseNumber(QFile::encodeName(entry).constData(), number)
+                    && QFileInfo::exists(dir.filePath(entry + "/info.xml"))) {
+                    present.append(number);
+
+                    auto wd = watched.constFind(number);
+                    if (wd != watched.constEnd()
+                        && m_snapshotWatches.value(wd.value()).modified != infoModified(configName, number)) {
+                        modified.append(number);
+                    }
+                    watchSnapshot(configName, number);
+                }
+            }
+
+            const QSet<int> presentSet(present.begin(), present.end());
+            for (auto wd = watched.constBegin(); wd != watched.constEnd(); ++wd) {
+                if (!presentSet.contains(wd.key())) {
+                    forgetSnapshot(configName, wd.key());
+                }
+            }
+        }
+        else {
+            for (int number : changes.numbers) {
+                const QString entry = QString::number(number);
+                if (QFileInfo::exists(dir.filePath(entry + "/info.xml"))) {
+                    present.append(number);
+                    watchSnapshot(configName, number);
+                }
+                else if (QFileInfo::exists(dir.filePath(entry)) && changes.retries < MaxRetries) {
+                    // 作成途中のスナップショット
+                    PendingChanges &retry = m_pending[configName];
+                    retry.numbers.insert(number);
+                    retry.retries = changes.retries + 1;
+                }
+                else {
+                    absent.append(number);
+                    forgetSnapshot(configName, number);
+                }
+            }
+
+            for (int number : changes.modified) {
+                const QString entry = QString::number(number);
+                if (!changes.numbers.contains(number) && QFileInfo::exists(dir.filePath(entry + "/info.xml"))) {
+                    modified.append(number);
+                    watchSnapshot(configName, number);
+                }
+            }
+        }
+
+        if (changes.rescan || !present.isEmpty() || !absent.isEmpty() || !modified.isEmpty()) {
+            emit snapshotsTouched(configName, present, absent, modified, changes.rescan);
+        }
+    }
+
+    if (!m_pending.isEmpty()) {
+        m_debounceTimer.start();
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SNAPSHOTWATCHER_H
+#define SNAPSHOTWATCHER_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+
+class QSocketNotifier;
+
+/**
+ * @brief スナップショットディレクトリをinotifyで監視するクラス
+ *
+ * 各設定の.snapshotsディレクトリ直下で番号ディレクトリが作成・削除されたことと、
+ * 各番号ディレクトリのinfo.xmlが書き換えられたこと (snapper modifyなど)を
+ * 検出し、一定時間イベントが途絶えた後にまとめて通知します。
+ * timelineやzypperなど他のツールが作成したスナップショットも検出できます。
+ */
+class SnapshotWatcher : public QObject
+{
+    Q_OBJECT
+
+private:
+    static constexpr int DebounceMs = 500;      // イベントをまとめる待ち時間
+    static constexpr int MaxRetries = 10;       // info.xml待ちの再試行回数
+
+    struct PendingChanges {
+        QSet<int> numbers;      // 作成・削除のイベントが発生した番号
+        QSet<int> modified;     // info.xmlが書き換えられた番号
+        bool rescan = false;    // イベント欠落のため全件の再走査が必要
+        int retries = 0;        // info.xml待ちの再試行回数
+    };
+
+    struct SnapshotWatch {
+        QString configName;     // 設定名
+        int number = 0;         // スナップショット番号
+        QDateTime modified;     // 最後に確認したinfo.xmlの更新日時 (再走査時の比較用)
+    };
+
+    int m_fd;                                       // inotifyのファイルディスクリプタ
+    QSocketNotifier *m_notifier;                    // inotifyイベントの通知
+    QHash<int, QString> m_watchConfigs;             // ウォッチ記述子 → 設定名
+    QHash<QString, int> m_configWatches;            // 設定名 → ウォッチ記述子
+    QHash<QString, QString> m_directories;          // 設定名 → 監視中のディレクトリ
+    QHash<int, SnapshotWatch> m_snapshotWatches;    // ウォッチ記述子 → 番号ディレクトリ
+    QHash<QString, QHash<int, int>> m_snapshotWds;  // 設定名 → スナップショット番号 → ウォッチ記述子
+    QHash<QString, PendingChanges> m_pending;       // 設定名 → 未通知のイベント
+    QTimer m_debounceTimer;                         // イベントをまとめるタイマー
+
+    static bool parseNumber(const char *name, int &number);
+    QDateTime infoModified(const QString &configName, int number) const;
+    void watchSnapshot(const QString &configName, int number);
+    void forgetSnapshot(const QString &configName, int number);
+
+public:
+    explicit SnapshotWatcher(QObject *parent = nullptr);
+    ~SnapshotWatcher();
+
+    bool isWatching(const QString &configName) const;
+    bool watch(const QString &configName, const QString &snapshotsDir);
+    void unwatch(const QString &configName);
+
+signals:
+    /**
+     * @brief スナップショットディレクトリの変化を通知
+     *
+     * @param configName 設定名
+     * @param present イベントが発生し、現在存在する番号
+     * @param absent イベントが発生し、現在存在しない番号
+     * @param modified info.xmlが書き換えられた番号
+     * @param rescan trueの場合presentは存在する全番号 (イベント欠落時)
+     */
+    void snapshotsTouched(const QString &configName, const QList<int> &present,
+                          const QList<int> &absent, const QList<int> &modified, bool rescan);
+
+private slots:
+    void readEvents();
+    void flushPending();
+};
+
+#endif // SNAPSHOTWATCHER_H
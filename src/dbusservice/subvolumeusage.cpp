@@ -0,0 +1,139 @@
+#include "subvolumeusage.h"
+#include <QDebug>
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
+#include <sys/ioctl.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * @brief サブボリュームのIDを取得
+ *
+ * @param path サブボリュームのパス
+ * @return サブボリュームID、btrfsのサブボリュームでない場合は0
+ */
+quint64 SubvolumeUsage::subvolumeId(const QString &path)
+{
+    const int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    // サブボリュームのルートディレクトリ (inode 256)の属するツリーがサブボリュームID
+    struct btrfs_ioctl_ino_lookup_args args {};
+    args.treeid = 0;
+    args.objectid = BTRFS_FIRST_FREE_OBJECTID;
+
+    const bool ok = ioctl(fd, BTRFS_IOC_INO_LOOKUP, &args) == 0;
+    ::close(fd);
+
+    return ok ? args.treeid : 0;
+}
+
+/**
+ * @brief サブボリュームの世代 (最後に変更されたトランザクションID)を取得
+ *
+ * 読み取り専用のスナップショットでは変化しないため、
+ * スナップショットの内容が同じであることの確認に使用できます。
+ *
+ * @param path サブボリュームのパス
+ * @return 世代、btrfsのサブボリュームでない場合や取得できない場合は0
+ */
+quint64 SubvolumeUsage::generation(const QString &path)
+{
+    const int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct btrfs_ioctl_get_subvol_info_args args {};
+    const bool ok = ioctl(fd, BTRFS_IOC_GET_SUBVOL_INFO, &args) == 0;
+    ::close(fd);
+
+    return ok ? args.generation : 0;
+}
+
+/**
+ * @brief 全てのサブボリュームの使用量を読み取る
+ *
+ * クォータツリーのレベル0のqgroup (qgroupid == サブボリュームID)の
+ * QGROUP_INFOを検索します。1回のioctlで最大4KiB分の項目を読み取り、
+ * 残りがある場合は続きから検索します。
+ *
+ * @param path ファイルシステム上のパス
+ * @param usage サブボリュームID → 使用量 (出力)
+ * @return 読み取れた場合true (クォータが無効な場合はfalse)
+ */
+bool SubvolumeUsage::readQgroups(const QString &path, QHash<quint64, Usage> &usage)
+{
+    usage.clear();
+
+    const int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        qWarning() << "Failed to open" << path << "for qgroup lookup:" << strerror(errno);
+        return false;
+    }
+
+    struct btrfs_ioctl_search_args args {};
+    struct btrfs_ioctl_search_key &key = args.key;
+
+    key.tree_id = BTRFS_QUOTA_TREE_OBJECTID;
+    key.min_objectid = 0;
+    key.max_objectid = 0;
+    key.min_type = BTRFS_QGROUP_INFO_KEY;
+    key.max_type = BTRFS_QGROUP_INFO_KEY;
+    key.min_offset = 0;
+    key.max_offset = (1ULL << 48) - 1;     // レベル0のqgroupだけ
+    key.min_transid = 0;
+    key.max_transid = static_cast<__u64>(-1);
+
+    bool ok = true;
+    for (;;) {
+        key.nr_items = 4096;
+
+        if (ioctl(fd, BTRFS_IOC_TREE_SEARCH, &args) != 0) {
+            // クォータが無効な場合はENOENT
+            if (errno != ENOENT) {
+                qWarning() << "Failed to search btrfs quota tree:" << strerror(errno);
+            }
+            ok = false;
+            break;
+        }
+
+        if (key.nr_items == 0) {
+            break;
+        }
+
+        size_t offset = 0;
+        quint64 lastOffset = 0;
+        for (__u32 i = 0; i < key.nr_items; ++i) {
+            struct btrfs_ioctl_search_header header;
+            memcpy(&header, args.buf + offset, sizeof(header));
+            offset += sizeof(header);
+
+            if (header.type == BTRFS_QGROUP_INFO_KEY && header.len >= sizeof(struct btrfs_qgroup_info_item)) {
+                struct btrfs_qgroup_info_item item;
+                memcpy(&item, args.buf + offset, sizeof(item));
+
+                Usage &entry = usage[header.offset];
+                entry.referenced = static_cast<qint64>(le64toh(item.rfer));
+                entry.exclusive = static_cast<qint64>(le64toh(item.excl));
+            }
+
+            offset += header.len;
+            lastOffset = header.offset;
+        }
+
+        // 最後に読み取った項目の次から検索を続ける
+        if (lastOffset >= key.max_offset) {
+            break;
+        }
+        key.min_offset = lastOffset + 1;
+    }
+
+    ::close(fd);
+    return ok;
+}
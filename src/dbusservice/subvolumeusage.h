@@ -0,0 +1,30 @@
+#ifndef SUBVOLUMEUSAGE_H
+#define SUBVOLUMEUSAGE_H
+
+#include <QHash>
+#include <QString>
+
+/**
+ * @brief btrfsのサブボリュームの使用量を取得するクラス
+ *
+ * クォータ (qgroup)が有効なファイルシステムでは、カーネルが
+ * サブボリュームごとの参照量 (referenced)と排他量 (exclusive)を保持しています。
+ * クォータツリーを検索し、全てのサブボリュームの使用量を一度に読み取ります。
+ */
+class SubvolumeUsage
+{
+public:
+    /**
+     * @brief サブボリュームの使用量
+     */
+    struct Usage {
+        qint64 referenced = 0;      // 参照しているデータ量 (バイト)
+        qint64 exclusive = 0;       // このサブボリュームだけが参照しているデータ量 (バイト)
+    };
+
+    static quint64 subvolumeId(const QString &path);
+    static quint64 generation(const QString &path);
+    static bool readQgroups(const QString &path, QHash<quint64, Usage> &usage);
+};
+
+#endif // SUBVOLUMEUSAGE_H
@@ -0,0 +1,228 @@
+#include "undoexecutor.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <snapper/Comparison.h>
+#include <snapper/File.h>
+#include <snapper/Exception.h>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+/**
+ * @brief UndoExecutorクラスのコンストラクタ
+ *
+ * @param comparison 復元に使用する比較結果 (undoフラグを設定済み)
+ * @param pool 並列モードで使用するスレッドプール
+ */
+UndoExecutor::UndoExecutor(snapper::Comparison &comparison, QThreadPool *pool)
+    : m_comparison(comparison)
+    , m_pool(pool)
+    , m_completed(0)
+    , m_succeeded(0)
+    , m_total(0)
+    , m_cancel(nullptr)
+    , m_cancelled(false)
+{
+}
+
+/**
+ * @brief ステップを実行順の段階に分割
+ *
+ * 同じ種類 (作成、変更、削除)の連続する区間ごとに、パスの深さで段階に分けます。
+ * 作成と変更は浅い順、削除は深い順に並べます。
+ * 種類の異なる区間の順序はgetUndoStepsの順序のまま保ちます。
+ *
+ * @param steps getUndoStepsが返したステップ
+ * @return 段階ごとのステップのインデックス (実行順)
+ */
+QList<QList<int>> UndoExecutor::partition(const std::vector<snapper::UndoStep> &steps)
+{
+    QList<QList<int>> waves;
+
+    size_t begin = 0;
+    while (begin < steps.size()) {
+        const snapper::Action action = steps[begin].action;
+        size_t end = begin;
+        while (end < steps.size() && steps[end].action == action) {
+            ++end;
+        }
+
+        // 深さ → ステップ
+        std::map<int, QList<int>> byDepth;
+        for (size_t i = begin; i < end; ++i) {
+            const int depth = static_cast<int>(std::count(steps[i].name.begin(), steps[i].name.end(), '/'));
+            byDepth[depth].append(static_cast<int>(i));
+        }
+
+        if (action == snapper::DELETE) {
+            for (auto it = byDepth.rbegin(); it != byDepth.rend(); ++it) {
+                waves.append(it->second);
+            }
+        }
+        else {
+            for (auto it = byDepth.begin(); it != byDepth.end(); ++it) {
+                waves.append(it->second);
+            }
+        }
+
+        begin = end;
+    }
+
+    return waves;
+}
+
+/**
+ * @brief ステップを実行
+ *
+ * 並列モードでない場合は、getUndoStepsの順序で1つずつ実行します。
+ * 失敗したステップがあっても残りのステップは実行します。
+ * 中止が要求された場合は、実行中のステップの完了後に残りのステップを実行せず戻ります。
+ *
+ * @param steps getUndoStepsが返したステップ
+ * @param parallel 段階ごとに並行して実行する場合true
+ * @return 全てのステップが成功した場合true (中止した場合はfalse)
+ */
+bool UndoExecutor::run(const std::vector<snapper::UndoStep> &steps, bool parallel)
+{
+    m_total = static_cast<int>(steps.size());
+    m_completed = 0;
+    m_succeeded = 0;
+    m_cancelled = false;
+    {
+        QMutexLocker locker(&m_failuresMutex);
+        m_failures.clear();
+    }
+
+    if (!parallel || !m_pool) {
+        for (const snapper::UndoStep &step : steps) {
+            if (isCancelRequested()) {
+                break;
+            }
+            runStep(step);
+        }
+    }
+    else {
+        const QList<QList<int>> waves = partition(steps);
+        for (const QList<int> &wave : waves) {
+            if (isCancelRequested()) {
+                break;
+            }
+            runWave(steps, wave);
+        }
+    }
+
+    m_cancelled = m_completed < m_total;
+
+    return m_succeeded == m_total;
+}
+
+/**
+ * @brief 失敗したステップの一覧を取得
+ *
+ * @return 失敗したファイルパス → エラーメッセージ
+ */
+QMap<QString, QString> UndoExecutor::failures() const
+{
+    QMutexLocker locker(&m_failuresMutex);
+    return m_failures;
+}
+
+/**
+ * @brief 中止が要求されているかを確認
+ *
+ * @return 中止が要求されている場合true
+ */
+bool UndoExecutor::isCancelRequested() const
+{
+    return m_cancel && m_cancel->load();
+}
+
+/**
+ * @brief 1つの段階のステップを並行して実行
+ *
+ * 呼び出し元のスレッドも実行に加わり、全てのステップが終わるまで戻りません。
+ * ステップ数が少ない段階は呼び出し元のスレッドだけで実行します。
+ *
+ * @param steps 全てのステップ
+ * @param wave この段階で実行するステップのインデックス
+ */
+void UndoExecutor::runWave(const std::vector<snapper::UndoStep> &steps, const QList<int> &wave)
+{
+    std::atomic<qsizetype> next(0);
+    auto work = [this, &steps, &wave, &next]() {
+        for (qsizetype i = next++; i < wave.size() && !isCancelRequested(); i = next++) {
+            runStep(steps[wave.at(i)]);
+        }
+    };
+
+    if (wave.size() < MinParallelWave) {
+        work();
+        return;
+    }
+
+    const int helpers = static_cast<int>(qMin<qsizetype>(m_pool->maxThreadCount(), wave.size() - 1));
+    QSemaphore finished;
+    for (int i = 0; i < helpers; ++i) {
+        m_pool->start([&work, &finished]() {
+            work();
+            finished.release();
+        });
+    }
+
+    work();
+    finished.acquire(helpers);
+}
+
+/**
+ * @brief 1つのステップを実行して進捗を通知
+ *
+ * @param step 実行するステップ
+ * @return 成功時true
+ */
+bool UndoExecutor::runStep(const snapper::UndoStep &step)
+{
+    const QString fileName = QString::fromStdString(step.name);
+    bool success = false;
+
+    try {
+        success = m_comparison.doUndoStep(step);
+        if (!success) {
+            qWarning() << "Failed to restore:" << fileName;
+            addFailure(fileName, "Failed to restore");
+        }
+    }
+    catch (const snapper::Exception &e) {
+        qWarning() << "Exception during restore:" << fileName << "-" << e.what();
+        addFailure(fileName, QString::fromUtf8(e.what()));
+    }
+    catch (const std::exception &e) {
+        // ワーカースレッドから例外を送出させない
+        qWarning() << "Unexpected error during restore:" << fileName << "-" << e.what();
+        addFailure(fileName, QString::fromUtf8(e.what()));
+    }
+
+    if (success) {
+        ++m_succeeded;
+    }
+
+    const int current = ++m_completed;
+    if (m_progress) {
+        m_progress(current, m_total, fileName);
+    }
+
+    return success;
+}
+
+/**
+ * @brief 失敗したステップを記録
+ *
+ * @param filePath 失敗したファイルパス
+ * @param message エラーメッセージ
+ */
+void UndoExecutor::addFailure(const QString &filePath, const QString &message)
+{
+    QMutexLocker locker(&m_failuresMutex);
+    m_failures.insert(filePath, message);
+}
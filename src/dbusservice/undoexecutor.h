@@ -0,0 +1,70 @@
+#ifndef UNDOEXECUTOR_H
+#define UNDOEXECUTOR_H
+
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+class QThreadPool;
+
+namespace snapper {
+    class Comparison;
+    struct UndoStep;
+}
+
+/**
+ * @brief 復元 (undo)の各ステップを実行するクラス
+ *
+ * 並列モードでは、getUndoStepsが返したステップを同じ種類の連続する区間ごとに分け、
+ * さらにパスの深さで段階 (wave)に分割します。作成と変更は親から子へ (浅い順)、
+ * 削除は子から親へ (深い順)段階を進め、同じ段階のステップはスレッドプールで
+ * 並行して実行します。同じ深さのパスは互いに親子関係にならないため、
+ * 親ディレクトリの作成前に子を作成したり、子の削除前に親を削除することはありません。
+ */
+class UndoExecutor
+{
+public:
+    using ProgressCallback = std::function<void(int current, int total, const QString &filePath)>;
+
+private:
+    static constexpr int MinParallelWave = 8;   // 並行して実行する段階の最小ステップ数
+
+    snapper::Comparison &m_comparison;          // 復元に使用する比較結果
+    QThreadPool *m_pool;                        // 並列モードで使用するスレッドプール
+    ProgressCallback m_progress;                // 進捗の通知先
+    std::atomic<int> m_completed;               // 実行済みのステップ数
+    std::atomic<int> m_succeeded;               // 成功したステップ数
+    int m_total;                                // ステップの総数
+    const std::atomic<bool> *m_cancel;          // 中止要求のフラグ (nullptrは中止しない)
+    bool m_cancelled;                           // 中止によりステップを残して終了した場合true
+    mutable QMutex m_failuresMutex;             // m_failuresの保護
+    QMap<QString, QString> m_failures;          // 失敗したファイルパス → エラーメッセージ
+
+    bool isCancelRequested() const;
+    bool runStep(const snapper::UndoStep &step);
+    void addFailure(const QString &filePath, const QString &message);
+    void runWave(const std::vector<snapper::UndoStep> &steps, const QList<int> &wave);
+
+public:
+    UndoExecutor(snapper::Comparison &comparison, QThreadPool *pool);
+
+    UndoExecutor(const UndoExecutor &) = delete;
+    UndoExecutor &operator=(const UndoExecutor &) = delete;
+
+    void setProgressCallback(ProgressCallback callback) { m_progress = std::move(callback); }
+    void setCancelFlag(const std::atomic<bool> *cancel) { m_cancel = cancel; }
+
+    bool run(const std::vector<snapper::UndoStep> &steps, bool parallel);
+    int succeeded() const { return m_succeeded; }
+    int total() const { return m_total; }
+    bool cancelled() const { return m_cancelled; }
+    QMap<QString, QString> failures() const;
+
+    static QList<QList<int>> partition(const std::vector<snapper::UndoStep> &steps);
+};
+
+#endif // UNDOEXECUTOR_H
@@ -1,9 +1,10 @@
 #include "filechangemodel.h"
+#include "mappedbuffer.h"
 #include <QProcess>
 #include <QDebug>
 #include <QFileInfo>
 #include <QDir>
-#include <QRegularExpression>
+#include <QSet>
 #include <QDBusConnection>
 #include <QDBusReply>
 #include <QDBusError>
@@ -12,7 +13,10 @@
 #include <QDBusPendingCall>
 #include <QDBusPendingCallWatcher>
 #include <QDBusPendingReply>
+#include <QDBusArgument>
+#include <QDBusUnixFileDescriptor>
 #include <algorithm>
+#include <utility>
 
 // ============================================================================
 // FileChangeItem Implementation
@@ -51,6 +55,7 @@ FileChangeItem::~FileChangeItem()
  */
 void FileChangeItem::appendChild(FileChangeItem *child)
 {
+    child->m_row = m_children.size();
     m_children.append(child);
 }
 
@@ -85,13 +90,14 @@ int FileChangeItem::childCount() const
  * @brief 親アイテム内での行番号を取得
  *
  * このアイテムが親アイテムの何番目の子であるかを返します。
+ * 子アイテムは追加のみで削除されないため、追加時に記録した行番号を返します。
  *
  * @return 行番号 (親がない場合は0)
  */
 int FileChangeItem::row() const
 {
     if (m_parent)
-        return m_parent->m_children.indexOf(const_cast<FileChangeItem*>(this));
+        return m_row;
     return 0;
 }
 
@@ -140,13 +146,28 @@ QString FileChangeItem::name() const
  * @brief ディレクトリかどうかを判定
  *
  * パスの末尾がスラッシュで終わっているか、子要素があればディレクトリと判定します。
+ * まだ取得していない子要素がある場合もディレクトリです。
  *
  * @return ディレクトリの場合はtrue、それ以外はfalse
  */
 bool FileChangeItem::isDirectory() const
 {
     // パスの末尾が/で終わっているか、子要素があればディレクトリ
-    return m_path.endsWith('/') || !m_children.isEmpty();
+    return m_path.endsWith('/') || !m_children.isEmpty() || m_hasChildren;
+}
+
+/**
+ * @brief サブツリー内の変更の件数を設定
+ *
+ * @param created 作成されたエントリ数
+ * @param modified 変更されたエントリ数
+ * @param deleted 削除されたエントリ数
+ */
+void FileChangeItem::setCounts(int created, int modified, int deleted)
+{
+    m_createdCount = created;
+    m_modifiedCount = modified;
+    m_deletedCount = deleted;
 }
 
 // ============================================================================
@@ -163,16 +184,31 @@ bool FileChangeItem::isDirectory() const
 FileChangeModel::FileChangeModel(QObject *parent)
     : QAbstractItemModel(parent)
     , m_snapshotNumber(0)
+    , m_compareToNumber(0)
+    , m_statusFilter(0)
     , m_rootItem(nullptr)
     , m_dbusInterface(nullptr)
     , m_hasChanges(false)
-    , m_currentBatchIndex(0)
-    , m_totalFilesCount(0)
-    , m_processedFilesCount(0)
-    , m_restoreHasError(false)
+    , m_loading(false)
+    , m_loadedCount(0)
+    , m_totalCount(0)
+    , m_loadSerial(0)
+    , m_comparisonHandle(0)
+    , m_comparisonSnapshot(0)
+    , m_comparisonCompareTo(0)
+    , m_restoreJobId(0)
+    , m_restoreStarting(false)
     , m_cancelRequested(false)
+    , m_progressPending(false)
+    , m_pendingCurrent(0)
+    , m_pendingTotal(0)
 {
     m_rootItem = new FileChangeItem("", FileChangeItem::Modified);
+    m_itemMap.insert(QString(), m_rootItem);
+
+    m_progressTimer.setSingleShot(true);
+    m_progressTimer.setInterval(ProgressFrameMs);
+    connect(&m_progressTimer, &QTimer::timeout, this, &FileChangeModel::flushRestoreProgress);
 
     m_dbusInterface = new QDBusInterface(
         "com.presire.qsnapper.Operations",
@@ -195,26 +231,78 @@ FileChangeModel::FileChangeModel(QObject *parent)
  */
 FileChangeModel::~FileChangeModel()
 {
+    closeComparison();
     delete m_rootItem;
 }
 
 /**
- * @brief 復元進捗のスロット
+ * @brief 復元ジョブの進捗のスロット
  *
- * D-Busから送信される復元進捗シグナルを受信し、全体の進捗を計算してemitします。
+ * D-Busから送信される復元ジョブの進捗シグナルを受信し、
+ * 実行中のジョブのものであれば保留します。
+ * 保留した進捗は1フレームに1回だけ最新のものをemitします。
  *
- * @param current バッチ内の現在処理中のファイル数
- * @param total バッチ内の総ファイル数
- * @param filePath 現在処理中のファイルパス
+ * @param jobId 復元ジョブのID
+ * @param current 完了したステップ数
+ * @param total ステップの総数
+ * @param filePath 処理したファイルパス
  */
-void FileChangeModel::onRestoreProgress(int current, int total, const QString &filePath)
+void FileChangeModel::onRestoreJobProgress(uint jobId, int current, int total, const QString &filePath)
 {
-    // バッチ内の進捗を全体の進捗に変換
-    // currentとtotalはバッチ内の進捗ではなく、UndoStepsの進捗
-    int overallCurrent = m_processedFilesCount + current;
-    int overallTotal = m_totalFilesCount;
+    if (jobId == 0 || jobId != m_restoreJobId) {
+        return;
+    }
 
-    emit restoreProgress(overallCurrent, overallTotal, filePath);
+    m_pendingCurrent = current;
+    m_pendingTotal = total;
+    m_pendingFilePath = filePath;
+    m_progressPending = true;
+
+    if (!m_progressTimer.isActive()) {
+        m_progressTimer.start();
+    }
+}
+
+/**
+ * @brief 保留中の復元の進捗をemit
+ */
+void FileChangeModel::flushRestoreProgress()
+{
+    m_progressTimer.stop();
+
+    if (!m_progressPending) {
+        return;
+    }
+
+    m_progressPending = false;
+    emit restoreProgress(m_pendingCurrent, m_pendingTotal, m_pendingFilePath);
+}
+
+/**
+ * @brief 復元ジョブの完了のスロット
+ *
+ * StartRestoreの応答より先に完了シグナルが届いた場合は、
+ * ジョブIDを受信するまで保持します。
+ *
+ * @param message RestoreJobFinishedシグナルのメッセージ
+ */
+void FileChangeModel::onRestoreJobFinished(const QDBusMessage &message)
+{
+    const QList<QVariant> arguments = message.arguments();
+    if (arguments.isEmpty()) {
+        return;
+    }
+
+    const uint jobId = arguments.at(0).toUInt();
+
+    if (m_restoreStarting) {
+        m_finishedJobs.insert(jobId, message);
+        return;
+    }
+
+    if (jobId != 0 && jobId == m_restoreJobId) {
+        finishRestore(message);
+    }
 }
 
 /**
@@ -247,10 +335,93 @@ void FileChangeModel::setSnapshotNumber(int number)
     }
 }
 
+/**
+ * @brief 比較先のスナップショット番号を設定
+ *
+ * 0の場合は現在のシステムと比較します。pre/postの組を表示する場合は
+ * snapshotNumberにpre、compareToNumberにpostのスナップショット番号を設定します。
+ * 変更された場合はシグナルを発行します。
+ *
+ * @param number 比較先のスナップショット番号
+ */
+void FileChangeModel::setCompareToNumber(int number)
+{
+    if (m_compareToNumber != number) {
+        m_compareToNumber = number;
+        emit compareToNumberChanged();
+    }
+}
+
+/**
+ * @brief 表示するパスの接頭辞を設定
+ *
+ * 絞り込みはサービス側で行われ、一致しない変更は受信しません。
+ * 次回のloadChanges()から反映されます。
+ *
+ * @param prefixes パスの接頭辞 (ディレクトリの絶対パス)
+ */
+void FileChangeModel::setPathPrefixes(const QStringList &prefixes)
+{
+    if (m_pathPrefixes != prefixes) {
+        m_pathPrefixes = prefixes;
+        emit filterChanged();
+    }
+}
+
+/**
+ * @brief 表示するファイルのglobを設定
+ *
+ * '/'を含まないglobはファイル名と、含むglobはパス全体と照合されます。
+ * 次回のloadChanges()から反映されます。
+ *
+ * @param globs globの一覧
+ */
+void FileChangeModel::setIncludeGlobs(const QStringList &globs)
+{
+    if (m_includeGlobs != globs) {
+        m_includeGlobs = globs;
+        emit filterChanged();
+    }
+}
+
+/**
+ * @brief 表示しないファイルのglobを設定
+ *
+ * 次回のloadChanges()から反映されます。
+ *
+ * @param globs globの一覧
+ */
+void FileChangeModel::setExcludeGlobs(const QStringList &globs)
+{
+    if (m_excludeGlobs != globs) {
+        m_excludeGlobs = globs;
+        emit filterChanged();
+    }
+}
+
+/**
+ * @brief 表示するステータスを設定
+ *
+ * 次回のloadChanges()から反映されます。
+ *
+ * @param mask StatusFlagの組み合わせ (0は全て)
+ */
+void FileChangeModel::setStatusFilter(int mask)
+{
+    if (m_statusFilter != mask) {
+        m_statusFilter = mask;
+        emit filterChanged();
+    }
+}
+
 /**
  * @brief ファイル変更リストを読み込み
  *
- * D-Bus経由でSnapperからファイル変更リストを取得し、モデルを構築します。
+ * D-Bus経由でSnapperからルート直下のファイル変更だけを取得し、モデルを構築します。
+ * ディレクトリの子要素は、ビューが展開した時にfetchMore()で取得します。
+ * サービスがディレクトリ単位の取得に対応していない場合は、ファイル変更リストを
+ * ページ単位で取得します。最初のページを受信した時点でツリーを表示し、
+ * 残りのページはバックグラウンドで取得しながら順次ツリーに追加します。
  * 設定名とスナップショット番号が有効である必要があります。
  */
 void FileChangeModel::loadChanges()
@@ -267,80 +438,452 @@ void FileChangeModel::loadChanges()
         return;
     }
 
-    // D-Bus経由でファイル変更を取得
-    QDBusReply<QString> reply = m_dbusInterface->call("GetFileChanges", m_configName, m_snapshotNumber);
+    beginResetModel();
+    clearModel();
+    endResetModel();
 
-    if (!reply.isValid()) {
-        qWarning() << "Failed to get file changes via D-Bus:" << reply.error().message();
-        emit errorOccurred(QString("Failed to get file changes: %1").arg(reply.error().message()));
-        return;
-    }
+    // 読み込み中の古い要求の応答は破棄する
+    m_loadSerial++;
+    m_loadedCount = 0;
+    m_totalCount = 0;
+    emit loadProgressChanged();
 
-    QString output = reply.value();
-    if (output.isEmpty()) {
-        qWarning() << "snapper status command returned empty output";
+    if (m_hasChanges) {
         m_hasChanges = false;
         emit hasChangesChanged();
-        emit errorOccurred("No file changes found");
+    }
+
+    setLoading(true);
+
+    // 変更一覧の取得、差分表示、復元で同じ比較結果を使うためセッションを開く
+    // (サービスはメソッドを並行して実行するため、一覧はセッションを開いた応答の後に要求する)
+    // パスで絞り込む場合、サービスは指定されたディレクトリだけを比較するため、
+    // ファイルシステム全体を比較するセッションは開かない
+    if (!m_pathPrefixes.isEmpty()) {
+        closeComparison();
+    }
+    else if (m_comparisonConfig != m_configName || m_comparisonSnapshot != m_snapshotNumber
+             || m_comparisonCompareTo != m_compareToNumber) {
+        closeComparison();
+        openComparison();
         return;
     }
 
-    m_hasChanges = true;
-    emit hasChangesChanged();
+    requestChildren(m_rootItem);
+}
+
+/**
+ * @brief 比較セッションを開く
+ *
+ * サービスにスナップショットと比較先 (別のスナップショット、または現在のシステム)の
+ * 比較結果を保持させ、
+ * 以降の差分取得や復元のたびに比較をやり直さないようにします。
+ * セッションを開けなかった場合も、各呼び出しは個別に比較して動作します。
+ * 応答の受信後に、読み込み中の変更一覧の最上位を要求します。
+ */
+void FileChangeModel::openComparison()
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "OpenComparison"
+    );
+    msg << m_configName << m_snapshotNumber << m_compareToNumber;
 
-    QStringList changes = output.split('\n', Qt::SkipEmptyParts);
+    m_comparisonConfig = m_configName;
+    m_comparisonSnapshot = m_snapshotNumber;
+    m_comparisonCompareTo = m_compareToNumber;
 
-    // 重複チェックと詳細分析
-    QSet<QString> uniquePaths;
-    QSet<QString> dirPaths;
-    QSet<QString> filePaths;
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(msg, -1);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+    const QString configName = m_configName;
+    const int snapshotNumber = m_snapshotNumber;
+    const int compareTo = m_compareToNumber;
+    const quint64 serial = m_loadSerial;
 
-    for (const QString &line : changes) {
-        QStringList parts = line.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
-        if (parts.size() >= 2) {
-            QString path = parts[1];
-            QString normalizedPath = path.endsWith('/') ? path.left(path.length() - 1) : path;
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, configName, snapshotNumber, compareTo, serial](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
 
-            uniquePaths.insert(normalizedPath);
+        QDBusPendingReply<uint> reply = *w;
+        const bool current = (m_comparisonConfig == configName && m_comparisonSnapshot == snapshotNumber
+                              && m_comparisonCompareTo == compareTo);
 
-            if (path.endsWith('/')) {
-                dirPaths.insert(normalizedPath);
-            } else {
-                filePaths.insert(normalizedPath);
+        if (reply.isError()) {
+            qWarning() << "Failed to open comparison session:" << reply.error().message();
+            if (current) {
+                m_comparisonConfig.clear();
+                m_comparisonSnapshot = 0;
+                m_comparisonCompareTo = 0;
             }
         }
+        else if (current) {
+            m_comparisonHandle = reply.value();
+        }
+        else {
+            // 応答を待つ間に閉じられた
+            sendCloseComparison(reply.value());
+        }
+
+        // セッションを開けなかった場合も、一覧は個別の比較で取得する
+        if (serial == m_loadSerial) {
+            if (current) {
+                requestChildren(m_rootItem);
+            }
+            else {
+                setLoading(false);
+            }
+        }
+    });
+}
+
+/**
+ * @brief 比較セッションを閉じる
+ *
+ * サービスにスナップショットのアンマウントを依頼します。応答は待ちません。
+ * ダイアログを閉じた時に呼び出されます。
+ */
+void FileChangeModel::closeComparison()
+{
+    if (m_comparisonHandle != 0) {
+        sendCloseComparison(m_comparisonHandle);
     }
 
-    // 親子関係を分析して、ファイルパスだがディレクトリとして扱うべきパスを特定
-    QSet<QString> pathsWithChildren;
-    for (const QString &filePath : filePaths) {
-        for (const QString &otherPath : uniquePaths) {
-            if (otherPath != filePath && otherPath.startsWith(filePath + "/")) {
-                pathsWithChildren.insert(filePath);
+    m_comparisonHandle = 0;
+    m_comparisonConfig.clear();
+    m_comparisonSnapshot = 0;
+    m_comparisonCompareTo = 0;
+}
+
+/**
+ * @brief 比較セッションを閉じる要求を送信
+ *
+ * @param handle 比較セッションのハンドル
+ */
+void FileChangeModel::sendCloseComparison(uint handle)
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "CloseComparison"
+    );
+    msg << handle;
+
+    // サービスが終了している場合は起動し直さない
+    msg.setAutoStartService(false);
+    QDBusConnection::systemBus().send(msg);
+}
+
+/**
+ * @brief ファイル変更リストの1ページを要求
+ *
+ * 比較には時間がかかるため、タイムアウトなしで非同期に呼び出します。
+ * 受信したページをツリーに追加し、残りがあれば次のページを要求します。
+ *
+ * @param offset 取得開始位置
+ * @param limit 取得する最大件数
+ */
+void FileChangeModel::requestChangesPage(int offset, int limit)
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "GetFileChangesPage"
+    );
+    msg << m_configName << m_snapshotNumber << m_compareToNumber
+        << m_pathPrefixes << m_includeGlobs << m_excludeGlobs << static_cast<uint>(m_statusFilter)
+        << offset << limit;
+
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(msg, -1);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+    const quint64 serial = m_loadSerial;
+
+    const bool offsetIsFirstPage = (offset == 0);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, serial, offsetIsFirstPage](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+
+        // 新しい読み込みが開始された場合は破棄
+        if (serial != m_loadSerial) {
+            return;
+        }
+
+        QDBusPendingReply<QStringList, int> reply = *w;
+
+        if (reply.isError()) {
+            qWarning() << "Failed to get file changes via D-Bus:" << reply.error().message();
+            setLoading(false);
+            emit errorOccurred(QString("Failed to get file changes: %1").arg(reply.error().message()));
+            return;
+        }
+
+        const QStringList changes = reply.argumentAt<0>();
+        m_totalCount = reply.argumentAt<1>();
+
+        if (m_totalCount == 0) {
+            qWarning() << "snapper status command returned empty output";
+            setLoading(false);
+            emit loadProgressChanged();
+            emit hasChangesChanged();
+            emit errorOccurred("No file changes found");
+            return;
+        }
+
+        appendChanges(changes);
+        m_loadedCount += changes.size();
+        emit loadProgressChanged();
+
+        if (!m_hasChanges) {
+            m_hasChanges = true;
+            emit hasChangesChanged();
+        }
+
+        if (m_loadedCount < m_totalCount && !changes.isEmpty()) {
+            if (offsetIsFirstPage) {
+                requestRemainingChanges();
+            }
+            else {
+                requestChangesPage(m_loadedCount, PageSize);
+            }
+        }
+        else {
+            setLoading(false);
+        }
+    });
+}
+
+/**
+ * @brief 残りのファイル変更リストをファイルディスクリプタで要求
+ *
+ * 最初のページ以降の全ての変更をサービスが封印済みmemfdに書き込んで返すため、
+ * D-Busメッセージのコピーやサイズ上限の影響を受けずに取得できます。
+ * 受け取ったファイルはマップしてそのまま解析します。
+ * サービスが対応していない場合はページ単位の取得に切り替えます。
+ */
+void FileChangeModel::requestRemainingChanges()
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "GetFileChangesFd"
+    );
+    msg << m_configName << m_snapshotNumber << m_compareToNumber
+        << m_pathPrefixes << m_includeGlobs << m_excludeGlobs << static_cast<uint>(m_statusFilter)
+        << m_loadedCount << MappedBuffer::isCompressionAvailable();
+
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(msg, -1);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+    const quint64 serial = m_loadSerial;
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, serial](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+
+        if (serial != m_loadSerial) {
+            return;
+        }
+
+        QDBusPendingReply<QDBusUnixFileDescriptor, int, bool> reply = *w;
+
+        if (reply.isError()) {
+            qWarning() << "Failed to get file changes via file descriptor, falling back to pages:"
+                       << reply.error().message();
+            requestChangesPage(m_loadedCount, PageSize);
+            return;
+        }
+
+        MappedBuffer buffer(reply.argumentAt<0>(), reply.argumentAt<2>());
+        if (!buffer.isValid()) {
+            qWarning() << "Failed to read file changes:" << buffer.errorString();
+            requestChangesPage(m_loadedCount, PageSize);
+            return;
+        }
+
+        m_totalCount = reply.argumentAt<1>();
+
+        qsizetype position = 0;
+        for (;;) {
+            const QStringList changes = buffer.lines(position, PageSize);
+            if (changes.isEmpty()) {
                 break;
             }
+            appendChanges(changes);
+            m_loadedCount += changes.size();
         }
+
+        emit loadProgressChanged();
+        setLoading(false);
+    });
+}
+
+/**
+ * @brief ディレクトリ直下のファイル変更を要求
+ *
+ * 比較には時間がかかるため、タイムアウトなしで非同期に呼び出します。
+ * ルートの取得に失敗し、サービスがGetChildrenに対応していない場合は
+ * ページ単位の取得に切り替えます。
+ *
+ * @param parentItem 子要素を取得するディレクトリのアイテム
+ */
+void FileChangeModel::requestChildren(FileChangeItem *parentItem)
+{
+    QString dirPath = parentItem->path();
+    if (dirPath.isEmpty()) {
+        dirPath = "/";
     }
 
-    // pathsWithChildrenの情報をsetupModelDataに渡す
-    QStringList processedChanges;
-    for (const QString &line : changes) {
-        QStringList parts = line.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
-        if (parts.size() >= 2) {
-            QString path = parts[1];
-            QString normalizedPath = path.endsWith('/') ? path.left(path.length() - 1) : path;
-
-            // 子要素を持つパスの場合は、末尾にスラッシュを追加
-            if (pathsWithChildren.contains(normalizedPath) && !path.endsWith('/')) {
-                QString modifiedLine = parts[0] + " " + path + "/";
-                processedChanges.append(modifiedLine);
-            } else {
-                processedChanges.append(line);
+    QDBusMessage msg = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "GetChildren"
+    );
+    msg << m_configName << m_snapshotNumber << m_compareToNumber
+        << m_pathPrefixes << m_includeGlobs << m_excludeGlobs << static_cast<uint>(m_statusFilter)
+        << dirPath;
+
+    parentItem->setFetching(true);
+
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(msg, -1);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+    const quint64 serial = m_loadSerial;
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, serial, parentItem](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+
+        // 新しい読み込みが開始された場合は破棄 (parentItemは削除済み)
+        if (serial != m_loadSerial) {
+            return;
+        }
+
+        parentItem->setFetching(false);
+        const bool isRoot = (parentItem == m_rootItem);
+        const QDBusMessage reply = w->reply();
+
+        if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().isEmpty()) {
+            if (isRoot && reply.errorName() == "org.freedesktop.DBus.Error.UnknownMethod") {
+                // ディレクトリ単位の取得に未対応のサービス
+                requestChangesPage(0, FirstPageSize);
+                return;
+            }
+
+            qWarning() << "Failed to get file changes via D-Bus:" << reply.errorMessage();
+            parentItem->setFetched(true);
+            if (isRoot) {
+                setLoading(false);
             }
+            emit errorOccurred(QString("Failed to get file changes: %1").arg(reply.errorMessage()));
+            return;
         }
+
+        appendChildren(parentItem, reply.arguments().at(0).value<QDBusArgument>());
+
+        if (!isRoot) {
+            return;
+        }
+
+        // ルートの子要素の件数の合計が変更の総数
+        m_totalCount = 0;
+        for (int i = 0; i < m_rootItem->childCount(); ++i) {
+            const FileChangeItem *child = m_rootItem->child(i);
+            m_totalCount += child->createdCount() + child->modifiedCount() + child->deletedCount();
+        }
+        m_loadedCount = m_totalCount;
+
+        setLoading(false);
+        emit loadProgressChanged();
+
+        if (m_totalCount == 0) {
+            qWarning() << "snapper status command returned empty output";
+            emit hasChangesChanged();
+            emit errorOccurred("No file changes found");
+            return;
+        }
+
+        if (!m_hasChanges) {
+            m_hasChanges = true;
+            emit hasChangesChanged();
+        }
+    });
+}
+
+/**
+ * @brief ディレクトリの子要素をツリーに追加
+ *
+ * 子要素は親のチェック状態を引き継ぎます。
+ *
+ * @param parentItem 子要素を追加するディレクトリのアイテム
+ * @param children a(ssbiii)型の子要素の配列 (名前、ステータス、子要素の有無、作成・変更・削除の件数)
+ */
+void FileChangeModel::appendChildren(FileChangeItem *parentItem, const QDBusArgument &children)
+{
+    QString basePath = parentItem->path();
+    if (basePath.endsWith('/')) {
+        basePath.chop(1);
     }
 
-    setupModelData(processedChanges);
+    QVector<FileChangeItem*> items;
+
+    children.beginArray();
+    while (!children.atEnd()) {
+        QString name;
+        QString status;
+        bool hasChildren = false;
+        int created = 0;
+        int modified = 0;
+        int deleted = 0;
+
+        children.beginStructure();
+        children >> name >> status >> hasChildren >> created >> modified >> deleted;
+        children.endStructure();
+
+        const QString normalizedPath = basePath + "/" + name;
+        if (name.isEmpty() || m_itemMap.contains(normalizedPath)) {
+            continue;
+        }
+
+        // 祖先として存在するだけのディレクトリはステータスが空
+        const FileChangeItem::ChangeType type = status.isEmpty() ? FileChangeItem::Modified
+                                                                 : parseChangeType(status.at(0));
+        FileChangeItem *item = new FileChangeItem(hasChildren ? normalizedPath + "/" : normalizedPath,
+                                                  type, parentItem);
+        item->setHasChildren(hasChildren);
+        item->setCounts(created, modified, deleted);
+        item->setChecked(parentItem->isChecked());
+
+        m_itemMap.insert(normalizedPath, item);
+        items.append(item);
+    }
+    children.endArray();
+
+    parentItem->setFetched(true);
+
+    if (items.isEmpty()) {
+        return;
+    }
+
+    const int first = parentItem->childCount();
+    beginInsertRows(indexForItem(parentItem), first, first + items.size() - 1);
+    for (FileChangeItem *item : std::as_const(items)) {
+        parentItem->appendChild(item);
+    }
+    endInsertRows();
+}
+
+/**
+ * @brief 読み込み中フラグを設定
+ *
+ * @param loading 読み込み中の場合true
+ */
+void FileChangeModel::setLoading(bool loading)
+{
+    if (m_loading != loading) {
+        m_loading = loading;
+        emit loadingChanged();
+    }
 }
 
 /**
@@ -362,15 +905,110 @@ QString FileChangeModel::getFileDiff(const QString &filePath)
         return QString();
     }
 
-    // D-Bus経由でファイル差分を取得
-    QDBusReply<QString> reply = m_dbusInterface->call("GetFileDiff", m_configName, m_snapshotNumber, filePath);
+    // D-Bus経由でファイル差分を取得 (大きな差分に備えてファイルディスクリプタで受け取る)
+    QDBusMessage reply = m_dbusInterface->call("GetFileDiffFd", m_configName, m_snapshotNumber, m_compareToNumber,
+                                               filePath, MappedBuffer::isCompressionAvailable());
 
-    if (!reply.isValid()) {
-        qWarning() << "Failed to get file diff via D-Bus:" << reply.error().message();
+    if (reply.type() == QDBusMessage::ReplyMessage && reply.arguments().size() == 2) {
+        MappedBuffer buffer(qdbus_cast<QDBusUnixFileDescriptor>(reply.arguments().at(0)),
+                            reply.arguments().at(1).toBool());
+        if (buffer.isValid()) {
+            return QString::fromUtf8(buffer.data());
+        }
+        qWarning() << "Failed to read file diff:" << buffer.errorString();
+    }
+    else if (reply.errorName() != "org.freedesktop.DBus.Error.UnknownMethod") {
+        qWarning() << "Failed to get file diff via D-Bus:" << reply.errorMessage();
         return QString();
     }
 
-    return reply.value();
+    // ファイルディスクリプタで受け取れない場合は文字列で取得
+    QDBusReply<QString> textReply = m_dbusInterface->call("GetFileDiff", m_configName, m_snapshotNumber,
+                                                          m_compareToNumber, filePath);
+
+    if (!textReply.isValid()) {
+        qWarning() << "Failed to get file diff via D-Bus:" << textReply.error().message();
+        return QString();
+    }
+
+    return textReply.value();
+}
+
+/**
+ * @brief ファイルの差分をハンク単位で取得
+ *
+ * D-Bus経由で行数とバイト数の上限付きの差分を取得します。
+ * 大きなファイルでも表示する分だけを受け取り、バイナリファイルは
+ * 内容の代わりにファイルサイズだけを受け取ります。
+ *
+ * 戻り値のマップのキー:
+ * - available: サービスがハンク単位の取得に対応している場合true
+ * - hunks: ハンクの配列 (oldStart, oldCount, newStart, newCount, lines)
+ * - binary: バイナリファイルで内容が異なる場合true
+ * - truncated: 上限により打ち切られた場合true
+ * - oldSize, newSize: スナップショット内と比較先のファイルサイズ
+ *
+ * @param filePath 差分を取得したいファイルのパス
+ * @return 差分の情報 (availableがfalseの場合はgetFileDiffを使用する)
+ */
+QVariantMap FileChangeModel::getFileDiffHunks(const QString &filePath)
+{
+    QVariantMap result;
+    result["available"] = false;
+
+    if (m_configName.isEmpty() || m_snapshotNumber <= 0 || filePath.isEmpty()) {
+        return result;
+    }
+
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
+        qWarning() << "D-Bus interface is not valid";
+        return result;
+    }
+
+    QDBusMessage reply = m_dbusInterface->call("GetFileDiffHunks", m_configName, m_snapshotNumber,
+                                               m_compareToNumber, filePath,
+                                               DiffContextLines, DiffMaxLines, DiffMaxBytes);
+
+    if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().size() != 5) {
+        if (reply.errorName() != "org.freedesktop.DBus.Error.UnknownMethod") {
+            qWarning() << "Failed to get file diff via D-Bus:" << reply.errorMessage();
+        }
+        return result;
+    }
+
+    // a(iiiias)型のハンクの配列を読み出す
+    QVariantList hunks;
+    const QDBusArgument argument = reply.arguments().at(0).value<QDBusArgument>();
+    argument.beginArray();
+    while (!argument.atEnd()) {
+        int oldStart = 0;
+        int oldCount = 0;
+        int newStart = 0;
+        int newCount = 0;
+        QStringList lines;
+
+        argument.beginStructure();
+        argument >> oldStart >> oldCount >> newStart >> newCount >> lines;
+        argument.endStructure();
+
+        QVariantMap hunk;
+        hunk["oldStart"] = oldStart;
+        hunk["oldCount"] = oldCount;
+        hunk["newStart"] = newStart;
+        hunk["newCount"] = newCount;
+        hunk["lines"] = lines;
+        hunks.append(hunk);
+    }
+    argument.endArray();
+
+    result["available"] = true;
+    result["hunks"] = hunks;
+    result["binary"] = reply.arguments().at(1).toBool();
+    result["truncated"] = reply.arguments().at(2).toBool();
+    result["oldSize"] = reply.arguments().at(3).toLongLong();
+    result["newSize"] = reply.arguments().at(4).toLongLong();
+
+    return result;
 }
 
 /**
@@ -474,6 +1112,12 @@ QVariant FileChangeModel::data(const QModelIndex &index, int role) const
         return item->isDirectory();
     case IsCheckedRole:
         return item->isChecked();
+    case CreatedCountRole:
+        return item->createdCount();
+    case ModifiedCountRole:
+        return item->modifiedCount();
+    case DeletedCountRole:
+        return item->deletedCount();
     case Qt::DisplayRole:
         return item->name();
     default:
@@ -481,6 +1125,52 @@ QVariant FileChangeModel::data(const QModelIndex &index, int role) const
     }
 }
 
+/**
+ * @brief 子要素があるかを判定
+ *
+ * まだ取得していない子要素がある場合もtrueを返すため、ビューは展開可能として表示します。
+ *
+ * @param parent 親のQModelIndex
+ * @return 子要素がある場合true
+ */
+bool FileChangeModel::hasChildren(const QModelIndex &parent) const
+{
+    const FileChangeItem *parentItem = getItem(parent);
+    return parentItem->childCount() > 0 || parentItem->hasUnfetchedChildren();
+}
+
+/**
+ * @brief 子要素を取得できるかを判定
+ *
+ * @param parent 親のQModelIndex
+ * @return まだ取得していない子要素があり、取得中でない場合true
+ */
+bool FileChangeModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (!parent.isValid()) {
+        return false;
+    }
+
+    return getItem(parent)->canFetchMore();
+}
+
+/**
+ * @brief 子要素を取得
+ *
+ * ディレクトリが展開された時にビューから呼び出されます。
+ * 子要素はサービスから非同期に取得し、受信した時点でツリーに追加します。
+ *
+ * @param parent 親のQModelIndex
+ */
+void FileChangeModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
+    }
+
+    requestChildren(getItem(parent));
+}
+
 /**
  * @brief ロール名を取得
  *
@@ -496,114 +1186,154 @@ QHash<int, QByteArray> FileChangeModel::roleNames() const
     roles[ChangeTypeRole] = "changeType";
     roles[IsDirectoryRole] = "isDirectory";
     roles[IsCheckedRole] = "isChecked";
+    roles[CreatedCountRole] = "createdCount";
+    roles[ModifiedCountRole] = "modifiedCount";
+    roles[DeletedCountRole] = "deletedCount";
     return roles;
 }
 
 /**
- * @brief モデルデータの構築
+ * @brief ファイル変更をツリーに追加
  *
- * ファイル変更リストからツリー構造のモデルデータを構築します。
- * 重複を除外し、ディレクトリ階層を適切に生成します。
+ * ファイル変更リストの1ページ分をツリーに追加します。
+ * 同じ親の下に連続して追加されるアイテムはまとめて1回の行挿入として通知し、
+ * まだモデルに挿入していないアイテムの子孫は通知なしで追加します。
+ * 既に存在するパスは重複として除外されます (最初に出現したもののみ保持)。
  *
- * @param changes ファイル変更リスト
+ * @param changes "ステータス パス"形式のファイル変更リスト
  */
-void FileChangeModel::setupModelData(const QStringList &changes)
+void FileChangeModel::appendChanges(const QStringList &changes)
 {
-    beginResetModel();
-    clearModel();
+    FileChangeItem *pendingParent = nullptr;    // 挿入待ちアイテムの親
+    QVector<FileChangeItem*> pendingItems;      // まだモデルに挿入していないアイテム
+    QSet<FileChangeItem*> pendingSet;
+
+    // 挿入待ちのアイテムをまとめてモデルに挿入
+    auto flush = [&]() {
+        if (pendingItems.isEmpty()) {
+            return;
+        }
+
+        const int first = pendingParent->childCount();
+        const QModelIndex parentIndex = indexForItem(pendingParent);
+        beginInsertRows(parentIndex, first, first + pendingItems.size() - 1);
+        for (FileChangeItem *item : std::as_const(pendingItems)) {
+            pendingParent->appendChild(item);
+        }
+        endInsertRows();
 
-    // アイテムマップ：正規化パス (スラッシュなし)→ FileChangeItem
-    QMap<QString, FileChangeItem*> itemMap;
-    itemMap[""] = m_rootItem;
+        // 子要素を持ったことでディレクトリ表示に変わる
+        if (first == 0 && parentIndex.isValid()) {
+            emit dataChanged(parentIndex, parentIndex, {IsDirectoryRole});
+        }
 
-    // 全変更をパースして、重複を除外
-    struct ChangeInfo {
-        QString path;           // スラッシュなしの正規化パス
-        FileChangeItem::ChangeType type;
-        bool isDirectory;
+        pendingItems.clear();
+        pendingSet.clear();
+        pendingParent = nullptr;
     };
 
-    // パスをキーにして重複を除外 (最初に出現したもののみ保持)
-    QMap<QString, ChangeInfo> uniqueChanges;
+    // 挿入待ちのアイテム、またはその子孫かを判定
+    auto isPending = [&](FileChangeItem *item) {
+        for (; item && !pendingSet.isEmpty(); item = item->parent()) {
+            if (pendingSet.contains(item)) {
+                return true;
+            }
+        }
+        return false;
+    };
 
-    // まず全変更を解析し、重複を除外
     for (const QString &line : changes) {
-        if (line.isEmpty())
-            continue;
-
-        // フォーマット: "+.... /path/to/file"
-        QRegularExpression re("\\s+");
-        QStringList parts = line.split(re, Qt::SkipEmptyParts);
-        if (parts.size() < 2) {
+        // フォーマット: "+.... /path/to/file" (パスは空白を含む場合がある)
+        const int separator = line.indexOf(' ');
+        if (separator <= 0) {
             continue;
         }
 
-        QString statusChars = parts[0];
-        QString filePath = parts[1];
+        const QString filePath = line.mid(separator + 1);
 
         // ディレクトリの場合は末尾のスラッシュを判定
-        bool isDirectory = filePath.endsWith('/');
-        QString normalizedPath = isDirectory ? filePath.left(filePath.length() - 1) : filePath;
+        const bool isDirectory = filePath.endsWith('/');
+        const QString normalizedPath = isDirectory ? filePath.chopped(1) : filePath;
 
         // 既に処理済みの場合はスキップ
-        if (uniqueChanges.contains(normalizedPath)) {
+        if (normalizedPath.isEmpty() || m_itemMap.contains(normalizedPath)) {
             continue;
         }
 
-        // 最初のステータス文字を使用
-        FileChangeItem::ChangeType type = parseChangeType(statusChars.at(0));
+        // 既に存在する最も深い祖先を探す
+        QString ancestorPath = normalizedPath;
+        do {
+            ancestorPath.truncate(qMax(0, ancestorPath.lastIndexOf('/')));
+        } while (!ancestorPath.isEmpty() && !m_itemMap.contains(ancestorPath));
 
-        ChangeInfo info;
-        info.path = normalizedPath;
-        info.type = type;
-        info.isDirectory = isDirectory;
-        uniqueChanges[normalizedPath] = info;
-    }
+        FileChangeItem *ancestor = m_itemMap.value(ancestorPath, m_rootItem);
 
-    // 重複除外後の変更リストを処理してツリーを構築
-    for (auto it = uniqueChanges.begin(); it != uniqueChanges.end(); ++it) {
-        const ChangeInfo &info = it.value();
+        // 祖先の下に不足している中間ディレクトリと変更されたアイテムを作成
+        const QStringList parts = normalizedPath.mid(ancestorPath.size()).split('/', Qt::SkipEmptyParts);
+        QString currentPath = ancestorPath;
+        FileChangeItem *parentItem = ancestor;
+        FileChangeItem *topItem = nullptr;
 
-        QStringList pathParts = info.path.split('/', Qt::SkipEmptyParts);
-        QString currentPath = "";
-        FileChangeItem *parentItem = m_rootItem;
-
-        for (int i = 0; i < pathParts.size(); ++i) {
-            QString part = pathParts[i];
-            currentPath += "/" + part;
-
-            bool isLastPart = (i == pathParts.size() - 1);
+        for (int i = 0; i < parts.size(); ++i) {
+            currentPath += "/" + parts[i];
+            const bool isLastPart = (i == parts.size() - 1);
 
+            FileChangeItem *item = nullptr;
             if (isLastPart) {
                 // 最終パート：変更があったファイルまたはディレクトリ
+                QString itemPath = isDirectory ? (currentPath + "/") : currentPath;
+                item = new FileChangeItem(itemPath, parseChangeType(line.at(0)), parentItem);
+            }
+            else {
+                // まだ作成されていない中間ディレクトリを作成
+                item = new FileChangeItem(currentPath + "/", FileChangeItem::Modified, parentItem);
+            }
 
-                // 既にこのパスがitemMapに存在するかチェック
-                if (!itemMap.contains(currentPath)) {
-                    // 新規アイテムを作成
-                    QString itemPath = info.isDirectory ? (currentPath + "/") : currentPath;
-                    FileChangeItem *item = new FileChangeItem(itemPath, info.type, parentItem);
-                    parentItem->appendChild(item);
-
-                    // itemMapに登録 (ディレクトリかファイルかに関わらず)
-                    itemMap[currentPath] = item;
-                }
+            if (topItem) {
+                parentItem->appendChild(item);
             }
             else {
-                // 中間ディレクトリの処理
-                if (!itemMap.contains(currentPath)) {
-                    // まだ作成されていない中間ディレクトリを作成
-                    FileChangeItem *dirItem = new FileChangeItem(currentPath + "/",
-                                                                FileChangeItem::Modified,
-                                                                parentItem);
-                    parentItem->appendChild(dirItem);
-                    itemMap[currentPath] = dirItem;
-                }
-                parentItem = itemMap[currentPath];
+                topItem = item;
             }
+
+            m_itemMap.insert(currentPath, item);
+            parentItem = item;
+        }
+
+        if (!topItem) {
+            continue;
+        }
+
+        if (isPending(ancestor)) {
+            // 祖先自体がまだモデルに挿入されていない
+            ancestor->appendChild(topItem);
+        }
+        else {
+            if (pendingParent != ancestor) {
+                flush();
+                pendingParent = ancestor;
+            }
+            pendingItems.append(topItem);
+            pendingSet.insert(topItem);
         }
     }
 
-    endResetModel();
+    flush();
+}
+
+/**
+ * @brief アイテムのインデックスを取得
+ *
+ * @param item 対象のアイテム
+ * @return アイテムのQModelIndex (ルートアイテムの場合は無効なインデックス)
+ */
+QModelIndex FileChangeModel::indexForItem(FileChangeItem *item) const
+{
+    if (!item || item == m_rootItem) {
+        return QModelIndex();
+    }
+
+    return createIndex(item->row(), 0, item);
 }
 
 /**
@@ -647,6 +1377,8 @@ void FileChangeModel::clearModel()
 {
     delete m_rootItem;
     m_rootItem = new FileChangeItem("", FileChangeItem::Modified);
+    m_itemMap.clear();
+    m_itemMap.insert(QString(), m_rootItem);
 }
 
 /**
@@ -728,10 +1460,15 @@ QString FileChangeModel::executeCommand(const QString &command, const QStringLis
  */
 void FileChangeModel::setItemChecked(const QString &filePath, bool checked)
 {
-    // ルートアイテムから指定されたパスのアイテムを検索
-    QModelIndex index = findItemIndex(m_rootItem, filePath);
+    // パスからアイテムを検索
+    QString normalizedPath = filePath;
+    if (normalizedPath.endsWith('/')) {
+        normalizedPath.chop(1);
+    }
+
+    FileChangeItem *item = m_itemMap.value(normalizedPath, nullptr);
+    QModelIndex index = indexForItem(item);
     if (index.isValid()) {
-        FileChangeItem *item = getItem(index);
 
         // チェックを外す場合は、明示的にチェックを外したフラグを立てる
         if (!checked) {
@@ -845,8 +1582,8 @@ QStringList FileChangeModel::getCheckedItems() const
 /**
  * @brief チェックされたアイテムを復元
  *
- * チェックされたすべてのアイテムを復元します。
- * 大量のファイルがある場合はバッチに分割して処理されます。
+ * チェックされたすべてのアイテムを1つの復元ジョブとしてサービスで復元します。
+ * 進捗はrestoreProgress、結果はrestoreCompletedシグナルで通知されます。
  *
  * @return 復元処理が開始された場合はtrue、エラーの場合はfalse
  */
@@ -872,152 +1609,157 @@ bool FileChangeModel::restoreCheckedItems()
         return false;
     }
 
-    // D-Busシグナルを接続して進捗を受信
-    bool connected = QDBusConnection::systemBus().connect(
-        "com.presire.qsnapper.Operations",
-        "/com/presire/qsnapper/Operations",
-        "com.presire.qsnapper.Operations",
-        "restoreProgress",
-        this,
-        SLOT(onRestoreProgress(int,int,QString))
-    );
-
-    if (!connected) {
-        qWarning() << "Failed to connect to restoreProgress signal";
+    if (m_restoreStarting || m_restoreJobId != 0) {
+        qWarning() << "Restore operation already in progress";
+        return false;
     }
 
-    // ファイルリストをバッチに分割して順次処理
-    // 1バッチあたり100ファイルに制限 (D-Busタイムアウトを回避)
-    m_restoreBatches.clear();
-    m_currentBatchIndex = 0;
-    m_totalFilesCount = checkedPaths.size();
-    m_processedFilesCount = 0;
-    m_restoreHasError = false;
+    // ジョブの進捗と完了を受信する (ジョブの開始前に接続する)
+    setRestoreSignalsConnected(true);
+
+    m_restoreStarting = true;
     m_cancelRequested = false;
+    m_finishedJobs.clear();
+    m_progressPending = false;
+
+    // 展開していないディレクトリ ("dir/") には一覧と同じ絞り込みをサービスで適用させる
+    QDBusPendingCall pendingCall = m_dbusInterface->asyncCall("StartRestore", m_configName, m_snapshotNumber,
+                                                              m_compareToNumber, checkedPaths,
+                                                              m_pathPrefixes, m_includeGlobs, m_excludeGlobs,
+                                                              static_cast<uint>(m_statusFilter));
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *w) {
+        QDBusPendingReply<uint> reply = *w;
+        w->deleteLater();
 
-    const int batchSize = 100;
-    for (int i = 0; i < checkedPaths.size(); i += batchSize) {
-        QStringList batch;
-        for (int j = i; j < qMin(i + batchSize, checkedPaths.size()); ++j) {
-            batch.append(checkedPaths[j]);
+        m_restoreStarting = false;
+        const QHash<uint, QDBusMessage> finishedJobs = std::exchange(m_finishedJobs, {});
+
+        if (reply.isError() || reply.value() == 0) {
+            qWarning() << "Failed to start restore:" << reply.error().message();
+            setRestoreSignalsConnected(false);
+            emit errorOccurred(reply.error().message());
+            emit restoreCompleted(false);
+            return;
         }
-        m_restoreBatches.append(batch);
-    }
 
-    // 最初のバッチを処理
-    processNextBatch();
+        m_restoreJobId = reply.value();
+
+        // 応答を待つ間に完了していた場合
+        auto finished = finishedJobs.constFind(m_restoreJobId);
+        if (finished != finishedJobs.constEnd()) {
+            finishRestore(finished.value());
+            return;
+        }
+
+        if (m_cancelRequested) {
+            sendCancelRestore(m_restoreJobId);
+        }
+    });
 
     return true;
 }
 
 /**
- * @brief 次のバッチを処理
+ * @brief 復元ジョブのシグナルの接続・切断
  *
- * 復元処理のバッチを順次処理します。
- * すべてのバッチが完了すると、完了シグナルを発行します。
- * キャンセルが要求された場合は、残りのバッチをスキップします。
+ * @param connected 接続する場合true、切断する場合false
  */
-void FileChangeModel::processNextBatch()
+void FileChangeModel::setRestoreSignalsConnected(bool connected)
 {
-    // キャンセルが要求された場合は処理を中断
-    if (m_cancelRequested) {
-        QDBusConnection::systemBus().disconnect(
-            "com.presire.qsnapper.Operations",
-            "/com/presire/qsnapper/Operations",
-            "com.presire.qsnapper.Operations",
-            "restoreProgress",
-            this,
-            SLOT(onRestoreProgress(int,int,QString))
-        );
-
-        emit restoreCompleted(false);
-        return;
+    QDBusConnection bus = QDBusConnection::systemBus();
+    const QString service = "com.presire.qsnapper.Operations";
+    const QString path = "/com/presire/qsnapper/Operations";
+    const QString interface = "com.presire.qsnapper.Operations";
+
+    if (connected) {
+        if (!bus.connect(service, path, interface, "RestoreJobProgress",
+                         this, SLOT(onRestoreJobProgress(uint,int,int,QString)))) {
+            qWarning() << "Failed to connect to RestoreJobProgress signal";
+        }
+        if (!bus.connect(service, path, interface, "RestoreJobFinished",
+                         this, SLOT(onRestoreJobFinished(QDBusMessage)))) {
+            qWarning() << "Failed to connect to RestoreJobFinished signal";
+        }
     }
+    else {
+        bus.disconnect(service, path, interface, "RestoreJobProgress",
+                       this, SLOT(onRestoreJobProgress(uint,int,int,QString)));
+        bus.disconnect(service, path, interface, "RestoreJobFinished",
+                       this, SLOT(onRestoreJobFinished(QDBusMessage)));
+    }
+}
 
-    if (m_currentBatchIndex >= m_restoreBatches.size()) {
-        // すべてのバッチが処理完了
-        QDBusConnection::systemBus().disconnect(
-            "com.presire.qsnapper.Operations",
-            "/com/presire/qsnapper/Operations",
-            "com.presire.qsnapper.Operations",
-            "restoreProgress",
-            this,
-            SLOT(onRestoreProgress(int,int,QString))
-        );
-
-        emit restoreCompleted(!m_restoreHasError);
+/**
+ * @brief 復元ジョブの中止を要求 (応答を待たない)
+ *
+ * @param jobId 中止するジョブのID
+ */
+void FileChangeModel::sendCancelRestore(uint jobId)
+{
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
         return;
     }
 
-    QStringList batch = m_restoreBatches[m_currentBatchIndex];
-
-    // 非同期呼び出しでファイルを処理 (タイムアウトなし)
-    QDBusMessage msg = QDBusMessage::createMethodCall(
-        "com.presire.qsnapper.Operations",
-        "/com/presire/qsnapper/Operations",
-        "com.presire.qsnapper.Operations",
-        "RestoreFiles"
-    );
-    msg << m_configName << m_snapshotNumber << batch;
-
-    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(msg, -1);
+    QDBusPendingCall pendingCall = m_dbusInterface->asyncCall("CancelRestore", jobId);
     QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
 
-    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, batch](QDBusPendingCallWatcher *w) {
-        QDBusPendingReply<bool> reply = *w;
-
-        if (reply.isError()) {
-            qWarning() << "Failed to restore batch:" << reply.error().message();
-            m_restoreHasError = true;
-            // エラーが発生してもすべてのバッチを処理する
-        } else {
-            bool success = reply.value();
-            if (!success) {
-                m_restoreHasError = true;
-            }
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [](QDBusPendingCallWatcher *w) {
+        if (w->isError()) {
+            qWarning() << "Failed to cancel restore:" << w->error().message();
         }
-
-        // バッチ完了後、処理済みファイル数を更新
-        m_processedFilesCount += batch.size();
-
-        // バッチ完了時に明示的に進捗を通知
-        emit restoreProgress(m_processedFilesCount, m_totalFilesCount,
-                           QString("Batch %1/%2 completed").arg(m_currentBatchIndex + 1).arg(m_restoreBatches.size()));
-
-        m_currentBatchIndex++;
-
         w->deleteLater();
-
-        // 次のバッチを処理
-        processNextBatch();
     });
 }
 
 /**
- * @brief アイテムのインデックスを検索
+ * @brief 復元ジョブの完了を処理
  *
- * 指定されたパスのアイテムを再帰的に検索し、そのQModelIndexを返します。
+ * 失敗したファイルがある場合は、その一部をエラーメッセージとして通知します。
  *
- * @param parent 検索開始アイテム
- * @param path 検索するパス
- * @return 見つかったアイテムのQModelIndex (見つからない場合は無効なインデックス)
+ * @param finished RestoreJobFinishedシグナルのメッセージ
  */
-QModelIndex FileChangeModel::findItemIndex(FileChangeItem *parent, const QString &path) const
+void FileChangeModel::finishRestore(const QDBusMessage &finished)
 {
-    for (int i = 0; i < parent->childCount(); ++i) {
-        FileChangeItem *child = parent->child(i);
-        if (child->path() == path) {
-            return createIndex(i, 0, child);
-        }
+    setRestoreSignalsConnected(false);
+    m_restoreJobId = 0;
+
+    // 最後の進捗を完了の通知より先に届ける
+    flushRestoreProgress();
+
+    const QList<QVariant> arguments = finished.arguments();
+    if (arguments.size() < 7) {
+        emit restoreCompleted(false);
+        return;
+    }
+
+    const bool success = arguments.at(1).toBool();
+    const bool cancelled = arguments.at(2).toBool();
+    const int total = arguments.at(4).toInt();
+    const QString error = arguments.at(6).toString();
 
-        // 再帰的に子要素を検索
-        QModelIndex childIndex = findItemIndex(child, path);
-        if (childIndex.isValid()) {
-            return childIndex;
+    // 失敗したファイルパス → エラーメッセージ (a{ss})
+    QMap<QString, QString> failures;
+    qvariant_cast<QDBusArgument>(arguments.at(5)) >> failures;
+
+    if (!error.isEmpty()) {
+        emit errorOccurred(error);
+    }
+    else if (!failures.isEmpty()) {
+        QStringList details;
+        for (auto it = failures.constBegin(); it != failures.constEnd() && details.size() < MaxReportedFailures; ++it) {
+            details.append(QString("%1: %2").arg(it.key(), it.value()));
         }
+        emit errorOccurred(tr("Failed to restore %1 of %2 files.").arg(failures.size()).arg(total)
+                           + "\n" + details.join("\n"));
     }
 
-    return QModelIndex();
+    if (cancelled) {
+        qWarning() << "Restore operation cancelled";
+    }
+
+    emit restoreCompleted(success);
 }
 
 /**
@@ -1056,6 +1798,10 @@ void FileChangeModel::collectCheckedItems(FileChangeItem *parent, QStringList &p
                 // 配下を再帰的に収集
                 collectAllFilesRecursive(child, paths);
             }
+            else if (child->hasUnfetchedChildren()) {
+                // 子要素を取得していないディレクトリは、配下全体の復元をサービスに任せる
+                paths.append(itemPath + "/");
+            }
             else {
                 // 子要素がないアイテム
                 // パスと変更タイプから判断
@@ -1112,6 +1858,10 @@ void FileChangeModel::collectAllFilesRecursive(FileChangeItem *parent, QStringLi
             // さらに配下を再帰的に処理
             collectAllFilesRecursive(child, paths);
         }
+        else if (child->hasUnfetchedChildren()) {
+            // 子要素を取得していないディレクトリは、配下全体の復元をサービスに任せる
+            paths.append(itemPath + "/");
+        }
         else {
             // 子要素がないアイテム
             if (!itemPath.isEmpty() && itemPath != "/") {
@@ -1124,12 +1874,17 @@ void FileChangeModel::collectAllFilesRecursive(FileChangeItem *parent, QStringLi
 /**
  * @brief 復元処理をキャンセル
  *
- * 復元処理のキャンセルを要求します。
- * 現在実行中のバッチは完了しますが、次のバッチ以降はスキップされます。
+ * サービスに復元ジョブの中止を要求します。
+ * 実行中のステップの完了後に残りのファイルはスキップされ、restoreCompletedが通知されます。
  * 既に復元されたファイルやディレクトリはそのまま残ります。
  */
 void FileChangeModel::cancelRestore()
 {
     m_cancelRequested = true;
     qWarning() << "Restore operation cancel requested";
+
+    // ジョブIDの受信前の場合は、受信した時点で中止を要求する
+    if (m_restoreJobId != 0) {
+        sendCancelRestore(m_restoreJobId);
+    }
 }
@@ -0,0 +1,156 @@
+#include "mappedbuffer.h"
+#include <QDebug>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#ifdef QSNAPPER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * @brief MappedBufferのコンストラクタ
+ *
+ * ファイルディスクリプタが封印済みであることを確認してからマップします。
+ * 封印されていないファイルは送信側が切り詰めるとアクセス時にSIGBUSとなるため拒否します。
+ *
+ * @param fd サービスから受け取ったファイルディスクリプタ
+ * @param compressed 内容がzstdで圧縮されている場合true
+ */
+MappedBuffer::MappedBuffer(const QDBusUnixFileDescriptor &fd, bool compressed)
+    : m_map(MAP_FAILED)
+    , m_mapSize(0)
+{
+    if (!fd.isValid()) {
+        m_error = "Invalid file descriptor";
+        return;
+    }
+
+    const int requiredSeals = F_SEAL_SHRINK | F_SEAL_WRITE;
+    int seals = fcntl(fd.fileDescriptor(), F_GET_SEALS);
+    if (seals < 0 || (seals & requiredSeals) != requiredSeals) {
+        m_error = "File descriptor is not sealed";
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd.fileDescriptor(), &st) < 0) {
+        m_error = QString("Failed to stat file descriptor: %1").arg(strerror(errno));
+        return;
+    }
+
+    // 空のデータはマップできない
+    if (st.st_size == 0) {
+        return;
+    }
+
+    m_mapSize = static_cast<size_t>(st.st_size);
+    m_map = mmap(nullptr, m_mapSize, PROT_READ, MAP_PRIVATE, fd.fileDescriptor(), 0);
+    if (m_map == MAP_FAILED) {
+        m_error = QString("Failed to map file descriptor: %1").arg(strerror(errno));
+        return;
+    }
+
+    if (compressed) {
+        decompress(static_cast<const char *>(m_map), m_mapSize);
+        munmap(m_map, m_mapSize);
+        m_map = MAP_FAILED;
+    }
+    else {
+        madvise(m_map, m_mapSize, MADV_SEQUENTIAL);
+        m_data = QByteArray::fromRawData(static_cast<const char *>(m_map), static_cast<qsizetype>(m_mapSize));
+    }
+}
+
+/**
+ * @brief MappedBufferのデストラクタ
+ *
+ * マップを解除します。
+ */
+MappedBuffer::~MappedBuffer()
+{
+    m_data.clear();
+    if (m_map != MAP_FAILED) {
+        munmap(m_map, m_mapSize);
+    }
+}
+
+/**
+ * @brief zstd展開が利用可能かを判定
+ *
+ * @return zstdを有効にしてビルドされている場合true
+ */
+bool MappedBuffer::isCompressionAvailable()
+{
+#ifdef QSNAPPER_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief zstdで圧縮されたデータを展開
+ *
+ * @param data 圧縮されたデータ
+ * @param size 圧縮されたデータのサイズ
+ * @return 成功時true
+ */
+bool MappedBuffer::decompress(const char *data, size_t size)
+{
+#ifdef QSNAPPER_HAVE_ZSTD
+    const unsigned long long contentSize = ZSTD_getFrameContentSize(data, size);
+    if (contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize == ZSTD_CONTENTSIZE_UNKNOWN
+        || contentSize > static_cast<unsigned long long>(std::numeric_limits<qsizetype>::max())) {
+        m_error = "Invalid compressed data";
+        return false;
+    }
+
+    m_data.resize(static_cast<qsizetype>(contentSize));
+    const size_t result = ZSTD_decompress(m_data.data(), static_cast<size_t>(contentSize), data, size);
+    if (ZSTD_isError(result)) {
+        m_error = QString("Failed to decompress data: %1").arg(ZSTD_getErrorName(result));
+        m_data.clear();
+        return false;
+    }
+
+    return true;
+#else
+    Q_UNUSED(data)
+    Q_UNUSED(size)
+    m_error = "Compressed data is not supported";
+    return false;
+#endif
+}
+
+/**
+ * @brief 改行区切りの行を取り出す
+ *
+ * positionから最大maxLines行を取り出し、positionを次の行の先頭に進めます。
+ * 大量の行を少しずつ処理する場合に使用します。
+ *
+ * @param position 読み込み位置 (入出力)
+ * @param maxLines 取り出す最大行数
+ * @return 取り出した行 (改行を含まない)
+ */
+QStringList MappedBuffer::lines(qsizetype &position, qsizetype maxLines) const
+{
+    QStringList result;
+    const qsizetype size = m_data.size();
+    const char *data = m_data.constData();
+
+    while (position < size && result.size() < maxLines) {
+        const char *end = static_cast<const char *>(memchr(data + position, '\n', static_cast<size_t>(size - position)));
+        const qsizetype lineEnd = end ? (end - data) : size;
+
+        if (lineEnd > position) {
+            result.append(QString::fromUtf8(data + position, lineEnd - position));
+        }
+        position = lineEnd + 1;
+    }
+
+    return result;
+}
@@ -7,6 +7,11 @@
 #include <QDBusConnection>
 #include <QDBusReply>
 #include <QDBusError>
+#include <QDBusMessage>
+#include <QDBusArgument>
+#include <QDBusPendingCall>
+#include <QDBusPendingCallWatcher>
+#include <algorithm>
 #include "snapperservice.h"
 
 Q_LOGGING_CATEGORY(snapperLog, "qsnapper")
@@ -26,6 +31,7 @@ SnapperService::SnapperService(QObject *parent)
     , m_configuredChecked(false)
     , m_configureOnInstall(false)
     , m_dbusInterface(nullptr)
+    , m_configName(QStringLiteral("root"))
 {
     m_dbusInterface = new QDBusInterface(
         "com.presire.qsnapper.Operations",
@@ -66,6 +72,23 @@ SnapperService* SnapperService::instance()
     return s_instance;
 }
 
+/**
+ * @brief 操作対象のSnapper設定名を設定
+ *
+ * スナップショットの一覧取得、作成、削除、ロールバックはこの設定に対して行われます。
+ *
+ * @param configName Snapper設定名
+ */
+void SnapperService::setConfigName(const QString &configName)
+{
+    if (configName.isEmpty() || m_configName == configName) {
+        return;
+    }
+
+    m_configName = configName;
+    emit configNameChanged();
+}
+
 /**
  * @brief Snapperが設定されているか確認
  *
@@ -219,6 +242,7 @@ FsSnapshot* SnapperService::createPost(const QString &description,
  * @brief すべてのスナップショットを取得
  *
  * D-Bus経由でSnapperに問い合わせ、すべてのスナップショットのリストを取得します。
+ * 型付きのListSnapshotsV2を使用するため、文字列の解析は行いません。
  *
  * @return スナップショットのリスト
  */
@@ -229,17 +253,159 @@ QList<FsSnapshot*> SnapperService::all()
         return QList<FsSnapshot*>();
     }
 
-    QDBusReply<QString> reply = m_dbusInterface->call("ListSnapshots");
+    QDBusMessage reply = m_dbusInterface->call("ListSnapshotsV2", m_configName);
 
-    if (!reply.isValid()) {
+    if (reply.type() == QDBusMessage::ErrorMessage) {
         qCCritical(snapperLog) << "Failed to list snapshots via D-Bus:"
-                               << reply.error().message();
+                               << reply.errorMessage();
         return QList<FsSnapshot*>();
     }
 
-    QString csvOutput = reply.value();
+    if (reply.arguments().isEmpty()) {
+        return QList<FsSnapshot*>();
+    }
 
-    return parseSnapshotList(csvOutput);
+    return parseSnapshotRecords(reply.arguments().constFirst().value<QDBusArgument>());
+}
+
+/**
+ * @brief 指定された番号のスナップショットを取得
+ *
+ * D-Bus経由で指定された番号のスナップショットだけを取得します。
+ * 存在しない番号は結果に含まれません。
+ *
+ * @param numbers 取得するスナップショット番号のリスト
+ * @return スナップショットのリスト
+ */
+QList<FsSnapshot*> SnapperService::snapshots(const QList<int> &numbers)
+{
+    if (numbers.isEmpty()) {
+        return QList<FsSnapshot*>();
+    }
+
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
+        qCCritical(snapperLog) << "D-Bus interface is not valid";
+        return QList<FsSnapshot*>();
+    }
+
+    QDBusMessage reply = m_dbusInterface->call("GetSnapshots", m_configName,
+                                               QVariant::fromValue(numbers));
+
+    if (reply.type() == QDBusMessage::ErrorMessage) {
+        qCCritical(snapperLog) << "Failed to get snapshots via D-Bus:"
+                               << reply.errorMessage();
+        return QList<FsSnapshot*>();
+    }
+
+    if (reply.arguments().isEmpty()) {
+        return QList<FsSnapshot*>();
+    }
+
+    return parseSnapshotRecords(reply.arguments().constFirst().value<QDBusArgument>());
+}
+
+/**
+ * @brief スナップショットの使用量を非同期に取得
+ *
+ * D-Bus経由でbtrfsのqgroupから読み取った参照量と排他量を要求し、
+ * 応答を受け取るとsnapshotSizesReceivedシグナルを発行します。
+ * 使用量を取得できないスナップショット (btrfs以外、クォータが無効)の値は-1です。
+ * 取得に失敗した場合はシグナルを発行しません。
+ *
+ * @param numbers 取得するスナップショット番号 (空の場合は全て)
+ */
+void SnapperService::requestSnapshotSizes(const QList<int> &numbers)
+{
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
+        qCCritical(snapperLog) << "D-Bus interface is not valid";
+        return;
+    }
+
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "GetSnapshotSizes"
+    );
+    message << m_configName << QVariant::fromValue(numbers);
+
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(message);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, configName = m_configName, numbers](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+
+        const QDBusMessage reply = w->reply();
+        if (reply.type() == QDBusMessage::ErrorMessage || reply.arguments().isEmpty()) {
+            qCWarning(snapperLog) << "Failed to get snapshot sizes via D-Bus:"
+                                  << reply.errorMessage();
+            return;
+        }
+
+        // スナップショットごとの使用量 (a(ixx))
+        const QDBusArgument argument = reply.arguments().constFirst().value<QDBusArgument>();
+        QHash<int, QPair<qint64, qint64>> sizes;
+
+        argument.beginArray();
+        while (!argument.atEnd()) {
+            int number = 0;
+            qint64 referenced = -1;
+            qint64 exclusive = -1;
+
+            argument.beginStructure();
+            argument >> number >> referenced >> exclusive;
+            argument.endStructure();
+
+            sizes.insert(number, qMakePair(referenced, exclusive));
+        }
+        argument.endArray();
+
+        emit snapshotSizesReceived(configName, numbers, sizes);
+    });
+}
+
+/**
+ * @brief 指定された世代以降のスナップショット一覧の差分を取得
+ *
+ * D-Bus経由で追加・削除・変更されたスナップショット番号を取得します。
+ * 差分を計算できない場合 (初回、サービス再起動など)はfalseを返し、
+ * newGenerationに現在の世代番号を設定します。その場合、呼び出し元は
+ * all()で全件を再取得する必要があります。
+ *
+ * @param generation 保持している世代番号 (初回は0)
+ * @param added 追加されたスナップショット番号 (出力)
+ * @param removed 削除されたスナップショット番号 (出力)
+ * @param modified 変更されたスナップショット番号 (出力)
+ * @param newGeneration 現在の世代番号 (出力、取得失敗時は0)
+ * @return 差分を取得できた場合true
+ */
+bool SnapperService::snapshotsSince(quint64 generation, QList<int> &added, QList<int> &removed,
+                                    QList<int> &modified, quint64 &newGeneration)
+{
+    newGeneration = 0;
+
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
+        qCCritical(snapperLog) << "D-Bus interface is not valid";
+        return false;
+    }
+
+    QDBusMessage reply = m_dbusInterface->call("ListSnapshotsSince", m_configName,
+                                               QVariant::fromValue<qulonglong>(generation));
+
+    if (reply.type() == QDBusMessage::ErrorMessage || reply.arguments().size() < 5) {
+        qCWarning(snapperLog) << "Failed to list snapshot changes via D-Bus:"
+                              << reply.errorMessage();
+        return false;
+    }
+
+    const QList<QVariant> arguments = reply.arguments();
+    added = qdbus_cast<QList<int>>(arguments.at(0));
+    removed = qdbus_cast<QList<int>>(arguments.at(1));
+    modified = qdbus_cast<QList<int>>(arguments.at(2));
+    newGeneration = arguments.at(3).toULongLong();
+
+    return arguments.at(4).toBool();
 }
 
 /**
@@ -252,13 +418,11 @@ QList<FsSnapshot*> SnapperService::all()
  */
 FsSnapshot* SnapperService::find(int number)
 {
-    QList<FsSnapshot*> snapshots = all();
-    for (FsSnapshot *snapshot : snapshots) {
-        if (snapshot->number() == number) {
-            return snapshot;
-        }
+    QList<FsSnapshot*> found = snapshots({number});
+    if (found.isEmpty()) {
+        return nullptr;
     }
-    return nullptr;
+    return found.constFirst();
 }
 
 /**
@@ -278,7 +442,7 @@ bool SnapperService::rollback(int number)
         return false;
     }
 
-    QDBusReply<bool> reply = m_dbusInterface->call("RollbackSnapshot", number);
+    QDBusReply<bool> reply = m_dbusInterface->call("RollbackSnapshot", m_configName, number);
 
     if (!reply.isValid()) {
         qCCritical(snapperLog) << "Failed to rollback snapshot via D-Bus:"
@@ -316,7 +480,7 @@ bool SnapperService::deleteSnapshot(int number)
         return false;
     }
 
-    QDBusReply<bool> reply = m_dbusInterface->call("DeleteSnapshot", number);
+    QDBusReply<bool> reply = m_dbusInterface->call("DeleteSnapshot", m_configName, number);
 
     if (!reply.isValid()) {
         qCCritical(snapperLog) << "Failed to delete snapshot via D-Bus:"
@@ -337,6 +501,219 @@ bool SnapperService::deleteSnapshot(int number)
     return success;
 }
 
+/**
+ * @brief 複数のスナップショットを一括削除
+ *
+ * D-Bus経由で1回の呼び出し (1回の認証)でまとめて削除します。
+ * 応答は非同期に受け取り、番号ごとにsnapshotDeletedまたは
+ * snapshotDeletionFailedシグナルを発行した後、
+ * snapshotsDeletionCompletedシグナルを発行します。
+ *
+ * @param numbers 削除するスナップショット番号のリスト
+ */
+void SnapperService::deleteSnapshots(const QList<int> &numbers)
+{
+    if (numbers.isEmpty()) {
+        emit snapshotsDeletionCompleted(0, 0);
+        return;
+    }
+
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
+        qCCritical(snapperLog) << "D-Bus interface is not valid";
+        for (int number : numbers) {
+            emit snapshotDeletionFailed(number, tr("D-Bus connection failed."));
+        }
+        emit snapshotsDeletionCompleted(0, numbers.size());
+        return;
+    }
+
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "DeleteSnapshots"
+    );
+    message << m_configName << compressNumberRanges(numbers);
+
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(message, DeleteTimeoutMs);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, numbers](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+        handleDeletionReply(w->reply(), numbers);
+    });
+}
+
+/**
+ * @brief 一括削除の応答を処理
+ *
+ * 番号ごとにsnapshotDeletedまたはsnapshotDeletionFailedシグナルを発行した後、
+ * snapshotsDeletionCompletedシグナルを発行します。
+ *
+ * @param reply DeleteSnapshotsまたはRunCleanupの応答
+ * @param numbers 削除を要求したスナップショット番号 (呼び出しが失敗した場合の通知に使用)
+ */
+void SnapperService::handleDeletionReply(const QDBusMessage &reply, const QList<int> &numbers)
+{
+    if (reply.type() == QDBusMessage::ErrorMessage || reply.arguments().isEmpty()) {
+        qCCritical(snapperLog) << "Failed to delete snapshots via D-Bus:" << reply.errorMessage();
+        for (int number : numbers) {
+            emit snapshotDeletionFailed(number, tr("Failed to delete snapshot: %1").arg(reply.errorMessage()));
+        }
+        emit snapshotsDeletionCompleted(0, numbers.size());
+        return;
+    }
+
+    // 番号ごとの削除結果 (a(ibs))
+    int successCount = 0;
+    int failureCount = 0;
+    const QDBusArgument argument = reply.arguments().constFirst().value<QDBusArgument>();
+
+    argument.beginArray();
+    while (!argument.atEnd()) {
+        int number = 0;
+        bool success = false;
+        QString error;
+
+        argument.beginStructure();
+        argument >> number >> success >> error;
+        argument.endStructure();
+
+        if (success) {
+            successCount++;
+            emit snapshotDeleted(number);
+        }
+        else {
+            failureCount++;
+            qCWarning(snapperLog) << "Delete snapshot" << number << "failed:" << error;
+            emit snapshotDeletionFailed(number, error);
+        }
+    }
+    argument.endArray();
+
+    emit snapshotsDeletionCompleted(successCount, failureCount);
+}
+
+/**
+ * @brief クリーンアップの計画を作成
+ *
+ * 設定ファイルの上限値に従ってクリーンアップで削除されるスナップショットを
+ * D-Bus経由で計算します (削除は行いません)。
+ * 応答は非同期に受け取り、cleanupPlannedまたはcleanupPlanFailedシグナルを発行します。
+ *
+ * @param algorithm クリーンアップアルゴリズム ("number"、"timeline"、"empty-pre-post")
+ */
+void SnapperService::planCleanup(const QString &algorithm)
+{
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
+        qCCritical(snapperLog) << "D-Bus interface is not valid";
+        emit cleanupPlanFailed(tr("D-Bus connection failed."));
+        return;
+    }
+
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "PlanCleanup"
+    );
+    message << m_configName << algorithm;
+
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(message, DeleteTimeoutMs);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+
+        const QDBusMessage reply = w->reply();
+
+        if (reply.type() == QDBusMessage::ErrorMessage || reply.arguments().size() < 3) {
+            qCCritical(snapperLog) << "Failed to plan cleanup via D-Bus:" << reply.errorMessage();
+            emit cleanupPlanFailed(tr("Failed to plan cleanup: %1").arg(reply.errorMessage()));
+            return;
+        }
+
+        const QList<QVariant> arguments = reply.arguments();
+        const uint planId = arguments.at(0).toUInt();
+        const QList<int> numbers = qdbus_cast<QList<int>>(arguments.at(1));
+
+        m_cleanupPlans.insert(planId, numbers);
+        emit cleanupPlanned(planId, numbers, arguments.at(2).toLongLong());
+    });
+}
+
+/**
+ * @brief クリーンアップの計画を実行
+ *
+ * planCleanupで作成した計画のスナップショットだけをD-Bus経由で一括削除します。
+ * 結果はdeleteSnapshotsと同じシグナルで通知します。
+ *
+ * @param planId cleanupPlannedシグナルで通知された計画ID
+ */
+void SnapperService::runCleanup(uint planId)
+{
+    const QList<int> numbers = m_cleanupPlans.take(planId);
+
+    if (!m_dbusInterface || !m_dbusInterface->isValid()) {
+        qCCritical(snapperLog) << "D-Bus interface is not valid";
+        for (int number : numbers) {
+            emit snapshotDeletionFailed(number, tr("D-Bus connection failed."));
+        }
+        emit snapshotsDeletionCompleted(0, numbers.size());
+        return;
+    }
+
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "RunCleanup"
+    );
+    message << planId;
+
+    QDBusPendingCall pendingCall = QDBusConnection::systemBus().asyncCall(message, DeleteTimeoutMs);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(pendingCall, this);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, numbers](QDBusPendingCallWatcher *w) {
+        w->deleteLater();
+        handleDeletionReply(w->reply(), numbers);
+    });
+}
+
+/**
+ * @brief スナップショット番号のリストを範囲指定に変換
+ *
+ * 連続する番号だけを"100-450"のような範囲にまとめます。
+ * 指定されていない番号を範囲に含めないよう、間が空いている番号はまとめません。
+ *
+ * @param numbers スナップショット番号のリスト
+ * @return 範囲指定のリスト
+ */
+QStringList SnapperService::compressNumberRanges(QList<int> numbers)
+{
+    std::sort(numbers.begin(), numbers.end());
+    numbers.erase(std::unique(numbers.begin(), numbers.end()), numbers.end());
+
+    QStringList ranges;
+    for (qsizetype i = 0; i < numbers.size(); ) {
+        qsizetype j = i;
+        while (j + 1 < numbers.size() && numbers.at(j + 1) == numbers.at(j) + 1) {
+            ++j;
+        }
+
+        if (i == j) {
+            ranges.append(QString::number(numbers.at(i)));
+        }
+        else {
+            ranges.append(QString("%1-%2").arg(numbers.at(i)).arg(numbers.at(j)));
+        }
+
+        i = j + 1;
+    }
+
+    return ranges;
+}
+
 /**
  * @brief スナップショットを作成 (内部実装)
  *
@@ -370,6 +747,7 @@ FsSnapshot* SnapperService::create(FsSnapshot::SnapshotType snapshotType,
     }
 
     QDBusReply<QString> reply = m_dbusInterface->call("CreateSnapshot",
+                                                      m_configName,
                                                       type,
                                                       description,
                                                       preNumber,
@@ -384,15 +762,21 @@ FsSnapshot* SnapperService::create(FsSnapshot::SnapshotType snapshotType,
         return nullptr;
     }
 
-    // スナップショットリストを再取得して最新のスナップショットを返す
-    QList<FsSnapshot*> snapshots = all();
-    if (!snapshots.isEmpty()) {
-        FsSnapshot *newSnapshot = snapshots.last();
+    // 応答 (ヘッダー行 + データ行のCSV)から番号を取り出し、作成されたスナップショットだけを取得する
+    const QStringList lines = reply.value().split('\n', Qt::SkipEmptyParts);
+    bool ok = false;
+    int number = lines.size() >= 2 ? lines.at(1).section(',', 0, 0).toInt(&ok) : 0;
+    if (!ok || number <= 0) {
+        qCWarning(snapperLog) << "Unexpected CreateSnapshot reply:" << reply.value();
+        return nullptr;
+    }
+
+    FsSnapshot *newSnapshot = find(number);
+    if (newSnapshot) {
         emit snapshotCreated(newSnapshot);
-        return newSnapshot;
     }
 
-    return nullptr;
+    return newSnapshot;
 }
 
 /**
@@ -509,72 +893,65 @@ void SnapperService::setupSnapperQuota()
 }
 
 /**
- * @brief CSV形式のスナップショットリストをパース
+ * @brief D-Bus配列からスナップショットリストを構築
  *
- * Snapperから取得したCSV形式の出力をパースし、
+ * ListSnapshotsV2が返すa(iiixussa{ss})型の配列を直接読み出し、
  * FsSnapshotオブジェクトのリストに変換します。
  *
- * @param csvOutput CSV形式のスナップショットリスト
- * @return パースされたスナップショットのリスト
+ * @param argument スナップショット情報の配列を保持するD-Bus引数
+ * @return 構築されたスナップショットのリスト
  */
-QList<FsSnapshot*> SnapperService::parseSnapshotList(const QString &csvOutput)
+QList<FsSnapshot*> SnapperService::parseSnapshotRecords(const QDBusArgument &argument)
 {
     QList<FsSnapshot*> snapshots;
 
-    QStringList lines = csvOutput.split('\n', Qt::SkipEmptyParts);
-    if (lines.isEmpty()) {
-        return snapshots;
-    }
-
-    for (int i = 1; i < lines.size(); ++i) {
-        QString line = lines[i];
-        QStringList fields = line.split(',');
+    argument.beginArray();
+    while (!argument.atEnd()) {
+        int number = 0;
+        int type = 0;
+        int previousNumber = 0;
+        qint64 date = 0;
+        uint uid = 0;
+        QString cleanup;
+        QString description;
+        QVariantMap userdata;
 
-        if (fields.size() < 7) {
-            continue;
+        argument.beginStructure();
+        argument >> number >> type >> previousNumber >> date >> uid >> cleanup >> description;
+
+        argument.beginMap();
+        while (!argument.atEnd()) {
+            QString key;
+            QString value;
+            argument.beginMapEntry();
+            argument >> key >> value;
+            argument.endMapEntry();
+            userdata.insert(key, value);
         }
+        argument.endMap();
+        argument.endStructure();
 
-        bool ok;
-        int number = fields[0].toInt(&ok);
-        if (!ok || number == 0) {
+        if (number == 0) {
             continue;
         }
 
-        FsSnapshot::SnapshotType type = FsSnapshot::stringToSnapshotType(fields[1]);
-
-        int previousNumber = fields[2].toInt(&ok);
-        if (!ok) {
-            previousNumber = -1;
-        }
-
-        QDateTime timestamp = QDateTime::fromString(fields[3], Qt::ISODate);
-        if (!timestamp.isValid()) {
-            timestamp = QDateTime();
-            qCWarning(snapperLog) << "Error when parsing date/time:" << fields[3];
+        // snapper::SnapshotTypeの値 (0: single, 1: pre, 2: post)を変換
+        FsSnapshot::SnapshotType snapshotType = FsSnapshot::SnapshotType::Single;
+        if (type == 1) {
+            snapshotType = FsSnapshot::SnapshotType::Pre;
         }
-
-        QString user = fields[4];
-
-        FsSnapshot::CleanupAlgorithm cleanupAlgo = FsSnapshot::stringToCleanupAlgorithm(fields[5]);
-
-        QString description = fields[6];
-
-        // Parse userdata (key1=value1,key2=value2 format)
-        QVariantMap userdata;
-        if (fields.size() >= 8 && !fields[7].isEmpty()) {
-            QStringList userdataPairs = fields[7].split(',');
-            for (const QString &pair : userdataPairs) {
-                QStringList keyValue = pair.split('=');
-                if (keyValue.size() == 2) {
-                    userdata[keyValue[0]] = keyValue[1];
-                }
-            }
+        else if (type == 2) {
+            snapshotType = FsSnapshot::SnapshotType::Post;
         }
 
-        FsSnapshot *snapshot = new FsSnapshot(number, type, previousNumber, timestamp,
-                                              user, cleanupAlgo, description, userdata, this);
+        FsSnapshot *snapshot = new FsSnapshot(number, snapshotType, previousNumber,
+                                              QDateTime::fromSecsSinceEpoch(date),
+                                              QString::number(uid),
+                                              FsSnapshot::stringToCleanupAlgorithm(cleanup),
+                                              description, userdata, this);
         snapshots.append(snapshot);
     }
+    argument.endArray();
 
     return snapshots;
 }
@@ -1,6 +1,9 @@
 #include "snapshotlistmodel.h"
 #include "snapperservice.h"
 #include <QDebug>
+#include <QDBusConnection>
+#include <algorithm>
+#include <iterator>
 
 /**
  * @brief SnapshotListModelオブジェクトを構築
@@ -14,6 +17,8 @@
 SnapshotListModel::SnapshotListModel(QObject *parent)
     : QAbstractListModel(parent)
     , m_snapperService(SnapperService::instance())
+    , m_generation(0)
+    , m_invalidDeletionCount(0)
 {
     connect(m_snapperService, &SnapperService::snapshotCreated,
             this, &SnapshotListModel::onSnapshotCreated);
@@ -27,6 +32,40 @@ SnapshotListModel::SnapshotListModel(QObject *parent)
             this, &SnapshotListModel::onSnapshotDeleted);
     connect(m_snapperService, &SnapperService::snapshotDeletionFailed,
             this, &SnapshotListModel::onSnapshotDeletionFailed);
+    connect(m_snapperService, &SnapperService::snapshotsDeletionCompleted,
+            this, &SnapshotListModel::onSnapshotsDeletionCompleted);
+    connect(m_snapperService, &SnapperService::configNameChanged,
+            this, &SnapshotListModel::onConfigNameChanged);
+    connect(m_snapperService, &SnapperService::snapshotSizesReceived,
+            this, &SnapshotListModel::onSnapshotSizesReceived);
+
+    // 他のツールによるスナップショットの作成・削除をD-Busシグナルで受信
+    bool connected = QDBusConnection::systemBus().connect(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "SnapshotsChanged",
+        this,
+        SLOT(onSnapshotsChanged(QString,QList<int>,QList<int>))
+    );
+
+    if (!connected) {
+        qWarning() << "Failed to connect to SnapshotsChanged signal";
+    }
+
+    // 削除したスナップショットの領域の解放の進捗を受信
+    connected = QDBusConnection::systemBus().connect(
+        "com.presire.qsnapper.Operations",
+        "/com/presire/qsnapper/Operations",
+        "com.presire.qsnapper.Operations",
+        "SpaceReclaimProgress",
+        this,
+        SLOT(onSpaceReclaimProgress(QString,int,qlonglong))
+    );
+
+    if (!connected) {
+        qWarning() << "Failed to connect to SpaceReclaimProgress signal";
+    }
 }
 
 /**
@@ -97,6 +136,10 @@ QVariant SnapshotListModel::data(const QModelIndex &index, int role) const
         return snapshot->cleanupAlgoString();
     case UserdataRole:
         return snapshot->userdata();
+    case ReferencedSizeRole:
+        return m_sizes.value(snapshot->number(), qMakePair(qint64(-1), qint64(-1))).first;
+    case ExclusiveSizeRole:
+        return m_sizes.value(snapshot->number(), qMakePair(qint64(-1), qint64(-1))).second;
     default:
         return QVariant();
     }
@@ -124,25 +167,226 @@ QHash<int, QByteArray> SnapshotListModel::roleNames() const
     roles[SnapshotTypeStringRole] = "snapshotTypeString";
     roles[CleanupAlgoStringRole] = "cleanupAlgoString";
     roles[UserdataRole] = "userdata";
+    roles[ReferencedSizeRole] = "referencedSize";
+    roles[ExclusiveSizeRole] = "exclusiveSize";
     return roles;
 }
 
 /**
  * @brief スナップショット一覧を再読み込み
  *
- * SnapperServiceから最新のスナップショット一覧を取得し、
- * モデルの内容を更新する。既存のスナップショットオブジェクトは
- * 全て削除され、新しいデータで置き換えられる。
+ * 前回の読み込み以降の差分だけをSnapperServiceから取得し、
+ * 追加・削除・変更された行だけをモデルに反映する。
+ * 差分を取得できない場合 (初回、サービス再起動など)は全件を再取得する。
  * QMLから呼び出し可能なメソッド。
  */
 void SnapshotListModel::refresh()
 {
+    if (m_generation != 0 && applySnapshotDelta()) {
+        return;
+    }
+
+    reload();
+}
+
+/**
+ * @brief スナップショット一覧を全件再取得
+ *
+ * 既存のスナップショットオブジェクトを全て削除し、新しいデータで置き換える。
+ * 一覧の取得前に世代番号を取得しておくことで、取得中の変更も
+ * 次回の差分で確実に反映される。
+ */
+void SnapshotListModel::reload()
+{
+    QList<int> added;
+    QList<int> removed;
+    QList<int> modified;
+    quint64 generation = 0;
+    m_snapperService->snapshotsSince(0, added, removed, modified, generation);
+
     beginResetModel();
     qDeleteAll(m_snapshots);
     m_snapshots.clear();
     m_snapshots = m_snapperService->all();
+    m_sizes.clear();
     endResetModel();
+
+    m_generation = generation;
     emit countChanged();
+
+    updateSizes();
+}
+
+/**
+ * @brief スナップショット一覧の差分をモデルに反映
+ *
+ * 保持している世代番号以降の差分を取得し、削除された行の除去、
+ * 変更された行の置き換え、追加された行の挿入を行う。
+ * 処理量は一覧の件数ではなく変更数に比例する。
+ *
+ * @return 差分を反映できた場合true、全件の再取得が必要な場合false
+ */
+bool SnapshotListModel::applySnapshotDelta()
+{
+    QList<int> added;
+    QList<int> removed;
+    QList<int> modified;
+    quint64 generation = 0;
+
+    if (!m_snapperService->snapshotsSince(m_generation, added, removed, modified, generation)) {
+        return false;
+    }
+
+    const int previousCount = m_snapshots.count();
+
+    for (int number : std::as_const(removed)) {
+        int row = indexOfNumber(number);
+        if (row < 0) {
+            continue;
+        }
+        beginRemoveRows(QModelIndex(), row, row);
+        delete m_snapshots.takeAt(row);
+        m_sizes.remove(number);
+        endRemoveRows();
+    }
+
+    QList<int> changed = modified;
+    changed.append(added);
+    const QList<FsSnapshot*> fetched = m_snapperService->snapshots(changed);
+
+    for (FsSnapshot *snapshot : fetched) {
+        int row = indexOfNumber(snapshot->number());
+        if (row >= 0) {
+            delete m_snapshots.at(row);
+            m_snapshots[row] = snapshot;
+            emit dataChanged(index(row), index(row));
+            continue;
+        }
+
+        row = insertionRow(snapshot->number());
+        beginInsertRows(QModelIndex(), row, row);
+        m_snapshots.insert(row, snapshot);
+        endInsertRows();
+    }
+
+    m_generation = generation;
+    if (m_snapshots.count() != previousCount) {
+        emit countChanged();
+    }
+
+    // 他のスナップショットの削除で排他量が変わるため、削除があれば全ての使用量を取得し直す
+    // それ以外は追加・変更されたスナップショットの使用量だけを取得する
+    if (!removed.isEmpty()) {
+        updateSizes();
+    }
+    else if (!changed.isEmpty()) {
+        updateSizes(changed);
+    }
+
+    return true;
+}
+
+/**
+ * @brief スナップショットの使用量の更新を要求
+ *
+ * GUIスレッドを止めないよう非同期に取得し、応答はonSnapshotSizesReceivedで反映する。
+ *
+ * @param numbers 取得するスナップショット番号 (空の場合は全て)
+ */
+void SnapshotListModel::updateSizes(const QList<int> &numbers)
+{
+    m_snapperService->requestSnapshotSizes(numbers);
+}
+
+/**
+ * @brief スナップショットの使用量の応答の内部ハンドラ
+ *
+ * 取得したスナップショットの参照量と排他量を反映し、
+ * 値が変わった行の使用量のロールだけを更新する。
+ * 使用量を取得できない場合の値は-1。
+ *
+ * @param configName 取得したSnapper設定名
+ * @param numbers 取得を要求したスナップショット番号 (空の場合は全て)
+ * @param sizes スナップショット番号 → (参照量, 排他量)
+ */
+void SnapshotListModel::onSnapshotSizesReceived(const QString &configName, const QList<int> &numbers,
+                                                const QHash<int, QPair<qint64, qint64>> &sizes)
+{
+    // 要求後に設定が切り替わった場合は破棄する
+    if (configName != m_snapperService->configName()) {
+        return;
+    }
+
+    QHash<int, QPair<qint64, qint64>> updated;
+    if (numbers.isEmpty()) {
+        updated = sizes;
+    }
+    else {
+        updated = m_sizes;
+        for (int number : numbers) {
+            auto size = sizes.constFind(number);
+            if (size != sizes.constEnd()) {
+                updated.insert(number, size.value());
+            }
+            else {
+                updated.remove(number);
+            }
+        }
+    }
+
+    int firstChanged = -1;
+    int lastChanged = -1;
+    for (int row = 0; row < m_snapshots.count(); ++row) {
+        const int number = m_snapshots.at(row)->number();
+        if (m_sizes.value(number) != updated.value(number)) {
+            if (firstChanged < 0) {
+                firstChanged = row;
+            }
+            lastChanged = row;
+        }
+    }
+
+    m_sizes = updated;
+
+    if (firstChanged >= 0) {
+        emit dataChanged(index(firstChanged), index(lastChanged), {ReferencedSizeRole, ExclusiveSizeRole});
+    }
+}
+
+/**
+ * @brief スナップショット番号に対応する行を検索
+ *
+ * 一覧は番号の昇順に並んでいるため二分探索で検索する。
+ *
+ * @param number スナップショット番号
+ *
+ * @return 行番号、見つからない場合は-1
+ */
+int SnapshotListModel::indexOfNumber(int number) const
+{
+    int row = insertionRow(number);
+    if (row < m_snapshots.count() && m_snapshots.at(row)->number() == number) {
+        return row;
+    }
+    return -1;
+}
+
+/**
+ * @brief スナップショット番号の挿入位置を取得
+ *
+ * 番号の昇順を保つための挿入位置を二分探索で求める。
+ *
+ * @param number スナップショット番号
+ *
+ * @return 挿入する行番号
+ */
+int SnapshotListModel::insertionRow(int number) const
+{
+    auto it = std::lower_bound(m_snapshots.cbegin(), m_snapshots.cend(), number,
+                               [](const FsSnapshot *snapshot, int value) {
+                                   return snapshot->number() < value;
+                               });
+    return static_cast<int>(std::distance(m_snapshots.cbegin(), it));
 }
 
 /**
@@ -227,36 +471,47 @@ void SnapshotListModel::deleteSnapshot(int number)
 /**
  * @brief 複数のスナップショットを一括削除
  *
- * スナップショット番号のリストを受け取り、各スナップショットを順次削除する。
- * 成功数と失敗数をカウントし、全ての削除処理完了後にシグナルで通知する。
- * 処理完了後、スナップショット一覧を自動的に再読み込みする。
+ * スナップショット番号のリストを受け取り、1回のD-Bus呼び出しでまとめて削除する。
+ * 削除は非同期に実行され、完了後にsnapshotsDeletionCompletedシグナルで
+ * 成功数と失敗数を通知する。一覧には削除の通知 (SnapshotsChanged)で反映される。
  * QMLから呼び出し可能なメソッド。
  *
  * @param numbers 削除するスナップショット番号のリスト (QVariant配列)
  */
 void SnapshotListModel::deleteSnapshots(const QVariantList &numbers)
 {
-    int successCount = 0;
-    int failureCount = 0;
+    QList<int> validNumbers;
+    m_invalidDeletionCount = 0;
 
     for (const QVariant &numVariant : numbers) {
         bool ok;
         int number = numVariant.toInt(&ok);
         if (!ok) {
-            failureCount++;
+            m_invalidDeletionCount++;
             continue;
         }
 
-        bool success = m_snapperService->deleteSnapshot(number);
-        if (success) {
-            successCount++;
-        } else {
-            failureCount++;
-        }
+        validNumbers.append(number);
     }
 
+    m_snapperService->deleteSnapshots(validNumbers);
+}
+
+/**
+ * @brief 一括削除完了時の内部ハンドラ
+ *
+ * スナップショット一覧を再読み込みし、無効な番号を失敗数に含めてQMLに転送する。
+ *
+ * @param successCount 削除に成功した数
+ * @param failureCount 削除に失敗した数
+ */
+void SnapshotListModel::onSnapshotsDeletionCompleted(int successCount, int failureCount)
+{
+    const int invalidCount = m_invalidDeletionCount;
+    m_invalidDeletionCount = 0;
+
     refresh();
-    emit snapshotsDeletionCompleted(successCount, failureCount);
+    emit snapshotsDeletionCompleted(successCount, failureCount + invalidCount);
 }
 
 /**
@@ -338,3 +593,58 @@ void SnapshotListModel::onSnapshotDeletionFailed(int number, const QString &erro
 {
     emit snapshotDeletionFailed(number, error);
 }
+
+/**
+ * @brief スナップショット一覧変更シグナルの内部ハンドラ
+ *
+ * D-Busサービスからのスナップショット追加・削除・変更の通知を受け取り、
+ * 差分だけをモデルに反映する。通知の内容は変更履歴にも記録されているため、
+ * 差分の取得により取りこぼした通知も含めて反映される。
+ *
+ * @param configName 変更があったSnapper設定名
+ * @param added 追加されたスナップショット番号
+ * @param removed 削除されたスナップショット番号
+ */
+void SnapshotListModel::onSnapshotsChanged(const QString &configName, const QList<int> &added,
+                                           const QList<int> &removed)
+{
+    // 通知の番号ではなく変更履歴の差分を反映する
+    Q_UNUSED(added);
+    Q_UNUSED(removed);
+
+    if (configName != m_snapperService->configName() || m_generation == 0) {
+        return;
+    }
+
+    refresh();
+}
+
+/**
+ * @brief 領域の解放の進捗シグナルの内部ハンドラ
+ *
+ * D-Busサービスからの通知のうち、表示中の設定のものだけをQMLに転送する。
+ *
+ * @param configName Snapper設定名
+ * @param pendingSubvolumes 解放待ちのサブボリューム数 (0で完了)
+ * @param bytesFreed 解放された容量の目安 (バイト)
+ */
+void SnapshotListModel::onSpaceReclaimProgress(const QString &configName, int pendingSubvolumes,
+                                               qlonglong bytesFreed)
+{
+    if (configName != m_snapperService->configName()) {
+        return;
+    }
+
+    emit spaceReclaimProgress(pendingSubvolumes, bytesFreed);
+}
+
+/**
+ * @brief Snapper設定の変更シグナルの内部ハンドラ
+ *
+ * 世代番号は設定ごとの変更履歴に対するものなので、
+ * 設定が切り替わった場合は差分ではなく全件を再取得する。
+ */
+void SnapshotListModel::onConfigNameChanged()
+{
+    reload();
+}
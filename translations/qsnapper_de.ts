@@ -16,6 +16,10 @@
         <source>No files selected for restoration</source>
         <translation>Es sind keine Dateien zur Wiederherstellung ausgewählt</translation>
     </message>
+    <message>
+        <source>Failed to restore %1 of %2 files.</source>
+        <translation>%1 von %2 Dateien konnten nicht wiederhergestellt werden.</translation>
+    </message>
 </context>
 <context>
     <name>SnapshotListPage</name>
@@ -43,6 +47,14 @@
         <source>Deletion completed: %1 succeeded, %2 failed</source>
         <translation>Löschen beendet: %1 erfolgreich %2 fehlgeschlagen</translation>
     </message>
+    <message>
+        <source>Reclaiming space: %1 subvolume(s) pending, %2 freed</source>
+        <translation>Speicherplatz wird freigegeben: %1 Subvolume(s) ausstehend, %2 freigegeben</translation>
+    </message>
+    <message>
+        <source>Space reclaimed: %1 freed</source>
+        <translation>Speicherplatz freigegeben: %1</translation>
+    </message>
     <message>
         <source>qSnapper</source>
         <translation>qSnapper</translation>
@@ -170,6 +182,10 @@
         <source>Prev: #%1</source>
         <translation>Vorherige: #%1</translation>
     </message>
+    <message>
+        <source>Exclusive: %1</source>
+        <translation>Exklusiv: %1</translation>
+    </message>
     <message>
         <source>Date: %1</source>
         <translation>Datum: %1</translation>
@@ -257,6 +273,10 @@
         <source>Restore Files</source>
         <translation>Dateien wiederherstellen</translation>
     </message>
+    <message>
+        <source>Compare with Pre</source>
+        <translation>Mit Pre vergleichen</translation>
+    </message>
     <message>
         <source>System Rollback</source>
         <translation>System Rollback</translation>
@@ -304,6 +324,10 @@
         <source>Snapshot Overview</source>
         <translation>Schnappschuss Übersicht</translation>
     </message>
+    <message>
+        <source>Filter paths (e.g. /etc, *.conf)</source>
+        <translation>Pfade filtern (z. B. /etc, *.conf)</translation>
+    </message>
     <message>
         <source>Root Filesystem</source>
         <translation>Root Dateisystem</translation>
@@ -328,6 +352,14 @@
         <source>No diff found.</source>
         <translation>Kein Unterschied gefunden.</translation>
     </message>
+    <message>
+        <source>Binary files differ (snapshot: %1 bytes, current: %2 bytes).</source>
+        <translation>Binärdateien unterscheiden sich (Snapshot: %1 Bytes, aktuell: %2 Bytes).</translation>
+    </message>
+    <message>
+        <source>The diff is too large and has been truncated (snapshot: %1 bytes, current: %2 bytes).</source>
+        <translation>Der Unterschied ist zu groß und wurde gekürzt (Snapshot: %1 Bytes, aktuell: %2 Bytes).</translation>
+    </message>
     <message>
         <source>No differences with snapshot</source>
         <translation>Keine Unterschiede zum Snapshot</translation>
@@ -16,6 +16,10 @@
         <source>No files selected for restoration</source>
         <translation>復元するファイルが選択されていません</translation>
     </message>
+    <message>
+        <source>Failed to restore %1 of %2 files.</source>
+        <translation>%2 個中 %1 個のファイルの復元に失敗しました。</translation>
+    </message>
 </context>
 <context>
     <name>SnapshotListPage</name>
@@ -43,6 +47,14 @@
         <source>Deletion completed: %1 succeeded, %2 failed</source>
         <translation>削除完了: 成功 %1個、失敗 %2個</translation>
     </message>
+    <message>
+        <source>Reclaiming space: %1 subvolume(s) pending, %2 freed</source>
+        <translation>領域を解放中: 残り %1 個のサブボリューム、%2 解放済み</translation>
+    </message>
+    <message>
+        <source>Space reclaimed: %1 freed</source>
+        <translation>領域の解放が完了しました: %1 解放</translation>
+    </message>
     <message>
         <source>qSnapper</source>
         <translation>qSnapper</translation>
@@ -170,6 +182,10 @@
         <source>Prev: #%1</source>
         <translation>前: #%1</translation>
     </message>
+    <message>
+        <source>Exclusive: %1</source>
+        <translation>排他: %1</translation>
+    </message>
     <message>
         <source>Date: %1</source>
         <translation>日時: %1</translation>
@@ -257,6 +273,10 @@
         <source>Restore Files</source>
         <translation>ファイルを復元</translation>
     </message>
+    <message>
+        <source>Compare with Pre</source>
+        <translation>Preと比較</translation>
+    </message>
     <message>
         <source>System Rollback</source>
         <translation>システムロールバック</translation>
@@ -304,6 +324,10 @@
         <source>Snapshot Overview</source>
         <translation>選択されたスナップショットの概要</translation>
     </message>
+    <message>
+        <source>Filter paths (e.g. /etc, *.conf)</source>
+        <translation>パスで絞り込み (例: /etc, *.conf)</translation>
+    </message>
     <message>
         <source>Root Filesystem</source>
         <translation>ルートファイルシステム</translation>
@@ -328,6 +352,14 @@
         <source>No diff found.</source>
         <translation>差分が見つかりませんでした。</translation>
     </message>
+    <message>
+        <source>Binary files differ (snapshot: %1 bytes, current: %2 bytes).</source>
+        <translation>バイナリファイルが異なります (スナップショット: %1 バイト、現在: %2 バイト)。</translation>
+    </message>
+    <message>
+        <source>The diff is too large and has been truncated (snapshot: %1 bytes, current: %2 bytes).</source>
+        <translation>差分が大きすぎるため、途中までを表示しています (スナップショット: %1 バイト、現在: %2 バイト)。</translation>
+    </message>
     <message>
         <source>No differences with snapshot</source>
         <translation>スナップショットとの差分がありません</translation>